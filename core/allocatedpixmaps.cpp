@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "allocatedpixmaps_p.h"
+
+#include "observer.h"
+
+using namespace Okular;
+
+bool AllocatedPixmaps::isEmpty() const
+{
+    return m_pages.isEmpty();
+}
+
+int AllocatedPixmaps::count() const
+{
+    int result = 0;
+    PageMap::const_iterator it = m_pages.constBegin(), end = m_pages.constEnd();
+    for ( ; it != end; ++it )
+        result += it.value().count();
+    return result;
+}
+
+QList< AllocatedPixmap * > AllocatedPixmaps::pixmaps( int page ) const
+{
+    return m_pages.value( page );
+}
+
+void AllocatedPixmaps::append( AllocatedPixmap *pixmap )
+{
+    m_pages[ pixmap->page ].append( pixmap );
+    m_observerPages[ pixmap->observer ][ pixmap->page ].append( pixmap );
+}
+
+void AllocatedPixmaps::remove( AllocatedPixmap *pixmap )
+{
+    removeFrom( m_pages, pixmap );
+
+    QHash< DocumentObserver *, PageMap >::iterator oIt = m_observerPages.find( pixmap->observer );
+    if ( oIt == m_observerPages.end() )
+        return;
+
+    removeFrom( oIt.value(), pixmap );
+    if ( oIt.value().isEmpty() )
+        m_observerPages.erase( oIt );
+}
+
+AllocatedPixmap *AllocatedPixmaps::take( DocumentObserver *observer, int page )
+{
+    QHash< DocumentObserver *, PageMap >::const_iterator oIt = m_observerPages.constFind( observer );
+    if ( oIt == m_observerPages.constEnd() )
+        return 0;
+
+    const QList< AllocatedPixmap * > pixmaps = oIt.value().value( page );
+    if ( pixmaps.isEmpty() )
+        return 0;
+
+    AllocatedPixmap *pixmap = pixmaps.first();
+    remove( pixmap );
+    return pixmap;
+}
+
+QList< AllocatedPixmap * > AllocatedPixmaps::takeAll( DocumentObserver *observer )
+{
+    QList< AllocatedPixmap * > result;
+
+    const PageMap pages = m_observerPages.take( observer );
+    PageMap::const_iterator it = pages.constBegin(), end = pages.constEnd();
+    for ( ; it != end; ++it )
+    {
+        foreach ( AllocatedPixmap *pixmap, it.value() )
+        {
+            removeFrom( m_pages, pixmap );
+            result.append( pixmap );
+        }
+    }
+
+    return result;
+}
+
+QList< AllocatedPixmap * > AllocatedPixmaps::takeAll()
+{
+    QList< AllocatedPixmap * > result;
+
+    PageMap::const_iterator it = m_pages.constBegin(), end = m_pages.constEnd();
+    for ( ; it != end; ++it )
+        result += it.value();
+
+    m_pages.clear();
+    m_observerPages.clear();
+    return result;
+}
+
+AllocatedPixmap *AllocatedPixmaps::farthest( int viewportPage, bool unloadableOnly, DocumentObserver *observer ) const
+{
+    if ( !observer )
+        return farthest( m_pages, viewportPage, unloadableOnly );
+
+    QHash< DocumentObserver *, PageMap >::const_iterator oIt = m_observerPages.constFind( observer );
+    if ( oIt == m_observerPages.constEnd() )
+        return 0;
+
+    return farthest( oIt.value(), viewportPage, unloadableOnly );
+}
+
+AllocatedPixmap *AllocatedPixmaps::farthest( const PageMap &pages, int viewportPage, bool unloadableOnly )
+{
+    if ( pages.isEmpty() )
+        return 0;
+
+    // Walk the pages from both ends towards the viewport, always taking the
+    // farthest of the two. Usually only the pages around the viewport can
+    // not be unloaded, so this stops at the first step or so.
+    PageMap::const_iterator low = pages.constBegin();
+    PageMap::const_iterator high = pages.constEnd();
+    --high;
+    while ( true )
+    {
+        const bool takeLow = qAbs( low.key() - viewportPage ) >= qAbs( high.key() - viewportPage );
+        const QList< AllocatedPixmap * > &bucket = takeLow ? low.value() : high.value();
+        foreach ( AllocatedPixmap *pixmap, bucket )
+        {
+            if ( !unloadableOnly || pixmap->observer->canUnloadPixmap( pixmap->page ) )
+                return pixmap;
+        }
+
+        if ( low == high )
+            return 0;
+
+        if ( takeLow )
+            ++low;
+        else
+            --high;
+    }
+}
+
+void AllocatedPixmaps::removeFrom( PageMap &pages, AllocatedPixmap *pixmap )
+{
+    PageMap::iterator it = pages.find( pixmap->page );
+    if ( it == pages.end() )
+        return;
+
+    it.value().removeOne( pixmap );
+    if ( it.value().isEmpty() )
+        pages.erase( it );
+}
+
+/* kate: replace-tabs on; indent-width 4; */
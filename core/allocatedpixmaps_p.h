@@ -0,0 +1,107 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_ALLOCATEDPIXMAPS_P_H_
+#define _OKULAR_ALLOCATEDPIXMAPS_P_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+
+namespace Okular {
+class DocumentObserver;
+}
+
+struct AllocatedPixmap
+{
+    // owner of the page
+    Okular::DocumentObserver *observer;
+    int page;
+    qulonglong memory;
+    // public constructor: initialize data
+    AllocatedPixmap( Okular::DocumentObserver *o, int p, qulonglong m ) : observer( o ), page( p ), memory( m ) {}
+};
+
+namespace Okular {
+
+/**
+ * @short The eviction index of the pixmaps in the cache
+ *
+ * Allocation descriptors are kept sorted by page number, both globally and
+ * per observer. The pixmap farthest from a given viewport page is then
+ * always at one of the two ends of the index, so looking for it does not
+ * depend on the number of cached pixmaps, and the index does not need to be
+ * updated when the viewport moves.
+ *
+ * The index does not own the descriptors. There is at most one descriptor
+ * per observer and page.
+ */
+class AllocatedPixmaps
+{
+    public:
+        bool isEmpty() const;
+        int count() const;
+
+        /**
+         * Returns the descriptors of the pixmaps of @p page, of all the observers.
+         */
+        QList< AllocatedPixmap * > pixmaps( int page ) const;
+
+        /**
+         * Adds the @p pixmap descriptor to the index.
+         */
+        void append( AllocatedPixmap *pixmap );
+
+        /**
+         * Removes the @p pixmap descriptor from the index.
+         */
+        void remove( AllocatedPixmap *pixmap );
+
+        /**
+         * Removes the descriptor of the pixmap of @p observer for @p page and
+         * returns it, or 0 if there is none.
+         */
+        AllocatedPixmap *take( DocumentObserver *observer, int page );
+
+        /**
+         * Removes all the descriptors of @p observer and returns them.
+         */
+        QList< AllocatedPixmap * > takeAll( DocumentObserver *observer );
+
+        /**
+         * Empties the index, returning all the descriptors it contained.
+         */
+        QList< AllocatedPixmap * > takeAll();
+
+        /**
+         * Returns the descriptor of the pixmap farthest from @p viewportPage,
+         * or 0 if there is none. If @p unloadableOnly is set, only pixmaps
+         * their observer can unload are considered. If @p observer is not 0,
+         * only its pixmaps are considered.
+         *
+         * Pixmaps at the same distance are returned lowest page first, then
+         * in allocation order.
+         */
+        AllocatedPixmap *farthest( int viewportPage, bool unloadableOnly, DocumentObserver *observer = 0 ) const;
+
+    private:
+        typedef QMap< int, QList< AllocatedPixmap * > > PageMap;
+
+        static AllocatedPixmap *farthest( const PageMap &pages, int viewportPage, bool unloadableOnly );
+        static void removeFrom( PageMap &pages, AllocatedPixmap *pixmap );
+
+        PageMap m_pages;
+        QHash< DocumentObserver *, PageMap > m_observerPages;
+};
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -21,13 +21,21 @@
 #include <sys/sysctl.h>
 #include <vm/vm_param.h>
 #endif
+#ifdef Q_OS_LINUX
+#include <fcntl.h>
+#include <unistd.h>
+#endif
 
 // qt/kde/system includes
 #include <QtCore/QtAlgorithms>
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDateTime>
 #include <QtCore/QDir>
+#include <QtCore/QElapsedTimer>
 #include <QtCore/QFile>
 #include <QtCore/QFileInfo>
 #include <QtCore/QMap>
+#include <QtCore/QSocketNotifier>
 #include <QtCore/QTextStream>
 #include <QtCore/QTimer>
 #include <QtGui/QApplication>
@@ -54,6 +62,7 @@
 #include <ktemporaryfile.h>
 #include <ktoolinvocation.h>
 #include <kzip.h>
+#include <threadweaver/ThreadWeaver.h>
 
 // local includes
 #include "action.h"
@@ -74,6 +83,7 @@
 #include "page.h"
 #include "page_p.h"
 #include "pagecontroller_p.h"
+#include "pixmapdiskcache_p.h"
 #include "scripter.h"
 #include "settings_core.h"
 #include "sourcereference.h"
@@ -81,6 +91,7 @@
 #include "texteditors_p.h"
 #include "tile.h"
 #include "tilesmanager_p.h"
+#include "trace_p.h"
 #include "utils_p.h"
 #include "view.h"
 #include "view_p.h"
@@ -93,16 +104,6 @@
 
 using namespace Okular;
 
-struct AllocatedPixmap
-{
-    // owner of the page
-    DocumentObserver *observer;
-    int page;
-    qulonglong memory;
-    // public constructor: initialize data
-    AllocatedPixmap( DocumentObserver *o, int p, qulonglong m ) : observer( o ), page( p ), memory( m ) {}
-};
-
 struct ArchiveData
 {
     ArchiveData()
@@ -128,8 +129,44 @@ struct RunningSearch
     bool isCurrentlySearching : 1;
     QColor cachedColor;
     int pagesDone;
+    // the pages the text may be on, according to the text index; empty if
+    // there is no index
+    QBitArray candidatePages;
+    // since the highlights of the whole document searches were last notified
+    QElapsedTimer notificationTimer;
+    // the pages whose text was last extracted ahead of the search, kept
+    // while it runs
+    int prefetchFirstPage;
+    int prefetchLastPage;
+    // the page whose text the whole document search waits for, or -1, and
+    // what it goes on with when the text arrives
+    int waitingTextPage;
+    QSet< int > *waitingPagesToNotify;
+    QStringList waitingWords;
+    // the page last waited for: its text is not waited for again if the
+    // generator threads failed to extract it
+    int waitedTextPage;
 };
 
+// whether the text of @p search may be on @p page
+static bool searchMayMatch( const RunningSearch *search, int page )
+{
+    return page >= search->candidatePages.size() || search->candidatePages.testBit( page );
+}
+
+// deletes requests taken from the queue without being sent to the generator
+static void deleteQueuedPixmapRequest( PixmapRequest *request )
+{
+    Trace::end( "Queued", request );
+    delete request;
+}
+
+static void deleteQueuedPixmapRequests( const QList< PixmapRequest * > &requests )
+{
+    foreach ( PixmapRequest *request, requests )
+        deleteQueuedPixmapRequest( request );
+}
+
 #define foreachObserver( cmd ) {\
     QSet< DocumentObserver * >::const_iterator it=d->m_observers.constBegin(), end=d->m_observers.constEnd();\
     for ( ; it != end ; ++ it ) { (*it)-> cmd ; } }
@@ -141,6 +178,18 @@ struct RunningSearch
 #define OKULAR_HISTORY_MAXSTEPS 100
 #define OKULAR_HISTORY_SAVEDSTEPS 10
 
+// how long the text indexing waits for the generator to be idle
+#define OKULAR_TEXTINDEX_IDLE_INTERVAL 500
+
+// how long the whole document searches go on before letting the event loop
+// run, and how often they show the matches found meanwhile
+#define OKULAR_SEARCH_SLICE 20
+#define OKULAR_SEARCH_NOTIFY_INTERVAL 100
+
+// the memory the text layouts may take for each text page that may be
+// loaded, enough for the layouts of many more pages than the text pages
+#define OKULAR_TEXTLAYOUT_MEMORY_PER_TEXTPAGE 65536
+
 /***** Document ******/
 
 QString DocumentPrivate::pagesSizeString() const
@@ -295,26 +344,28 @@ qulonglong DocumentPrivate::calculateMemoryToFree()
     // [MEM] choose memory parameters based on configuration profile
     qulonglong clipValue = 0;
     qulonglong memoryToFree = 0;
+    // the text pages and their layouts count as well
+    const qulonglong allocatedMemory = m_allocatedPixmapsTotalMemory + m_allocatedTextPagesTotalMemory + m_textLayouts.memory();
 
     switch ( SettingsCore::memoryLevel() )
     {
         case SettingsCore::EnumMemoryLevel::Low:
-            memoryToFree = m_allocatedPixmapsTotalMemory;
+            memoryToFree = allocatedMemory;
             break;
 
         case SettingsCore::EnumMemoryLevel::Normal:
         {
             qulonglong thirdTotalMemory = getTotalMemory() / 3;
             qulonglong freeMemory = getFreeMemory();
-            if (m_allocatedPixmapsTotalMemory > thirdTotalMemory) memoryToFree = m_allocatedPixmapsTotalMemory - thirdTotalMemory;
-            if (m_allocatedPixmapsTotalMemory > freeMemory) clipValue = (m_allocatedPixmapsTotalMemory - freeMemory) / 2;
+            if (allocatedMemory > thirdTotalMemory) memoryToFree = allocatedMemory - thirdTotalMemory;
+            if (allocatedMemory > freeMemory) clipValue = (allocatedMemory - freeMemory) / 2;
         }
         break;
 
         case SettingsCore::EnumMemoryLevel::Aggressive:
         {
             qulonglong freeMemory = getFreeMemory();
-            if (m_allocatedPixmapsTotalMemory > freeMemory) clipValue = (m_allocatedPixmapsTotalMemory - freeMemory) / 2;
+            if (allocatedMemory > freeMemory) clipValue = (allocatedMemory - freeMemory) / 2;
         }
         break;
         case SettingsCore::EnumMemoryLevel::Greedy:
@@ -322,7 +373,7 @@ qulonglong DocumentPrivate::calculateMemoryToFree()
             qulonglong freeSwap;
             qulonglong freeMemory = getFreeMemory( &freeSwap );
             const qulonglong memoryLimit = qMin( qMax( freeMemory, getTotalMemory()/2 ), freeMemory+freeSwap );
-            if (m_allocatedPixmapsTotalMemory > memoryLimit) clipValue = (m_allocatedPixmapsTotalMemory - memoryLimit) / 2;
+            if (allocatedMemory > memoryLimit) clipValue = (allocatedMemory - memoryLimit) / 2;
         }
         break;
     }
@@ -330,6 +381,12 @@ qulonglong DocumentPrivate::calculateMemoryToFree()
     if ( clipValue > memoryToFree )
         memoryToFree = clipValue;
 
+    // an explicit budget caps the cache whatever the profile is
+    const qulonglong memoryBudget = Q_UINT64_C(1048576) * SettingsCore::pixmapMemoryBudget();
+    if ( memoryBudget > 0 && allocatedMemory > memoryBudget &&
+         allocatedMemory - memoryBudget > memoryToFree )
+        memoryToFree = allocatedMemory - memoryBudget;
+
     return memoryToFree;
 }
 
@@ -363,15 +420,20 @@ void DocumentPrivate::cleanupPixmapMemory( qulonglong memoryToFree )
 
         // m_allocatedPixmapsTotalMemory can't underflow because we always add or remove
         // the memory used by the AllocatedPixmap so at most it can reach zero
+        const qulonglong memoryBefore = m_allocatedPixmapsTotalMemory;
         m_allocatedPixmapsTotalMemory -= p->memory;
-        // Make sure memoryToFree does not underflow
-        if ( p->memory > memoryToFree )
-            memoryToFree = 0;
-        else
-            memoryToFree -= p->memory;
         pagesFreed++;
         // delete pixmap
         m_pagesVector.at( p->page )->deletePixmap( p->observer );
+        // a buffer shared with another observer is still there, and is now
+        // accounted to that observer
+        updateAllocatedPixmapsMemory( p->page );
+        const qulonglong memoryFreed = memoryBefore - m_allocatedPixmapsTotalMemory;
+        // Make sure memoryToFree does not underflow
+        if ( memoryFreed > memoryToFree )
+            memoryToFree = 0;
+        else
+            memoryToFree -= memoryFreed;
         // delete allocation descriptor
         delete p;
     }
@@ -380,7 +442,7 @@ void DocumentPrivate::cleanupPixmapMemory( qulonglong memoryToFree )
 
     // Store pages that weren't completely removed
 
-    QLinkedList< AllocatedPixmap * > pixmapsToKeep;
+    QList< AllocatedPixmap * > pixmapsToKeep;
     while (memoryToFree > 0)
     {
         int clean_hits = 0;
@@ -420,8 +482,117 @@ void DocumentPrivate::cleanupPixmapMemory( qulonglong memoryToFree )
         if (clean_hits == 0) break;
     }
 
-    m_allocatedPixmaps += pixmapsToKeep;
+    foreach ( AllocatedPixmap *p, pixmapsToKeep )
+        m_allocatedPixmaps.append( p );
     //p--rintf("freeMemory A:[%d -%d = %d] \n", m_allocatedPixmaps.count() + pagesFreed, pagesFreed, m_allocatedPixmaps.count() );
+
+    // the text pages go last: they are small and slow to extract again
+    while ( memoryToFree > 0 )
+    {
+        const int pageToKick = farthestUnloadableTextPage();
+        if ( pageToKick == -1 )
+            break;
+
+        const qulonglong memoryFreed = m_allocatedTextPages.value( pageToKick );
+        unloadTextPage( pageToKick );
+        memoryToFree = (memoryFreed < memoryToFree) ? (memoryToFree - memoryFreed) : 0;
+    }
+}
+
+bool DocumentPrivate::isTextPagePinned( int page ) const
+{
+    // the highlights of the searches go on from the text page, and the
+    // text is selected on the visible pages
+    const Page *kp = m_pagesVector.at( page );
+    if ( kp->hasHighlights() || kp->textSelection() )
+        return true;
+
+    foreach ( const VisiblePageRect *rect, m_pageRects )
+    {
+        if ( rect->pageNumber == page )
+            return true;
+    }
+
+    if ( m_requestedTextPages.contains( page ) )
+        return true;
+
+    foreach ( const RunningSearch *search, m_searches )
+    {
+        if ( search->continueOnPage == page )
+            return true;
+        if ( search->isCurrentlySearching && page >= search->prefetchFirstPage && page <= search->prefetchLastPage )
+            return true;
+    }
+    return false;
+}
+
+int DocumentPrivate::farthestUnloadableTextPage( int keepPage ) const
+{
+    const int currentViewportPage = (*m_viewportIterator).pageNumber;
+
+    int farthestPage = -1;
+    QMap< int, qulonglong >::const_iterator it = m_allocatedTextPages.constBegin(), end = m_allocatedTextPages.constEnd();
+    for ( ; it != end; ++it )
+    {
+        const int page = it.key();
+        if ( page == keepPage ||
+             ( farthestPage != -1 && qAbs( page - currentViewportPage ) <= qAbs( farthestPage - currentViewportPage ) ) )
+            continue;
+
+        if ( !isTextPagePinned( page ) )
+            farthestPage = page;
+    }
+    return farthestPage;
+}
+
+void DocumentPrivate::unloadTextPage( int page )
+{
+    m_allocatedTextPagesTotalMemory -= m_allocatedTextPages.take( page );
+    m_pagesVector.at( page )->setTextPage( 0 ); // deletes the textpage
+}
+
+void DocumentPrivate::updateAllocatedPixmapsMemory( int page )
+{
+    Page *kp = m_pagesVector.value( page, 0 );
+    if ( !kp )
+        return;
+
+    // pixmaps of several observers can share the same buffer: count it once
+    QSet< qint64 > countedPixmaps;
+    foreach ( AllocatedPixmap *p, m_allocatedPixmaps.pixmaps( page ) )
+    {
+        qulonglong memory = p->memory;
+        const TilesManager *tm = kp->d->tilesManager( p->observer );
+        if ( tm )
+        {
+            memory = tm->totalMemory();
+        }
+        else
+        {
+            QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator it = kp->d->m_pixmaps.constFind( p->observer );
+            // if there is no pixmap yet it is being rotated: keep the estimate
+            if ( it != kp->d->m_pixmaps.constEnd() )
+            {
+                const QPixmap *pixmap = it.value().m_pixmap;
+                const QImage &image = it.value().m_image;
+                const qint64 cacheKey = pixmap ? pixmap->cacheKey() : image.cacheKey();
+                if ( countedPixmaps.contains( cacheKey ) )
+                {
+                    memory = 0;
+                }
+                else
+                {
+                    countedPixmaps.insert( cacheKey );
+                    if ( pixmap )
+                        memory = 4 * (qulonglong)pixmap->width() * pixmap->height();
+                    else
+                        memory = image.byteCount();
+                }
+            }
+        }
+        m_allocatedPixmapsTotalMemory = m_allocatedPixmapsTotalMemory - p->memory + memory;
+        p->memory = memory;
+    }
 }
 
 /* Returns the next pixmap to evict from cache, or NULL if no suitable pixmap
@@ -431,39 +602,84 @@ void DocumentPrivate::cleanupPixmapMemory( qulonglong memoryToFree )
  */
 AllocatedPixmap * DocumentPrivate::searchLowestPriorityPixmap( bool unloadableOnly, bool thenRemoveIt, DocumentObserver *observer )
 {
-    QLinkedList< AllocatedPixmap * >::iterator pIt = m_allocatedPixmaps.begin();
-    QLinkedList< AllocatedPixmap * >::iterator pEnd = m_allocatedPixmaps.end();
-    QLinkedList< AllocatedPixmap * >::iterator farthestPixmap = pEnd;
     const int currentViewportPage = (*m_viewportIterator).pageNumber;
 
     /* Find the pixmap that is farthest from the current viewport */
-    int maxDistance = -1;
-    while ( pIt != pEnd )
-    {
-        const AllocatedPixmap * p = *pIt;
-        // Filter by observer
-        if ( observer == 0 || p->observer == observer )
-        {
-            const int distance = qAbs( p->page - currentViewportPage );
-            if ( maxDistance < distance && ( !unloadableOnly || p->observer->canUnloadPixmap( p->page ) ) )
-            {
-                maxDistance = distance;
-                farthestPixmap = pIt;
-            }
-        }
-        ++pIt;
-    }
+    AllocatedPixmap * selectedPixmap = m_allocatedPixmaps.farthest( currentViewportPage, unloadableOnly, observer );
 
     /* No pixmap to remove */
-    if ( farthestPixmap == pEnd )
+    if ( !selectedPixmap )
         return 0;
 
-    AllocatedPixmap * selectedPixmap = *farthestPixmap;
     if ( thenRemoveIt )
-        m_allocatedPixmaps.erase( farthestPixmap );
+        m_allocatedPixmaps.remove( selectedPixmap );
     return selectedPixmap;
 }
 
+#if defined(Q_OS_LINUX)
+static QByteArray readFirstLine( const QString &fileName )
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return QByteArray();
+    return file.readLine().trimmed();
+}
+
+/*
+ * Reads the memory limit of the cgroup v2 group this process belongs to,
+ * and how much of it is still available; when several ancestors have a
+ * limit the tightest one applies. Returns false if there is no limit.
+ */
+static bool getCgroupMemory( qulonglong *limit, qulonglong *available )
+{
+    QFile cgroupFile( "/proc/self/cgroup" );
+    if ( !cgroupFile.open( QIODevice::ReadOnly ) )
+        return false;
+
+    // the unified hierarchy is the one with id 0 and no controller list
+    QString path;
+    QTextStream readStream( &cgroupFile );
+    while ( true )
+    {
+        const QString entry = readStream.readLine();
+        if ( entry.isNull() ) break;
+        if ( entry.startsWith( "0::/" ) )
+        {
+            path = entry.mid( 3 );
+            break;
+        }
+    }
+    if ( path.isEmpty() )
+        return false;
+
+    bool found = false;
+    while ( true )
+    {
+        const QString dir = QString( "/sys/fs/cgroup" ) + ( path == "/" ? QString() : path );
+        bool ok;
+        const qulonglong max = readFirstLine( dir + "/memory.max" ).toULongLong( &ok );
+        // the file contains "max" when the group has no limit
+        if ( ok )
+        {
+            const qulonglong current = readFirstLine( dir + "/memory.current" ).toULongLong();
+            const qulonglong headroom = current < max ? max - current : 0;
+            if ( !found || max < *limit )
+                *limit = max;
+            if ( !found || headroom < *available )
+                *available = headroom;
+            found = true;
+        }
+
+        if ( path == "/" )
+            break;
+        path = path.section( '/', 0, -2 );
+        if ( path.isEmpty() )
+            path = "/";
+    }
+    return found;
+}
+#endif
+
 qulonglong DocumentPrivate::getTotalMemory()
 {
     static qulonglong cachedValue = 0;
@@ -482,7 +698,15 @@ qulonglong DocumentPrivate::getTotalMemory()
         QString entry = readStream.readLine();
         if ( entry.isNull() ) break;
         if ( entry.startsWith( "MemTotal:" ) )
-            return (cachedValue = (Q_UINT64_C(1024) * entry.section( ' ', -2, -2 ).toULongLong()));
+        {
+            cachedValue = Q_UINT64_C(1024) * entry.section( ' ', -2, -2 ).toULongLong();
+
+            // inside a container the memory we can get is the cgroup limit
+            qulonglong cgroupLimit, cgroupAvailable;
+            if ( getCgroupMemory( &cgroupLimit, &cgroupAvailable ) && cgroupLimit < cachedValue )
+                cachedValue = cgroupLimit;
+            return cachedValue;
+        }
     }
 #elif defined(Q_OS_FREEBSD)
     qulonglong physmem;
@@ -567,9 +791,15 @@ qulonglong DocumentPrivate::getFreeMemory( qulonglong *freeSwap )
 
     lastUpdate = QTime::currentTime();
 
+    cachedValue = Q_UINT64_C(1024) * memoryFree;
+    // the cgroup may run out of memory well before the system does
+    qulonglong cgroupLimit, cgroupAvailable;
+    if ( getCgroupMemory( &cgroupLimit, &cgroupAvailable ) && cgroupAvailable < cachedValue )
+        cachedValue = cgroupAvailable;
+
     if (freeSwap)
         *freeSwap = ( cachedFreeSwap = (Q_UINT64_C(1024) * values[3]) );
-    return ( cachedValue = (Q_UINT64_C(1024) * memoryFree) );
+    return cachedValue;
 #elif defined(Q_OS_FREEBSD)
     qulonglong cache, inact, free, psize;
     size_t cachelen, inactlen, freelen, psizelen;
@@ -1307,10 +1537,73 @@ void DocumentPrivate::slotTimedMemoryCheck()
 {
     // [MEM] clean memory (for 'free mem dependant' profiles only)
     if ( SettingsCore::memoryLevel() != SettingsCore::EnumMemoryLevel::Low &&
-         m_allocatedPixmapsTotalMemory > 1024*1024 )
+         m_allocatedPixmapsTotalMemory + m_allocatedTextPagesTotalMemory + m_textLayouts.memory() > 1024*1024 )
         cleanupPixmapMemory();
 }
 
+void DocumentPrivate::startMemoryPressureMonitor()
+{
+#if defined(Q_OS_LINUX)
+    if ( m_memoryPressureNotifier )
+        return;
+
+    // kernels built without PSI support do not have this file
+    const int fd = ::open( "/proc/pressure/memory", O_RDWR | O_NONBLOCK );
+    if ( fd < 0 )
+        return;
+
+    // be notified when some tasks are stalled on memory for 200ms in a 2s
+    // window; unprivileged processes may only use multiples of 2s
+    static const char trigger[] = "some 200000 2000000";
+    if ( ::write( fd, trigger, sizeof( trigger ) ) < 0 )
+    {
+        ::close( fd );
+        return;
+    }
+
+    m_memoryPressureNotifier = new QSocketNotifier( fd, QSocketNotifier::Exception, m_parent );
+    QObject::connect( m_memoryPressureNotifier, SIGNAL(activated(int)), m_parent, SLOT(slotMemoryPressure()) );
+#endif
+}
+
+void DocumentPrivate::stopMemoryPressureMonitor()
+{
+#if defined(Q_OS_LINUX)
+    if ( !m_memoryPressureNotifier )
+        return;
+
+    const int fd = m_memoryPressureNotifier->socket();
+    delete m_memoryPressureNotifier;
+    m_memoryPressureNotifier = 0;
+    ::close( fd );
+#endif
+}
+
+void DocumentPrivate::slotMemoryPressure()
+{
+    // the system is short of memory: give back half of the pixmap cache
+    // right away instead of waiting for the next timed check
+    if ( m_allocatedPixmapsTotalMemory > 1024*1024 )
+    {
+        kDebug(OkularDebug) << "Memory pressure, freeing" << m_allocatedPixmapsTotalMemory / 2 << "bytes";
+        cleanupPixmapMemory( m_allocatedPixmapsTotalMemory / 2 );
+    }
+
+    // and half of the text pages, which cleanupPixmapMemory() only unloads
+    // when the pixmaps are not enough
+    qulonglong textMemoryToFree = m_allocatedTextPagesTotalMemory / 2;
+    while ( textMemoryToFree > 0 )
+    {
+        const int pageToKick = farthestUnloadableTextPage();
+        if ( pageToKick == -1 )
+            break;
+
+        const qulonglong memoryFreed = m_allocatedTextPages.value( pageToKick );
+        unloadTextPage( pageToKick );
+        textMemoryToFree = (memoryFreed < textMemoryToFree) ? (textMemoryToFree - memoryFreed) : 0;
+    }
+}
+
 void DocumentPrivate::sendGeneratorPixmapRequest()
 {
     /* If the pixmap cache will have to be cleaned in order to make room for the
@@ -1329,15 +1622,11 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
 
     // find a request
     PixmapRequest * request = 0;
+    QList< PixmapRequest * > waitingForPreview;
     m_pixmapRequestsMutex.lock();
-    while ( !m_pixmapRequestsStack.isEmpty() && !request )
+    while ( !m_pixmapRequestsQueue.isEmpty() && !request )
     {
-        PixmapRequest * r = m_pixmapRequestsStack.last();
-        if (!r)
-        {
-            m_pixmapRequestsStack.pop_back();
-            continue;
-        }
+        PixmapRequest * r = m_pixmapRequestsQueue.top();
 
         QRect requestRect = r->isTile() ? r->normalizedRect().geometry( r->width(), r->height() ) : QRect( 0, 0, r->width(), r->height() );
         TilesManager *tilesManager = r->d->tilesManager();
@@ -1345,27 +1634,41 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         // If it's a preload but the generator is not threaded no point in trying to preload
         if ( r->preload() && !m_generator->hasFeature( Generator::Threaded ) )
         {
-            m_pixmapRequestsStack.pop_back();
-            delete r;
+            m_pixmapRequestsQueue.takeTop();
+            deleteQueuedPixmapRequest( r );
         }
         // request only if page isn't already present and request has valid id
         // request only if page isn't already present and request has valid id
         else if ( ( !r->d->mForce && r->page()->hasPixmap( r->observer(), r->width(), r->height(), r->normalizedRect() ) ) || !m_observers.contains(r->observer()) )
         {
-            m_pixmapRequestsStack.pop_back();
-            delete r;
+            m_pixmapRequestsQueue.takeTop();
+            deleteQueuedPixmapRequest( r );
         }
         else if ( !r->d->mForce && r->preload() && qAbs( r->pageNumber() - currentViewportPage ) >= maxDistance )
         {
-            m_pixmapRequestsStack.pop_back();
+            m_pixmapRequestsQueue.takeTop();
             //kDebug() << "Ignoring request that doesn't fit in cache";
-            delete r;
+            deleteQueuedPixmapRequest( r );
         }
         // Ignore requests for pixmaps that are already being generated
         else if ( tilesManager && tilesManager->isRequesting( r->normalizedRect(), r->width(), r->height() ) )
         {
-            m_pixmapRequestsStack.pop_back();
-            delete r;
+            m_pixmapRequestsQueue.takeTop();
+            deleteQueuedPixmapRequest( r );
+        }
+        // Ignore requests that another rendering thread is already working on
+        else if ( !tilesManager && !r->d->mForce && isPixmapRequestExecuting( r ) )
+        {
+            m_pixmapRequestsQueue.takeTop();
+            deleteQueuedPixmapRequest( r );
+        }
+        // Wait for the preview of the page to be done, or it could replace
+        // the full resolution pixmap; requestDone() will try again. The
+        // requests of the other pages go on meanwhile
+        else if ( !r->d->mPreview && isPreviewExecuting( r ) )
+        {
+            m_pixmapRequestsQueue.takeTop();
+            waitingForPreview.append( r );
         }
         // If the requested area is above 8000000 pixels, switch on the tile manager
         else if ( !tilesManager && m_generator->hasFeature( Generator::TiledRendering ) && (long)r->width() * (long)r->height() > 8000000L )
@@ -1376,6 +1679,16 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
 
             // fill the tiles manager with the last rendered pixmap
             const QPixmap *pixmap = r->page()->_o_nearestPixmap( r->observer(), r->width(), r->height() );
+            QPixmap compactPixmap;
+            if ( !pixmap )
+            {
+                const QImage *image = r->page()->_o_nearestImage( r->observer(), r->width(), r->height() );
+                if ( image )
+                {
+                    compactPixmap = QPixmap::fromImage( *image );
+                    pixmap = &compactPixmap;
+                }
+            }
             if ( pixmap )
             {
                 tilesManager = new TilesManager( r->pageNumber(), pixmap->width(), pixmap->height(), r->page()->rotation() );
@@ -1392,25 +1705,23 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
             r->page()->d->setTilesManager( r->observer(), tilesManager );
             r->setTile( true );
 
-            // Change normalizedRect to the smallest rect that contains all
-            // visible tiles.
+            // Change normalizedRect to the visible tiles
             if ( !r->normalizedRect().isNull() )
             {
-                NormalizedRect tilesRect;
+                QList< NormalizedRect > tilesRects;
                 const QList<Tile> tiles = tilesManager->tilesAt( r->normalizedRect(), TilesManager::TerminalTile );
                 QList<Tile>::const_iterator tIt = tiles.constBegin(), tEnd = tiles.constEnd();
                 while ( tIt != tEnd )
                 {
-                    Tile tile = *tIt;
-                    if ( tilesRect.isNull() )
-                        tilesRect = tile.rect();
-                    else
-                        tilesRect |= tile.rect();
-
+                    tilesRects.append( (*tIt).rect() );
                     ++tIt;
                 }
 
-                r->setNormalizedRect( tilesRect );
+                foreach ( PixmapRequest *tileRequest, splitTileRequest( r, tilesRects ) )
+                {
+                    Trace::begin( "Queued", tileRequest, tileRequest->pageNumber() );
+                    m_pixmapRequestsQueue.enqueue( tileRequest, tileRequest->pageNumber() - currentViewportPage );
+                }
                 request = r;
             }
             else
@@ -1419,8 +1730,8 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
                 // preload requests issued by PageView if the requested page is
                 // not visible and the user has just switched from a non-tiled
                 // zoom level to a tiled one
-                m_pixmapRequestsStack.pop_back();
-                delete r;
+                m_pixmapRequestsQueue.takeTop();
+                deleteQueuedPixmapRequest( r );
             }
         }
         // If the requested area is below 6000000 pixels, switch off the tile manager
@@ -1435,9 +1746,16 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
 
             request = r;
         }
+        // The page stopped using tiles after this tile was queued along with
+        // the other tiles of its request: the whole page is being rendered
+        else if ( !tilesManager && r->isTile() )
+        {
+            m_pixmapRequestsQueue.takeTop();
+            deleteQueuedPixmapRequest( r );
+        }
         else if ( (long)requestRect.width() * (long)requestRect.height() > 20000000L )
         {
-            m_pixmapRequestsStack.pop_back();
+            m_pixmapRequestsQueue.takeTop();
             if ( !m_warnedOutOfMemory )
             {
                 kWarning(OkularDebug).nospace() << "Running out of memory on page " << r->pageNumber()
@@ -1445,7 +1763,7 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
                 kWarning(OkularDebug) << "this message will be reported only once.";
                 m_warnedOutOfMemory = true;
             }
-            delete r;
+            deleteQueuedPixmapRequest( r );
         }
         else
         {
@@ -1453,6 +1771,9 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         }
     }
 
+    foreach ( PixmapRequest *r, waitingForPreview )
+        m_pixmapRequestsQueue.enqueue( r, r->pageNumber() - currentViewportPage );
+
     // if no request found (or already generated), return
     if ( !request )
     {
@@ -1471,12 +1792,48 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
     if ( pixmapBytes > (1024 * 1024) )
         cleanupPixmapMemory( memoryToFree /* previously calculated value */ );
 
+    // serve the request from the pixmap of another observer
+    if ( reusePagePixmap( request ) )
+    {
+        Trace::end( "Queued", request );
+        Trace::begin( "Rendering", request, request->pageNumber() );
+        m_pixmapRequestsQueue.remove( request );
+        m_executingPixmapRequests.push_back( request );
+        m_pixmapRequestsMutex.unlock();
+        requestDone( request );
+        return;
+    }
+
+    // or from the disk cache if the page was rendered before: the image is
+    // decoded in a thread, then pixmapDiskCacheLoaded() completes the request
+    const QString diskCacheKey = diskCachedPixmapKey( request );
+    if ( !diskCacheKey.isEmpty() )
+    {
+        Trace::end( "Queued", request );
+        Trace::begin( "Rendering", request, request->pageNumber() );
+        m_pixmapRequestsQueue.remove( request );
+        m_executingPixmapRequests.push_back( request );
+        const bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
+        m_pixmapRequestsMutex.unlock();
+
+        PixmapDiskCacheLoadJob *job = new PixmapDiskCacheLoadJob( diskCacheKey, request );
+        QObject::connect( job, SIGNAL(done(ThreadWeaver::Job*)), m_parent, SLOT(pixmapDiskCacheLoaded(ThreadWeaver::Job*)) );
+        ThreadWeaver::Weaver::instance()->enqueue( job );
+
+        // the generator is still free for the next request
+        if ( hasPixmaps )
+            QTimer::singleShot( 0, m_parent, SLOT(sendGeneratorPixmapRequest()) );
+        return;
+    }
+
     // submit the request to the generator
     if ( m_generator->canGeneratePixmap() )
     {
         QRect requestRect = !request->isTile() ? QRect(0, 0, request->width(), request->height() ) : request->normalizedRect().geometry( request->width(), request->height() );
         kDebug(OkularDebug).nospace() << "sending request observer=" << request->observer() << " " <<requestRect.width() << "x" << requestRect.height() << "@" << request->pageNumber() << " async == " << request->asynchronous() << " isTile == " << request->isTile();
-        m_pixmapRequestsStack.removeAll ( request );
+        m_pixmapRequestsQueue.remove( request );
+        Trace::end( "Queued", request );
+        Trace::begin( "Rendering", request, request->pageNumber() );
 
         if ( tm )
             tm->setRequest( request->normalizedRect(), request->width(), request->height() );
@@ -1494,6 +1851,16 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
         m_executingPixmapRequests.push_back( request );
         m_pixmapRequestsMutex.unlock();
         m_generator->generatePixmap( request );
+
+        // keep the other rendering threads busy, if the generator has any
+        if ( m_generator->hasFeature( Generator::ReentrantRendering ) )
+        {
+            m_pixmapRequestsMutex.lock();
+            const bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
+            m_pixmapRequestsMutex.unlock();
+            if ( hasPixmaps && m_generator->canGeneratePixmap() )
+                sendGeneratorPixmapRequest();
+        }
     }
     else
     {
@@ -1503,14 +1870,280 @@ void DocumentPrivate::sendGeneratorPixmapRequest()
     }
 }
 
+bool DocumentPrivate::isPixmapRequestExecuting( PixmapRequest *request ) const
+{
+    QLinkedList< PixmapRequest * >::const_iterator eIt = m_executingPixmapRequests.constBegin(), eEnd = m_executingPixmapRequests.constEnd();
+    for ( ; eIt != eEnd; ++eIt )
+    {
+        const PixmapRequest *executing = *eIt;
+        // the pixmap of an aborted request will not come
+        if ( executing->shouldAbortRender() )
+            continue;
+
+        if ( executing->observer() == request->observer() && executing->pageNumber() == request->pageNumber() )
+        {
+            // executing requests have their size swapped on rotated documents
+            const bool swapped = (int)m_rotation % 2;
+            const int width = swapped ? executing->height() : executing->width();
+            const int height = swapped ? executing->width() : executing->height();
+            if ( width == request->width() && height == request->height() )
+                return true;
+        }
+    }
+    return false;
+}
+
+QList< PixmapRequest * > DocumentPrivate::splitTileRequest( PixmapRequest *request, const QList< NormalizedRect > &tiles )
+{
+    QList< PixmapRequest * > tileRequests;
+    if ( tiles.count() < 2 || !m_generator->hasFeature( Generator::ReentrantRendering ) )
+    {
+        // the smallest rect that contains all the tiles
+        NormalizedRect tilesRect;
+        foreach ( const NormalizedRect &tile, tiles )
+        {
+            if ( tilesRect.isNull() )
+                tilesRect = tile;
+            else
+                tilesRect |= tile;
+        }
+
+        request->setNormalizedRect( tilesRect );
+        return tileRequests;
+    }
+
+    // the middle of the requested area is what the user is looking at
+    const NormalizedRect &requestedRect = request->normalizedRect();
+    const double centerX = ( requestedRect.left + requestedRect.right ) / 2;
+    const double centerY = ( requestedRect.top + requestedRect.bottom ) / 2;
+    QMultiMap< double, NormalizedRect > tilesByDistance;
+    foreach ( const NormalizedRect &tile, tiles )
+    {
+        const double dx = ( tile.left + tile.right ) / 2 - centerX;
+        const double dy = ( tile.top + tile.bottom ) / 2 - centerY;
+        tilesByDistance.insert( dx * dx + dy * dy, tile );
+    }
+
+    QMultiMap< double, NormalizedRect >::const_iterator tIt = tilesByDistance.constBegin(), tEnd = tilesByDistance.constEnd();
+    request->setNormalizedRect( tIt.value() );
+    for ( ++tIt; tIt != tEnd; ++tIt )
+    {
+        PixmapRequest *tileRequest = new PixmapRequest( request->observer(), request->pageNumber(), request->width(), request->height(),
+                                                        request->priority(), QFlag( request->d->mFeatures ) );
+        tileRequest->d->mPage = request->page();
+        tileRequest->d->mForce = request->d->mForce;
+        tileRequest->setTile( true );
+        tileRequest->setNormalizedRect( tIt.value() );
+        tileRequests.append( tileRequest );
+    }
+
+    kDebug(OkularDebug).nospace() << "Split the tiles request of page " << request->pageNumber() << " in " << tiles.count() << " requests";
+    return tileRequests;
+}
+
+QString DocumentPrivate::pixmapDiskCacheKey( const Page *page, int width, int height ) const
+{
+    if ( !SettingsCore::enablePixmapDiskCache() || m_xmlFileName.isEmpty() )
+        return QString();
+
+    // annotations and form fields can change without the document file changing
+    if ( page->hasAnnotations() || !page->formFields().isEmpty() )
+        return QString();
+
+    // the generators add the settings of their own that change the rendering
+    const QString renderHints = QString( "%1-%2-%3-%4-%5-%6" ).arg( m_generatorName )
+        .arg( documentMetaData( "PaperColor", true ).value< QColor >().name() )
+        .arg( SettingsCore::textAntialias() ).arg( SettingsCore::graphicsAntialias() )
+        .arg( SettingsCore::textHinting() )
+        .arg( m_generator->metaData( "RenderSettings", QVariant() ).toString() );
+    return PixmapDiskCache::key( QFileInfo( m_xmlFileName ).fileName(), page->number(),
+                                 width, height, page->rotation(), renderHints );
+}
+
+bool DocumentPrivate::reusePagePixmap( PixmapRequest *request )
+{
+    if ( request->isTile() || request->d->mForce || request->d->tilesManager() )
+        return false;
+
+    const QPixmap *pixmap = request->page()->d->reusablePixmap( request->observer(), request->width(), request->height() );
+    if ( !pixmap )
+        return false;
+
+    kDebug(OkularDebug).nospace() << "Reusing page pixmap observer=" << request->observer() << " page=" << request->pageNumber()
+        << " (" << pixmap->width() << "x" << pixmap->height() << " px)";
+
+    // pixmaps of the same size share the same buffer, larger ones are scaled down
+    QPixmap *newPixmap;
+    if ( pixmap->width() == request->width() && pixmap->height() == request->height() )
+        newPixmap = new QPixmap( *pixmap );
+    else
+        newPixmap = new QPixmap( pixmap->scaled( request->width(), request->height(), Qt::IgnoreAspectRatio, Qt::SmoothTransformation ) );
+    request->page()->d->setRotatedPixmap( request->observer(), newPixmap );
+    return true;
+}
+
+QString DocumentPrivate::diskCachedPixmapKey( PixmapRequest *request ) const
+{
+    // forced requests want a fresh rendering
+    if ( request->isTile() || request->d->mForce || request->d->mSkipDiskCache )
+        return QString();
+
+    const QString key = pixmapDiskCacheKey( request->page(), request->width(), request->height() );
+    if ( key.isEmpty() || !PixmapDiskCache::self()->contains( key ) )
+        return QString();
+    return key;
+}
+
+void DocumentPrivate::pixmapDiskCacheLoaded( ThreadWeaver::Job *job )
+{
+    PixmapDiskCacheLoadJob *loadJob = static_cast< PixmapDiskCacheLoadJob * >( job );
+    PixmapRequest *request = loadJob->request();
+    const QImage image = loadJob->image();
+    loadJob->deleteLater();
+
+    // requestDone() drops the requests of a closing document and the
+    // aborted ones
+    if ( !m_generator || m_closingLoop || request->shouldAbortRender() )
+    {
+        requestDone( request );
+        return;
+    }
+
+    // the file went away or the page was rotated meanwhile: render it
+    if ( image.isNull() || image.width() != request->width() || image.height() != request->height() )
+    {
+        Trace::end( "Rendering", request );
+        request->d->mSkipDiskCache = true;
+        m_pixmapRequestsMutex.lock();
+        m_executingPixmapRequests.removeAll( request );
+        Trace::begin( "Queued", request, request->pageNumber() );
+        m_pixmapRequestsQueue.enqueue( request, request->pageNumber() - (*m_viewportIterator).pageNumber );
+        m_pixmapRequestsMutex.unlock();
+        sendGeneratorPixmapRequest();
+        return;
+    }
+
+    kDebug(OkularDebug).nospace() << "Loaded cached pixmap observer=" << request->observer() << " page=" << request->pageNumber();
+
+    // the cached image is already rotated
+    request->page()->d->setRotatedImage( request->observer(), image );
+    if ( !request->page()->isBoundingBoxKnown() && request->page()->rotation() == Rotation0 )
+        setPageBoundingBox( request->pageNumber(), Utils::imageBoundingBox( &image ) );
+    requestDone( request );
+}
+
+void DocumentPrivate::storePixmapInDiskCache( Page *page, DocumentObserver *observer )
+{
+    QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator it = page->d->m_pixmaps.constFind( observer );
+    // no pixmap, or it has not been rotated yet
+    if ( it == page->d->m_pixmaps.constEnd() || it.value().m_rotation != page->rotation() )
+        return;
+
+    const QSize size = it.value().size();
+    const QString key = pixmapDiskCacheKey( page, size.width(), size.height() );
+    if ( key.isEmpty() || PixmapDiskCache::self()->contains( key ) )
+        return;
+
+    PixmapDiskCache::self()->setMaximumSize( (qint64)SettingsCore::pixmapDiskCacheSize() * 1024 * 1024 );
+
+    PixmapDiskCacheJob *job = new PixmapDiskCacheJob( key, it.value().toImage() );
+    QObject::connect( job, SIGNAL(done(ThreadWeaver::Job*)), job, SLOT(deleteLater()) );
+    ThreadWeaver::Weaver::instance()->enqueue( job );
+}
+
+bool DocumentPrivate::isPreviewExecuting( PixmapRequest *request ) const
+{
+    QLinkedList< PixmapRequest * >::const_iterator eIt = m_executingPixmapRequests.constBegin(), eEnd = m_executingPixmapRequests.constEnd();
+    for ( ; eIt != eEnd; ++eIt )
+    {
+        const PixmapRequest *executing = *eIt;
+        if ( executing->d->mPreview && executing->observer() == request->observer() && executing->pageNumber() == request->pageNumber() )
+            return true;
+    }
+    return false;
+}
+
+void DocumentPrivate::abortStalePixmapRequests( DocumentObserver *observer, const QLinkedList< PixmapRequest * > &requests )
+{
+    QLinkedList< PixmapRequest * >::const_iterator eIt = m_executingPixmapRequests.constBegin(), eEnd = m_executingPixmapRequests.constEnd();
+    for ( ; eIt != eEnd; ++eIt )
+    {
+        PixmapRequest *executing = *eIt;
+        if ( executing->observer() != observer || executing->shouldAbortRender() )
+            continue;
+
+        // executing requests have their size swapped on rotated documents
+        const bool swapped = (int)m_rotation % 2;
+        const int width = swapped ? executing->height() : executing->width();
+        const int height = swapped ? executing->width() : executing->height();
+
+        // a preview is still useful as long as its page is requested
+        bool stale = true;
+        QLinkedList< PixmapRequest * >::const_iterator rIt = requests.constBegin(), rEnd = requests.constEnd();
+        for ( ; rIt != rEnd && stale; ++rIt )
+        {
+            const PixmapRequest *request = *rIt;
+            if ( request->pageNumber() == executing->pageNumber()
+                 && ( executing->d->mPreview || ( request->width() == width && request->height() == height ) ) )
+                stale = false;
+        }
+
+        if ( stale )
+        {
+            kDebug(OkularDebug).nospace() << "Aborting request observer=" << observer << " page=" << executing->pageNumber();
+            executing->d->mShouldAbortRender = 1;
+            if ( TilesManager *tm = executing->d->tilesManager() )
+                tm->abortRequest( TilesManager::toRotatedRect( executing->normalizedRect(), m_rotation ) );
+        }
+    }
+}
+
+PixmapRequest *DocumentPrivate::progressivePreviewRequest( PixmapRequest *request )
+{
+    if ( !( request->d->mFeatures & PixmapRequest::Progressive ) || !request->asynchronous() || request->preload()
+         || request->isTile() || request->d->tilesManager() )
+        return 0;
+
+    // the page is not blank: the nearest pixmap will be shown meanwhile
+    Page *page = request->page();
+    if ( page->_o_nearestPixmap( request->observer(), request->width(), request->height() )
+         || page->_o_nearestImage( request->observer(), request->width(), request->height() ) )
+        return 0;
+
+    // it is quicker to get the full pixmap from the disk cache
+    const QString key = pixmapDiskCacheKey( page, request->width(), request->height() );
+    if ( !key.isEmpty() && PixmapDiskCache::self()->contains( key ) )
+        return 0;
+
+    // a quarter of the resolution is a sixteenth of the pixels, and it is
+    // still within the rescale range of the page painter
+    const int width = request->width() / 4;
+    const int height = request->height() / 4;
+    if ( width < 1 || height < 1 )
+        return 0;
+
+    PixmapRequest::PixmapRequestFeatures features = PixmapRequest::Asynchronous;
+    PixmapRequest *preview = new PixmapRequest( request->observer(), request->pageNumber(), width, height, request->priority(), features );
+    preview->d->mPage = page;
+    preview->d->mPreview = true;
+    preview->setNormalizedRect( request->normalizedRect() );
+    request->d->mPriority++;
+    return preview;
+}
+
 void DocumentPrivate::rotationFinished( int page, Okular::Page *okularPage )
 {
     Okular::Page *wantedPage = m_pagesVector.value( page, 0 );
     if ( !wantedPage || wantedPage != okularPage )
         return;
 
+    updateAllocatedPixmapsMemory( page );
+
     foreach(DocumentObserver *o, m_observers)
+    {
+        storePixmapInDiskCache( wantedPage, o );
         o->notifyPageChanged( page, DocumentObserver::Pixmap | DocumentObserver::Annotations );
+    }
 }
 
 void DocumentPrivate::fontReadingProgress( int page )
@@ -1525,6 +2158,12 @@ void DocumentPrivate::fontReadingProgress( int page )
     }
 }
 
+void DocumentPrivate::textExtractionProgress( int done, int total )
+{
+    resumeSearchesWaitingForText( false );
+    emit m_parent->textExtractionProgress( done, total );
+}
+
 void DocumentPrivate::fontReadingGotFont( const Okular::FontInfo& font )
 {
     // TODO try to avoid duplicate fonts
@@ -1560,8 +2199,7 @@ void DocumentPrivate::slotGeneratorConfigChanged( const QString& )
         }
 
         // [MEM] remove allocation descriptors
-        qDeleteAll( m_allocatedPixmaps );
-        m_allocatedPixmaps.clear();
+        qDeleteAll( m_allocatedPixmaps.takeAll() );
         m_allocatedPixmapsTotalMemory = 0;
 
         // send reload signals to observers
@@ -1584,7 +2222,7 @@ void DocumentPrivate::refreshPixmaps( int pageNumber )
     QMap< DocumentObserver*, PagePrivate::PixmapObject >::ConstIterator it = page->d->m_pixmaps.constBegin(), itEnd = page->d->m_pixmaps.constEnd();
     for ( ; it != itEnd; ++it )
     {
-        QSize size = (*it).m_pixmap->size();
+        QSize size = (*it).size();
         PixmapRequest * p = new PixmapRequest( it.key(), pageNumber, size.width(), size.height(), 1, PixmapRequest::Asynchronous );
         p->d->mForce = true;
         requestedPixmaps.push_back( p );
@@ -1635,10 +2273,12 @@ void DocumentPrivate::_o_configChanged()
 {
     // free text pages if needed
     calculateMaxTextPages();
-    while (m_allocatedTextPagesFifo.count() > m_maxAllocatedTextPages)
+    while (m_allocatedTextPages.count() > m_maxAllocatedTextPages)
     {
-        int pageToKick = m_allocatedTextPagesFifo.takeFirst();
-        m_pagesVector.at(pageToKick)->setTextPage( 0 ); // deletes the textpage
+        const int pageToKick = farthestUnloadableTextPage();
+        if (pageToKick == -1)
+            break;
+        unloadTextPage( pageToKick );
     }
 }
 
@@ -1646,6 +2286,7 @@ void DocumentPrivate::doContinueDirectionMatchSearch(void *doContinueDirectionMa
 {
     DoContinueDirectionMatchSearchStruct *searchStruct = static_cast<DoContinueDirectionMatchSearchStruct *>(doContinueDirectionMatchSearchStruct);
     RunningSearch *search = m_searches.value(searchStruct->searchID);
+    TraceScope traceScope( "Search", searchStruct->currentPage );
 
     if ((m_searchCancelled && !searchStruct->match) || !search)
     {
@@ -1682,23 +2323,40 @@ void DocumentPrivate::doContinueDirectionMatchSearch(void *doContinueDirectionMa
 
     if (doContinue)
     {
-        // get page
-        Page * page = m_pagesVector[ searchStruct->currentPage ];
-        // request search page if needed
-        if ( !page->hasTextPage() )
-            m_parent->requestTextPage( page->number() );
-
-        // if found a match on the current page, end the loop
-        searchStruct->match = page->findText( searchStruct->searchID, search->cachedString, forward ? FromTop : FromBottom, search->cachedCaseSensitivity );
-        if ( !searchStruct->match )
+        // skip at once the pages the text index rules out: they need
+        // neither their text nor a search
+        const int pageCount = m_pagesVector.count();
+        while ( search->pagesDone < pageCount && searchStruct->currentPage >= 0 && searchStruct->currentPage < pageCount
+                && !searchMayMatch( search, searchStruct->currentPage ) )
         {
             if (forward) searchStruct->currentPage++;
             else searchStruct->currentPage--;
             search->pagesDone++;
         }
-        else
+
+        if ( search->pagesDone < pageCount && searchStruct->currentPage >= 0 && searchStruct->currentPage < pageCount )
         {
-            search->pagesDone = 1;
+            // get page
+            Page * page = m_pagesVector[ searchStruct->currentPage ];
+            // request search page if needed, and the next ones meanwhile
+            if ( !page->hasTextPage() )
+            {
+                prefetchSearchTextPages( search, searchStruct->currentPage, forward );
+                m_parent->requestTextPage( page->number() );
+            }
+
+            // if found a match on the current page, end the loop
+            searchStruct->match = page->findText( searchStruct->searchID, search->cachedString, forward ? FromTop : FromBottom, search->cachedCaseSensitivity );
+            if ( !searchStruct->match )
+            {
+                if (forward) searchStruct->currentPage++;
+                else searchStruct->currentPage--;
+                search->pagesDone++;
+            }
+            else
+            {
+                search->pagesDone = 1;
+            }
         }
 
         // Both of the previous if branches need to call doContinueDirectionMatchSearch
@@ -1711,6 +2369,30 @@ void DocumentPrivate::doContinueDirectionMatchSearch(void *doContinueDirectionMa
     }
 }
 
+void DocumentPrivate::prefetchSearchTextPages( RunningSearch *search, int page, bool forward )
+{
+    if ( !m_generator->hasFeature( Generator::Threaded ) || !m_generator->hasFeature( Generator::ReentrantTextExtraction ) )
+        return;
+
+    // a few pages per thread, but not so many that the text pages cache
+    // drops them before the search gets there
+    const int count = qBound( 1, 2 * QThread::idealThreadCount(), qMax( 1, m_maxAllocatedTextPages / 2 ) );
+    QList< Page * > pages;
+    for ( int i = 0; i < count; ++i )
+    {
+        const int p = forward ? page + i : page - i;
+        if ( p < 0 || p >= m_pagesVector.count() )
+            break;
+        if ( searchMayMatch( search, p ) && !m_pagesVector.at( p )->hasTextPage() )
+            pages.append( m_pagesVector.at( p ) );
+    }
+
+    // the text pages cache must not drop them before the search gets there
+    search->prefetchFirstPage = qMax( 0, forward ? page : page - count + 1 );
+    search->prefetchLastPage = qMin( m_pagesVector.count() - 1, forward ? page + count - 1 : page );
+    m_generator->d_func()->extractTextPages( pages );
+}
+
 void DocumentPrivate::doProcessSearchMatch( RegularAreaRect *match, RunningSearch *search, QSet< int > *pagesToNotify, int currentPage, int searchID, bool moveViewport, const QColor & color )
 {
     // reset cursor to previous shape
@@ -1765,55 +2447,96 @@ void DocumentPrivate::doProcessSearchMatch( RegularAreaRect *match, RunningSearc
     delete pagesToNotify;
 }
 
-void DocumentPrivate::doContinueAllDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID)
+void DocumentPrivate::doContinueAllDocumentSearch(void *pagesToNotifySet, int currentPage, int searchID)
 {
-    QMap< Page *, QVector<RegularAreaRect *> > *pageMatches = static_cast< QMap< Page *, QVector<RegularAreaRect *> > * >(pageMatchesMap);
     QSet< int > *pagesToNotify = static_cast< QSet< int > * >( pagesToNotifySet );
     RunningSearch *search = m_searches.value(searchID);
+    TraceScope traceScope( "Search", currentPage );
 
     if (m_searchCancelled || !search)
     {
-        typedef QVector<RegularAreaRect *> MatchesVector;
-
         QApplication::restoreOverrideCursor();
 
         if (search) search->isCurrentlySearching = false;
 
+        // the matches found so far stay highlighted
+        notifySearchHighlights( pagesToNotify );
         emit m_parent->searchFinished( searchID, Document::SearchCancelled );
-        foreach(const MatchesVector &mv, *pageMatches) qDeleteAll(mv);
-        delete pageMatches;
         delete pagesToNotify;
         return;
     }
 
-    if (currentPage < m_pagesVector.count())
+    // search the pages for a while, then let the event loop run
+    const bool hadMatches = !search->highlightedPages.isEmpty();
+    const int firstPage = currentPage;
+    bool waiting = false;
+    QElapsedTimer slice;
+    slice.start();
+    while ( currentPage < m_pagesVector.count() && slice.elapsed() < OKULAR_SEARCH_SLICE )
     {
+        // skip the pages the text index rules out
+        if ( !searchMayMatch( search, currentPage ) )
+        {
+            ++currentPage;
+            continue;
+        }
+
         // get page (from the first to the last)
         Page *page = m_pagesVector.at(currentPage);
         int pageNumber = page->number(); // redundant? is it == currentPage ?
 
-        // request search page if needed
+        // request search page if needed, and the next ones meanwhile; the
+        // text is not extracted here if the generator threads can do it,
+        // and at most once a slice otherwise
         if ( !page->hasTextPage() )
+        {
+            if ( waitForSearchText( search, currentPage, pagesToNotify, QStringList() ) )
+            {
+                waiting = true;
+                break;
+            }
+            if ( currentPage != firstPage )
+                break;
             m_parent->requestTextPage( pageNumber );
+        }
 
         // loop on a page adding highlights for all found items
         RegularAreaRect * lastMatch = 0;
         while ( 1 )
         {
+            RegularAreaRect * match;
             if ( lastMatch )
-                lastMatch = page->findText( searchID, search->cachedString, NextResult, search->cachedCaseSensitivity, lastMatch );
+                match = page->findText( searchID, search->cachedString, NextResult, search->cachedCaseSensitivity, lastMatch );
             else
-                lastMatch = page->findText( searchID, search->cachedString, FromTop, search->cachedCaseSensitivity );
+                match = page->findText( searchID, search->cachedString, FromTop, search->cachedCaseSensitivity );
+            delete lastMatch;
+            lastMatch = match;
 
             if ( !lastMatch )
                 break;
 
-            // add highligh rect to the matches map
-            (*pageMatches)[page].append(lastMatch);
+            // highlight it right away, the highlight has its own copy
+            page->d->setHighlight( searchID, lastMatch, search->cachedColor );
+            search->highlightedPages.insert( pageNumber );
+            pagesToNotify->insert( pageNumber );
+        }
+
+        ++currentPage;
+    }
+
+    if (currentPage < m_pagesVector.count())
+    {
+        // show the first match at once, the next ones from time to time
+        if ( !hadMatches && !search->highlightedPages.isEmpty() )
+            search->notificationTimer.invalidate();
+        if ( !search->notificationTimer.isValid() || search->notificationTimer.elapsed() >= OKULAR_SEARCH_NOTIFY_INTERVAL )
+        {
+            notifySearchHighlights( pagesToNotify );
+            search->notificationTimer.start();
         }
-        delete lastMatch;
 
-        QMetaObject::invokeMethod(m_parent, "doContinueAllDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotifySet), Q_ARG(void *, pageMatches), Q_ARG(int, currentPage + 1), Q_ARG(int, searchID));
+        if ( !waiting )
+            QMetaObject::invokeMethod(m_parent, "doContinueAllDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotifySet), Q_ARG(int, currentPage), Q_ARG(int, searchID));
     }
     else
     {
@@ -1821,59 +2544,37 @@ void DocumentPrivate::doContinueAllDocumentSearch(void *pagesToNotifySet, void *
         QApplication::restoreOverrideCursor();
 
         search->isCurrentlySearching = false;
-        bool foundAMatch = pageMatches->count() != 0;
-        QMap< Page *, QVector<RegularAreaRect *> >::const_iterator it, itEnd;
-        it = pageMatches->constBegin();
-        itEnd = pageMatches->constEnd();
-        for ( ; it != itEnd; ++it)
-        {
-            foreach(RegularAreaRect *match, it.value())
-            {
-                it.key()->d->setHighlight( searchID, match, search->cachedColor );
-                delete match;
-            }
-            search->highlightedPages.insert( it.key()->number() );
-            pagesToNotify->insert( it.key()->number() );
-        }
+        bool foundAMatch = !search->highlightedPages.isEmpty();
 
         foreach(DocumentObserver *observer, m_observers)
             observer->notifySetup( m_pagesVector, 0 );
 
         // notify observers about highlights changes
-        foreach(int pageNumber, *pagesToNotify)
-            foreach(DocumentObserver *observer, m_observers)
-                observer->notifyPageChanged( pageNumber, DocumentObserver::Highlights );
+        notifySearchHighlights( pagesToNotify );
 
         if (foundAMatch) emit m_parent->searchFinished(searchID, Document::MatchFound );
         else emit m_parent->searchFinished( searchID, Document::NoMatchFound );
 
-        delete pageMatches;
         delete pagesToNotify;
     }
 }
 
-void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID, const QStringList & words)
+void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, int currentPage, int searchID, const QStringList & words)
 {
     typedef QPair<RegularAreaRect *, QColor> MatchColor;
-    QMap< Page *, QVector<MatchColor> > *pageMatches = static_cast< QMap< Page *, QVector<MatchColor> > * >(pageMatchesMap);
     QSet< int > *pagesToNotify = static_cast< QSet< int > * >( pagesToNotifySet );
     RunningSearch *search = m_searches.value(searchID);
+    TraceScope traceScope( "Search", currentPage );
 
     if (m_searchCancelled || !search)
     {
-        typedef QVector<MatchColor> MatchesVector;
-
         QApplication::restoreOverrideCursor();
 
         if (search) search->isCurrentlySearching = false;
 
+        // the matches found so far stay highlighted
+        notifySearchHighlights( pagesToNotify );
         emit m_parent->searchFinished( searchID, Document::SearchCancelled );
-
-        foreach(const MatchesVector &mv, *pageMatches)
-        {
-            foreach(const MatchColor &mc, mv) delete mc.first;
-        }
-        delete pageMatches;
         delete pagesToNotify;
         return;
     }
@@ -1883,17 +2584,42 @@ void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, vo
     int baseHue, baseSat, baseVal;
     search->cachedColor.getHsv( &baseHue, &baseSat, &baseVal );
 
-    if (currentPage < m_pagesVector.count())
+    // search the pages for a while, then let the event loop run
+    const bool hadMatches = !search->highlightedPages.isEmpty();
+    const int firstPage = currentPage;
+    bool waiting = false;
+    QElapsedTimer slice;
+    slice.start();
+    while ( currentPage < m_pagesVector.count() && slice.elapsed() < OKULAR_SEARCH_SLICE )
     {
+        // skip the pages the text index rules out
+        if ( !searchMayMatch( search, currentPage ) )
+        {
+            ++currentPage;
+            continue;
+        }
+
         // get page (from the first to the last)
         Page *page = m_pagesVector.at(currentPage);
         int pageNumber = page->number(); // redundant? is it == currentPage ?
 
-        // request search page if needed
+        // request search page if needed, and the next ones meanwhile; the
+        // text is not extracted here if the generator threads can do it,
+        // and at most once a slice otherwise
         if ( !page->hasTextPage() )
+        {
+            if ( waitForSearchText( search, currentPage, pagesToNotify, words ) )
+            {
+                waiting = true;
+                break;
+            }
+            if ( currentPage != firstPage )
+                break;
             m_parent->requestTextPage( pageNumber );
+        }
 
-        // loop on a page adding highlights for all found items
+        // loop on a page collecting the matches of all the words
+        QVector<MatchColor> pageMatches;
         bool allMatched = wordCount > 0,
              anyMatched = false;
         for ( int w = 0; w < wordCount; w++ )
@@ -1916,24 +2642,41 @@ void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, vo
                 if ( !lastMatch )
                     break;
 
-                // add highligh rect to the matches map
-                (*pageMatches)[page].append(MatchColor(lastMatch, wordColor));
+                // add highligh rect to the matches of the page
+                pageMatches.append(MatchColor(lastMatch, wordColor));
                 wordMatched = true;
             }
             allMatched = allMatched && wordMatched;
             anyMatched = anyMatched || wordMatched;
         }
 
-        // if not all words are present in page, remove partial highlights
+        // highlight the page only if all words are present in it, if needed
         const bool matchAll = search->cachedType == Document::GoogleAll;
-        if ( !allMatched && matchAll )
+        if ( allMatched || ( anyMatched && !matchAll ) )
+        {
+            foreach(const MatchColor &mc, pageMatches)
+                page->d->setHighlight( searchID, mc.first, mc.second );
+            search->highlightedPages.insert( pageNumber );
+            pagesToNotify->insert( pageNumber );
+        }
+        foreach(const MatchColor &mc, pageMatches) delete mc.first;
+
+        ++currentPage;
+    }
+
+    if (currentPage < m_pagesVector.count())
+    {
+        // show the first match at once, the next ones from time to time
+        if ( !hadMatches && !search->highlightedPages.isEmpty() )
+            search->notificationTimer.invalidate();
+        if ( !search->notificationTimer.isValid() || search->notificationTimer.elapsed() >= OKULAR_SEARCH_NOTIFY_INTERVAL )
         {
-            QVector<MatchColor> &matches = (*pageMatches)[page];
-            foreach(const MatchColor &mc, matches) delete mc.first;
-            pageMatches->remove(page);
+            notifySearchHighlights( pagesToNotify );
+            search->notificationTimer.start();
         }
 
-        QMetaObject::invokeMethod(m_parent, "doContinueGooglesDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotifySet), Q_ARG(void *, pageMatches), Q_ARG(int, currentPage + 1), Q_ARG(int, searchID), Q_ARG(QStringList, words));
+        if ( !waiting )
+            QMetaObject::invokeMethod(m_parent, "doContinueGooglesDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotifySet), Q_ARG(int, currentPage), Q_ARG(int, searchID), Q_ARG(QStringList, words));
     }
     else
     {
@@ -1941,38 +2684,69 @@ void DocumentPrivate::doContinueGooglesDocumentSearch(void *pagesToNotifySet, vo
         QApplication::restoreOverrideCursor();
 
         search->isCurrentlySearching = false;
-        bool foundAMatch = pageMatches->count() != 0;
-        QMap< Page *, QVector<MatchColor> >::const_iterator it, itEnd;
-        it = pageMatches->constBegin();
-        itEnd = pageMatches->constEnd();
-        for ( ; it != itEnd; ++it)
-        {
-            foreach(const MatchColor &mc, it.value())
-            {
-                it.key()->d->setHighlight( searchID, mc.first, mc.second );
-                delete mc.first;
-            }
-            search->highlightedPages.insert( it.key()->number() );
-            pagesToNotify->insert( it.key()->number() );
-        }
+        bool foundAMatch = !search->highlightedPages.isEmpty();
 
         // send page lists to update observers (since some filter on bookmarks)
         foreach(DocumentObserver *observer, m_observers)
             observer->notifySetup( m_pagesVector, 0 );
 
         // notify observers about highlights changes
-        foreach(int pageNumber, *pagesToNotify)
-            foreach(DocumentObserver *observer, m_observers)
-                observer->notifyPageChanged( pageNumber, DocumentObserver::Highlights );
+        notifySearchHighlights( pagesToNotify );
 
         if (foundAMatch) emit m_parent->searchFinished( searchID, Document::MatchFound );
         else emit m_parent->searchFinished( searchID, Document::NoMatchFound );
 
-        delete pageMatches;
         delete pagesToNotify;
     }
 }
 
+void DocumentPrivate::notifySearchHighlights( QSet< int > *pagesToNotify )
+{
+    foreach(int pageNumber, *pagesToNotify)
+        foreach(DocumentObserver *observer, m_observers)
+            observer->notifyPageChanged( pageNumber, DocumentObserver::Highlights );
+    pagesToNotify->clear();
+}
+
+bool DocumentPrivate::waitForSearchText( RunningSearch *search, int page, QSet< int > *pagesToNotify, const QStringList &words )
+{
+    if ( page == search->waitedTextPage )
+        return false;
+
+    prefetchSearchTextPages( search, page, true );
+    if ( !m_generator->hasFeature( Generator::Threaded ) || !m_generator->d_func()->isExtractingTextPage( m_pagesVector.at( page ) ) )
+        return false;
+
+    search->waitingTextPage = page;
+    search->waitedTextPage = page;
+    search->waitingPagesToNotify = pagesToNotify;
+    search->waitingWords = words;
+    return true;
+}
+
+void DocumentPrivate::resumeSearchesWaitingForText( bool all )
+{
+    QMap< int, RunningSearch * >::const_iterator it = m_searches.constBegin(), itEnd = m_searches.constEnd();
+    for ( ; it != itEnd; ++it )
+    {
+        RunningSearch *search = it.value();
+        const int page = search->waitingTextPage;
+        if ( page == -1 )
+            continue;
+
+        if ( !all && !m_pagesVector.at( page )->hasTextPage() && m_generator->d_func()->isExtractingTextPage( m_pagesVector.at( page ) ) )
+            continue;
+
+        search->waitingTextPage = -1;
+        if ( search->cachedType == Document::AllDocument )
+            QMetaObject::invokeMethod(m_parent, "doContinueAllDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, search->waitingPagesToNotify), Q_ARG(int, page), Q_ARG(int, it.key()));
+        else
+            QMetaObject::invokeMethod(m_parent, "doContinueGooglesDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, search->waitingPagesToNotify), Q_ARG(int, page), Q_ARG(int, it.key()), Q_ARG(QStringList, search->waitingWords));
+        search->waitingPagesToNotify = 0;
+        search->waitingWords.clear();
+    }
+}
+
 QVariant DocumentPrivate::documentMetaData( const QString &key, const QVariant &option ) const
 {
     if ( key == QLatin1String( "PaperColor" ) )
@@ -2449,6 +3223,12 @@ Document::OpenResult Document::openDocument( const QString & docFile, const KUrl
         connect( d->m_memCheckTimer, SIGNAL(timeout()), this, SLOT(slotTimedMemoryCheck()) );
     }
     d->m_memCheckTimer->start( 2000 );
+    d->startMemoryPressureMonitor();
+
+    if ( !d->m_xmlFileName.isEmpty() )
+        d->m_docDataSideFileId = d->docDataSideFileId();
+    d->loadTextLayouts();
+    d->startTextIndexing();
 
     const DocumentViewport nextViewport = d->nextDocumentViewport();
     if ( nextViewport.isValid() )
@@ -2500,11 +3280,7 @@ void Document::closeDocument()
 
      // remove requests left in queue
     d->m_pixmapRequestsMutex.lock();
-    QLinkedList< PixmapRequest * >::const_iterator sIt = d->m_pixmapRequestsStack.constBegin();
-    QLinkedList< PixmapRequest * >::const_iterator sEnd = d->m_pixmapRequestsStack.constEnd();
-    for ( ; sIt != sEnd; ++sIt )
-        delete *sIt;
-    d->m_pixmapRequestsStack.clear();
+    deleteQueuedPixmapRequests( d->m_pixmapRequestsQueue.takeAll() );
     d->m_pixmapRequestsMutex.unlock();
 
     QEventLoop loop;
@@ -2534,6 +3310,10 @@ void Document::closeDocument()
     // stop any audio playback
     AudioPlayer::instance()->stopPlaybacks();
 
+    d->stopTextIndexing();
+    d->saveTextLayouts();
+    d->m_docDataSideFileId.clear();
+
     // close the current document and save document info if a document is still opened
     if ( d->m_generator && d->m_pagesVector.size() > 0 )
     {
@@ -2550,6 +3330,7 @@ void Document::closeDocument()
     // stop timers
     if ( d->m_memCheckTimer )
         d->m_memCheckTimer->stop();
+    d->stopMemoryPressureMonitor();
     if ( d->m_saveBookmarksTimer )
         d->m_saveBookmarksTimer->stop();
 
@@ -2594,10 +3375,11 @@ void Document::closeDocument()
     d->m_pagesVector.clear();
 
     // clear 'memory allocation' descriptors
-    qDeleteAll( d->m_allocatedPixmaps );
-    d->m_allocatedPixmaps.clear();
+    qDeleteAll( d->m_allocatedPixmaps.takeAll() );
 
-    // clear 'running searches' descriptors
+    // clear 'running searches' descriptors; the ones waiting for a text
+    // finish as cancelled
+    d->resumeSearchesWaitingForText( true );
     QMap< int, RunningSearch * >::const_iterator rIt = d->m_searches.constBegin();
     QMap< int, RunningSearch * >::const_iterator rEnd = d->m_searches.constEnd();
     for ( ; rIt != rEnd; ++rIt )
@@ -2618,7 +3400,9 @@ void Document::closeDocument()
     d->m_viewportHistory.append( DocumentViewport() );
     d->m_viewportIterator = d->m_viewportHistory.begin();
     d->m_allocatedPixmapsTotalMemory = 0;
-    d->m_allocatedTextPagesFifo.clear();
+    d->m_allocatedTextPages.clear();
+    d->m_allocatedTextPagesTotalMemory = 0;
+    d->m_requestedTextPages.clear();
     d->m_pageSize = PageSize();
     d->m_pageSizes.clear();
 
@@ -2654,18 +3438,12 @@ void Document::removeObserver( DocumentObserver * pObserver )
             (*it)->deletePixmap( pObserver );
 
         // [MEM] free observer's allocation descriptors
-        QLinkedList< AllocatedPixmap * >::iterator aIt = d->m_allocatedPixmaps.begin();
-        QLinkedList< AllocatedPixmap * >::iterator aEnd = d->m_allocatedPixmaps.end();
-        while ( aIt != aEnd )
+        foreach ( AllocatedPixmap * p, d->m_allocatedPixmaps.takeAll( pObserver ) )
         {
-            AllocatedPixmap * p = *aIt;
-            if ( p->observer == pObserver )
-            {
-                aIt = d->m_allocatedPixmaps.erase( aIt );
-                delete p;
-            }
-            else
-                ++aIt;
+            d->m_allocatedPixmapsTotalMemory -= p->memory;
+            // the buffer may still be used by another observer
+            d->updateAllocatedPixmapsMemory( p->page );
+            delete p;
         }
 
         // delete observer entry from the map
@@ -2692,8 +3470,7 @@ void Document::reparseConfig()
         }
 
         // [MEM] remove allocation descriptors
-        qDeleteAll( d->m_allocatedPixmaps );
-        d->m_allocatedPixmaps.clear();
+        qDeleteAll( d->m_allocatedPixmaps.takeAll() );
         d->m_allocatedPixmapsTotalMemory = 0;
 
         // send reload signals to observers
@@ -3091,20 +3868,22 @@ void Document::requestPixmaps( const QLinkedList< PixmapRequest * > & requests,
     }
     const bool removeAllPrevious = reqOptions & RemoveAllPrevious;
     d->m_pixmapRequestsMutex.lock();
-    QLinkedList< PixmapRequest * >::iterator sIt = d->m_pixmapRequestsStack.begin(), sEnd = d->m_pixmapRequestsStack.end();
-    while ( sIt != sEnd )
+    if ( removeAllPrevious )
     {
-        if ( (*sIt)->observer() == requesterObserver
-             && ( removeAllPrevious || requestedPages.contains( (*sIt)->pageNumber() ) ) )
-        {
-            // delete request and remove it from stack
-            delete *sIt;
-            sIt = d->m_pixmapRequestsStack.erase( sIt );
-        }
-        else
-            ++sIt;
+        deleteQueuedPixmapRequests( d->m_pixmapRequestsQueue.takeRequests( requesterObserver ) );
+        // stop rendering what the observer does not ask for anymore
+        d->abortStalePixmapRequests( requesterObserver, requests );
+    }
+    else
+    {
+        foreach ( int pageNumber, requestedPages )
+            deleteQueuedPixmapRequests( d->m_pixmapRequestsQueue.takeRequests( requesterObserver, pageNumber ) );
     }
 
+    // requests nearer to the current viewport come first among the ones
+    // with the same priority
+    const int currentViewportPage = (*d->m_viewportIterator).pageNumber;
+
     // 2. [ADD TO STACK] add requests to stack
     QLinkedList< PixmapRequest * >::const_iterator rIt = requests.constBegin(), rEnd = requests.constEnd();
     for ( ; rIt != rEnd; ++rIt )
@@ -3121,45 +3900,46 @@ void Document::requestPixmaps( const QLinkedList< PixmapRequest * > & requests,
 
         request->d->mPage = d->m_pagesVector.value( request->pageNumber() );
 
+        if ( !request->asynchronous() )
+            request->d->mPriority = 0;
+
+        QList< PixmapRequest * > tileRequests;
         if ( request->isTile() )
         {
             // Change the current request rect so that only invalid tiles are
             // requested. Also make sure the rect is tile-aligned.
-            NormalizedRect tilesRect;
+            QList< NormalizedRect > tilesRects;
             const QList<Tile> tiles = request->d->tilesManager()->tilesAt( request->normalizedRect(), TilesManager::TerminalTile );
             QList<Tile>::const_iterator tIt = tiles.constBegin(), tEnd = tiles.constEnd();
             while ( tIt != tEnd )
             {
                 const Tile &tile = *tIt;
                 if ( !tile.isValid() )
-                {
-                    if ( tilesRect.isNull() )
-                        tilesRect = tile.rect();
-                    else
-                        tilesRect |= tile.rect();
-                }
+                    tilesRects.append( tile.rect() );
 
                 tIt++;
             }
 
-            request->setNormalizedRect( tilesRect );
+            tileRequests = d->splitTileRequest( request, tilesRects );
         }
 
-        if ( !request->asynchronous() )
-            request->d->mPriority = 0;
+        // progressive requests for blank pages get a quick low resolution
+        // preview first. Stale previews are dropped along with their request
+        // when the observer asks for other pages
+        if ( PixmapRequest *preview = d->progressivePreviewRequest( request ) )
+        {
+            Trace::begin( "Queued", preview, preview->pageNumber() );
+            d->m_pixmapRequestsQueue.enqueue( preview, preview->pageNumber() - currentViewportPage );
+        }
 
-        // add request to the 'stack' at the right place
-        if ( !request->priority() )
-            // add priority zero requests to the top of the stack
-            d->m_pixmapRequestsStack.append( request );
-        else
+        // add request to the queue, sorted by priority
+        Trace::begin( "Queued", request, request->pageNumber() );
+        d->m_pixmapRequestsQueue.enqueue( request, request->pageNumber() - currentViewportPage );
+
+        foreach ( PixmapRequest *tileRequest, tileRequests )
         {
-            // insert in stack sorted by priority
-            sIt = d->m_pixmapRequestsStack.begin();
-            sEnd = d->m_pixmapRequestsStack.end();
-            while ( sIt != sEnd && (*sIt)->priority() > request->priority() )
-                ++sIt;
-            d->m_pixmapRequestsStack.insert( sIt, request );
+            Trace::begin( "Queued", tileRequest, tileRequest->pageNumber() );
+            d->m_pixmapRequestsQueue.enqueue( tileRequest, tileRequest->pageNumber() - currentViewportPage );
         }
     }
     d->m_pixmapRequestsMutex.unlock();
@@ -3180,9 +3960,61 @@ void Document::requestTextPage( uint page )
 
     // Memory management for TextPages
 
+    // the text is needed now: keep it even if it was being extracted for the text index
+    if ( (int)page == d->m_textIndexingPage )
+        d->m_textIndexingPage = -1;
+
+    // its text may be on the way already
+    if ( d->m_generator->hasFeature( Generator::Threaded ) && d->m_generator->d_func()->waitForTextPage( kp ) )
+        return;
+
     d->m_generator->generateTextPage( kp );
 }
 
+void Document::requestTextPages( const QList< int > &pages )
+{
+    if ( !d->m_generator || !d->m_generator->hasFeature( Generator::TextExtraction ) )
+        return;
+
+    // only as many pages as the text pages cache keeps along with the ones
+    // in use, or the first ones would be dropped before they are used
+    const int count = qMin( pages.count(), qMax( 1, d->m_maxAllocatedTextPages / 2 ) );
+    d->m_requestedTextPages.clear();
+    QList< Page * > textPages;
+    for ( int i = 0; i < count; ++i )
+    {
+        Page *page = d->m_pagesVector.value( pages.at( i ) );
+        if ( !page )
+            continue;
+        d->m_requestedTextPages.insert( pages.at( i ) );
+        if ( !page->hasTextPage() )
+            textPages.append( page );
+    }
+
+    if ( d->m_generator->hasFeature( Generator::Threaded ) )
+    {
+        d->m_generator->d_func()->extractTextPages( textPages );
+        return;
+    }
+
+    // one page after the other, in the GUI thread
+    for ( int i = 0; i < textPages.count(); ++i )
+    {
+        d->m_generator->generateTextPage( textPages.at( i ) );
+        emit textExtractionProgress( i + 1, textPages.count() );
+    }
+}
+
+void Document::setExtractTextOfRenderedPages( bool extract )
+{
+    d->m_extractTextOfRenderedPages = extract;
+}
+
+qulonglong Document::pixmapsMemory() const
+{
+    return d->m_allocatedPixmapsTotalMemory;
+}
+
 void DocumentPrivate::notifyAnnotationChanges( int page )
 {
     int flags = DocumentObserver::Annotations;
@@ -3529,10 +4361,18 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
     {
         RunningSearch * search = new RunningSearch();
         search->continueOnPage = -1;
+        search->waitingTextPage = -1;
         searchIt = d->m_searches.insert( searchID, search );
     }
     RunningSearch * s = *searchIt;
 
+    // the previous search waiting for a text is replaced by this one
+    if ( s->waitingTextPage != -1 )
+    {
+        QApplication::restoreOverrideCursor();
+        delete s->waitingPagesToNotify;
+    }
+
     // update search structure
     bool newText = text != s->cachedString;
     s->cachedString = text;
@@ -3541,6 +4381,34 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
     s->cachedViewportMove = moveViewport;
     s->cachedColor = color;
     s->isCurrentlySearching = true;
+    s->notificationTimer.invalidate();
+    s->prefetchFirstPage = 0;
+    s->prefetchLastPage = -1;
+    s->waitingTextPage = -1;
+    s->waitingPagesToNotify = 0;
+    s->waitingWords.clear();
+    s->waitedTextPage = -1;
+
+    // the pages the text may be on, the others are not searched
+    s->candidatePages = QBitArray();
+    if ( d->m_textIndex.pageCount() == d->m_pagesVector.count() )
+    {
+        if ( type == GoogleAll || type == GoogleAny )
+        {
+            s->candidatePages = QBitArray( d->m_pagesVector.count(), type == GoogleAll );
+            foreach ( const QString &word, text.split( ' ', QString::SkipEmptyParts ) )
+            {
+                if ( type == GoogleAll )
+                    s->candidatePages &= d->m_textIndex.candidatePages( word );
+                else
+                    s->candidatePages |= d->m_textIndex.candidatePages( word );
+            }
+        }
+        else
+        {
+            s->candidatePages = d->m_textIndex.candidatePages( text );
+        }
+    }
 
     // global data for search
     QSet< int > *pagesToNotify = new QSet< int >;
@@ -3557,10 +4425,8 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
     // 1. ALLDOC - proces all document marking pages
     if ( type == AllDocument )
     {
-        QMap< Page *, QVector<RegularAreaRect *> > *pageMatches = new QMap< Page *, QVector<RegularAreaRect *> >;
-
         // search and highlight 'text' (as a solid phrase) on all pages
-        QMetaObject::invokeMethod(this, "doContinueAllDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotify), Q_ARG(void *, pageMatches), Q_ARG(int, 0), Q_ARG(int, searchID));
+        QMetaObject::invokeMethod(this, "doContinueAllDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotify), Q_ARG(int, 0), Q_ARG(int, searchID));
     }
     // 2. NEXTMATCH - find next matching item (or start from top)
     // 3. PREVMATCH - find previous matching item (or start from bottom)
@@ -3603,11 +4469,10 @@ void Document::searchText( int searchID, const QString & text, bool fromStart, Q
     // 4. GOOGLE* - process all document marking pages
     else if ( type == GoogleAll || type == GoogleAny )
     {
-        QMap< Page *, QVector< QPair<RegularAreaRect *, QColor> > > *pageMatches = new QMap< Page *, QVector<QPair<RegularAreaRect *, QColor> > >;
         const QStringList words = text.split( ' ', QString::SkipEmptyParts );
 
         // search and highlight every word in 'text' on all pages
-        QMetaObject::invokeMethod(this, "doContinueGooglesDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotify), Q_ARG(void *, pageMatches), Q_ARG(int, 0), Q_ARG(int, searchID), Q_ARG(QStringList, words));
+        QMetaObject::invokeMethod(this, "doContinueGooglesDocumentSearch", Qt::QueuedConnection, Q_ARG(void *, pagesToNotify), Q_ARG(int, 0), Q_ARG(int, searchID), Q_ARG(QStringList, words));
     }
 }
 
@@ -3669,6 +4534,10 @@ void Document::resetSearch( int searchID )
     // send the setup signal too (to update views that filter on matches)
     foreachObserver( notifySetup( d->m_pagesVector, 0 ) );
 
+    // a search waiting for a text goes on to find it is gone
+    if ( s->waitingTextPage != -1 )
+        d->resumeSearchesWaitingForText( true );
+
     // remove serch from the runningSearches list and delete it
     d->m_searches.erase( searchIt );
     delete s;
@@ -3677,6 +4546,9 @@ void Document::resetSearch( int searchID )
 void Document::cancelSearch()
 {
     d->m_searchCancelled = true;
+
+    // the searches waiting for a text see it at once
+    d->resumeSearchesWaitingForText( true );
 }
 
 void Document::undo()
@@ -4568,6 +5440,8 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
     if ( !req )
         return;
 
+    Trace::end( "Rendering", req );
+
     if ( !m_generator || m_closingLoop )
     {
         m_pixmapRequestsMutex.lock();
@@ -4580,22 +5454,34 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
     }
 
 #ifndef NDEBUG
-    if ( !m_generator->canGeneratePixmap() )
+    if ( !m_generator->hasFeature( Generator::ReentrantRendering ) && !m_generator->canGeneratePixmap() )
         kDebug(OkularDebug) << "requestDone with generator not in READY state.";
 #endif
 
+    // the pixmap of an aborted request was not set: just drop the request,
+    // so that its tiles can be requested again
+    if ( req->shouldAbortRender() )
+    {
+        if ( TilesManager *tm = req->d->tilesManager() )
+            tm->cancelRequest( TilesManager::toRotatedRect( req->normalizedRect(), m_rotation ) );
+
+        m_pixmapRequestsMutex.lock();
+        m_executingPixmapRequests.removeAll( req );
+        const bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
+        m_pixmapRequestsMutex.unlock();
+        delete req;
+
+        if ( hasPixmaps )
+            sendGeneratorPixmapRequest();
+        return;
+    }
+
     // [MEM] 1.1 find and remove a previous entry for the same page and id
-    QLinkedList< AllocatedPixmap * >::iterator aIt = m_allocatedPixmaps.begin();
-    QLinkedList< AllocatedPixmap * >::iterator aEnd = m_allocatedPixmaps.end();
-    for ( ; aIt != aEnd; ++aIt )
-        if ( (*aIt)->page == req->pageNumber() && (*aIt)->observer == req->observer() )
-        {
-            AllocatedPixmap * p = *aIt;
-            m_allocatedPixmaps.erase( aIt );
-            m_allocatedPixmapsTotalMemory -= p->memory;
-            delete p;
-            break;
-        }
+    if ( AllocatedPixmap * p = m_allocatedPixmaps.take( req->observer(), req->pageNumber() ) )
+    {
+        m_allocatedPixmapsTotalMemory -= p->memory;
+        delete p;
+    }
 
     DocumentObserver *observer = req->observer();
     if ( m_observers.contains(observer) )
@@ -4611,9 +5497,16 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
         AllocatedPixmap * memoryPage = new AllocatedPixmap( req->observer(), req->pageNumber(), memoryBytes );
         m_allocatedPixmaps.append( memoryPage );
         m_allocatedPixmapsTotalMemory += memoryBytes;
+        // do not count twice a buffer shared with other observers
+        updateAllocatedPixmapsMemory( req->pageNumber() );
+
+        if ( !tm && !req->d->mPreview )
+            storePixmapInDiskCache( req->page(), observer );
 
         // 2. notify an observer that its pixmap changed
         observer->notifyPageChanged( req->pageNumber(), DocumentObserver::Pixmap );
+        req->d->mDelivered = true;
+        Trace::end( "Request", req );
     }
 #ifndef NDEBUG
     else
@@ -4628,7 +5521,7 @@ void DocumentPrivate::requestDone( PixmapRequest * req )
 
     // 4. start a new generation if some is pending
     m_pixmapRequestsMutex.lock();
-    bool hasPixmaps = !m_pixmapRequestsStack.isEmpty();
+    bool hasPixmaps = !m_pixmapRequestsQueue.isEmpty();
     m_pixmapRequestsMutex.unlock();
     if ( hasPixmaps )
         sendGeneratorPixmapRequest();
@@ -4675,24 +5568,179 @@ void DocumentPrivate::calculateMaxTextPages()
             m_maxAllocatedTextPages = multipliers * 1250;
         break;
     }
+    m_textLayouts.setMaxMemory( (qulonglong)m_maxAllocatedTextPages * OKULAR_TEXTLAYOUT_MEMORY_PER_TEXTPAGE );
 }
 
-void DocumentPrivate::textGenerationDone( Page *page )
+QString DocumentPrivate::docDataSideFileName( const QString &extension ) const
 {
-    if ( !m_pageController ) return;
+    if ( m_xmlFileName.isEmpty() )
+        return QString();
+
+    QString fileName = m_xmlFileName;
+    if ( fileName.endsWith( ".xml" ) )
+        fileName.chop( 4 );
+    return fileName + extension;
+}
+
+QByteArray DocumentPrivate::docDataSideFileId() const
+{
+    QFile file( m_docFileName );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return QByteArray();
+
+    // hashing the whole of a big document would slow down its opening:
+    // its beginning and its end change with nearly any edit
+    static const qint64 HashedBytes = 64 * 1024;
+    const QFileInfo info( file );
+    QCryptographicHash hash( QCryptographicHash::Md5 );
+    hash.addData( QFile::encodeName( info.absoluteFilePath() ) );
+    hash.addData( QByteArray::number( info.size() ) );
+    hash.addData( QByteArray::number( (qint64)info.lastModified().toTime_t() ) );
+    hash.addData( file.read( HashedBytes ) );
+    if ( file.size() > HashedBytes )
+    {
+        file.seek( qMax( HashedBytes, file.size() - HashedBytes ) );
+        hash.addData( file.read( HashedBytes ) );
+    }
+    return hash.result();
+}
+
+void DocumentPrivate::startTextIndexing()
+{
+    m_textIndex.clear( m_pagesVector.count() );
+    m_textIndexingPage = -1;
+    if ( !SettingsCore::enableTextIndex() || !m_generator->hasFeature( Generator::TextExtraction ) )
+        return;
+
+    const QString fileName = docDataSideFileName( ".textindex" );
+    if ( !m_docDataSideFileId.isEmpty() && m_textIndex.load( fileName, m_pagesVector.count(), m_docDataSideFileId ) )
+        kDebug(OkularDebug) << "Loaded the text index from" << fileName;
+
+    // extracting the text in the GUI thread would not be in the background;
+    // then only the pages whose text is extracted anyway are indexed
+    if ( !m_generator->hasFeature( Generator::Threaded ) || m_textIndex.isComplete() )
+        return;
+
+    if ( !m_textIndexTimer )
+    {
+        m_textIndexTimer = new QTimer( m_parent );
+        m_textIndexTimer->setSingleShot( true );
+        QObject::connect( m_textIndexTimer, SIGNAL(timeout()), m_parent, SLOT(doContinueTextIndexing()) );
+    }
+    m_textIndexTimer->start( OKULAR_TEXTINDEX_IDLE_INTERVAL );
+}
+
+void DocumentPrivate::stopTextIndexing()
+{
+    if ( m_textIndexTimer )
+        m_textIndexTimer->stop();
+    m_textIndexingPage = -1;
+
+    const QString fileName = docDataSideFileName( ".textindex" );
+    if ( m_textIndex.isModified() && !m_docDataSideFileId.isEmpty() && !m_textIndex.save( fileName, m_docDataSideFileId ) )
+        kWarning(OkularDebug) << "Could not save the text index to" << fileName;
+    m_textIndex.clear();
+}
+
+void DocumentPrivate::loadTextLayouts()
+{
+    m_textLayouts.clear( m_pagesVector.count() );
+    if ( !m_generator->hasFeature( Generator::TextExtraction ) )
+        return;
+
+    const QString fileName = docDataSideFileName( ".textlayout" );
+    if ( !m_docDataSideFileId.isEmpty() && m_textLayouts.load( fileName, m_pagesVector.count(), m_docDataSideFileId ) )
+        kDebug(OkularDebug) << "Loaded the text layouts from" << fileName;
+}
+
+void DocumentPrivate::saveTextLayouts()
+{
+    const QString fileName = docDataSideFileName( ".textlayout" );
+    if ( m_textLayouts.isModified() && !m_docDataSideFileId.isEmpty() && !m_textLayouts.save( fileName, m_docDataSideFileId ) )
+        kWarning(OkularDebug) << "Could not save the text layouts to" << fileName;
+    m_textLayouts.clear();
+}
+
+void DocumentPrivate::doContinueTextIndexing()
+{
+    if ( !m_generator || m_textIndex.isComplete() || !SettingsCore::enableTextIndex() )
+        return;
 
-    // 1. If we reached the cache limit, delete the first text page from the fifo
-    if (m_allocatedTextPagesFifo.size() == m_maxAllocatedTextPages)
+    if ( m_textIndexingPage != -1 )
     {
-        int pageToKick = m_allocatedTextPagesFifo.takeFirst();
-        if (pageToKick != page->number()) // this should never happen but better be safe than sorry
+        // still extracting
+        if ( !m_generator->canGenerateTextPage() )
         {
-            m_pagesVector.at(pageToKick)->setTextPage( 0 ); // deletes the textpage
+            m_textIndexTimer->start( OKULAR_TEXTINDEX_IDLE_INTERVAL );
+            return;
         }
+
+        // the generator gave no text for the page
+        m_textIndex.addPage( m_textIndexingPage, QString() );
+        m_textIndexingPage = -1;
+    }
+
+    // near the current page first
+    const int pageNumber = m_textIndex.nextUnindexedPage( (*m_viewportIterator).pageNumber );
+    if ( pageNumber == -1 )
+        return;
+
+    Page *page = m_pagesVector.at( pageNumber );
+    if ( page->hasTextPage() )
+    {
+        m_textIndex.addPage( pageNumber, page->text() );
+        m_textIndexTimer->start( 0 );
+        return;
+    }
+
+    // the pixmaps come first
+    m_pixmapRequestsMutex.lock();
+    const bool busy = !m_pixmapRequestsQueue.isEmpty() || !m_executingPixmapRequests.isEmpty();
+    m_pixmapRequestsMutex.unlock();
+
+    if ( busy || !m_generator->d_func()->startTextPageGeneration( page, QThread::IdlePriority ) )
+    {
+        m_textIndexTimer->start( OKULAR_TEXTINDEX_IDLE_INTERVAL );
+        return;
+    }
+
+    // textGenerationDone() goes on, this is the watchdog in case no text comes
+    m_textIndexingPage = pageNumber;
+    m_textIndexTimer->start( OKULAR_TEXTINDEX_IDLE_INTERVAL );
+}
+
+void DocumentPrivate::textGenerationDone( Page *page )
+{
+    if ( !m_pageController ) return;
+
+    const int number = page->number();
+    if ( SettingsCore::enableTextIndex() && !m_textIndex.isIndexed( number ) )
+        m_textIndex.addPage( number, page->text() );
+
+    // the text extracted only for the index is not kept
+    if ( number == m_textIndexingPage )
+    {
+        m_textIndexingPage = -1;
+        page->setTextPage( 0 );
+        m_textIndexTimer->start( 0 );
+        return;
     }
 
-    // 2. Add the page to the fifo of generated text pages
-    m_allocatedTextPagesFifo.append( page->number() );
+    // 1. Account the memory of the text page, that may replace a previous one
+    const qulonglong memory = page->d->textPageMemory();
+    m_allocatedTextPagesTotalMemory -= m_allocatedTextPages.value( number, 0 );
+    m_allocatedTextPages.insert( number, memory );
+    m_allocatedTextPagesTotalMemory += memory;
+
+    // 2. If we reached the cache limit, delete the text pages farthest from
+    // the viewport that are not in use
+    while (m_allocatedTextPages.count() > m_maxAllocatedTextPages)
+    {
+        const int pageToKick = farthestUnloadableTextPage( number );
+        if (pageToKick == -1)
+            break;
+        unloadTextPage( pageToKick );
+    }
 }
 
 void Document::setRotation( int r )
@@ -4744,8 +5792,7 @@ void Document::setPageSize( const PageSize &size )
     for ( ; pIt != pEnd; ++pIt )
         (*pIt)->d->changeSize( size );
     // clear 'memory allocation' descriptors
-    qDeleteAll( d->m_allocatedPixmaps );
-    d->m_allocatedPixmaps.clear();
+    qDeleteAll( d->m_allocatedPixmaps.takeAll() );
     d->m_allocatedPixmapsTotalMemory = 0;
     // notify the generator that the current page size has changed
     d->m_generator->pageSizeChanged( size, d->m_pageSize );
@@ -32,6 +32,10 @@ class KXMLGUIClient;
 class KUrl;
 class DocumentItem;
 
+namespace ThreadWeaver {
+class Job;
+}
+
 namespace Okular {
 
 class Annotation;
@@ -488,6 +492,47 @@ class OKULAR_EXPORT Document : public QObject
          */
         void requestTextPage( uint number );
 
+        /**
+         * Sends a request for the text pages of the given @p pages.
+         *
+         * The text of several pages is extracted at the same time if the
+         * generator allows it, and in any case outside of the GUI thread for
+         * threaded generators. Each text page is set as soon as it is ready,
+         * and the progress is notified with textExtractionProgress().
+         *
+         * A later requestTextPage() for one of the pages waits for it instead
+         * of extracting its text again.
+         *
+         * Only the first of the @p pages, as many as the text pages cache
+         * can keep, are extracted, and they stay in the cache until the next
+         * call. To go through more pages, call it again with the pages not
+         * used yet as the first ones are used, and with an empty list at the
+         * end.
+         *
+         * @since 0.23
+         */
+        void requestTextPages( const QList< int > &pages );
+
+        /**
+         * Sets whether threaded generators extract the text of the pages
+         * along with their pixmaps, as they do by default, so that the text
+         * tools need not wait for it.
+         *
+         * This is meant for measurements that keep rendering and text
+         * extraction apart; it is not saved in the configuration.
+         *
+         * @since 0.23
+         */
+        void setExtractTextOfRenderedPages( bool extract );
+
+        /**
+         * Returns the memory the pixmaps of the pages take, in bytes, as the
+         * document accounts it against its memory limits.
+         *
+         * @since 0.23
+         */
+        qulonglong pixmapsMemory() const;
+
         /**
          * Adds a new @p annotation to the given @p page.
          */
@@ -1003,6 +1048,17 @@ class OKULAR_EXPORT Document : public QObject
          */
         void fontReadingEnded();
 
+        /**
+         * Reports the progress of the text extraction requested with
+         * requestTextPages().
+         *
+         * \param done is the number of pages whose text is extracted
+         * \param total is the number of pages requested
+         *
+         * @since 0.23
+         */
+        void textExtractionProgress( int done, int total );
+
         /**
          * Reports that the current search finished
          */
@@ -1100,7 +1156,9 @@ class OKULAR_EXPORT Document : public QObject
 
         Q_PRIVATE_SLOT( d, void saveDocumentInfo() const )
         Q_PRIVATE_SLOT( d, void slotTimedMemoryCheck() )
+        Q_PRIVATE_SLOT( d, void slotMemoryPressure() )
         Q_PRIVATE_SLOT( d, void sendGeneratorPixmapRequest() )
+        Q_PRIVATE_SLOT( d, void pixmapDiskCacheLoaded( ThreadWeaver::Job *job ) )
         Q_PRIVATE_SLOT( d, void rotationFinished( int page, Okular::Page *okularPage ) )
         Q_PRIVATE_SLOT( d, void fontReadingProgress( int page ) )
         Q_PRIVATE_SLOT( d, void fontReadingGotFont( const Okular::FontInfo& font ) )
@@ -1110,8 +1168,9 @@ class OKULAR_EXPORT Document : public QObject
 
         // search thread simulators
         Q_PRIVATE_SLOT( d, void doContinueDirectionMatchSearch(void *doContinueDirectionMatchSearchStruct) )
-        Q_PRIVATE_SLOT( d, void doContinueAllDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID) )
-        Q_PRIVATE_SLOT( d, void doContinueGooglesDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID, const QStringList & words) )
+        Q_PRIVATE_SLOT( d, void doContinueAllDocumentSearch(void *pagesToNotifySet, int currentPage, int searchID) )
+        Q_PRIVATE_SLOT( d, void doContinueGooglesDocumentSearch(void *pagesToNotifySet, int currentPage, int searchID, const QStringList & words) )
+        Q_PRIVATE_SLOT( d, void doContinueTextIndexing() )
 };
 
 
@@ -27,15 +27,19 @@
 
 // local includes
 #include "fontinfo.h"
+#include "allocatedpixmaps_p.h"
 #include "generator.h"
+#include "pixmaprequestqueue_p.h"
+#include "textindex_p.h"
+#include "textlayoutcache_p.h"
 
 class QUndoStack;
 class QEventLoop;
 class QFile;
+class QSocketNotifier;
 class QTimer;
 class KTemporaryFile;
 
-struct AllocatedPixmap;
 struct ArchiveData;
 struct RunningSearch;
 
@@ -84,13 +88,18 @@ class DocumentPrivate
             m_tempFile( 0 ),
             m_docSize( -1 ),
             m_allocatedPixmapsTotalMemory( 0 ),
+            m_allocatedTextPagesTotalMemory( 0 ),
             m_maxAllocatedTextPages( 0 ),
             m_warnedOutOfMemory( false ),
+            m_extractTextOfRenderedPages( true ),
             m_rotation( Rotation0 ),
             m_exportCached( false ),
             m_bookmarkManager( 0 ),
             m_memCheckTimer( 0 ),
             m_saveBookmarksTimer( 0 ),
+            m_memoryPressureNotifier( 0 ),
+            m_textIndexTimer( 0 ),
+            m_textIndexingPage( -1 ),
             m_generator( 0 ),
             m_walletGenerator( 0 ),
             m_generatorsLoaded( false ),
@@ -113,12 +122,114 @@ class DocumentPrivate
         qulonglong calculateMemoryToFree();
         void cleanupPixmapMemory();
         void cleanupPixmapMemory( qulonglong memoryToFree );
+        /**
+         * Updates the memory of the allocation descriptors of @p page after
+         * its pixmaps changed. Buffers shared by several observers are
+         * accounted to only one of them.
+         */
+        void updateAllocatedPixmapsMemory( int page );
+        /**
+         * Whether the text page of @p page is in use and must not be deleted:
+         * the page has highlights or a text selection, is visible, or a
+         * search goes on from it.
+         */
+        bool isTextPagePinned( int page ) const;
+        /**
+         * Returns the page whose text page is the farthest from the current
+         * viewport and is not in use, other than @p keepPage, or -1 if there
+         * is none.
+         */
+        int farthestUnloadableTextPage( int keepPage = -1 ) const;
+        /**
+         * Deletes the text page of @p page; it is extracted again when needed.
+         */
+        void unloadTextPage( int page );
         AllocatedPixmap * searchLowestPriorityPixmap( bool unloadableOnly = false, bool thenRemoveIt = false, DocumentObserver *observer = 0 /* any */ );
+        /**
+         * Returns whether a request for the same pixmap as @p request is being
+         * generated. m_pixmapRequestsMutex must be locked.
+         */
+        bool isPixmapRequestExecuting( PixmapRequest *request ) const;
+        /**
+         * Returns whether the preview of the page of @p request is being
+         * generated. m_pixmapRequestsMutex must be locked.
+         */
+        bool isPreviewExecuting( PixmapRequest *request ) const;
+        /**
+         * Returns a request for a low resolution preview of the page of the
+         * progressive @p request, lowering the priority of @p request, or 0
+         * if no preview is needed.
+         */
+        PixmapRequest *progressivePreviewRequest( PixmapRequest *request );
+        /**
+         * Restricts the tile @p request to the @p tiles it has to render.
+         * Generators that render concurrently get one request per tile,
+         * nearest to the middle of the requested area first: @p request is
+         * left with the first tile, and the requests of the others are
+         * returned.
+         */
+        QList< PixmapRequest * > splitTileRequest( PixmapRequest *request, const QList< NormalizedRect > &tiles );
+        /**
+         * Aborts the requests of @p observer being generated that are not
+         * among its new @p requests. m_pixmapRequestsMutex must be locked.
+         */
+        void abortStalePixmapRequests( DocumentObserver *observer, const QLinkedList< PixmapRequest * > &requests );
+        /**
+         * Returns the disk cache key of a pixmap of @p page of the given size,
+         * or an empty string if the page can not be cached.
+         */
+        QString pixmapDiskCacheKey( const Page *page, int width, int height ) const;
+        /**
+         * Returns the disk cache key of the pixmap of @p request if the disk
+         * cache has it and the request can use it, or an empty string.
+         */
+        QString diskCachedPixmapKey( PixmapRequest *request ) const;
+        /**
+         * Sets the pixmap of @p request from the pixmap another observer
+         * has for the same page, sharing or scaling it down. Returns
+         * whether there was one.
+         */
+        bool reusePagePixmap( PixmapRequest *request );
+        /**
+         * Stores the pixmap of @p observer for @p page in the disk cache,
+         * if it is not there already.
+         */
+        void storePixmapInDiskCache( Page *page, DocumentObserver *observer );
         void calculateMaxTextPages();
         qulonglong getTotalMemory();
         qulonglong getFreeMemory( qulonglong *freeSwap = 0 );
+        /**
+         * Watches the pressure stall information of the kernel, if available,
+         * to trim the pixmap cache as soon as the system runs short of memory.
+         */
+        void startMemoryPressureMonitor();
+        void stopMemoryPressureMonitor();
         void loadDocumentInfo();
         void loadDocumentInfo( QFile &infoFile );
+        /**
+         * The file with @p extension next to the document info file, for the
+         * text index or the text layouts, or an empty string if the document
+         * has none.
+         */
+        QString docDataSideFileName( const QString &extension ) const;
+        /**
+         * What identifies the document in its side files: the name of the
+         * document info file only has the file name and size, so this adds
+         * the path, the modification time and a hash of the content.
+         */
+        QByteArray docDataSideFileId() const;
+        /**
+         * Loads the text index saved for the document, then starts indexing
+         * the pages it misses in the background if the generator extracts
+         * text in a thread.
+         */
+        void startTextIndexing();
+        void stopTextIndexing();
+        /**
+         * Loads the text layouts saved for the document, and saves them.
+         */
+        void loadTextLayouts();
+        void saveTextLayouts();
         void loadViewsInfo( View *view, const QDomElement &e );
         void saveViewsInfo( View *view, QDomElement &e ) const;
         QString giveAbsolutePath( const QString & fileName ) const;
@@ -140,6 +251,8 @@ class DocumentPrivate
         bool canRemoveExternalAnnotations() const;
         void warnLimitedAnnotSupport();
         OKULAR_EXPORT static QString docDataFileName(const KUrl &url, qint64 document_size);
+        // for the tests that look into the caches of a document
+        static DocumentPrivate *get( Document *document ) { return document->d; }
 
         // Methods that implement functionality needed by undo commands
         void performAddPageAnnotation( int page, Annotation *annotation );
@@ -150,7 +263,9 @@ class DocumentPrivate
         // private slots
         void saveDocumentInfo() const;
         void slotTimedMemoryCheck();
+        void slotMemoryPressure();
         void sendGeneratorPixmapRequest();
+        void pixmapDiskCacheLoaded( ThreadWeaver::Job *job );
         void rotationFinished( int page, Okular::Page *okularPage );
         void fontReadingProgress( int page );
         void fontReadingGotFont( const Okular::FontInfo& font );
@@ -158,10 +273,33 @@ class DocumentPrivate
         void refreshPixmaps( int );
         void _o_configChanged();
         void doContinueDirectionMatchSearch(void *doContinueDirectionMatchSearchStruct);
-        void doContinueAllDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID);
-        void doContinueGooglesDocumentSearch(void *pagesToNotifySet, void *pageMatchesMap, int currentPage, int searchID, const QStringList & words);
+        void doContinueAllDocumentSearch(void *pagesToNotifySet, int currentPage, int searchID);
+        void doContinueGooglesDocumentSearch(void *pagesToNotifySet, int currentPage, int searchID, const QStringList & words);
+        void doContinueTextIndexing();
 
         void doProcessSearchMatch( RegularAreaRect *match, RunningSearch *search, QSet< int > *pagesToNotify, int currentPage, int searchID, bool moveViewport, const QColor & color );
+        /**
+         * Queues the extraction of the text of the pages @p search reaches
+         * next from @p page, if the generator extracts several pages at the
+         * same time. Their text pages are not unloaded while the search runs.
+         */
+        void prefetchSearchTextPages( RunningSearch *search, int page, bool forward );
+        /**
+         * Notifies the observers of the new highlights of @p pagesToNotify,
+         * then empties it.
+         */
+        void notifySearchHighlights( QSet< int > *pagesToNotify );
+        /**
+         * Whether the whole document search @p search waits for the text of
+         * @p page rather than extracting it now: the text is extracted by
+         * the generator threads, and the search is resumed when it arrives.
+         */
+        bool waitForSearchText( RunningSearch *search, int page, QSet< int > *pagesToNotify, const QStringList &words );
+        /**
+         * Resumes the whole document searches whose text arrived, or all of
+         * them if @p all.
+         */
+        void resumeSearchesWaitingForText( bool all );
 
         // generators stuff
         /**
@@ -170,6 +308,7 @@ class DocumentPrivate
          */
         void requestDone( PixmapRequest * request );
         void textGenerationDone( Page *page );
+        void textExtractionProgress( int done, int total );
         /**
          * Sets the bounding box of the given @p page (in terms of upright orientation, i.e., Rotation0).
          */
@@ -215,14 +354,20 @@ class DocumentPrivate
 
         // observers / requests / allocator stuff
         QSet< DocumentObserver * > m_observers;
-        QLinkedList< PixmapRequest * > m_pixmapRequestsStack;
+        PixmapRequestQueue m_pixmapRequestsQueue;
         QLinkedList< PixmapRequest * > m_executingPixmapRequests;
         QMutex m_pixmapRequestsMutex;
-        QLinkedList< AllocatedPixmap * > m_allocatedPixmaps;
+        AllocatedPixmaps m_allocatedPixmaps;
         qulonglong m_allocatedPixmapsTotalMemory;
-        QList< int > m_allocatedTextPagesFifo;
+        // the memory of the text pages, by page number
+        QMap< int, qulonglong > m_allocatedTextPages;
+        // the pages of the last requestTextPages(), kept until it is called again
+        QSet< int > m_requestedTextPages;
+        qulonglong m_allocatedTextPagesTotalMemory;
         int m_maxAllocatedTextPages;
         bool m_warnedOutOfMemory;
+        // see Document::setExtractTextOfRenderedPages()
+        bool m_extractTextOfRenderedPages;
 
         // the rotation applied to the document
         Rotation m_rotation;
@@ -243,6 +388,19 @@ class DocumentPrivate
         // timers (memory checking / info saver)
         QTimer *m_memCheckTimer;
         QTimer *m_saveBookmarksTimer;
+        QSocketNotifier *m_memoryPressureNotifier;
+
+        // the words of the pages, filled in the background to narrow down searches
+        TextIndex m_textIndex;
+        QTimer *m_textIndexTimer;
+        // the page whose text is being extracted only to index it, or -1
+        int m_textIndexingPage;
+        // the reading order of the text of the pages, not to analyze their
+        // layout again when their text is extracted again
+        TextLayoutCache m_textLayouts;
+        // the document the side files are of, taken at its opening: the file
+        // may have changed by the time they are saved
+        QByteArray m_docDataSideFileId;
 
         QHash<QString, GeneratorInfo> m_loadedGenerators;
         Generator * m_generator;
@@ -25,47 +25,60 @@
 #include "page.h"
 #include "page_p.h"
 #include "textpage.h"
+#include "trace_p.h"
 #include "utils.h"
 
 using namespace Okular;
 
 GeneratorPrivate::GeneratorPrivate()
     : m_document( 0 ),
-      mPixmapGenerationThread( 0 ), mTextPageGenerationThread( 0 ),
-      m_mutex( 0 ), m_threadsMutex( 0 ), mPixmapReady( true ), mTextPageReady( true ),
-      m_closing( false ), m_closingLoop( 0 ),
+      mTextPageGenerationThread( 0 ), mTextExtractionsDone( 0 ), mTextExtractionsTotal( 0 ),
+      m_mutex( 0 ), m_threadsMutex( 0 ), mRunningPixmapGenerations( 0 ), mTextPageReady( true ),
+      mDeliveryScheduled( false ), mTextDeliveryScheduled( false ), m_closing( false ), m_closingLoop( 0 ),
       m_dpi(72.0, 72.0)
 {
 }
 
 GeneratorPrivate::~GeneratorPrivate()
 {
-    if ( mPixmapGenerationThread )
-        mPixmapGenerationThread->wait();
+    foreach ( PixmapGenerationThread *thread, mPixmapGenerationThreads )
+        thread->wait();
 
-    delete mPixmapGenerationThread;
+    qDeleteAll( mPixmapGenerationThreads );
 
     if ( mTextPageGenerationThread )
         mTextPageGenerationThread->wait();
 
     delete mTextPageGenerationThread;
 
+    foreach ( TextExtractionThread *thread, mTextExtractionThreads )
+        thread->wait();
+
+    qDeleteAll( mTextExtractionThreads );
+    for ( int i = 0; i < mExtractedTextPages.count(); ++i )
+        delete mExtractedTextPages.at( i ).second;
+
     delete m_mutex;
     delete m_threadsMutex;
 }
 
 PixmapGenerationThread* GeneratorPrivate::pixmapGenerationThread()
 {
-    if ( mPixmapGenerationThread )
-        return mPixmapGenerationThread;
+    // reuse an idle thread, if any
+    foreach ( PixmapGenerationThread *thread, mPixmapGenerationThreads )
+    {
+        if ( !thread->request() )
+            return thread;
+    }
 
     Q_Q( Generator );
-    mPixmapGenerationThread = new PixmapGenerationThread( q );
-    QObject::connect( mPixmapGenerationThread, SIGNAL(finished()),
+    PixmapGenerationThread *thread = new PixmapGenerationThread( q );
+    QObject::connect( thread, SIGNAL(finished()),
                       q, SLOT(pixmapGenerationFinished()),
                       Qt::QueuedConnection );
+    mPixmapGenerationThreads.append( thread );
 
-    return mPixmapGenerationThread;
+    return thread;
 }
 
 TextPageGenerationThread* GeneratorPrivate::textPageGenerationThread()
@@ -82,33 +95,176 @@ TextPageGenerationThread* GeneratorPrivate::textPageGenerationThread()
     return mTextPageGenerationThread;
 }
 
-void GeneratorPrivate::pixmapGenerationFinished()
+bool GeneratorPrivate::startTextPageGeneration( Page *page, QThread::Priority priority )
 {
     Q_Q( Generator );
-    PixmapRequest *request = mPixmapGenerationThread->request();
-    mPixmapGenerationThread->endGeneration();
+    if ( !q->hasFeature( Generator::TextExtraction ) || page->hasTextPage() || !q->canGenerateTextPage() || m_closing )
+        return false;
 
-    QMutexLocker locker( threadsLock() );
-    mPixmapReady = true;
+    mTextPageReady = false;
+    textPageGenerationThread()->startGeneration( page, priority );
+    return true;
+}
+
+int GeneratorPrivate::maxPixmapGenerations() const
+{
+    Q_Q( const Generator );
+    if ( !q->hasFeature( Generator::Threaded ) || !q->hasFeature( Generator::ReentrantRendering ) )
+        return 1;
 
+    return qMax( 1, QThread::idealThreadCount() );
+}
+
+void GeneratorPrivate::extractTextPages( const QList< Page * > &pages )
+{
+    Q_Q( Generator );
+    QMutexLocker locker( threadsLock() );
     if ( m_closing )
+        return;
+
+    foreach ( Page *page, pages )
     {
-        delete request;
-        if ( mTextPageReady )
+        if ( page->hasTextPage() || mPendingTextPages.contains( page ) )
+            continue;
+
+        mTextExtractionQueue.append( page );
+        mPendingTextPages.insert( page );
+        ++mTextExtractionsTotal;
+    }
+
+    int extracting = 0;
+    foreach ( TextExtractionThread *thread, mTextExtractionThreads )
+    {
+        if ( thread->isExtracting() )
+            ++extracting;
+    }
+
+    const int wanted = qMin( maxTextExtractions(), mTextExtractionQueue.count() );
+    for ( int i = 0; i < mTextExtractionThreads.count() && extracting < wanted; ++i )
+    {
+        TextExtractionThread *thread = mTextExtractionThreads.at( i );
+        if ( !thread->isExtracting() )
         {
-            locker.unlock();
-            m_closingLoop->quit();
+            thread->startExtraction();
+            ++extracting;
         }
+    }
+    for ( ; extracting < wanted; ++extracting )
+    {
+        TextExtractionThread *thread = new TextExtractionThread( q );
+        mTextExtractionThreads.append( thread );
+        thread->startExtraction();
+    }
+}
+
+bool GeneratorPrivate::waitForTextPage( Page *page )
+{
+    QMutexLocker locker( threadsLock() );
+    if ( !mPendingTextPages.contains( page ) )
+        return false;
+
+    // it is needed now, before the others
+    if ( mTextExtractionQueue.removeOne( page ) )
+        mTextExtractionQueue.prepend( page );
+
+    while ( mPendingTextPages.contains( page ) )
+        mTextPageExtracted.wait( threadsLock() );
+    locker.unlock();
+
+    deliverExtractedTextPages();
+    return true;
+}
+
+bool GeneratorPrivate::isExtractingTextPage( Page *page )
+{
+    QMutexLocker locker( threadsLock() );
+    if ( mPendingTextPages.contains( page ) )
+        return true;
+
+    for ( int i = 0; i < mExtractedTextPages.count(); ++i )
+    {
+        if ( mExtractedTextPages.at( i ).first == page )
+            return true;
+    }
+    return false;
+}
+
+int GeneratorPrivate::maxTextExtractions() const
+{
+    Q_Q( const Generator );
+    if ( !q->hasFeature( Generator::ReentrantTextExtraction ) )
+        return 1;
+
+    return qMax( 1, QThread::idealThreadCount() );
+}
+
+void GeneratorPrivate::pixmapGenerationFinished()
+{
+    Q_Q( Generator );
+    PixmapGenerationThread *thread = qobject_cast< PixmapGenerationThread * >( q->sender() );
+    if ( !thread || !thread->request() || mFinishedPixmapGenerationThreads.contains( thread ) )
         return;
+
+    mFinishedPixmapGenerationThreads.append( thread );
+
+    // Several threads may finish during the same event loop iteration:
+    // collect them all and deliver the most important ones first
+    if ( !mDeliveryScheduled )
+    {
+        mDeliveryScheduled = true;
+        QMetaObject::invokeMethod( q, "deliverFinishedPixmaps", Qt::QueuedConnection );
     }
+}
 
-    const QImage& img = mPixmapGenerationThread->image();
-    request->page()->setPixmap( request->observer(), new QPixmap( QPixmap::fromImage( img ) ), request->normalizedRect() );
-    const int pageNumber = request->page()->number();
+static bool finishedPixmapLessThan( const PixmapGenerationThread *t1, const PixmapGenerationThread *t2 )
+{
+    // lower value means higher priority
+    return t1->request()->priority() < t2->request()->priority();
+}
+
+void GeneratorPrivate::deliverFinishedPixmaps()
+{
+    Q_Q( Generator );
+    mDeliveryScheduled = false;
+
+    QList< PixmapGenerationThread * > finishedThreads = mFinishedPixmapGenerationThreads;
+    mFinishedPixmapGenerationThreads.clear();
+    qStableSort( finishedThreads.begin(), finishedThreads.end(), finishedPixmapLessThan );
+
+    foreach ( PixmapGenerationThread *thread, finishedThreads )
+    {
+        PixmapRequest *request = thread->request();
+        thread->endGeneration();
 
-    if ( mPixmapGenerationThread->calcBoundingBox() )
-        q->updatePageBoundingBox( pageNumber, mPixmapGenerationThread->boundingBox() );
-    q->signalPixmapRequestDone( request );
+        QMutexLocker locker( threadsLock() );
+        --mRunningPixmapGenerations;
+
+        if ( m_closing )
+        {
+            delete request;
+            if ( mRunningPixmapGenerations == 0 && mTextPageReady )
+            {
+                locker.unlock();
+                m_closingLoop->quit();
+            }
+            continue;
+        }
+
+        // the request being signaled may start a new generation
+        locker.unlock();
+
+        // the image of an aborted request may be incomplete
+        if ( !request->shouldAbortRender() )
+        {
+            const QImage& img = thread->image();
+            request->page()->setImage( request->observer(), img, request->normalizedRect() );
+            const int pageNumber = request->page()->number();
+
+            if ( thread->calcBoundingBox() )
+                q->updatePageBoundingBox( pageNumber, thread->boundingBox() );
+        }
+        q->signalPixmapRequestDone( request );
+    }
 }
 
 void GeneratorPrivate::textpageGenerationFinished()
@@ -123,7 +279,7 @@ void GeneratorPrivate::textpageGenerationFinished()
     if ( m_closing )
     {
         delete mTextPageGenerationThread->textPage();
-        if ( mPixmapReady )
+        if ( mRunningPixmapGenerations == 0 )
         {
             locker.unlock();
             m_closingLoop->quit();
@@ -134,11 +290,48 @@ void GeneratorPrivate::textpageGenerationFinished()
     if ( mTextPageGenerationThread->textPage() )
     {
         TextPage *tp = mTextPageGenerationThread->textPage();
-        page->setTextPage( tp );
+        PagePrivate::get( page )->setAnalyzedTextPage( tp );
         q->signalTextGenerationDone( page, tp );
     }
 }
 
+void GeneratorPrivate::deliverExtractedTextPages()
+{
+    Q_Q( Generator );
+    QMutexLocker locker( threadsLock() );
+    mTextDeliveryScheduled = false;
+
+    const QList< QPair< Page *, TextPage * > > extractedTextPages = mExtractedTextPages;
+    mExtractedTextPages.clear();
+    if ( extractedTextPages.isEmpty() )
+        return;
+
+    mTextExtractionsDone += extractedTextPages.count();
+    const int done = mTextExtractionsDone;
+    const int total = mTextExtractionsTotal;
+    if ( mPendingTextPages.isEmpty() )
+        mTextExtractionsDone = mTextExtractionsTotal = 0;
+    locker.unlock();
+
+    for ( int i = 0; i < extractedTextPages.count(); ++i )
+    {
+        Page *page = extractedTextPages.at( i ).first;
+        TextPage *tp = extractedTextPages.at( i ).second;
+        if ( m_closing )
+        {
+            delete tp;
+        }
+        else if ( tp )
+        {
+            PagePrivate::get( page )->setAnalyzedTextPage( tp );
+            q->signalTextGenerationDone( page, tp );
+        }
+    }
+
+    if ( !m_closing && m_document )
+        m_document->textExtractionProgress( done, total );
+}
+
 QMutex* GeneratorPrivate::threadsLock()
 {
     if ( !m_threadsMutex )
@@ -202,8 +395,21 @@ bool Generator::closeDocument()
 
     d->m_closing = true;
 
+    // the pages being extracted are finished, the others are forgotten
     d->threadsLock()->lock();
-    if ( !( d->mPixmapReady && d->mTextPageReady ) )
+    d->mTextExtractionQueue.clear();
+    d->threadsLock()->unlock();
+    foreach ( TextExtractionThread *thread, d->mTextExtractionThreads )
+        thread->wait();
+
+    d->threadsLock()->lock();
+    for ( int i = 0; i < d->mExtractedTextPages.count(); ++i )
+        delete d->mExtractedTextPages.at( i ).second;
+    d->mExtractedTextPages.clear();
+    d->mPendingTextPages.clear();
+    d->mTextExtractionsDone = d->mTextExtractionsTotal = 0;
+
+    if ( !( d->mRunningPixmapGenerations == 0 && d->mTextPageReady ) )
     {
         QEventLoop loop;
         d->m_closingLoop = &loop;
@@ -229,13 +435,15 @@ bool Generator::closeDocument()
 bool Generator::canGeneratePixmap() const
 {
     Q_D( const Generator );
-    return d->mPixmapReady;
+    return d->mRunningPixmapGenerations < d->maxPixmapGenerations();
 }
 
 void Generator::generatePixmap( PixmapRequest *request )
 {
     Q_D( Generator );
-    d->mPixmapReady = false;
+    d->threadsLock()->lock();
+    ++d->mRunningPixmapGenerations;
+    d->threadsLock()->unlock();
 
     const bool calcBoundingBox = !request->isTile() && !request->page()->isBoundingBoxKnown();
 
@@ -247,22 +455,26 @@ void Generator::generatePixmap( PixmapRequest *request )
          * We create the text page for every page that is visible to the
          * user, so he can use the text extraction tools without a delay.
          */
-        if ( hasFeature( TextExtraction ) && !request->page()->hasTextPage() && canGenerateTextPage() && !d->m_closing ) {
-            d->mTextPageReady = false;
-            d->textPageGenerationThread()->startGeneration( request->page() );
-        }
+        if ( !d->m_document || d->m_document->m_extractTextOfRenderedPages )
+            d->startTextPageGeneration( request->page(), QThread::InheritPriority );
 
         return;
     }
 
+    const qint64 traceStart = Trace::isEnabled() ? Trace::now() : 0;
     const QImage& img = image( request );
-    request->page()->setPixmap( request->observer(), new QPixmap( QPixmap::fromImage( img ) ), request->normalizedRect() );
+    Trace::complete( "Generator::image", traceStart, request->pageNumber() );
+    const bool aborted = request->shouldAbortRender();
+    if ( !aborted )
+        request->page()->setImage( request->observer(), img, request->normalizedRect() );
     const int pageNumber = request->page()->number();
 
-    d->mPixmapReady = true;
+    d->threadsLock()->lock();
+    --d->mRunningPixmapGenerations;
+    d->threadsLock()->unlock();
 
     signalPixmapRequestDone( request );
-    if ( calcBoundingBox )
+    if ( calcBoundingBox && !aborted )
         updatePageBoundingBox( pageNumber, Utils::imageBoundingBox( &img ) );
 }
 
@@ -274,6 +486,7 @@ bool Generator::canGenerateTextPage() const
 
 void Generator::generateTextPage( Page *page )
 {
+    TraceScope traceScope( "Generator::textPage", page->number() );
     TextPage *tp = textPage( page );
     page->setTextPage( tp );
     signalTextGenerationDone( page, tp );
@@ -465,11 +678,19 @@ PixmapRequest::PixmapRequest( DocumentObserver *observer, int pageNumber, int wi
     d->mFeatures = features;
     d->mForce = false;
     d->mTile = false;
+    d->mPreview = false;
+    d->mSkipDiskCache = false;
+    d->mDelivered = false;
     d->mNormalizedRect = NormalizedRect();
+    d->mShouldAbortRender = 0;
+    Trace::begin( "Request", this, pageNumber );
 }
 
 PixmapRequest::~PixmapRequest()
 {
+    // dropped before being delivered
+    if ( !d->mDelivered )
+        Trace::end( "Request", this );
     delete d;
 }
 
@@ -508,6 +729,11 @@ bool PixmapRequest::preload() const
     return d->mFeatures & Preload;
 }
 
+bool PixmapRequest::shouldAbortRender() const
+{
+    return d->mShouldAbortRender != 0;
+}
+
 Page* PixmapRequest::page() const
 {
     return d->mPage;
@@ -188,6 +188,7 @@ class OKULAR_EXPORT Generator : public QObject
     /// @cond PRIVATE
     friend class PixmapGenerationThread;
     friend class TextPageGenerationThread;
+    friend class TextExtractionThread;
     /// @endcond
 
     Q_OBJECT
@@ -207,7 +208,9 @@ class OKULAR_EXPORT Generator : public QObject
             PrintNative,       ///< Whether the Generator supports native cross-platform printing (QPainter-based).
             PrintPostscript,   ///< Whether the Generator supports postscript-based file printing.
             PrintToFile,       ///< Whether the Generator supports export to PDF & PS through the Print Dialog
-            TiledRendering     ///< Whether the Generator can render tiles @since 0.16 (KDE 4.10)
+            TiledRendering,    ///< Whether the Generator can render tiles @since 0.16 (KDE 4.10)
+            ReentrantRendering, ///< Whether image() can be run concurrently for different requests, in several threads (requires @ref Threaded) @since 0.23
+            ReentrantTextExtraction ///< Whether textPage() can be run concurrently for different pages, in several threads (requires @ref Threaded) @since 0.23
         };
 
         /**
@@ -280,6 +283,9 @@ class OKULAR_EXPORT Generator : public QObject
         /**
          * This method returns whether the generator is ready to
          * handle a new pixmap request.
+         *
+         * Generators with the @ref ReentrantRendering feature are ready
+         * as long as one of their rendering threads is idle.
          */
         virtual bool canGeneratePixmap() const;
 
@@ -482,7 +488,11 @@ class OKULAR_EXPORT Generator : public QObject
          * the passed pixmap @p request.
          *
          * @warning this method may be executed in its own separated thread if the
-         * @ref Threaded is enabled!
+         * @ref Threaded is enabled, and in several threads at the same time if
+         * @ref ReentrantRendering is enabled too!
+         *
+         * Long renderings should poll PixmapRequest::shouldAbortRender() and
+         * return early when it is set.
          */
         virtual QImage image( PixmapRequest *page );
 
@@ -490,7 +500,8 @@ class OKULAR_EXPORT Generator : public QObject
          * Returns the text page for the given @p page.
          *
          * @warning this method may be executed in its own separated thread if the
-         * @ref Threaded is enabled!
+         * @ref Threaded is enabled, and in several threads at the same time if
+         * @ref ReentrantTextExtraction is enabled too!
          */
         virtual TextPage* textPage( Page *page );
 
@@ -558,7 +569,9 @@ class OKULAR_EXPORT Generator : public QObject
         Q_DISABLE_COPY( Generator )
 
         Q_PRIVATE_SLOT( d_func(), void pixmapGenerationFinished() )
+        Q_PRIVATE_SLOT( d_func(), void deliverFinishedPixmaps() )
         Q_PRIVATE_SLOT( d_func(), void textpageGenerationFinished() )
+        Q_PRIVATE_SLOT( d_func(), void deliverExtractedTextPages() )
 };
 
 /**
@@ -574,7 +587,8 @@ class OKULAR_EXPORT PixmapRequest
         {
             NoFeature = 0,
             Asynchronous = 1,
-            Preload = 2
+            Preload = 2,
+            Progressive = 4     ///< If the page has no pixmap yet, render a low resolution preview first @since 0.23
         };
         Q_DECLARE_FLAGS( PixmapRequestFeatures, PixmapRequestFeature )
 
@@ -641,6 +655,17 @@ class OKULAR_EXPORT PixmapRequest
          */
         Page *page() const;
 
+        /**
+         * Returns whether the pixmap of this request is not needed anymore,
+         * e.g. because its page went out of the view.
+         *
+         * Generators can poll it while rendering, from any thread, and stop
+         * as soon as it is set: what they return then is discarded.
+         *
+         * @since 0.23
+         */
+        bool shouldAbortRender() const;
+
         /**
          * Sets whether the generator should render only the given normalized
          * rect or the entire page
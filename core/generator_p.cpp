@@ -9,10 +9,15 @@
 
 #include "generator_p.h"
 
+#include <QtCore/QMutexLocker>
+
 #include <kdebug.h>
 
 #include "fontinfo.h"
 #include "generator.h"
+#include "page.h"
+#include "page_p.h"
+#include "trace_p.h"
 #include "utils.h"
 
 using namespace Okular;
@@ -59,10 +64,12 @@ void PixmapGenerationThread::run()
 {
     mImage = QImage();
 
-    if ( mRequest )
+    // the request may have been aborted while waiting for this thread
+    if ( mRequest && !mRequest->shouldAbortRender() )
     {
+        TraceScope traceScope( "Generator::image", mRequest->pageNumber() );
         mImage = mGenerator->image( mRequest );
-        if ( mCalcBoundingBox )
+        if ( mCalcBoundingBox && !mRequest->shouldAbortRender() )
             mBoundingBox = Utils::imageBoundingBox( &mImage );
     }
 }
@@ -73,11 +80,11 @@ TextPageGenerationThread::TextPageGenerationThread( Generator *generator )
 {
 }
 
-void TextPageGenerationThread::startGeneration( Page *page )
+void TextPageGenerationThread::startGeneration( Page *page, QThread::Priority priority )
 {
     mPage = page;
 
-    start( QThread::InheritPriority );
+    start( priority );
 }
 
 void TextPageGenerationThread::endGeneration()
@@ -100,7 +107,66 @@ void TextPageGenerationThread::run()
     mTextPage = 0;
 
     if ( mPage )
+    {
+        TraceScope traceScope( "Generator::textPage", mPage->number() );
         mTextPage = mGenerator->textPage( mPage );
+        // the layout analysis is the slow part, keep it out of the GUI thread
+        if ( mTextPage )
+            PagePrivate::get( mPage )->analyzeTextPage( mTextPage );
+    }
+}
+
+
+TextExtractionThread::TextExtractionThread( Generator *generator )
+    : mGenerator( generator ), mExtracting( false )
+{
+}
+
+void TextExtractionThread::startExtraction()
+{
+    // the thread may still be returning from its previous run
+    wait();
+    mExtracting = true;
+    start( QThread::InheritPriority );
+}
+
+bool TextExtractionThread::isExtracting() const
+{
+    return mExtracting;
+}
+
+void TextExtractionThread::run()
+{
+    GeneratorPrivate *d = mGenerator->d_func();
+
+    QMutexLocker locker( d->threadsLock() );
+    while ( !d->mTextExtractionQueue.isEmpty() )
+    {
+        Page *page = d->mTextExtractionQueue.takeFirst();
+        locker.unlock();
+
+        TextPage *textPage = 0;
+        {
+            TraceScope traceScope( "Generator::textPage", page->number() );
+            textPage = mGenerator->textPage( page );
+            // the layout analysis is the slow part, it runs in parallel too
+            if ( textPage )
+                PagePrivate::get( page )->analyzeTextPage( textPage );
+        }
+
+        locker.relock();
+        d->mPendingTextPages.remove( page );
+        d->mExtractedTextPages.append( qMakePair( page, textPage ) );
+        d->mTextPageExtracted.wakeAll();
+
+        // the pages extracted meanwhile by the other threads go along
+        if ( !d->mTextDeliveryScheduled )
+        {
+            d->mTextDeliveryScheduled = true;
+            QMetaObject::invokeMethod( mGenerator, "deliverExtractedTextPages", Qt::QueuedConnection );
+        }
+    }
+    mExtracting = false;
 }
 
 
@@ -12,8 +12,12 @@
 
 #include "area.h"
 
+#include <QtCore/QAtomicInt>
+#include <QtCore/QList>
+#include <QtCore/QPair>
 #include <QtCore/QSet>
 #include <QtCore/QThread>
+#include <QtCore/QWaitCondition>
 #include <QtGui/QImage>
 
 class QEventLoop;
@@ -28,6 +32,7 @@ class Generator;
 class Page;
 class PixmapGenerationThread;
 class PixmapRequest;
+class TextExtractionThread;
 class TextPage;
 class TextPageGenerationThread;
 class TilesManager;
@@ -45,8 +50,45 @@ class GeneratorPrivate
         PixmapGenerationThread* pixmapGenerationThread();
         TextPageGenerationThread* textPageGenerationThread();
 
+        /**
+         * Starts extracting the text of @p page in the text page thread,
+         * running with @p priority. Returns false if the generator can not
+         * extract text, or is already doing it.
+         */
+        bool startTextPageGeneration( Page *page, QThread::Priority priority );
+
+        /**
+         * The number of pixmap requests that can be rendered at the same time.
+         */
+        int maxPixmapGenerations() const;
+
+        /**
+         * Queues the extraction of the text of @p pages, done by a pool of
+         * threads; the text pages are set as they are ready.
+         */
+        void extractTextPages( const QList< Page * > &pages );
+
+        /**
+         * If the text of @p page is queued or being extracted, waits for it
+         * and returns true.
+         */
+        bool waitForTextPage( Page *page );
+
+        /**
+         * Whether the text of @p page is queued, being extracted or waiting
+         * to be delivered.
+         */
+        bool isExtractingTextPage( Page *page );
+
+        /**
+         * The number of pages whose text can be extracted at the same time.
+         */
+        int maxTextExtractions() const;
+
         void pixmapGenerationFinished();
+        void deliverFinishedPixmaps();
         void textpageGenerationFinished();
+        void deliverExtractedTextPages();
 
         QMutex* threadsLock();
 
@@ -57,12 +99,27 @@ class GeneratorPrivate
         // NOTE: the following should be a QSet< GeneratorFeature >,
         // but it is not to avoid #include'ing generator.h
         QSet< int > m_features;
-        PixmapGenerationThread *mPixmapGenerationThread;
+        // the pool of pixmap rendering threads; a thread is idle when it has no request
+        QList< PixmapGenerationThread * > mPixmapGenerationThreads;
+        // threads whose rendering is done, waiting to be delivered by priority
+        QList< PixmapGenerationThread * > mFinishedPixmapGenerationThreads;
         TextPageGenerationThread *mTextPageGenerationThread;
+        // the pool of text extraction threads, with the pages they take the
+        // text of in turn; all of them are protected by the threads lock
+        QList< TextExtractionThread * > mTextExtractionThreads;
+        QList< Page * > mTextExtractionQueue;
+        // the pages queued or being extracted
+        QSet< Page * > mPendingTextPages;
+        QList< QPair< Page *, TextPage * > > mExtractedTextPages;
+        QWaitCondition mTextPageExtracted;
+        int mTextExtractionsDone;
+        int mTextExtractionsTotal;
         mutable QMutex *m_mutex;
         QMutex *m_threadsMutex;
-        bool mPixmapReady : 1;
+        int mRunningPixmapGenerations;
         bool mTextPageReady : 1;
+        bool mDeliveryScheduled : 1;
+        bool mTextDeliveryScheduled : 1;
         bool m_closing : 1;
         QEventLoop *m_closingLoop;
         QSizeF m_dpi;
@@ -83,8 +140,14 @@ class PixmapRequestPrivate
         int mFeatures;
         bool mForce : 1;
         bool mTile : 1;
+        bool mPreview : 1;
+        // the disk cache did not have the pixmap after all
+        bool mSkipDiskCache : 1;
+        // the trace span of the request ended when it was delivered
+        bool mDelivered : 1;
         Page *mPage;
         NormalizedRect mNormalizedRect;
+        QAtomicInt mShouldAbortRender;
 };
 
 
@@ -124,7 +187,7 @@ class TextPageGenerationThread : public QThread
     public:
         TextPageGenerationThread( Generator *generator );
 
-        void startGeneration( Page *page );
+        void startGeneration( Page *page, QThread::Priority priority = QThread::InheritPriority );
 
         void endGeneration();
 
@@ -141,6 +204,33 @@ class TextPageGenerationThread : public QThread
         TextPage *mTextPage;
 };
 
+class TextExtractionThread : public QThread
+{
+    Q_OBJECT
+
+    public:
+        TextExtractionThread( Generator *generator );
+
+        /**
+         * Starts taking the pages of the queue of the generator, until it
+         * is empty. To be called with the threads lock held.
+         */
+        void startExtraction();
+
+        /**
+         * Whether the thread is taking pages from the queue. To be called
+         * with the threads lock held.
+         */
+        bool isExtracting() const;
+
+    protected:
+        virtual void run();
+
+    private:
+        Generator *mGenerator;
+        bool mExtracting;
+};
+
 class FontExtractionThread : public QThread
 {
     Q_OBJECT
@@ -40,6 +40,7 @@
 #include "textpage_p.h"
 #include "tile.h"
 #include "tilesmanager_p.h"
+#include "trace_p.h"
 #include "utils_p.h"
 
 #include <limits>
@@ -103,18 +104,93 @@ void PagePrivate::imageRotationDone( RotationJob * job )
     }
 
     QMap< DocumentObserver*, PixmapObject >::iterator it = m_pixmaps.find( job->observer() );
-    if ( it != m_pixmaps.end() )
+    if ( it == m_pixmaps.end() )
+        it = m_pixmaps.insert( job->observer(), PixmapObject() );
+
+    it.value().setImage( job->image() );
+    it.value().m_rotation = job->rotation();
+}
+
+void PagePrivate::setRotatedPixmap( DocumentObserver *observer, QPixmap *pixmap )
+{
+    QMap< DocumentObserver*, PixmapObject >::iterator it = m_pixmaps.find( observer );
+    if ( it == m_pixmaps.end() )
+        it = m_pixmaps.insert( observer, PixmapObject() );
+
+    it.value().setPixmap( pixmap );
+    it.value().m_rotation = m_rotation;
+}
+
+void PagePrivate::setRotatedImage( DocumentObserver *observer, const QImage &image )
+{
+    QMap< DocumentObserver*, PixmapObject >::iterator it = m_pixmaps.find( observer );
+    if ( it == m_pixmaps.end() )
+        it = m_pixmaps.insert( observer, PixmapObject() );
+
+    it.value().setImage( image );
+    it.value().m_rotation = m_rotation;
+}
+
+bool PagePrivate::isCompactImage( const QImage &image )
+{
+    switch ( image.format() )
     {
-        PixmapObject &object = it.value();
-        (*object.m_pixmap) = QPixmap::fromImage( job->image() );
-        object.m_rotation = job->rotation();
-    } else {
-        PixmapObject object;
-        object.m_pixmap = new QPixmap( QPixmap::fromImage( job->image() ) );
-        object.m_rotation = job->rotation();
+        case QImage::Format_Mono:
+        case QImage::Format_MonoLSB:
+        case QImage::Format_Indexed8:
+            return true;
+        default:
+            return false;
+    }
+}
+
+void PagePrivate::PixmapObject::setPixmap( QPixmap *pixmap )
+{
+    delete m_pixmap;
+    m_pixmap = pixmap;
+    m_image = QImage();
+}
+
+void PagePrivate::PixmapObject::setImage( const QImage &image )
+{
+    // compact images are converted only when painted, see PagePainter
+    if ( isCompactImage( image ) )
+    {
+        delete m_pixmap;
+        m_pixmap = 0;
+        m_image = image;
+    }
+    else if ( m_pixmap )
+    {
+        (*m_pixmap) = QPixmap::fromImage( image );
+        m_image = QImage();
+    }
+    else
+    {
+        m_pixmap = new QPixmap( QPixmap::fromImage( image ) );
+        m_image = QImage();
+    }
+}
 
-        m_pixmaps.insert( job->observer(), object );
+const QPixmap *PagePrivate::reusablePixmap( const DocumentObserver *observer, int width, int height ) const
+{
+    const QPixmap *result = 0;
+    QMap< DocumentObserver*, PixmapObject >::const_iterator it = m_pixmaps.constBegin(), end = m_pixmaps.constEnd();
+    for ( ; it != end; ++it )
+    {
+        // skip pixmaps that are still waiting to be rotated, and compact images
+        if ( it.key() == observer || it.value().m_rotation != m_rotation || !it.value().m_pixmap )
+            continue;
+
+        const QPixmap *pixmap = it.value().m_pixmap;
+        if ( pixmap->width() == width && pixmap->height() == height )
+            return pixmap;
+
+        if ( pixmap->width() >= 2 * width && pixmap->height() >= 2 * height
+             && ( !result || pixmap->width() < result->width() ) )
+            result = pixmap;
     }
+    return result;
 }
 
 QTransform PagePrivate::rotationMatrix() const
@@ -220,9 +296,7 @@ bool Page::hasPixmap( DocumentObserver *observer, int width, int height, const N
     if ( width == -1 || height == -1 )
         return true;
 
-    const QPixmap *pixmap = it.value().m_pixmap;
-
-    return (pixmap->width() == width && pixmap->height() == height);
+    return it.value().size() == QSize( width, height );
 }
 
 bool Page::hasTextPage() const
@@ -371,7 +445,7 @@ void PagePrivate::rotateAt( Rotation orientation )
 
         const PagePrivate::PixmapObject &object = it.value();
 
-        RotationJob *job = new RotationJob( object.m_pixmap->toImage(), object.m_rotation, m_rotation, it.key() );
+        RotationJob *job = new RotationJob( object.toImage(), object.m_rotation, m_rotation, it.key() );
         job->setPage( this );
         m_doc->m_pageController->addRotationJob(job);
     }
@@ -515,17 +589,7 @@ void Page::setPixmap( DocumentObserver *observer, QPixmap *pixmap, const Normali
             return;
         }
 
-        QMap< DocumentObserver*, PagePrivate::PixmapObject >::iterator it = d->m_pixmaps.find( observer );
-        if ( it != d->m_pixmaps.end() )
-        {
-            delete it.value().m_pixmap;
-        }
-        else
-        {
-            it = d->m_pixmaps.insert( observer, PagePrivate::PixmapObject() );
-        }
-        it.value().m_pixmap = pixmap;
-        it.value().m_rotation = d->m_rotation;
+        d->setRotatedPixmap( observer, pixmap );
     } else {
         RotationJob *job = new RotationJob( pixmap->toImage(), Rotation0, d->m_rotation, observer );
         job->setPage( d );
@@ -536,19 +600,53 @@ void Page::setPixmap( DocumentObserver *observer, QPixmap *pixmap, const Normali
     }
 }
 
-void Page::setTextPage( TextPage * textPage )
+void Page::setImage( DocumentObserver *observer, const QImage &image, const NormalizedRect &rect )
 {
-    delete d->m_text;
+    TraceScope traceScope( "Page::setImage", d->m_number );
 
-    d->m_text = textPage;
-    if ( d->m_text )
+    if ( !PagePrivate::isCompactImage( image ) || d->tilesManager( observer ) )
     {
-        d->m_text->d->m_page = d;
-        /**
-         * Correct text order for before text selection
-         */
-        d->m_text->d->correctTextOrder();
+        setPixmap( observer, new QPixmap( QPixmap::fromImage( image ) ), rect );
+        return;
+    }
+
+    if ( d->m_rotation == Rotation0 )
+    {
+        d->setRotatedImage( observer, image );
     }
+    else
+    {
+        RotationJob *job = new RotationJob( image, Rotation0, d->m_rotation, observer );
+        job->setPage( d );
+        d->m_doc->m_pageController->addRotationJob(job);
+    }
+}
+
+void Page::setTextPage( TextPage * textPage )
+{
+    if ( textPage )
+        d->analyzeTextPage( textPage );
+    d->setAnalyzedTextPage( textPage );
+}
+
+void PagePrivate::analyzeTextPage( TextPage *textPage )
+{
+    textPage->d->m_page = this;
+    /**
+     * Correct text order for before text selection
+     */
+    textPage->d->correctTextOrder();
+}
+
+void PagePrivate::setAnalyzedTextPage( TextPage *textPage )
+{
+    delete m_text;
+    m_text = textPage;
+}
+
+PagePrivate *PagePrivate::get( Page *page )
+{
+    return page->d;
 }
 
 void Page::setObjectRects( const QLinkedList< ObjectRect * > & rects )
@@ -769,6 +867,11 @@ void PagePrivate::deleteTextSelections()
     m_textSelections = 0;
 }
 
+qulonglong PagePrivate::textPageMemory() const
+{
+    return m_text ? m_text->d->memoryUsage() : 0;
+}
+
 void Page::deleteSourceReferences()
 {
     deleteObjectRects( m_rects, QSet<ObjectRect::ObjectType>() << ObjectRect::SourceRef );
@@ -966,7 +1069,7 @@ const QPixmap * Page::_o_nearestPixmap( DocumentObserver *observer, int w, int h
 
     const QPixmap * pixmap = 0;
 
-    // if a pixmap is present for given id, use it
+    // if a pixmap is present for given id, use it (it is 0 for compact images)
     QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator itPixmap = d->m_pixmaps.constFind( observer );
     if ( itPixmap != d->m_pixmaps.constEnd() )
         pixmap = itPixmap.value().m_pixmap;
@@ -977,6 +1080,9 @@ const QPixmap * Page::_o_nearestPixmap( DocumentObserver *observer, int w, int h
         QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator it = d->m_pixmaps.constBegin(), end = d->m_pixmaps.constEnd();
         for ( ; it != end; ++it )
         {
+            if ( !(*it).m_pixmap )
+                continue;
+
             int pixWidth = (*it).m_pixmap->width(),
                 distance = pixWidth > w ? pixWidth - w : w - pixWidth;
             if ( minDistance == -1 || distance < minDistance )
@@ -990,6 +1096,41 @@ const QPixmap * Page::_o_nearestPixmap( DocumentObserver *observer, int w, int h
     return pixmap;
 }
 
+const QImage * Page::_o_nearestImage( DocumentObserver *observer, int w, int h ) const
+{
+    Q_UNUSED( h )
+
+    const QImage * image = 0;
+
+    // same as _o_nearestPixmap(), for the pages kept as compact images
+    QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator itPixmap = d->m_pixmaps.constFind( observer );
+    if ( itPixmap != d->m_pixmaps.constEnd() )
+    {
+        if ( !itPixmap.value().m_pixmap )
+            image = &itPixmap.value().m_image;
+    }
+    else if ( !d->m_pixmaps.isEmpty() )
+    {
+        int minDistance = -1;
+        QMap< DocumentObserver*, PagePrivate::PixmapObject >::const_iterator it = d->m_pixmaps.constBegin(), end = d->m_pixmaps.constEnd();
+        for ( ; it != end; ++it )
+        {
+            if ( (*it).m_pixmap )
+                continue;
+
+            int imageWidth = (*it).m_image.width(),
+                distance = imageWidth > w ? imageWidth - w : w - imageWidth;
+            if ( minDistance == -1 || distance < minDistance )
+            {
+                image = &(*it).m_image;
+                minDistance = distance;
+            }
+        }
+    }
+
+    return image;
+}
+
 bool Page::hasTilesManager( const DocumentObserver *observer ) const
 {
     return d->tilesManager( observer ) != 0;
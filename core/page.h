@@ -17,6 +17,7 @@
 #include "global.h"
 #include "textpage.h"
 
+class QImage;
 class QPixmap;
 
 class PagePainter;
@@ -268,6 +269,17 @@ class OKULAR_EXPORT Page
          */
         void setPixmap( DocumentObserver *observer, QPixmap *pixmap, const NormalizedRect &rect = NormalizedRect() );
 
+        /**
+         * Sets the region described by @p rect with @p image for the
+         * given @p observer.
+         * Bilevel and 8 bit indexed images of the entire page are kept in
+         * their format, which takes much less memory than a pixmap; other
+         * images are converted to a pixmap.
+         *
+         * @since 0.23
+         */
+        void setImage( DocumentObserver *observer, const QImage &image, const NormalizedRect &rect = NormalizedRect() );
+
         /**
          * Sets the @p text page.
          */
@@ -401,6 +413,7 @@ class OKULAR_EXPORT Page
         /// @endcond
 
         const QPixmap * _o_nearestPixmap( DocumentObserver *, int, int ) const;
+        const QImage * _o_nearestImage( DocumentObserver *, int, int ) const;
 
         QLinkedList< ObjectRect* > m_rects;
         QLinkedList< HighlightAreaRect* > m_highlights;
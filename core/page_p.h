@@ -12,8 +12,10 @@
 #define _OKULAR_PAGE_PRIVATE_H_
 
 // qt/kde includes
+#include <qimage.h>
 #include <qlinkedlist.h>
 #include <qmap.h>
+#include <qpixmap.h>
 #include <qtransform.h>
 #include <qstring.h>
 #include <qdom.h>
@@ -104,6 +106,25 @@ class PagePrivate
          */
         void deleteTextSelections();
 
+        /**
+         * Returns the memory taken by the text page, in bytes, or 0 if there
+         * is no text page.
+         */
+        qulonglong textPageMemory() const;
+
+        /**
+         * Puts the text of @p textPage in reading order for the page. It
+         * does not change the page, so it may run in a text extraction
+         * thread.
+         */
+        void analyzeTextPage( TextPage *textPage );
+
+        /**
+         * Sets @p textPage, already put in order by analyzeTextPage(), as
+         * the text page.
+         */
+        void setAnalyzedTextPage( TextPage *textPage );
+
         /**
          * Get the tiles manager for the tiled @observer
          */
@@ -114,10 +135,49 @@ class PagePrivate
          */
         void setTilesManager( const DocumentObserver *observer, TilesManager *tm );
 
+        /**
+         * Sets the @p pixmap of the whole page for @p observer, without
+         * rotating it: the pixmap is already in the current orientation.
+         */
+        void setRotatedPixmap( DocumentObserver *observer, QPixmap *pixmap );
+
+        /**
+         * Same as setRotatedPixmap(), but for an image: compact images are
+         * kept as they are, the others are converted to a pixmap.
+         */
+        void setRotatedImage( DocumentObserver *observer, const QImage &image );
+
+        /**
+         * Whether @p image is in a format that is kept as it is in the page
+         * cache, instead of being converted to a 32 bit pixmap: bilevel
+         * and 8 bit indexed (e.g. grayscale) images.
+         */
+        static bool isCompactImage( const QImage &image );
+
+        static PagePrivate *get( Page *page );
+
+        /**
+         * Returns a pixmap of an observer other than @p observer that can be
+         * used for a @p width x @p height pixmap of the page, or 0 if there
+         * is none: either one of exactly that size, which can be shared, or
+         * the smallest one at least twice as big, which can be scaled down.
+         */
+        const QPixmap *reusablePixmap( const DocumentObserver *observer, int width, int height ) const;
+
         class PixmapObject
         {
             public:
+                PixmapObject() : m_pixmap( 0 ) {}
+
+                QSize size() const { return m_pixmap ? m_pixmap->size() : m_image.size(); }
+                QImage toImage() const { return m_pixmap ? m_pixmap->toImage() : m_image; }
+
+                void setPixmap( QPixmap *pixmap );
+                void setImage( const QImage &image );
+
+                // either m_pixmap is set, or the page is kept in the compact m_image
                 QPixmap *m_pixmap;
+                QImage m_image;
                 Rotation m_rotation;
         };
         QMap< DocumentObserver*, PixmapObject > m_pixmaps;
@@ -0,0 +1,161 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "pixmapdiskcache_p.h"
+
+#include <QtCore/QCryptographicHash>
+#include <QtCore/QDir>
+#include <QtCore/QFile>
+#include <QtCore/QFileInfo>
+#include <QtCore/QMutexLocker>
+
+#include <kdebug.h>
+#include <kglobal.h>
+#include <kstandarddirs.h>
+
+#ifdef Q_OS_WIN
+#include <sys/utime.h>
+#else
+#include <utime.h>
+#endif
+
+#include "debug_p.h"
+
+using namespace Okular;
+
+K_GLOBAL_STATIC( PixmapDiskCache, s_pixmapDiskCache )
+
+PixmapDiskCache::PixmapDiskCache()
+    : m_maximumSize( 0 ), m_totalSize( -1 )
+{
+    m_directory = KStandardDirs::locateLocal( "data", "okular/docdata/pixmaps/" );
+}
+
+PixmapDiskCache *PixmapDiskCache::self()
+{
+    return s_pixmapDiskCache;
+}
+
+QString PixmapDiskCache::key( const QString &documentId, int page, int width, int height,
+                              Rotation rotation, const QString &renderHints )
+{
+    return QString( "%1:%2:%3x%4:%5:%6" ).arg( documentId ).arg( page ).arg( width ).arg( height )
+                                         .arg( (int)rotation ).arg( renderHints );
+}
+
+void PixmapDiskCache::setMaximumSize( qint64 bytes )
+{
+    QMutexLocker locker( &m_mutex );
+    m_maximumSize = bytes;
+}
+
+bool PixmapDiskCache::contains( const QString &key ) const
+{
+    return QFile::exists( filePath( key ) );
+}
+
+QImage PixmapDiskCache::load( const QString &key )
+{
+    const QString path = filePath( key );
+    QImage image;
+    if ( !image.load( path, "PNG" ) )
+        return QImage();
+
+    // mark it as recently used
+    ::utime( QFile::encodeName( path ), 0 );
+    return image;
+}
+
+void PixmapDiskCache::store( const QString &key, const QImage &image )
+{
+    const QString path = filePath( key );
+    const QString partPath = path + ".part";
+    if ( !image.save( partPath, "PNG" ) )
+    {
+        kDebug(OkularDebug) << "Could not write the pixmap cache file" << partPath;
+        QFile::remove( partPath );
+        return;
+    }
+
+    QMutexLocker locker( &m_mutex );
+    const qint64 oldSize = QFileInfo( path ).size();
+    QFile::remove( path );
+    if ( !QFile::rename( partPath, path ) )
+    {
+        QFile::remove( partPath );
+        return;
+    }
+
+    if ( m_totalSize >= 0 )
+        m_totalSize += QFileInfo( path ).size() - oldSize;
+
+    if ( m_totalSize < 0 || m_totalSize > m_maximumSize )
+        trim();
+}
+
+QString PixmapDiskCache::filePath( const QString &key ) const
+{
+    const QByteArray hash = QCryptographicHash::hash( key.toUtf8(), QCryptographicHash::Sha1 ).toHex();
+    return m_directory + QString::fromLatin1( hash ) + ".png";
+}
+
+void PixmapDiskCache::trim()
+{
+    // newest first
+    const QFileInfoList entries = QDir( m_directory ).entryInfoList( QStringList() << "*.png", QDir::Files, QDir::Time );
+
+    m_totalSize = 0;
+    foreach ( const QFileInfo &entry, entries )
+        m_totalSize += entry.size();
+
+    if ( m_totalSize <= m_maximumSize )
+        return;
+
+    // leave some room, so that we do not trim on every store
+    const qint64 target = m_maximumSize / 10 * 9;
+    for ( int i = entries.count() - 1; i >= 0 && m_totalSize > target; --i )
+    {
+        if ( QFile::remove( entries.at( i ).absoluteFilePath() ) )
+            m_totalSize -= entries.at( i ).size();
+    }
+}
+
+PixmapDiskCacheJob::PixmapDiskCacheJob( const QString &key, const QImage &image )
+    : mKey( key ), mImage( image )
+{
+}
+
+void PixmapDiskCacheJob::run()
+{
+    PixmapDiskCache::self()->store( mKey, mImage );
+}
+
+PixmapDiskCacheLoadJob::PixmapDiskCacheLoadJob( const QString &key, PixmapRequest *request )
+    : mKey( key ), mRequest( request )
+{
+}
+
+PixmapRequest *PixmapDiskCacheLoadJob::request() const
+{
+    return mRequest;
+}
+
+QImage PixmapDiskCacheLoadJob::image() const
+{
+    return mImage;
+}
+
+void PixmapDiskCacheLoadJob::run()
+{
+    mImage = PixmapDiskCache::self()->load( mKey );
+}
+
+#include "pixmapdiskcache_p.moc"
+
+/* kate: replace-tabs on; indent-width 4; */
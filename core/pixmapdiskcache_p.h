@@ -0,0 +1,135 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_PIXMAPDISKCACHE_P_H_
+#define _OKULAR_PIXMAPDISKCACHE_P_H_
+
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtGui/QImage>
+
+#include <threadweaver/Job.h>
+
+#include "core/global.h"
+
+namespace Okular {
+
+class PixmapRequest;
+
+/**
+ * @short A cache of rendered pages kept on disk across sessions
+ *
+ * Pages are stored as compressed images in the docdata area, one file per
+ * key. The total size of the cache is capped; when it goes beyond the cap
+ * the least recently used images are removed.
+ *
+ * There is a single cache per process, shared by all the documents. All the
+ * methods are thread safe.
+ */
+class PixmapDiskCache
+{
+    public:
+        PixmapDiskCache();
+
+        static PixmapDiskCache *self();
+
+        /**
+         * Builds the key of a rendered page.
+         *
+         * @p documentId identifies the document (see DocumentPrivate::docDataFileName()),
+         * @p renderHints the settings that influence how the generator renders,
+         * including the ones of the generator itself, which it gives as the
+         * "RenderSettings" meta data.
+         */
+        static QString key( const QString &documentId, int page, int width, int height,
+                            Rotation rotation, const QString &renderHints );
+
+        /**
+         * Sets the maximum size of the cache, in bytes.
+         */
+        void setMaximumSize( qint64 bytes );
+
+        /**
+         * Whether an image is stored for @p key.
+         */
+        bool contains( const QString &key ) const;
+
+        /**
+         * Returns the image stored for @p key, or a null image if there is
+         * none. The image is marked as recently used.
+         */
+        QImage load( const QString &key );
+
+        /**
+         * Stores @p image for @p key, then trims the cache if it grew
+         * beyond its maximum size.
+         */
+        void store( const QString &key, const QImage &image );
+
+    private:
+        QString filePath( const QString &key ) const;
+        void trim();
+
+        mutable QMutex m_mutex;
+        QString m_directory;
+        qint64 m_maximumSize;
+        // -1 until the directory has been scanned
+        qint64 m_totalSize;
+};
+
+/**
+ * Stores a rendered page in the disk cache, away from the GUI thread.
+ */
+class PixmapDiskCacheJob : public ThreadWeaver::Job
+{
+    Q_OBJECT
+
+    public:
+        PixmapDiskCacheJob( const QString &key, const QImage &image );
+
+    protected:
+        virtual void run();
+
+    private:
+        const QString mKey;
+        const QImage mImage;
+};
+
+/**
+ * Loads the rendered page of a pixmap request from the disk cache, away
+ * from the GUI thread.
+ */
+class PixmapDiskCacheLoadJob : public ThreadWeaver::Job
+{
+    Q_OBJECT
+
+    public:
+        PixmapDiskCacheLoadJob( const QString &key, PixmapRequest *request );
+
+        PixmapRequest *request() const;
+
+        /**
+         * The image loaded, or a null image if it could not be.
+         */
+        QImage image() const;
+
+    protected:
+        virtual void run();
+
+    private:
+        const QString mKey;
+        PixmapRequest *mRequest;
+        QImage mImage;
+};
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,153 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "pixmaprequestqueue_p.h"
+
+#include "generator.h"
+
+using namespace Okular;
+
+bool PixmapRequestQueue::Key::operator<( const Key &other ) const
+{
+    if ( priority != other.priority )
+        return priority < other.priority;
+    if ( distance != other.distance )
+        return distance < other.distance;
+    return order < other.order;
+}
+
+PixmapRequestQueue::PixmapRequestQueue()
+    : m_counter( 0 )
+{
+}
+
+bool PixmapRequestQueue::isEmpty() const
+{
+    return m_queue.isEmpty();
+}
+
+int PixmapRequestQueue::count() const
+{
+    return m_queue.count();
+}
+
+void PixmapRequestQueue::enqueue( PixmapRequest *request, int distance )
+{
+    Q_ASSERT( request && !m_keys.contains( request ) );
+
+    Key key;
+    key.priority = request->priority();
+    key.distance = qAbs( distance );
+    // priority zero requests are served last in, first out
+    ++m_counter;
+    key.order = key.priority == 0 ? -m_counter : m_counter;
+
+    m_queue.insert( key, request );
+    m_keys.insert( request, key );
+    m_index[ request->observer() ].insert( request->pageNumber(), request );
+}
+
+PixmapRequest *PixmapRequestQueue::top() const
+{
+    if ( m_queue.isEmpty() )
+        return 0;
+
+    return m_queue.constBegin().value();
+}
+
+PixmapRequest *PixmapRequestQueue::takeTop()
+{
+    if ( m_queue.isEmpty() )
+        return 0;
+
+    QMap< Key, PixmapRequest * >::iterator it = m_queue.begin();
+    PixmapRequest *request = it.value();
+    m_queue.erase( it );
+    m_keys.remove( request );
+    removeFromIndex( request );
+    return request;
+}
+
+bool PixmapRequestQueue::remove( PixmapRequest *request )
+{
+    QHash< PixmapRequest *, Key >::iterator kIt = m_keys.find( request );
+    if ( kIt == m_keys.end() )
+        return false;
+
+    m_queue.remove( kIt.value() );
+    m_keys.erase( kIt );
+    removeFromIndex( request );
+    return true;
+}
+
+QList< PixmapRequest * > PixmapRequestQueue::takeRequests( DocumentObserver *observer )
+{
+    QList< PixmapRequest * > result;
+
+    QHash< DocumentObserver *, QMultiHash< int, PixmapRequest * > >::iterator oIt = m_index.find( observer );
+    if ( oIt == m_index.end() )
+        return result;
+
+    result = oIt.value().values();
+    m_index.erase( oIt );
+
+    foreach ( PixmapRequest *request, result )
+        m_queue.remove( m_keys.take( request ) );
+
+    return result;
+}
+
+QList< PixmapRequest * > PixmapRequestQueue::takeRequests( DocumentObserver *observer, int pageNumber )
+{
+    QList< PixmapRequest * > result;
+
+    QHash< DocumentObserver *, QMultiHash< int, PixmapRequest * > >::iterator oIt = m_index.find( observer );
+    if ( oIt == m_index.end() )
+        return result;
+
+    result = oIt.value().values( pageNumber );
+    if ( result.isEmpty() )
+        return result;
+
+    oIt.value().remove( pageNumber );
+    if ( oIt.value().isEmpty() )
+        m_index.erase( oIt );
+
+    foreach ( PixmapRequest *request, result )
+        m_queue.remove( m_keys.take( request ) );
+
+    return result;
+}
+
+QList< PixmapRequest * > PixmapRequestQueue::takeAll()
+{
+    const QList< PixmapRequest * > result = m_queue.values();
+    m_queue.clear();
+    m_keys.clear();
+    m_index.clear();
+    return result;
+}
+
+QList< PixmapRequest * > PixmapRequestQueue::requests() const
+{
+    return m_queue.values();
+}
+
+void PixmapRequestQueue::removeFromIndex( PixmapRequest *request )
+{
+    QHash< DocumentObserver *, QMultiHash< int, PixmapRequest * > >::iterator oIt = m_index.find( request->observer() );
+    if ( oIt == m_index.end() )
+        return;
+
+    oIt.value().remove( request->pageNumber(), request );
+    if ( oIt.value().isEmpty() )
+        m_index.erase( oIt );
+}
+
+/* kate: replace-tabs on; indent-width 4; */
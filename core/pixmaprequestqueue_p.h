@@ -0,0 +1,118 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_PIXMAPREQUESTQUEUE_P_H_
+#define _OKULAR_PIXMAPREQUESTQUEUE_P_H_
+
+#include <QtCore/QHash>
+#include <QtCore/QList>
+#include <QtCore/QMap>
+
+namespace Okular {
+
+class DocumentObserver;
+class PixmapRequest;
+
+/**
+ * @short The queue of pending pixmap requests
+ *
+ * Requests are kept sorted by priority (lower value first), then by their
+ * distance from the viewport at the time they were enqueued. Requests with
+ * the same priority and distance are served in the order they were enqueued,
+ * except for priority zero (synchronous) requests, where the most recent
+ * request comes first.
+ *
+ * Requests are also indexed by observer and page number, so that removing
+ * the previous requests of an observer does not need to walk the whole
+ * queue. All the operations are logarithmic in the number of queued
+ * requests (or linear in the number of removed ones).
+ *
+ * The queue does not own the requests.
+ */
+class PixmapRequestQueue
+{
+    public:
+        PixmapRequestQueue();
+
+        /**
+         * Whether there are no pending requests.
+         */
+        bool isEmpty() const;
+
+        /**
+         * The number of pending requests.
+         */
+        int count() const;
+
+        /**
+         * Adds @p request to the queue. @p distance is the distance
+         * (in pages) between the requested page and the current viewport.
+         */
+        void enqueue( PixmapRequest *request, int distance );
+
+        /**
+         * Returns the most important request, or 0 if the queue is empty.
+         */
+        PixmapRequest *top() const;
+
+        /**
+         * Removes the most important request from the queue and returns it,
+         * or 0 if the queue is empty.
+         */
+        PixmapRequest *takeTop();
+
+        /**
+         * Removes @p request from the queue. Returns whether it was queued.
+         */
+        bool remove( PixmapRequest *request );
+
+        /**
+         * Removes all the requests of @p observer and returns them.
+         */
+        QList< PixmapRequest * > takeRequests( DocumentObserver *observer );
+
+        /**
+         * Removes the requests of @p observer for @p pageNumber and returns them.
+         */
+        QList< PixmapRequest * > takeRequests( DocumentObserver *observer, int pageNumber );
+
+        /**
+         * Empties the queue, returning all the requests it contained.
+         */
+        QList< PixmapRequest * > takeAll();
+
+        /**
+         * Returns all the requests, most important first.
+         */
+        QList< PixmapRequest * > requests() const;
+
+    private:
+        struct Key
+        {
+            int priority;
+            int distance;
+            qint64 order;
+
+            bool operator<( const Key &other ) const;
+        };
+
+        void removeFromIndex( PixmapRequest *request );
+
+        QMap< Key, PixmapRequest * > m_queue;
+        QHash< PixmapRequest *, Key > m_keys;
+        // observer -> page number -> requests
+        QHash< DocumentObserver *, QMultiHash< int, PixmapRequest * > > m_index;
+        qint64 m_counter;
+};
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
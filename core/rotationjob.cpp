@@ -11,6 +11,8 @@
 
 #include <QtGui/QTransform>
 
+#include "trace_p.h"
+
 using namespace Okular;
 
 RotationJob::RotationJob( const QImage &image, Rotation oldRotation, Rotation newRotation, DocumentObserver *observer )
@@ -56,6 +58,8 @@ NormalizedRect RotationJob::rect() const
 
 void RotationJob::run()
 {
+    TraceScope traceScope( "RotationJob" );
+
     if ( mOldRotation == mNewRotation ) {
         mRotatedImage = mImage;
         return;
@@ -0,0 +1,74 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "sidefile_p.h"
+
+#include <QtCore/QByteArray>
+#include <QtCore/QDataStream>
+#include <QtCore/QFile>
+#include <QtCore/QString>
+
+#include <kdebug.h>
+
+#include "debug_p.h"
+
+bool Okular::readSideFile( const QString &fileName, quint32 magic, quint32 version, int pageCount, const QByteArray &documentId, QByteArray *payload )
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::ReadOnly ) )
+        return false;
+
+    QDataStream in( &file );
+    in.setVersion( QDataStream::Qt_4_6 );
+    quint32 fileMagic = 0, fileVersion = 0;
+    qint32 count = -1;
+    in >> fileMagic >> fileVersion >> count;
+    if ( in.status() != QDataStream::Ok || fileMagic != magic || fileVersion != version || count != pageCount )
+        return false;
+
+    QByteArray id;
+    in >> id;
+    if ( in.status() != QDataStream::Ok || id != documentId )
+    {
+        kDebug(OkularDebug) << "Ignoring" << fileName << "of another document";
+        return false;
+    }
+
+    in >> *payload;
+    if ( in.status() != QDataStream::Ok )
+    {
+        kWarning(OkularDebug) << "Truncated file" << fileName;
+        payload->clear();
+        return false;
+    }
+    return true;
+}
+
+bool Okular::writeSideFile( const QString &fileName, quint32 magic, quint32 version, int pageCount, const QByteArray &documentId, const QByteArray &payload )
+{
+    const QString partFileName = fileName + ".part";
+    QFile file( partFileName );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+        return false;
+
+    QDataStream out( &file );
+    out.setVersion( QDataStream::Qt_4_6 );
+    out << magic << version << (qint32)pageCount << documentId << payload;
+    file.close();
+    if ( out.status() != QDataStream::Ok || file.error() != QFile::NoError )
+    {
+        QFile::remove( partFileName );
+        return false;
+    }
+
+    QFile::remove( fileName );
+    return QFile::rename( partFileName, fileName );
+}
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,41 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_SIDEFILE_P_H_
+#define _OKULAR_SIDEFILE_P_H_
+
+#include <QtCore/QtGlobal>
+
+class QByteArray;
+class QString;
+
+namespace Okular
+{
+
+/**
+ * Reads @p payload from @p fileName, a file saved next to the document info
+ * file by writeSideFile(). Fails if the file is not of the format @p magic
+ * in its @p version, or was saved for a document other than @p documentId,
+ * of @p pageCount pages.
+ */
+bool readSideFile( const QString &fileName, quint32 magic, quint32 version, int pageCount, const QByteArray &documentId, QByteArray *payload );
+
+/**
+ * Saves @p payload to @p fileName, with a header of the format @p magic in
+ * its @p version and of the document @p documentId of @p pageCount pages.
+ * The file is written aside then renamed, so that a failure does not leave
+ * a truncated file.
+ */
+bool writeSideFile( const QString &fileName, quint32 magic, quint32 version, int pageCount, const QByteArray &documentId, const QByteArray &payload );
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
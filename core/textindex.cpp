@@ -0,0 +1,281 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "textindex_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QSet>
+#include <QtCore/QStringList>
+
+#include <kdebug.h>
+
+#include "debug_p.h"
+#include "sidefile_p.h"
+
+using namespace Okular;
+
+static const quint32 IndexMagic = 0x4f4b5458; // "OKTX"
+static const quint32 IndexVersion = 2;
+
+enum TermMatch
+{
+    ExactTerm,
+    PrefixTerm,     // the term starts the word
+    SuffixTerm,     // the term ends the word
+    SubstringTerm
+};
+
+// the hyphens are dropped: the search ignores the ones of line breaks
+static QString indexedWord( const QString &word )
+{
+    QString w = word;
+    w.remove( QLatin1Char( '-' ) );
+    return w;
+}
+
+// the words of @p text, case folded, split at white space
+static QStringList foldedWords( const QString &text )
+{
+    const QString folded = text.toCaseFolded();
+    QStringList words;
+    int start = -1;
+    for ( int i = 0; i <= folded.length(); ++i )
+    {
+        if ( i == folded.length() || folded.at( i ).isSpace() )
+        {
+            if ( start >= 0 )
+                words.append( folded.mid( start, i - start ) );
+            start = -1;
+        }
+        else if ( start < 0 )
+        {
+            start = i;
+        }
+    }
+    return words;
+}
+
+TextIndex::TextIndex()
+    : m_indexedCount( 0 ), m_modified( false )
+{
+}
+
+void TextIndex::clear( int pageCount )
+{
+    m_wordIds.clear();
+    m_words.clear();
+    m_pages.clear();
+    m_indexedPages = QBitArray( pageCount );
+    m_indexedCount = 0;
+    m_modified = false;
+}
+
+int TextIndex::pageCount() const
+{
+    return m_indexedPages.size();
+}
+
+bool TextIndex::isIndexed( int page ) const
+{
+    return page >= 0 && page < m_indexedPages.size() && m_indexedPages.testBit( page );
+}
+
+bool TextIndex::isComplete() const
+{
+    return m_indexedCount == m_indexedPages.size();
+}
+
+int TextIndex::nextUnindexedPage( int page ) const
+{
+    const int count = m_indexedPages.size();
+    if ( isComplete() || count == 0 )
+        return -1;
+
+    page = qBound( 0, page, count - 1 );
+    for ( int i = 0; i < count; ++i )
+    {
+        const int p = ( page + i ) % count;
+        if ( !m_indexedPages.testBit( p ) )
+            return p;
+    }
+    return -1;
+}
+
+void TextIndex::addPage( int page, const QString &text )
+{
+    if ( page < 0 || page >= m_indexedPages.size() || m_indexedPages.testBit( page ) )
+        return;
+
+    const QStringList words = foldedWords( text );
+    QSet< QString > pageWords;
+    for ( int i = 0; i < words.count(); ++i )
+    {
+        pageWords.insert( indexedWord( words.at( i ) ) );
+
+        // a word hyphenated at the end of a line goes on in the next one
+        if ( words.at( i ).endsWith( QLatin1Char( '-' ) ) )
+        {
+            QString joined = indexedWord( words.at( i ) );
+            for ( int j = i + 1; j < words.count(); ++j )
+            {
+                joined += indexedWord( words.at( j ) );
+                if ( !words.at( j ).endsWith( QLatin1Char( '-' ) ) )
+                    break;
+            }
+            pageWords.insert( joined );
+        }
+    }
+    pageWords.remove( QString() );
+
+    foreach ( const QString &word, pageWords )
+    {
+        QHash< QString, int >::const_iterator it = m_wordIds.constFind( word );
+        if ( it == m_wordIds.constEnd() )
+        {
+            it = m_wordIds.insert( word, m_words.count() );
+            m_words.append( word );
+            m_pages.append( QVector< int >() );
+        }
+
+        // pages are mostly indexed in order
+        QVector< int > &pages = m_pages[ it.value() ];
+        if ( pages.isEmpty() || pages.last() < page )
+            pages.append( page );
+        else
+            pages.insert( qLowerBound( pages.begin(), pages.end(), page ), page );
+    }
+
+    m_indexedPages.setBit( page );
+    ++m_indexedCount;
+    m_modified = true;
+}
+
+QBitArray TextIndex::matchingPages( const QString &term, int match ) const
+{
+    QBitArray result( m_indexedPages.size() );
+
+    if ( match == ExactTerm )
+    {
+        const int id = m_wordIds.value( term, -1 );
+        if ( id >= 0 )
+        {
+            foreach ( int page, m_pages.at( id ) )
+                result.setBit( page );
+        }
+        return result;
+    }
+
+    for ( int id = 0; id < m_words.count(); ++id )
+    {
+        const QString &word = m_words.at( id );
+        bool matches = false;
+        switch ( match )
+        {
+            case PrefixTerm:
+                matches = word.startsWith( term );
+                break;
+            case SuffixTerm:
+                matches = word.endsWith( term );
+                break;
+            default:
+                matches = word.contains( term );
+                break;
+        }
+        if ( matches )
+        {
+            foreach ( int page, m_pages.at( id ) )
+                result.setBit( page );
+        }
+    }
+    return result;
+}
+
+QBitArray TextIndex::candidatePages( const QString &query ) const
+{
+    // the search normalizes the query, not the text
+    const QStringList terms = foldedWords( query.normalized( QString::NormalizationForm_KC ) );
+
+    QBitArray matched = m_indexedPages;
+    for ( int i = 0; i < terms.count(); ++i )
+    {
+        const QString term = indexedWord( terms.at( i ) );
+        if ( term.isEmpty() )
+            continue;
+
+        // the words inside the query are whole words of the text
+        const bool first = i == 0;
+        const bool last = i == terms.count() - 1;
+        const int match = first && last ? SubstringTerm : first ? SuffixTerm : last ? PrefixTerm : ExactTerm;
+        matched &= matchingPages( term, match );
+    }
+
+    return matched | ~m_indexedPages;
+}
+
+bool TextIndex::isModified() const
+{
+    return m_modified;
+}
+
+bool TextIndex::load( const QString &fileName, int pageCount, const QByteArray &documentId )
+{
+    clear( pageCount );
+
+    QByteArray data;
+    if ( !readSideFile( fileName, IndexMagic, IndexVersion, pageCount, documentId, &data ) )
+        return false;
+
+    QDataStream payload( qUncompress( data ) );
+    payload.setVersion( QDataStream::Qt_4_6 );
+    QBitArray indexedPages;
+    QVector< QString > words;
+    QVector< QVector< int > > pages;
+    payload >> indexedPages >> words >> pages;
+    if ( payload.status() != QDataStream::Ok || indexedPages.size() != pageCount || words.count() != pages.count() )
+    {
+        kWarning(OkularDebug) << "Invalid text index" << fileName;
+        return false;
+    }
+
+    for ( int id = 0; id < words.count(); ++id )
+    {
+        foreach ( int page, pages.at( id ) )
+        {
+            if ( page < 0 || page >= pageCount )
+            {
+                clear( pageCount );
+                return false;
+            }
+        }
+        m_wordIds.insert( words.at( id ), id );
+    }
+    m_words = words;
+    m_pages = pages;
+    m_indexedPages = indexedPages;
+    m_indexedCount = indexedPages.count( true );
+    return true;
+}
+
+bool TextIndex::save( const QString &fileName, const QByteArray &documentId )
+{
+    QByteArray data;
+    {
+        QDataStream payload( &data, QIODevice::WriteOnly );
+        payload.setVersion( QDataStream::Qt_4_6 );
+        payload << m_indexedPages << m_words << m_pages;
+    }
+
+    if ( !writeSideFile( fileName, IndexMagic, IndexVersion, m_indexedPages.size(), documentId, qCompress( data ) ) )
+        return false;
+
+    m_modified = false;
+    return true;
+}
+
+/* kate: replace-tabs on; indent-width 4; */
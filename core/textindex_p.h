@@ -0,0 +1,105 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_TEXTINDEX_P_H_
+#define _OKULAR_TEXTINDEX_P_H_
+
+#include <QtCore/QBitArray>
+#include <QtCore/QHash>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+namespace Okular {
+
+/**
+ * @short An inverted index of the words of the pages of a document
+ *
+ * The index maps every word of the indexed pages, case folded, to the pages
+ * it is on. It tells the pages on which a text can not be found, so that a
+ * search does not need to extract and scan the text of those pages.
+ *
+ * The answers are a superset of the pages TextPage::findText() finds the
+ * text on: a query matches the words that end with its first word, start
+ * with its last one and are equal to the others. As the search ignores the
+ * hyphenation of line breaks, hyphens are left out of the index, and words
+ * ending with a hyphen are also indexed joined with the next ones.
+ */
+class TextIndex
+{
+    public:
+        TextIndex();
+
+        /**
+         * Empties the index, for a document of @p pageCount pages.
+         */
+        void clear( int pageCount = 0 );
+
+        int pageCount() const;
+
+        /**
+         * Whether the words of @p page are in the index.
+         */
+        bool isIndexed( int page ) const;
+
+        /**
+         * Whether all the pages are indexed.
+         */
+        bool isComplete() const;
+
+        /**
+         * Returns the first page from @p page on, wrapping around, that is not
+         * indexed, or -1 if the index is complete.
+         */
+        int nextUnindexedPage( int page ) const;
+
+        /**
+         * Adds the words of @p text, the text of @p page, to the index.
+         */
+        void addPage( int page, const QString &text );
+
+        /**
+         * Returns the pages on which @p query may be found: the indexed pages
+         * that contain all its words and the pages that are not indexed yet.
+         */
+        QBitArray candidatePages( const QString &query ) const;
+
+        /**
+         * Whether pages were added since the index was loaded or saved.
+         */
+        bool isModified() const;
+
+        /**
+         * Loads the index from @p fileName. Fails if the file is not a valid
+         * index of a document of @p pageCount pages, or was saved for a
+         * document other than @p documentId.
+         */
+        bool load( const QString &fileName, int pageCount, const QByteArray &documentId );
+
+        /**
+         * Saves the index to @p fileName, for the document @p documentId.
+         */
+        bool save( const QString &fileName, const QByteArray &documentId );
+
+    private:
+        QBitArray matchingPages( const QString &term, int match ) const;
+
+        QHash< QString, int > m_wordIds;
+        QVector< QString > m_words;
+        // the pages of each word, in increasing order
+        QVector< QVector< int > > m_pages;
+        QBitArray m_indexedPages;
+        int m_indexedCount;
+        bool m_modified;
+};
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,223 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "textlayoutcache_p.h"
+
+#include <QtCore/QDataStream>
+#include <QtCore/QMutexLocker>
+
+#include <kdebug.h>
+
+#include <climits>
+
+#include "debug_p.h"
+#include "sidefile_p.h"
+
+using namespace Okular;
+
+static const quint32 CacheMagic = 0x4f4b544c; // "OKTL"
+static const quint32 CacheVersion = 2;
+
+// a space in the encoded order, that no difference of positions can be
+static const qint32 SpaceMarker = INT_MIN;
+
+TextLayoutCache::TextLayoutCache()
+    : m_memory( 0 ), m_maxMemory( ~Q_UINT64_C(0) ), m_modified( false )
+{
+}
+
+void TextLayoutCache::clear( int pageCount )
+{
+    QMutexLocker locker( &m_mutex );
+    m_keys = QVector< QByteArray >( pageCount );
+    m_layouts = QVector< QByteArray >( pageCount );
+    m_memory = 0;
+    m_modified = false;
+}
+
+int TextLayoutCache::pageCount() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_keys.count();
+}
+
+void TextLayoutCache::setMaxMemory( qulonglong maxMemory )
+{
+    QMutexLocker locker( &m_mutex );
+    m_maxMemory = maxMemory;
+    trim( 0 );
+}
+
+qulonglong TextLayoutCache::memory() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_memory;
+}
+
+void TextLayoutCache::trim( int page )
+{
+    const int count = m_keys.count();
+    for ( int distance = qMax( page, count - 1 - page ); distance > 0 && m_memory > m_maxMemory; --distance )
+    {
+        const int pages[2] = { page - distance, page + distance };
+        for ( int i = 0; i < 2; ++i )
+        {
+            const int p = pages[ i ];
+            if ( p < 0 || p >= count || m_keys.at( p ).isEmpty() )
+                continue;
+
+            m_memory -= m_keys.at( p ).size() + m_layouts.at( p ).size();
+            m_keys[ p ].clear();
+            m_layouts[ p ].clear();
+        }
+    }
+}
+
+bool TextLayoutCache::layout( int page, const QByteArray &key, QVector< int > *order, QVector< float > *spaceAreas ) const
+{
+    QByteArray layout;
+    {
+        QMutexLocker locker( &m_mutex );
+        if ( page < 0 || page >= m_keys.count() || key.isEmpty() || m_keys.at( page ) != key )
+            return false;
+        layout = m_layouts.at( page );
+    }
+
+    QDataStream in( qUncompress( layout ) );
+    in.setVersion( QDataStream::Qt_4_6 );
+    in.setFloatingPointPrecision( QDataStream::SinglePrecision );
+    QVector< qint32 > encoded;
+    QVector< float > areas;
+    in >> encoded >> areas;
+    if ( in.status() != QDataStream::Ok )
+        return false;
+
+    // the characters are stored as the difference of their position to
+    // the one following the previous character, mostly 0
+    order->clear();
+    order->reserve( encoded.count() );
+    int spaces = 0;
+    qint64 previous = -1;
+    foreach ( qint32 value, encoded )
+    {
+        if ( value == SpaceMarker )
+        {
+            order->append( -1 );
+            ++spaces;
+            continue;
+        }
+
+        const qint64 position = previous + 1 + value;
+        if ( position < 0 || position > INT_MAX )
+            return false;
+        order->append( (int)position );
+        previous = position;
+    }
+    if ( areas.count() != 4 * spaces )
+        return false;
+
+    *spaceAreas = areas;
+    return true;
+}
+
+void TextLayoutCache::setLayout( int page, const QByteArray &key, const QVector< int > &order, const QVector< float > &spaceAreas )
+{
+    QVector< qint32 > encoded;
+    encoded.reserve( order.count() );
+    int previous = -1;
+    foreach ( int position, order )
+    {
+        if ( position < 0 )
+        {
+            encoded.append( SpaceMarker );
+            continue;
+        }
+        encoded.append( position - previous - 1 );
+        previous = position;
+    }
+
+    QByteArray data;
+    {
+        QDataStream payload( &data, QIODevice::WriteOnly );
+        payload.setVersion( QDataStream::Qt_4_6 );
+        payload.setFloatingPointPrecision( QDataStream::SinglePrecision );
+        payload << encoded << spaceAreas;
+    }
+
+    const QByteArray layout = qCompress( data );
+
+    QMutexLocker locker( &m_mutex );
+    if ( page < 0 || page >= m_keys.count() )
+        return;
+
+    m_memory -= m_keys.at( page ).size() + m_layouts.at( page ).size();
+    m_keys[ page ] = key;
+    m_layouts[ page ] = layout;
+    m_memory += key.size() + layout.size();
+    m_modified = true;
+    trim( page );
+}
+
+bool TextLayoutCache::isModified() const
+{
+    QMutexLocker locker( &m_mutex );
+    return m_modified;
+}
+
+bool TextLayoutCache::load( const QString &fileName, int pageCount, const QByteArray &documentId )
+{
+    clear( pageCount );
+
+    QByteArray data;
+    if ( !readSideFile( fileName, CacheMagic, CacheVersion, pageCount, documentId, &data ) )
+        return false;
+
+    QDataStream in( data );
+    in.setVersion( QDataStream::Qt_4_6 );
+    QVector< QByteArray > keys, layouts;
+    in >> keys >> layouts;
+    if ( in.status() != QDataStream::Ok || keys.count() != pageCount || layouts.count() != pageCount )
+    {
+        kWarning(OkularDebug) << "Invalid text layout cache" << fileName;
+        return false;
+    }
+
+    QMutexLocker locker( &m_mutex );
+    m_keys = keys;
+    m_layouts = layouts;
+    for ( int i = 0; i < pageCount; ++i )
+        m_memory += keys.at( i ).size() + layouts.at( i ).size();
+    trim( 0 );
+    return true;
+}
+
+bool TextLayoutCache::save( const QString &fileName, const QByteArray &documentId )
+{
+    m_mutex.lock();
+    const QVector< QByteArray > keys = m_keys;
+    const QVector< QByteArray > layouts = m_layouts;
+    m_mutex.unlock();
+
+    // the layouts are compressed already
+    QByteArray data;
+    {
+        QDataStream out( &data, QIODevice::WriteOnly );
+        out.setVersion( QDataStream::Qt_4_6 );
+        out << keys << layouts;
+    }
+
+    if ( !writeSideFile( fileName, CacheMagic, CacheVersion, keys.count(), documentId, data ) )
+        return false;
+
+    QMutexLocker locker( &m_mutex );
+    m_modified = false;
+    return true;
+}
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,108 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_TEXTLAYOUTCACHE_P_H_
+#define _OKULAR_TEXTLAYOUTCACHE_P_H_
+
+#include <QtCore/QByteArray>
+#include <QtCore/QMutex>
+#include <QtCore/QString>
+#include <QtCore/QVector>
+
+namespace Okular {
+
+/**
+ * @short The reading order of the text of the pages of a document
+ *
+ * The layout analysis of a TextPage puts the characters the generator gives
+ * in reading order and adds spaces between the words. The cache keeps its
+ * result for each page, compressed: the position of each character of the
+ * ordered text in the text of the generator, and the areas of the spaces.
+ * When the text of a page is extracted again, after it was unloaded or when
+ * the document is opened again, it is put in order from the cache instead
+ * of analyzing its layout again.
+ *
+ * The layout of a page is stored with a key of the text it was made from,
+ * so that it is not used for any other text.
+ *
+ * The text extraction threads analyze the layouts, so all the methods are
+ * thread safe.
+ */
+class TextLayoutCache
+{
+    public:
+        TextLayoutCache();
+
+        /**
+         * Empties the cache, for a document of @p pageCount pages.
+         */
+        void clear( int pageCount = 0 );
+
+        int pageCount() const;
+
+        /**
+         * Sets the memory the layouts may take, in bytes. Beyond it, the
+         * layouts of the pages farthest from the one stored last are dropped.
+         */
+        void setMaxMemory( qulonglong maxMemory );
+
+        /**
+         * The memory the layouts take, in bytes.
+         */
+        qulonglong memory() const;
+
+        /**
+         * Gets the layout of @p page, if it was made from the text of key
+         * @p key: in @p order the position of each character in the text,
+         * or -1 for a space, and in @p spaceAreas the left, top, right and
+         * bottom of each space, one after the other.
+         */
+        bool layout( int page, const QByteArray &key, QVector< int > *order, QVector< float > *spaceAreas ) const;
+
+        /**
+         * Stores the layout of @p page, made from the text of key @p key.
+         */
+        void setLayout( int page, const QByteArray &key, const QVector< int > &order, const QVector< float > &spaceAreas );
+
+        /**
+         * Whether layouts were stored since the cache was loaded or saved.
+         */
+        bool isModified() const;
+
+        /**
+         * Loads the cache from @p fileName. Fails if the file is not a valid
+         * cache of a document of @p pageCount pages, or was saved for a
+         * document other than @p documentId.
+         */
+        bool load( const QString &fileName, int pageCount, const QByteArray &documentId );
+
+        /**
+         * Saves the cache to @p fileName, for the document @p documentId.
+         */
+        bool save( const QString &fileName, const QByteArray &documentId );
+
+    private:
+        // drops the layouts farthest from @p page until they fit, with the
+        // mutex locked
+        void trim( int page );
+
+        // the key and the compressed layout of each page, empty if unknown
+        QVector< QByteArray > m_keys;
+        QVector< QByteArray > m_layouts;
+        qulonglong m_memory;
+        qulonglong m_maxMemory;
+        bool m_modified;
+        mutable QMutex m_mutex;
+};
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
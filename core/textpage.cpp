@@ -14,13 +14,21 @@
 
 #include "area.h"
 #include "debug_p.h"
+#include "document_p.h"
 #include "misc.h"
 #include "page.h"
 #include "page_p.h"
 
+#include <algorithm>
+#include <cfloat>
+#include <climits>
+#include <cmath>
 #include <cstring>
+#include <new>
 
 #include <QtAlgorithms>
+#include <QCryptographicHash>
+#include <QHash>
 #include <QVarLengthArray>
 
 using namespace Okular;
@@ -33,35 +41,16 @@ class SearchPoint
         {
         }
 
-        /** The TinyTextEntity containing the first character of the match. */
-        TextList::ConstIterator it_begin;
-
-        /** The TinyTextEntity containing the last character of the match. */
-        TextList::ConstIterator it_end;
-
-        /** The index of the first character of the match in (*it_begin)->text().
-         *  Satisfies 0 <= offset_begin < (*it_begin)->text().length().
+        /** The index of the first character of the match in the search text.
+         *  Satisfies 0 <= offset_begin < offset_end.
          */
         int offset_begin;
 
-        /** One plus the index of the last character of the match in (*it_end)->text().
-         *  Satisfies 0 < offset_end <= (*it_end)->text().length().
+        /** One plus the index of the last character of the match in the search text.
          */
         int offset_end;
 };
 
-/* text comparison functions */
-
-static bool CaseInsensitiveCmpFn( const QStringRef & from, const QStringRef & to )
-{
-    return from.compare( to, Qt::CaseInsensitive ) == 0;
-}
-
-static bool CaseSensitiveCmpFn( const QStringRef & from, const QStringRef & to )
-{
-    return from.compare( to, Qt::CaseSensitive ) == 0;
-}
-
 
 /**
  * Returns true iff segments [@p left1, @p right1] and [@p left2, @p right2] on the real line
@@ -108,82 +97,138 @@ static bool doesConsumeY(const NormalizedRect& first, const NormalizedRect& seco
 /*
   Rationale behind TinyTextEntity:
 
-  instead of storing directly a QString for the text of an entity,
-  we store the UTF-16 data and their length. This way, we save about
-  4 int's wrt a QString, and we can create a new string from that
-  raw data (that's the only penalty of that).
-  Even better, if the string we need to store has at most
-  MaxStaticChars characters, then we store those in place of the QChar*
-  that would be used (with new[] + free[]) for the data.
+  a page has an entity for every character of its text, so they have to
+  be small: instead of a QString and a NormalizedRect of doubles, an
+  entity keeps a pointer to its UTF-16 data, their length and the
+  coordinates of its area as floats, that are precise enough for
+  normalized coordinates. The entities and their text do not own any
+  memory: they are allocated one after the other in the TextArena of the
+  page, which releases them all at once, and the text is created from
+  that raw data (that's the only penalty of that).
  */
 class TinyTextEntity
 {
-    static const int MaxStaticChars = sizeof( QChar * ) / sizeof( QChar );
-
     public:
-        TinyTextEntity( const QString &text, const NormalizedRect &rect )
-            : area( rect )
+        TinyTextEntity( const QChar *text, int length, const NormalizedRect &rect )
+            : m_text( text ), m_left( rect.left ), m_top( rect.top ),
+              m_right( rect.right ), m_bottom( rect.bottom ), m_length( length )
         {
-            Q_ASSERT_X( !text.isEmpty(), "TinyTextEntity", "empty string" );
-            Q_ASSERT_X( sizeof( d ) == sizeof( QChar * ), "TinyTextEntity",
-                        "internal storage is wider than QChar*, fix it!" );
-            length = text.length();
-            switch ( length )
-            {
-#if QT_POINTER_SIZE >= 8
-                case 4:
-                    d.qc[3] = text.at( 3 ).unicode();
-                    // fall through
-                case 3:
-                    d.qc[2] = text.at( 2 ).unicode();
-                    // fall through
-#endif
-                case 2:
-                    d.qc[1] = text.at( 1 ).unicode();
-                    // fall through
-                case 1:
-                    d.qc[0] = text.at( 0 ).unicode();
-                    break;
-                default:
-                    d.data = new QChar[ length ];
-                    std::memcpy( d.data, text.constData(), length * sizeof( QChar ) );
-            }
+            Q_ASSERT_X( length > 0, "TinyTextEntity", "empty string" );
         }
 
-        ~TinyTextEntity()
+        inline QString text() const
         {
-            if ( length > MaxStaticChars )
-            {
-                delete [] d.data;
-            }
+            return QString::fromRawData( m_text, m_length );
         }
 
-        inline QString text() const
+        // a copy of the text, that can outlive the arena
+        inline QString textCopy() const
         {
-            return length <= MaxStaticChars ? QString::fromRawData( ( const QChar * )&d.qc[0], length )
-                                            : QString::fromRawData( d.data, length );
+            return QString( m_text, m_length );
+        }
+
+        inline int length() const
+        {
+            return m_length;
+        }
+
+        inline NormalizedRect area() const
+        {
+            return NormalizedRect( m_left, m_top, m_right, m_bottom );
         }
 
         inline NormalizedRect transformedArea( const QTransform &matrix ) const
         {
-            NormalizedRect transformed_area = area;
+            NormalizedRect transformed_area = area();
             transformed_area.transform( matrix );
             return transformed_area;
         }
 
-        NormalizedRect area;
-
     private:
         Q_DISABLE_COPY( TinyTextEntity )
 
-        union
-        {
-            QChar *data;
-            ushort qc[MaxStaticChars];
-        } d;
-        int length;
+        const QChar *m_text;
+        float m_left, m_top, m_right, m_bottom;
+        int m_length;
 };
 
+// the blocks of a TextArena grow with it between these sizes, unless it
+// is reserved exactly
+static const size_t TextArenaMinBlockSize = 4 * 1024;
+static const size_t TextArenaMaxBlockSize = 64 * 1024;
+
+TextArena::TextArena()
+    : m_entities( 0 ), m_entitiesLeft( 0 ), m_text( 0 ), m_textLeft( 0 ), m_memory( 0 )
+{
+}
+
+TextArena::~TextArena()
+{
+    // the entities have nothing to destroy
+    foreach ( char *block, m_blocks )
+        delete [] block;
+}
+
+size_t TextArena::nextBlockSize() const
+{
+    return qBound( TextArenaMinBlockSize, (size_t)m_memory, TextArenaMaxBlockSize );
+}
+
+char *TextArena::allocateBlock( size_t size )
+{
+    char *block = new char[ size ];
+    m_blocks.append( block );
+    m_memory += size;
+    return block;
+}
+
+void TextArena::reserve( int entities, int characters )
+{
+    const size_t entitiesSize = entities * sizeof( TinyTextEntity );
+    const size_t textSize = characters * sizeof( QChar );
+    if ( entitiesSize > m_entitiesLeft )
+    {
+        m_entities = allocateBlock( entitiesSize );
+        m_entitiesLeft = entitiesSize;
+    }
+    if ( textSize > m_textLeft )
+    {
+        m_text = allocateBlock( textSize );
+        m_textLeft = textSize;
+    }
+}
+
+TinyTextEntity *TextArena::create( const QString &text, const NormalizedRect &rect )
+{
+    const size_t textSize = text.length() * sizeof( QChar );
+    if ( textSize > m_textLeft )
+    {
+        m_textLeft = qMax( textSize, nextBlockSize() );
+        m_text = allocateBlock( m_textLeft );
+    }
+    QChar *data = reinterpret_cast< QChar * >( m_text );
+    std::memcpy( data, text.constData(), textSize );
+    m_text += textSize;
+    m_textLeft -= textSize;
+
+    if ( sizeof( TinyTextEntity ) > m_entitiesLeft )
+    {
+        // new[] returns memory aligned for any object
+        const size_t blockSize = nextBlockSize();
+        m_entitiesLeft = blockSize - blockSize % sizeof( TinyTextEntity );
+        m_entities = allocateBlock( m_entitiesLeft );
+    }
+    TinyTextEntity *entity = new ( m_entities ) TinyTextEntity( data, text.length(), rect );
+    m_entities += sizeof( TinyTextEntity );
+    m_entitiesLeft -= sizeof( TinyTextEntity );
+    return entity;
+}
+
+qulonglong TextArena::memoryUsage() const
+{
+    return m_memory;
+}
+
 
 TextEntity::TextEntity( const QString &text, NormalizedRect *area )
     : m_text( text ), m_area( area ), d( 0 )
@@ -214,14 +259,15 @@ NormalizedRect TextEntity::transformedArea(const QTransform &matrix) const
 
 
 TextPagePrivate::TextPagePrivate()
-    : m_page( 0 )
+    : m_arena( new TextArena() ), m_page( 0 ), m_gridSize( 0 ), m_gridLeft( 0 ), m_gridTop( 0 ),
+      m_gridCellWidth( 0 ), m_gridCellHeight( 0 )
 {
 }
 
 TextPagePrivate::~TextPagePrivate()
 {
     qDeleteAll( m_searchPoints );
-    qDeleteAll( m_words );
+    delete m_arena;
 }
 
 
@@ -238,7 +284,7 @@ TextPage::TextPage( const TextEntity::List &words )
     {
         TextEntity *e = *it;
         if ( !e->text().isEmpty() )
-            d->m_words.append( new TinyTextEntity( e->text(), *e->area() ) );
+            d->m_words.append( d->m_arena->create( e->text(), *e->area() ) );
         delete e;
     }
 }
@@ -251,7 +297,11 @@ TextPage::~TextPage()
 void TextPage::append( const QString &text, NormalizedRect *area )
 {
     if ( !text.isEmpty() )
-        d->m_words.append( new TinyTextEntity( text.normalized(QString::NormalizationForm_KC), *area ) );
+    {
+        d->m_words.append( d->m_arena->create( text.normalized(QString::NormalizationForm_KC), *area ) );
+        d->clearSearchText();
+        d->clearGrid();
+    }
     delete area;
 }
 
@@ -267,9 +317,9 @@ struct WordWithCharacters
         return word->text();
     }
     
-    inline const NormalizedRect &area() const
+    inline NormalizedRect area() const
     {
-      return word->area;
+      return word->area();
     }
     
     TinyTextEntity *word;
@@ -535,34 +585,35 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
     TextList::ConstIterator start = it, end = itEnd, tmpIt = it; //, tmpItEnd = itEnd;
     const MergeSide side = d->m_page ? (MergeSide)d->m_page->m_page->totalOrientation() : MergeRight;
 
-    NormalizedRect tmp;
-    //case 2(a)
-    for ( ; it != itEnd; ++it )
+    //case 2(a), the last entities that contain the points
+    foreach ( int i, d->wordsNear( NormalizedRect( startC.x, startC.y, startC.x, startC.y ) ) )
     {
-        tmp = (*it)->area;
-        if(tmp.contains(startC.x,startC.y)){
-            start = it;
-        }
-        if(tmp.contains(endC.x,endC.y)){
-            end = it;
-        }
+        if ( d->m_words.at( i )->area().contains( startC.x, startC.y ) )
+            start = tmpIt + i;
+    }
+    foreach ( int i, d->wordsNear( NormalizedRect( endC.x, endC.y, endC.x, endC.y ) ) )
+    {
+        if ( d->m_words.at( i )->area().contains( endC.x, endC.y ) )
+            end = tmpIt + i;
     }
 
     //case 2(b)
-    it = tmpIt;
     if(start == it && end == itEnd)
     {
-        for ( ; it != itEnd; ++it )
+        // is there any text reactangle within the start_end rect
+        bool found = false;
+        foreach ( int i, d->wordsNear( start_end ) )
         {
-            // is there any text reactangle within the start_end rect
-            tmp = (*it)->area;
-            if(start_end.intersects(tmp))
+            if ( start_end.intersects( d->m_words.at( i )->area() ) )
+            {
+                found = true;
                 break;
+            }
         }
 
         // we have searched every text entities, but none is within the rectangle created by start and end
         // so, no selection should be done
-        if(it == itEnd)
+        if(!found)
         {
             return ret;
         }
@@ -576,32 +627,33 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
         bool flagV = false;
         NormalizedRect rect;
 
-        // selection type 01
+        // selection type 01: the first entity right to and not above the start
         if(startC.y <= endC.y)
         {
-            for ( ; it != itEnd; ++it )
+            foreach ( int i, d->wordsNear( NormalizedRect( startC.x, startC.y, DBL_MAX, DBL_MAX ) ) )
             {
-                rect= (*it)->area;
+                rect= d->m_words.at( i )->area();
                 rect.isBottom(startC) ? flagV = false: flagV = true;
 
                 if(flagV && rect.isRight(startC))
                 {
-                    start = it;
+                    start = tmpIt + i;
                     break;
                 }
             }
         }
 
-        //selection type 02
+        //selection type 02: the nearest entity right to and not below the start
         else
         {
             selection_two_start = true;
             int distance = scaleX + scaleY + 100;
             int count = 0;
 
-            for ( ; it != itEnd; ++it )
+            foreach ( int i, d->wordsNear( NormalizedRect( startC.x, -DBL_MAX, DBL_MAX, startC.y ) ) )
             {
-                rect= (*it)->area;
+                it = tmpIt + i;
+                rect= (*it)->area();
 
                 if(rect.isBottomOrLevel(startC) && rect.isRight(startC))
                 {
@@ -629,16 +681,18 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
     if(end == itEnd)
     {
         it = tmpIt;
-        itEnd = itEnd-1;
 
         bool flagV = false;
         NormalizedRect rect;
 
+        // the last entity left to and not below the end
         if(startC.y <= endC.y)
         {
-            for ( ; itEnd >= it; itEnd-- )
+            const QVector< int > candidates = d->wordsNear( NormalizedRect( -DBL_MAX, -DBL_MAX, endC.x, endC.y ) );
+            for ( int k = candidates.count() - 1; k >= 0; --k )
             {
-                rect= (*itEnd)->area;
+                itEnd = it + candidates.at( k );
+                rect= (*itEnd)->area();
                 rect.isTop(endC) ? flagV = false: flagV = true;
 
                 if(flagV && rect.isLeft(endC))
@@ -649,12 +703,15 @@ RegularAreaRect * TextPage::textArea ( TextSelection * sel) const
             }
         }
 
+        // the nearest entity left to and not above the end
         else
         {
             int distance = scaleX + scaleY + 100;
-            for ( ; itEnd >= it; itEnd-- )
+            const QVector< int > candidates = d->wordsNear( NormalizedRect( -DBL_MAX, endC.y, endC.x, DBL_MAX ) );
+            for ( int k = candidates.count() - 1; k >= 0; --k )
             {
-                rect= (*itEnd)->area;
+                itEnd = it + candidates.at( k );
+                rect= (*itEnd)->area();
 
                 if(rect.isTopOrLevel(endC) && rect.isLeft(endC))
                 {
@@ -719,9 +776,6 @@ RegularAreaRect* TextPage::findText( int searchID, const QString &query, SearchD
     // invalid search request
     if ( d->m_words.isEmpty() || query.isEmpty() || ( area && area->isNull() ) )
         return 0;
-    TextList::ConstIterator start;
-    int start_offset = 0;
-    TextList::ConstIterator end;
     const QMap< int, SearchPoint* >::const_iterator sIt = d->m_searchPoints.constFind( searchID );
     if ( sIt == d->m_searchPoints.constEnd() )
     {
@@ -732,43 +786,22 @@ RegularAreaRect* TextPage::findText( int searchID, const QString &query, SearchD
         else if ( dir == PreviousResult )
             dir = FromBottom;
     }
-    bool forward = true;
+    RegularAreaRect* ret = 0;
     switch ( dir )
     {
         case FromTop:
-            start = d->m_words.constBegin();
-            start_offset = 0;
-            end = d->m_words.constEnd();
+            ret = d->findTextInternalForward( searchID, query, caseSensitivity, 0 );
             break;
         case FromBottom:
-            start = d->m_words.constEnd();
-            start_offset = 0;
-            end = d->m_words.constBegin();
-            forward = false;
+            ret = d->findTextInternalBackward( searchID, query, caseSensitivity, d->searchText( caseSensitivity ).length() );
             break;
         case NextResult:
-            start = (*sIt)->it_end;
-            start_offset = (*sIt)->offset_end;
-            end = d->m_words.constEnd();
+            ret = d->findTextInternalForward( searchID, query, caseSensitivity, (*sIt)->offset_end );
             break;
         case PreviousResult:
-            start = (*sIt)->it_begin;
-            start_offset = (*sIt)->offset_begin;
-            end = d->m_words.constBegin();
-            forward = false;
+            ret = d->findTextInternalBackward( searchID, query, caseSensitivity, (*sIt)->offset_begin );
             break;
     };
-    RegularAreaRect* ret = 0;
-    const TextComparisonFunction cmpFn = caseSensitivity == Qt::CaseSensitive
-                                       ? CaseSensitiveCmpFn : CaseInsensitiveCmpFn;
-    if ( forward )
-    {
-        ret = d->findTextInternalForward( searchID, query, cmpFn, start, start_offset, end );
-    }
-    else
-    {
-        ret = d->findTextInternalBackward( searchID, query, cmpFn, start, start_offset, end );
-    }
     return ret;
 }
 
@@ -798,8 +831,8 @@ static int stringLengthAdaptedWithHyphen(const QString &str, const TextList::Con
             else
             {
                 // 2. if the next word is in a different line or not
-                const NormalizedRect& hyphenArea = (*it)->area;
-                const NormalizedRect& lookaheadArea = (*(it + 1))->area;
+                const NormalizedRect hyphenArea = (*it)->area();
+                const NormalizedRect lookaheadArea = (*(it + 1))->area();
 
                 // lookahead to check whether both the '-' rect and next character rect overlap
                 if( !doesConsumeY( hyphenArea, lookaheadArea, 70 ) )
@@ -818,251 +851,248 @@ static int stringLengthAdaptedWithHyphen(const QString &str, const TextList::Con
     return len;
 }
 
-RegularAreaRect* TextPagePrivate::searchPointToArea(const SearchPoint* sp)
+const QString &TextPagePrivate::searchText( Qt::CaseSensitivity caseSensitivity )
 {
-    const QTransform matrix = m_page ? m_page->rotationMatrix() : QTransform();
-    RegularAreaRect* ret=new RegularAreaRect;
-
-    for (TextList::ConstIterator it = sp->it_begin; ; it++)
+    if ( m_searchTextOffsets.isEmpty() )
     {
-        const TinyTextEntity* curEntity = *it;
-        ret->append( curEntity->transformedArea( matrix ) );
-
-        if (it == sp->it_end) {
-            break;
+        m_searchTextOffsets.reserve( m_words.count() + 1 );
+        const TextList::ConstIterator itEnd = m_words.constEnd();
+        for ( TextList::ConstIterator it = m_words.constBegin(); it != itEnd; ++it )
+        {
+            m_searchTextOffsets.append( m_searchText.length() );
+            const QString str = (*it)->text();
+            m_searchText.append( str.leftRef( stringLengthAdaptedWithHyphen( str, it, itEnd ) ) );
         }
+        m_searchTextOffsets.append( m_searchText.length() );
+        m_searchText.squeeze();
     }
 
-    ret->simplify();
-    return ret;
+    if ( caseSensitivity == Qt::CaseSensitive )
+        return m_searchText;
+
+    // simple case folding keeps the length, and so the offsets of the words
+    if ( m_foldedSearchText.isEmpty() && !m_searchText.isEmpty() )
+    {
+        m_foldedSearchText = m_searchText.toCaseFolded();
+        Q_ASSERT( m_foldedSearchText.length() == m_searchText.length() );
+    }
+    return m_foldedSearchText;
 }
 
-RegularAreaRect* TextPagePrivate::findTextInternalForward( int searchID, const QString &_query,
-                                                             TextComparisonFunction comparer,
-                                                             const TextList::ConstIterator &start,
-                                                             int start_offset,
-                                                             const TextList::ConstIterator &end)
+int TextPagePrivate::wordAtSearchOffset( int offset ) const
 {
-    // normalize query search all unicode (including glyphs)
-    const QString query = _query.normalized(QString::NormalizationForm_KC);
-
-    // j is the current position in our query
-    // len is the length of the string in TextEntity
-    // queryLeft is the length of the query we have left
-    int j=0, queryLeft=query.length();
-
-    TextList::ConstIterator it = start;
-    int offset = start_offset;
-
-    TextList::ConstIterator it_begin = TextList::ConstIterator();
-    int offset_begin = 0; //dummy initial value to suppress compiler warnings
-
-    while ( it != end )
-    {
-        const TinyTextEntity* curEntity = *it;
-        const QString& str = curEntity->text();
-        int len = stringLengthAdaptedWithHyphen(str, it, m_words.constEnd());
+    // the last word starting before the offset, past the ones left empty
+    return qUpperBound( m_searchTextOffsets.constBegin(), m_searchTextOffsets.constEnd(), offset ) - m_searchTextOffsets.constBegin() - 1;
+}
 
-        if (offset >= len)
-        {
-            it++;
-            offset = 0;
-            continue;
-        }
+void TextPagePrivate::clearSearchText()
+{
+    if ( m_searchTextOffsets.isEmpty() )
+        return;
 
-        if ( it_begin == TextList::ConstIterator() )
-        {
-            it_begin = it;
-            offset_begin = offset;
-        }
+    m_searchText.clear();
+    m_foldedSearchText.clear();
+    m_searchTextOffsets.clear();
+    qDeleteAll( m_searchPoints );
+    m_searchPoints.clear();
+}
 
-        int min=qMin(queryLeft,len-offset);
-        {
-#ifdef DEBUG_TEXTPAGE
-            kDebug(OkularDebug) << str.midRef(offset, min) << ":" << _query.midRef(j, min);
-#endif
-            // we have equal (or less than) area of the query left as the length of the current 
-            // entity
+// the grid has about this number of words in each cell
+static const int WordsPerGridCell = 4;
+// and at most this number of cells on each side
+static const int MaxGridSize = 256;
 
-            if ( !comparer( str.midRef( offset, min ), query.midRef( j, min ) ) )
-            {
-                    // we have not matched
-                    // this means we do not have a complete match
-                    // we need to get back to query start
-                    // and continue the search from this place
-#ifdef DEBUG_TEXTPAGE
-            kDebug(OkularDebug) << "\tnot matched";
-#endif
-                    j = 0;
-                    queryLeft=query.length();
-                    it = it_begin;
-                    offset = offset_begin+1;
-                    it_begin = TextList::ConstIterator();
-            }
-            else
-            {
-                    // we have a match
-                    // move the current position in the query
-                    // to the position after the length of this string
-                    // we matched
-                    // subtract the length of the current entity from 
-                    // the left length of the query
-#ifdef DEBUG_TEXTPAGE
-            kDebug(OkularDebug) << "\tmatched";
-#endif
-                    j += min;
-                    queryLeft -= min;
+int TextPagePrivate::gridCell( double coordinate, double origin, double cellSize ) const
+{
+    const double cell = std::floor( ( coordinate - origin ) / cellSize );
+    return cell < 0 ? 0 : cell >= m_gridSize ? m_gridSize - 1 : (int)cell;
+}
 
-                    if (queryLeft==0)
-                    {
-                        // save or update the search point for the current searchID
-                        QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-                        if ( sIt == m_searchPoints.end() )
-                        {
-                            sIt = m_searchPoints.insert( searchID, new SearchPoint );
-                        }
-                        SearchPoint* sp = *sIt;
-                        sp->it_begin = it_begin;
-                        sp->it_end = it;
-                        sp->offset_begin = offset_begin;
-                        sp->offset_end = offset + min;
-                        return searchPointToArea(sp);
-                    }
+void TextPagePrivate::buildGrid() const
+{
+    const int count = m_words.count();
+    QVector< NormalizedRect > areas( count );
+    double left = DBL_MAX, top = DBL_MAX, right = -DBL_MAX, bottom = -DBL_MAX;
+    for ( int i = 0; i < count; ++i )
+    {
+        const NormalizedRect area = m_words.at( i )->area();
+        areas[ i ] = area;
+        left = qMin( left, qMin( area.left, area.right ) );
+        top = qMin( top, qMin( area.top, area.bottom ) );
+        right = qMax( right, qMax( area.left, area.right ) );
+        bottom = qMax( bottom, qMax( area.top, area.bottom ) );
+    }
 
-                    it++;
-                    offset = 0;
-            }
-        }
+    m_gridSize = qBound( 1, (int)std::ceil( std::sqrt( (double)count / WordsPerGridCell ) ), MaxGridSize );
+    m_gridLeft = left;
+    m_gridTop = top;
+    // all the words can be on a line
+    m_gridCellWidth = qMax( ( right - left ) / m_gridSize, DBL_MIN );
+    m_gridCellHeight = qMax( ( bottom - top ) / m_gridSize, DBL_MIN );
+
+    // a word goes in all the cells its area touches: count them, then fill
+    // them in the order of the words
+    QVector< int > cellRanges( 4 * count );
+    m_gridCellStarts.fill( 0, m_gridSize * m_gridSize + 1 );
+    for ( int i = 0; i < count; ++i )
+    {
+        const NormalizedRect &area = areas.at( i );
+        const int x1 = gridCell( qMin( area.left, area.right ), m_gridLeft, m_gridCellWidth );
+        const int x2 = gridCell( qMax( area.left, area.right ), m_gridLeft, m_gridCellWidth );
+        const int y1 = gridCell( qMin( area.top, area.bottom ), m_gridTop, m_gridCellHeight );
+        const int y2 = gridCell( qMax( area.top, area.bottom ), m_gridTop, m_gridCellHeight );
+        cellRanges[ 4 * i ] = x1;
+        cellRanges[ 4 * i + 1 ] = x2;
+        cellRanges[ 4 * i + 2 ] = y1;
+        cellRanges[ 4 * i + 3 ] = y2;
+        for ( int y = y1; y <= y2; ++y )
+            for ( int x = x1; x <= x2; ++x )
+                ++m_gridCellStarts[ y * m_gridSize + x + 1 ];
     }
-    // end of loop - it means that we've ended the textentities
+    for ( int c = 1; c < m_gridCellStarts.count(); ++c )
+        m_gridCellStarts[ c ] += m_gridCellStarts.at( c - 1 );
 
-    const QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-    if ( sIt != m_searchPoints.end() )
+    m_gridWords.resize( m_gridCellStarts.last() );
+    QVector< int > next = m_gridCellStarts;
+    for ( int i = 0; i < count; ++i )
     {
-        SearchPoint* sp = *sIt;
-        m_searchPoints.erase( sIt );
-        delete sp;
+        for ( int y = cellRanges.at( 4 * i + 2 ); y <= cellRanges.at( 4 * i + 3 ); ++y )
+            for ( int x = cellRanges.at( 4 * i ); x <= cellRanges.at( 4 * i + 1 ); ++x )
+                m_gridWords[ next[ y * m_gridSize + x ]++ ] = i;
     }
-    return 0;
 }
 
-RegularAreaRect* TextPagePrivate::findTextInternalBackward( int searchID, const QString &_query,
-                                                            TextComparisonFunction comparer,
-                                                            const TextList::ConstIterator &start,
-                                                            int start_offset,
-                                                            const TextList::ConstIterator &end)
+QVector< int > TextPagePrivate::wordsNear( const NormalizedRect &rect ) const
 {
-    // normalize query to search all unicode (including glyphs)
-    const QString query = _query.normalized(QString::NormalizationForm_KC);
+    QVector< int > words;
+    if ( m_words.isEmpty() )
+        return words;
 
-    // j is the current position in our query
-    // len is the length of the string in TextEntity
-    // queryLeft is the length of the query we have left
-    int j=query.length(), queryLeft=query.length();
+    if ( m_gridCellStarts.isEmpty() )
+        buildGrid();
 
-    TextList::ConstIterator it = start;
-    int offset = start_offset;
+    const int x1 = gridCell( qMin( rect.left, rect.right ), m_gridLeft, m_gridCellWidth );
+    const int x2 = gridCell( qMax( rect.left, rect.right ), m_gridLeft, m_gridCellWidth );
+    const int y1 = gridCell( qMin( rect.top, rect.bottom ), m_gridTop, m_gridCellHeight );
+    const int y2 = gridCell( qMax( rect.top, rect.bottom ), m_gridTop, m_gridCellHeight );
 
-    TextList::ConstIterator it_begin = TextList::ConstIterator();
-    int offset_begin = 0; //dummy initial value to suppress compiler warnings
+    // for most of the page, all the words are as fast
+    if ( 2 * ( x2 - x1 + 1 ) * ( y2 - y1 + 1 ) > m_gridSize * m_gridSize )
+    {
+        words.resize( m_words.count() );
+        for ( int i = 0; i < words.count(); ++i )
+            words[ i ] = i;
+        return words;
+    }
 
-    while ( true )
+    for ( int y = y1; y <= y2; ++y )
     {
-        if (offset <= 0)
+        for ( int x = x1; x <= x2; ++x )
         {
-            if ( it == end )
-            {
-                break;
-            }
-            it--;
+            const int cell = y * m_gridSize + x;
+            for ( int j = m_gridCellStarts.at( cell ); j < m_gridCellStarts.at( cell + 1 ); ++j )
+                words.append( m_gridWords.at( j ) );
         }
+    }
 
-        const TinyTextEntity* curEntity = *it;
-        const QString& str = curEntity->text();
-        int len = stringLengthAdaptedWithHyphen(str, it, m_words.constEnd());
+    // the words of a cell are in order, but a word can be in several cells
+    if ( x1 != x2 || y1 != y2 )
+    {
+        qSort( words );
+        words.erase( std::unique( words.begin(), words.end() ), words.end() );
+    }
+    return words;
+}
 
-        if (offset <= 0)
-        {
-            offset = len;
-        }
+void TextPagePrivate::clearGrid()
+{
+    m_gridCellStarts.clear();
+    m_gridWords.clear();
+}
 
-        if ( it_begin == TextList::ConstIterator() )
-        {
-            it_begin = it;
-            offset_begin = offset;
-        }
+// the rectangle around the rectangles of @p area
+static NormalizedRect boundingRect( const RegularAreaRect *area )
+{
+    if ( area->isEmpty() )
+        return NormalizedRect();
 
-        int min=qMin(queryLeft,offset);
-        {
-#ifdef DEBUG_TEXTPAGE
-            kDebug(OkularDebug) << str.midRef(offset-min, min) << " : " << _query.midRef(j-min, min);
-#endif
-            // we have equal (or less than) area of the query left as the length of the current 
-            // entity
+    NormalizedRect bounds = area->first();
+    foreach ( const NormalizedRect &rect, *area )
+        bounds |= rect;
+    return bounds;
+}
 
-            // Note len is not str.length() so we can't use rightRef here
-            if ( !comparer( str.midRef(offset-min, min ), query.midRef( j - min, min ) ) )
-            {
-                    // we have not matched
-                    // this means we do not have a complete match
-                    // we need to get back to query start
-                    // and continue the search from this place
-#ifdef DEBUG_TEXTPAGE
-                    kDebug(OkularDebug) << "\tnot matched";
-#endif
+RegularAreaRect* TextPagePrivate::searchPointToArea(const SearchPoint* sp)
+{
+    const QTransform matrix = m_page ? m_page->rotationMatrix() : QTransform();
+    RegularAreaRect* ret=new RegularAreaRect;
 
-                    j = query.length();
-                    queryLeft = query.length();
-                    it = it_begin;
-                    offset = offset_begin-1;
-                    it_begin = TextList::ConstIterator();
-            }
-            else
-            {
-                    // we have a match
-                    // move the current position in the query
-                    // to the position after the length of this string
-                    // we matched
-                    // subtract the length of the current entity from 
-                    // the left length of the query
-#ifdef DEBUG_TEXTPAGE
-                    kDebug(OkularDebug) << "\tmatched";
-#endif
-                    j -= min;
-                    queryLeft -= min;
+    // the words in between may have no text, as hyphens, but are part of it
+    const int first = wordAtSearchOffset( sp->offset_begin );
+    const int last = wordAtSearchOffset( sp->offset_end - 1 );
+    for ( int i = first; i <= last; ++i )
+    {
+        ret->append( m_words.at( i )->transformedArea( matrix ) );
+    }
 
-                    if ( queryLeft == 0 )
-                    {
-                        // save or update the search point for the current searchID
-                        QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-                        if ( sIt == m_searchPoints.end() )
-                        {
-                            sIt = m_searchPoints.insert( searchID, new SearchPoint );
-                        }
-                        SearchPoint* sp = *sIt;
-                        sp->it_begin = it;
-                        sp->it_end = it_begin;
-                        sp->offset_begin = offset - min;
-                        sp->offset_end = offset_begin;
-                        return searchPointToArea(sp);
-                    }
+    ret->simplify();
+    return ret;
+}
 
-                    offset = 0;
-            }
+RegularAreaRect* TextPagePrivate::searchResult( int searchID, int offset_begin, int offset_end )
+{
+    QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
 
+    if ( offset_begin < 0 )
+    {
+        // no more matches, forget the search
+        if ( sIt != m_searchPoints.end() )
+        {
+            delete *sIt;
+            m_searchPoints.erase( sIt );
         }
-
+        return 0;
     }
-    // end of loop - it means that we've ended the textentities
 
-    const QMap< int, SearchPoint* >::iterator sIt = m_searchPoints.find( searchID );
-    if ( sIt != m_searchPoints.end() )
+    // save or update the search point for the current searchID
+    if ( sIt == m_searchPoints.end() )
     {
-        SearchPoint* sp = *sIt;
-        m_searchPoints.erase( sIt );
-        delete sp;
+        sIt = m_searchPoints.insert( searchID, new SearchPoint );
     }
-    return 0;
+    SearchPoint* sp = *sIt;
+    sp->offset_begin = offset_begin;
+    sp->offset_end = offset_end;
+    return searchPointToArea(sp);
+}
+
+RegularAreaRect* TextPagePrivate::findTextInternalForward( int searchID, const QString &_query,
+                                                             Qt::CaseSensitivity caseSensitivity,
+                                                             int start )
+{
+    // normalize query search all unicode (including glyphs)
+    QString query = _query.normalized(QString::NormalizationForm_KC);
+    if ( caseSensitivity == Qt::CaseInsensitive )
+        query = query.toCaseFolded();
+
+    // the text is case folded already, an exact match does it
+    const int pos = searchText( caseSensitivity ).indexOf( query, start, Qt::CaseSensitive );
+    return searchResult( searchID, pos, pos + query.length() );
+}
+
+RegularAreaRect* TextPagePrivate::findTextInternalBackward( int searchID, const QString &_query,
+                                                            Qt::CaseSensitivity caseSensitivity,
+                                                            int start )
+{
+    // normalize query to search all unicode (including glyphs)
+    QString query = _query.normalized(QString::NormalizationForm_KC);
+    if ( caseSensitivity == Qt::CaseInsensitive )
+        query = query.toCaseFolded();
+
+    // the match has to end before the start (a negative start would count
+    // from the end of the text)
+    const int from = start - query.length();
+    const int pos = from < 0 ? -1 : searchText( caseSensitivity ).lastIndexOf( query, from, Qt::CaseSensitive );
+    return searchResult( searchID, pos, pos + query.length() );
 }
 
 QString TextPage::text(const RegularAreaRect *area) const
@@ -1079,21 +1109,22 @@ QString TextPage::text(const RegularAreaRect *area, TextAreaInclusionBehaviour b
     QString ret;
     if ( area )
     {
-        for ( ; it != itEnd; ++it )
+        foreach ( int i, d->wordsNear( boundingRect( area ) ) )
         {
+            const TinyTextEntity *te = d->m_words.at( i );
             if (b == AnyPixelTextAreaInclusionBehaviour)
             {
-                if ( area->intersects( (*it)->area ) )
+                if ( area->intersects( te->area() ) )
                 {
-                    ret += (*it)->text();
+                    ret += te->text();
                 }
             }
             else
             {
-                NormalizedPoint center = (*it)->area.center();
+                NormalizedPoint center = te->area().center();
                 if ( area->contains( center.x, center.y ) )
                 {
-                    ret += (*it)->text();
+                    ret += te->text();
                 }
             }
         }
@@ -1106,29 +1137,80 @@ QString TextPage::text(const RegularAreaRect *area, TextAreaInclusionBehaviour b
     return ret;
 }
 
-static bool compareTinyTextEntityX(const WordWithCharacters &first, const WordWithCharacters &second)
+/**
+ * The position of a word in a list and the key it is sorted by, computed
+ * once before sorting
+ */
+struct WordSortKey
 {
-    QRect firstArea = first.area().roundedGeometry(1000,1000);
-    QRect secondArea = second.area().roundedGeometry(1000,1000);
+    int key;
+    int index;
+};
 
-    return firstArea.left() < secondArea.left();
+static bool compareWordSortKeys(const WordSortKey &first, const WordSortKey &second)
+{
+    return first.key < second.key;
 }
 
-static bool compareTinyTextEntityY(const WordWithCharacters &first, const WordWithCharacters &second)
+/**
+ * Sorts @p words by the top (@p vertical) or the left of their area rounded
+ * to a 1000x1000 page
+ */
+static void sortWords(WordsWithCharacters *words, bool vertical)
 {
-    const QRect firstArea = first.area().roundedGeometry(1000,1000);
-    const QRect secondArea = second.area().roundedGeometry(1000,1000);
+    QVector<WordSortKey> keys(words->count());
+    for (int i = 0; i < words->count(); ++i)
+    {
+        const QRect area = words->at(i).area().roundedGeometry(1000,1000);
+        keys[i].key = vertical ? area.top() : area.left();
+        keys[i].index = i;
+    }
 
-    return firstArea.top() < secondArea.top();
+    qSort(keys.begin(), keys.end(), compareWordSortKeys);
+
+    const WordsWithCharacters unsorted = *words;
+    for (int i = 0; i < keys.count(); ++i)
+        (*words)[i] = unsorted.at(keys.at(i).index);
+}
+
+qulonglong TextPagePrivate::memoryUsage() const
+{
+    // the search text and the grid are counted even before they are built,
+    // so that the memory of the page does not change when it is searched
+    // or selected: the text, its case folded copy and an offset per word,
+    // and about two cells and a cell start per word
+    qulonglong characters = 0;
+    foreach (TinyTextEntity *te, m_words)
+        characters += te->length();
+
+    return m_arena->memoryUsage() + m_words.count() * sizeof( TinyTextEntity * )
+           + 2 * characters * sizeof( QChar ) + ( m_words.count() + 1 ) * sizeof( int )
+           + ( 2 * m_words.count() + m_words.count() / WordsPerGridCell + 1 ) * sizeof( int );
 }
 
 /**
- * Sets a new world list. Deleting the contents of the old one
+ * Sets a new world list. The entities of list are copied in a new arena,
+ * sized for them, which replaces the old one with the entities of the
+ * previous lists
  */
 void TextPagePrivate::setWordList(const TextList &list)
 {
-    qDeleteAll(m_words);
-    m_words = list;
+    int characters = 0;
+    foreach (TinyTextEntity *te, list)
+        characters += te->length();
+
+    TextArena *arena = new TextArena();
+    arena->reserve(list.count(), characters);
+    TextList words;
+    words.reserve(list.count());
+    foreach (TinyTextEntity *te, list)
+        words.append(arena->create(te->text(), te->area()));
+
+    delete m_arena;
+    m_arena = arena;
+    m_words = words;
+    clearSearchText();
+    clearGrid();
 }
 
 /**
@@ -1157,10 +1239,11 @@ static void removeSpace(TextList *words)
  * We will read the TinyTextEntity from characters and try to create words from there.
  * Note: characters might be already characters for some generators, but we will keep
  * the nomenclature characters for the generator produced data. The resulting
- * WordsWithCharacters memory has to be managed by the caller, both the 
- * WordWithCharacters::word and WordWithCharacters::characters contents
+ * WordsWithCharacters entities, both the WordWithCharacters::word and the
+ * WordWithCharacters::characters contents, are allocated in @p arena. The position in
+ * @p characters of the character each of the latter is made from goes in @p positions
  */
-static WordsWithCharacters makeWordFromCharacters(const TextList &characters, int pageWidth, int pageHeight)
+static WordsWithCharacters makeWordFromCharacters(TextArena *arena, const TextList &characters, int pageWidth, int pageHeight, QHash<const TinyTextEntity*, int> *positions)
 {
     /**
      * We will traverse characters and try to create words from the TinyTextEntities in it.
@@ -1174,6 +1257,8 @@ static WordsWithCharacters makeWordFromCharacters(const TextList &characters, in
 
      */
     WordsWithCharacters wordsWithCharacters;
+    wordsWithCharacters.reserve(characters.count());
+    positions->reserve(characters.count());
 
     TextList::ConstIterator it = characters.begin(), itEnd = characters.end(), tmpIt;
     int newLeft,newRight,newTop,newBottom;
@@ -1183,7 +1268,7 @@ static WordsWithCharacters makeWordFromCharacters(const TextList &characters, in
     {
         QString textString = (*it)->text();
         QString newString;
-        QRect lineArea = (*it)->area.roundedGeometry(pageWidth,pageHeight),elementArea;
+        QRect lineArea = (*it)->area().roundedGeometry(pageWidth,pageHeight),elementArea;
         TextList wordCharacters;
         tmpIt = it;
         int space = 0;
@@ -1198,15 +1283,16 @@ static WordsWithCharacters makeWordFromCharacters(const TextList &characters, in
                 if (tmpIt == it)
                 {
                     NormalizedRect newRect(lineArea,pageWidth,pageHeight);
-                    wordCharacters.append(new TinyTextEntity(textString.normalized
+                    wordCharacters.append(arena->create(textString.normalized
                                                    (QString::NormalizationForm_KC), newRect));
                 }
                 else
                 {
                     NormalizedRect newRect(elementArea,pageWidth,pageHeight);
-                    wordCharacters.append(new TinyTextEntity(textString.normalized
+                    wordCharacters.append(arena->create(textString.normalized
                                                    (QString::NormalizationForm_KC), newRect));
                 }
+                positions->insert(wordCharacters.last(), it - characters.begin());
             }
 
             ++it;
@@ -1216,7 +1302,7 @@ static WordsWithCharacters makeWordFromCharacters(const TextList &characters, in
              otherwise the last character can be missed
              */
             if (it == itEnd) break;
-            elementArea = (*it)->area.roundedGeometry(pageWidth,pageHeight);
+            elementArea = (*it)->area().roundedGeometry(pageWidth,pageHeight);
             if (!doesConsumeY(elementArea, lineArea, 60))
             {
                 --it;
@@ -1256,7 +1342,7 @@ static WordsWithCharacters makeWordFromCharacters(const TextList &characters, in
         if (!newString.isEmpty())
         {
             const NormalizedRect newRect(lineArea, pageWidth, pageHeight);
-            TinyTextEntity *word = new TinyTextEntity(newString.normalized(QString::NormalizationForm_KC), newRect);
+            TinyTextEntity *word = arena->create(newString.normalized(QString::NormalizationForm_KC), newRect);
             wordsWithCharacters.append(WordWithCharacters(word, wordCharacters));
 
             index++;
@@ -1293,24 +1379,66 @@ QList< QPair<WordsWithCharacters, QRect> > makeAndSortLines(const WordsWithChara
     QList<WordWithCharacters> words = wordsTmp;
 
     // Step 1
-    qSort(words.begin(),words.end(),compareTinyTextEntityY);
+    sortWords(&words, true);
 
-    // Step 2
-    QList<WordWithCharacters>::Iterator it = words.begin(), itEnd = words.end();
+    /*
+     The areas of the words, and the smallest top of the areas of the words
+     from each one on: as the words are sorted by their top on another scale,
+     the tops are not quite in order
+     */
+    const int count = words.count();
+    QVector<QRect> areas(count);
+    QVector<int> minTops(count + 1);
+    bool wellFormed = true;
+    for (int j = 0; j < count; ++j)
+    {
+        areas[j] = words.at(j).area().roundedGeometry(pageWidth,pageHeight);
+        wellFormed = wellFormed && areas.at(j).top() <= areas.at(j).bottom();
+    }
+    minTops[count] = INT_MAX;
+    for (int j = count - 1; j >= 0; --j)
+        minTops[j] = qMin(areas.at(j).top(), minTops.at(j + 1));
 
+    /*
+     The lines a word may still be added to, in the order they were made. A
+     line whose bottom is above the tops of all the remaining words does not
+     overlap any of them anymore, if no area is upside down
+     */
+    QVector<int> openLines;
+
+    // Step 2
     //for every non-space texts(characters/words) in the textList
-    for( ; it != itEnd ; it++)
+    for (int j = 0; j < count; ++j)
     {
-        const QRect elementArea = (*it).area().roundedGeometry(pageWidth,pageHeight);
-        bool found = false;
+        const QRect &elementArea = areas.at(j);
+        int found = -1;
+        int kept = 0;
+
+        for (int l = 0; l < openLines.count(); ++l)
+        {
+            const int i = openLines.at(l);
+            const QRect &lineArea = lines.at(i).second;
+            if (wellFormed && lineArea.bottom() < minTops.at(j))
+                continue;
+
+            openLines[kept++] = i;
 
-        for( int i = 0 ; i < lines.length() ; i++)
+            /*
+               if the new text and the line has y overlapping parts of more than 70%,
+               the text will be added to the first such line
+             */
+            if (found < 0 && doesConsumeY(elementArea,lineArea,70))
+                found = i;
+        }
+        openLines.resize(kept);
+
+        if (found >= 0)
         {
             /* the line area which will be expanded
                line_rects is only necessary to preserve the topmin and bottommax of all
                the texts in the line, left and right is not necessary at all
             */
-            QRect &lineArea = lines[i].second;
+            QRect &lineArea = lines[found].second;
             const int text_y1 = elementArea.top() ,
                       text_y2 = elementArea.top() + elementArea.height() ,
                       text_x1 = elementArea.left(),
@@ -1320,43 +1448,31 @@ QList< QPair<WordsWithCharacters, QRect> > makeAndSortLines(const WordsWithChara
                       line_x1 = lineArea.left(),
                       line_x2 = lineArea.left() + lineArea.width();
 
-            /*
-               if the new text and the line has y overlapping parts of more than 70%,
-               the text will be added to this line
-             */
-            if(doesConsumeY(elementArea,lineArea,70))
-            {
-                WordsWithCharacters &line = lines[i].first;
-                line.append(*it);
+            lines[found].first.append(words.at(j));
 
-                const int newLeft = line_x1 < text_x1 ? line_x1 : text_x1;
-                const int newRight = line_x2 > text_x2 ? line_x2 : text_x2;
-                const int newTop = line_y1 < text_y1 ? line_y1 : text_y1;
-                const int newBottom = text_y2 > line_y2 ? text_y2 : line_y2;
+            const int newLeft = line_x1 < text_x1 ? line_x1 : text_x1;
+            const int newRight = line_x2 > text_x2 ? line_x2 : text_x2;
+            const int newTop = line_y1 < text_y1 ? line_y1 : text_y1;
+            const int newBottom = text_y2 > line_y2 ? text_y2 : line_y2;
 
-                lineArea = QRect( newLeft,newTop, newRight - newLeft, newBottom - newTop );
-                found = true;
-            }
-
-            if(found) break;
+            lineArea = QRect( newLeft,newTop, newRight - newLeft, newBottom - newTop );
         }
-
         /* when we have found a new line create a new TextList containing
            only one element and append it to the lines
          */
-        if(!found)
+        else
         {
             WordsWithCharacters tmp;
-            tmp.append((*it));
+            tmp.append(words.at(j));
             lines.append(QPair<WordsWithCharacters, QRect>(tmp, elementArea));
+            openLines.append(lines.count() - 1);
         }
     }
 
     // Step 3
     for(int i = 0 ; i < lines.length() ; i++)
     {
-        WordsWithCharacters &list = lines[i].first;
-        qSort(list.begin(), list.end(), compareTinyTextEntityX);
+        sortWords(&lines[i].first, false);
     }
     
     return lines;
@@ -1417,63 +1533,32 @@ static void calculateStatisticalInformation(const QList<WordWithCharacters> &wor
     // We would like to use QMap instead of QHash as it will keep the keys sorted
     QMap<int,int> hor_space_stat;
     QMap<int,int> col_space_stat;
-    QList< QList<QRect> > space_rects;
-    QList<QRect> max_hor_space_rects;
 
     // Space in every line
     for(int i = 0 ; i < sortedLines.length() ; i++)
     {
-        const WordsWithCharacters list = sortedLines.at(i).first;
-        QList<QRect> line_space_rects;
-        int maxSpace = 0, minSpace = pageWidth;
-
-        // for every TinyTextEntity element in the line
-        WordsWithCharacters::ConstIterator it = list.begin(), itEnd = list.end();
-        QRect max_area1,max_area2;
-        QString before_max, after_max;
+        const WordsWithCharacters &list = sortedLines.at(i).first;
+        int maxSpace = 0;
 
-        // for every line
-        for( ; it != itEnd ; it++ )
+        // for every TinyTextEntity element in the line, the space to the next one
+        QRect area2 = list.isEmpty() ? QRect() : list.first().area().roundedGeometry(pageWidth,pageHeight);
+        for(int k = 0 ; k + 1 < list.length() ; k++ )
         {
-            const QRect area1 = (*it).area().roundedGeometry(pageWidth,pageHeight);
-            if( it+1 == itEnd ) break;
-
-            const QRect area2 = (*(it+1)).area().roundedGeometry(pageWidth,pageHeight);
-            int space = area2.left() - area1.right();
+            const QRect area1 = area2;
+            area2 = list.at(k+1).area().roundedGeometry(pageWidth,pageHeight);
+            const int space = area2.left() - area1.right();
 
             if(space > maxSpace)
-            {
-                max_area1 = area1;
-                max_area2 = area2;
                 maxSpace = space;
-                before_max = (*it).text();
-                after_max = (*(it+1)).text();
-            }
-
-            if(space < minSpace && space != 0) minSpace = space;
 
             //if we found a real space, whose length is not zero and also less than the pageWidth
             if(space != 0 && space != pageWidth)
             {
                 // increase the count of the space amount
-                if(hor_space_stat.contains(space)) hor_space_stat[space]++;
-                else hor_space_stat[space] = 1;
-
-                int left,right,top,bottom;
-
-                left = area1.right();
-                right = area2.left();
-
-                top = area2.top() < area1.top() ? area2.top() : area1.top();
-                bottom = area2.bottom() > area1.bottom() ? area2.bottom() : area1.bottom();
-
-                QRect rect(left,top,right-left,bottom-top);
-                line_space_rects.append(rect);
+                hor_space_stat[space]++;
             }
         }
 
-        space_rects.append(line_space_rects);
-
         if(hor_space_stat.contains(maxSpace))
         {
             if(hor_space_stat[maxSpace] != 1)
@@ -1482,23 +1567,7 @@ static void calculateStatisticalInformation(const QList<WordWithCharacters> &wor
         }
 
         if(maxSpace != 0)
-        {
-            if (col_space_stat.contains(maxSpace))
-                col_space_stat[maxSpace]++;
-            else col_space_stat[maxSpace] = 1;
-
-            //store the max rect of each line
-            const int left = max_area1.right();
-                const int right = max_area2.left();
-            const int top = (max_area1.top() > max_area2.top()) ? max_area2.top() :
-                                                                  max_area1.top();
-            const int bottom = (max_area1.bottom() < max_area2.bottom()) ? max_area2.bottom() :
-                                                                           max_area1.bottom();
-
-            const QRect rect(left,top,right-left,bottom-top);
-            max_hor_space_rects.append(rect);
-        }
-        else max_hor_space_rects.append(QRect(0,0,0,0));
+            col_space_stat[maxSpace]++;
     }
 
     // All the between word space counts are in hor_space_stat
@@ -1562,15 +1631,21 @@ static RegionTextList XYCutForBoundingBoxes(const QList<WordWithCharacters> &wor
         // allocate the size of proj profiles and initialize with 0
         int size_proj_y = node.area().height();
         int size_proj_x = node.area().width();
-        //dynamic memory allocation
-        QVarLengthArray<int> proj_on_xaxis(size_proj_x);
-        QVarLengthArray<int> proj_on_yaxis(size_proj_y);
+        //dynamic memory allocation, with one more element for the
+        //differences the profiles are summed up from
+        QVarLengthArray<int> proj_on_xaxis(qMax(size_proj_x, 0) + 1);
+        QVarLengthArray<int> proj_on_yaxis(qMax(size_proj_y, 0) + 1);
 
-        for( int j = 0 ; j < size_proj_y ; ++j ) proj_on_yaxis[j] = 0;
-        for( int j = 0 ; j < size_proj_x ; ++j ) proj_on_xaxis[j] = 0;
+        for( int j = 0 ; j <= size_proj_y ; ++j ) proj_on_yaxis[j] = 0;
+        for( int j = 0 ; j <= size_proj_x ; ++j ) proj_on_xaxis[j] = 0;
 
         const QList<WordWithCharacters> list = node.text();
 
+        // the areas of the texts, used for the profiles and for the cut
+        QVector<QRect> listRects(list.length());
+        for( int j = 0 ; j < list.length() ; ++j )
+            listRects[j] = list.at(j).area().geometry(pageWidth, pageHeight);
+
         // Calculate tcx and tcy locally for each new region
         int word_spacing, line_spacing, column_spacing;
         calculateStatisticalInformation(list, pageWidth, pageHeight, &word_spacing, &line_spacing, &column_spacing);
@@ -1582,26 +1657,34 @@ static RegionTextList XYCutForBoundingBoxes(const QList<WordWithCharacters> &wor
         int avgX = 0;
         int count;
 
-        // for every text in the region
+        // for every text in the region, add its height to the vertical
+        // projection profile proj_on_xaxis from its left to its right, and
+        // its width to the horizontal one in the same way: the differences
+        // between consecutive elements first, then their sums
         for(int j = 0 ; j < list.length() ; ++j )
         {
-            TinyTextEntity *ent = list.at(j).word;
-            const QRect entRect = ent->area.geometry(pageWidth, pageHeight);
+            const QRect &entRect = listRects.at(j);
 
-            // calculate vertical projection profile proj_on_xaxis1
-            for(int k = entRect.left() ; k <= entRect.left() + entRect.width() ; ++k)
+            const int x1 = qMax(entRect.left() - regionRect.left(), 0);
+            const int x2 = qMin(entRect.left() + entRect.width() - regionRect.left(), size_proj_x - 1);
+            if( x1 <= x2 )
             {
-                if( ( k-regionRect.left() ) < size_proj_x && ( k-regionRect.left() ) >= 0 )
-                    proj_on_xaxis[k - regionRect.left()] += entRect.height();
+                proj_on_xaxis[x1] += entRect.height();
+                proj_on_xaxis[x2 + 1] -= entRect.height();
             }
 
-            // calculate horizontal projection profile in the same way
-            for(int k = entRect.top() ; k <= entRect.top() + entRect.height() ; ++k)
+            const int y1 = qMax(entRect.top() - regionRect.top(), 0);
+            const int y2 = qMin(entRect.top() + entRect.height() - regionRect.top(), size_proj_y - 1);
+            if( y1 <= y2 )
             {
-                if( ( k-regionRect.top() ) < size_proj_y && ( k-regionRect.top() ) >= 0 )
-                    proj_on_yaxis[k - regionRect.top()] += entRect.width();
+                proj_on_yaxis[y1] += entRect.width();
+                proj_on_yaxis[y2 + 1] -= entRect.width();
             }
         }
+        for( int j = 1 ; j < size_proj_x ; ++j )
+            proj_on_xaxis[j] += proj_on_xaxis[j - 1];
+        for( int j = 1 ; j < size_proj_y ; ++j )
+            proj_on_yaxis[j] += proj_on_yaxis[j - 1];
 
         for( int j = 0 ; j < size_proj_y ; ++j )
         {
@@ -1758,13 +1841,10 @@ static RegionTextList XYCutForBoundingBoxes(const QList<WordWithCharacters> &wor
         {
             for( int j = 0 ; j < list.length() ; ++j )
             {
-                const WordWithCharacters word = list.at(j);
-                const QRect wordRect = word.area().geometry(pageWidth,pageHeight);
-
-                if(topRect.intersects(wordRect))
-                    list1.append(word);
+                if(topRect.intersects(listRects.at(j)))
+                    list1.append(list.at(j));
                 else
-                    list2.append(word);
+                    list2.append(list.at(j));
             }
 
             RegionText node1(list1,topRect);
@@ -1779,13 +1859,10 @@ static RegionTextList XYCutForBoundingBoxes(const QList<WordWithCharacters> &wor
         {
             for( int j = 0 ; j < list.length() ; ++j )
             {
-                const WordWithCharacters word = list.at(j);
-                const QRect wordRect = word.area().geometry(pageWidth,pageHeight);
-
-                if(leftRect.intersects(wordRect))
-                    list1.append(word);
-                else 
-                    list2.append(word);
+                if(leftRect.intersects(listRects.at(j)))
+                    list1.append(list.at(j));
+                else
+                    list2.append(list.at(j));
             }
 
             RegionText node1(list1,leftRect);
@@ -1800,9 +1877,9 @@ static RegionTextList XYCutForBoundingBoxes(const QList<WordWithCharacters> &wor
 }
 
 /**
- * Add spaces in between words in a line. It reuses the pointers passed in tree and might add new ones. You will need to take care of deleting them if needed
+ * Add spaces in between words in a line. It reuses the pointers passed in tree and might add new ones, allocated in @p arena
  */
-WordsWithCharacters addNecessarySpace(RegionTextList tree, int pageWidth, int pageHeight)
+WordsWithCharacters addNecessarySpace(TextArena *arena, const RegionTextList &tree, int pageWidth, int pageHeight)
 {
     /**
      * 1. Call makeAndSortLines before adding spaces in between words in a line
@@ -1810,24 +1887,32 @@ WordsWithCharacters addNecessarySpace(RegionTextList tree, int pageWidth, int pa
      * 3. Finally, extract all the space separated texts from each region and return it
      */
 
-    // Only change the texts under RegionTexts, not the area
+    // the words of the regions, with at most a space after each one
+    int count = 0;
+    foreach(const RegionText &region, tree)
+        count += region.text().length();
+
+    WordsWithCharacters tmp;
+    tmp.reserve(2 * count);
+
+    const QString spaceStr(" ");
     for(int j = 0 ; j < tree.length() ; j++)
     {
-        RegionText &tmpRegion = tree[j];
-
         // Step 01
-        QList< QPair<WordsWithCharacters, QRect> > sortedLines = makeAndSortLines(tmpRegion.text(), pageWidth, pageHeight);
+        const QList< QPair<WordsWithCharacters, QRect> > sortedLines = makeAndSortLines(tree.at(j).text(), pageWidth, pageHeight);
 
-        // Step 02
+        // Step 02 and 03
         for(int i = 0 ; i < sortedLines.length() ; i++)
         {
-            WordsWithCharacters &list = sortedLines[i].first;
+            const WordsWithCharacters &list = sortedLines.at(i).first;
+            QRect area2 = list.isEmpty() ? QRect() : list.first().area().roundedGeometry(pageWidth,pageHeight);
             for(int k = 0 ; k < list.length() ; k++ )
             {
-                const QRect area1 = list.at(k).area().roundedGeometry(pageWidth,pageHeight);
+                tmp.append(list.at(k));
                 if( k+1 >= list.length() ) break;
 
-                const QRect area2 = list.at(k+1).area().roundedGeometry(pageWidth,pageHeight);
+                const QRect area1 = area2;
+                area2 = list.at(k+1).area().roundedGeometry(pageWidth,pageHeight);
                 const int space = area2.left() - area1.right();
 
                 if(space != 0)
@@ -1838,36 +1923,73 @@ WordsWithCharacters addNecessarySpace(RegionTextList tree, int pageWidth, int pa
                     const int top = area2.top() < area1.top() ? area2.top() : area1.top();
                     const int bottom = area2.bottom() > area1.bottom() ? area2.bottom() : area1.bottom();
 
-                    const QString spaceStr(" ");
                     const QRect rect(QPoint(left,top),QPoint(right,bottom));
                     const NormalizedRect entRect(rect,pageWidth,pageHeight);
-                    TinyTextEntity *ent1 = new TinyTextEntity(spaceStr, entRect);
-                    TinyTextEntity *ent2 = new TinyTextEntity(spaceStr, entRect);
-                    WordWithCharacters word(ent1, QList<TinyTextEntity*>() << ent2);
-
-                    list.insert(k+1, word);
-
-                    // Skip the space
-                    k++;
+                    TinyTextEntity *ent1 = arena->create(spaceStr, entRect);
+                    TinyTextEntity *ent2 = arena->create(spaceStr, entRect);
+                    tmp.append(WordWithCharacters(ent1, TextList() << ent2));
                 }
             }
         }
+    }
 
-        WordsWithCharacters tmpList;
-        for(int i = 0 ; i < sortedLines.length() ; i++)
-        {
-            tmpList += sortedLines.at(i).first;
-        }
-        tmpRegion.setText(tmpList);
+    return tmp;
+}
+
+/**
+ * Returns a key of the layout analysis of @p characters: a hash of their text
+ * and areas, and of the size and the bounding box of the page
+ */
+static QByteArray layoutKey(const TextList &characters, int pageWidth, int pageHeight, const NormalizedRect &boundingBox)
+{
+    QCryptographicHash hash(QCryptographicHash::Md5);
+    const float page[6] = { (float)pageWidth, (float)pageHeight,
+                            (float)boundingBox.left, (float)boundingBox.top,
+                            (float)boundingBox.right, (float)boundingBox.bottom };
+    hash.addData(reinterpret_cast<const char *>(page), sizeof(page));
+
+    foreach (TinyTextEntity *te, characters)
+    {
+        const NormalizedRect area = te->area();
+        const float character[5] = { (float)te->length(), (float)area.left, (float)area.top,
+                                     (float)area.right, (float)area.bottom };
+        hash.addData(reinterpret_cast<const char *>(character), sizeof(character));
+        hash.addData(reinterpret_cast<const char *>(te->text().constData()), te->length() * sizeof(QChar));
     }
+    return hash.result();
+}
 
-    // Step 03
-    WordsWithCharacters tmp;
-    for(int i = 0 ; i < tree.length() ; i++)
+/**
+ * Puts @p characters in the order of a previous layout analysis, @p order and
+ * @p spaceAreas, as it made them: the same text, the same areas, and spaces
+ * between the words. Returns false if the order does not fit the characters
+ */
+static bool orderCharacters(TextArena *arena, const TextList &characters, const QVector<int> &order, const QVector<float> &spaceAreas, int pageWidth, int pageHeight, TextList *ordered)
+{
+    ordered->reserve(order.count());
+    const QString spaceStr(" ");
+    int space = 0;
+    foreach (int position, order)
     {
-        tmp += tree.at(i).text();
+        if (position < 0)
+        {
+            const NormalizedRect area(spaceAreas.at(space), spaceAreas.at(space + 1),
+                                      spaceAreas.at(space + 2), spaceAreas.at(space + 3));
+            ordered->append(arena->create(spaceStr, area));
+            space += 4;
+        }
+        else if (position < characters.count())
+        {
+            const TinyTextEntity *te = characters.at(position);
+            const NormalizedRect area(te->area().roundedGeometry(pageWidth,pageHeight),pageWidth,pageHeight);
+            ordered->append(arena->create(te->text().normalized(QString::NormalizationForm_KC), area));
+        }
+        else
+        {
+            return false;
+        }
     }
-    return tmp;
+    return true;
 }
 
 /**
@@ -1882,6 +2004,7 @@ void TextPagePrivate::correctTextOrder()
     const double scalingFactor = 2000.0 / (m_page->m_page->width() + m_page->m_page->height());
     const int pageWidth  = (int) (scalingFactor * m_page->m_page->width() );
     const int pageHeight = (int) (scalingFactor * m_page->m_page->height());
+    const NormalizedRect boundingBox = m_page->m_page->boundingBox();
 
     TextList characters = m_words;
 
@@ -1890,30 +2013,76 @@ void TextPagePrivate::correctTextOrder()
      */
     removeSpace(&characters);
 
+    /**
+     * Take the order from the text layouts of the document if the layout of
+     * the same text was analyzed already, when the page was loaded before
+     */
+    TextLayoutCache *layouts = m_page->m_doc ? &m_page->m_doc->m_textLayouts : 0;
+    QByteArray key;
+    if (layouts)
+    {
+        key = layoutKey(characters, pageWidth, pageHeight, boundingBox);
+
+        QVector<int> order;
+        QVector<float> spaceAreas;
+        TextList ordered;
+        if (layouts->layout(m_page->m_number, key, &order, &spaceAreas)
+            && orderCharacters(m_arena, characters, order, spaceAreas, pageWidth, pageHeight, &ordered))
+        {
+            setWordList(ordered);
+            return;
+        }
+    }
+
     /**
      * Construct words from characters
      */
-    const QList<WordWithCharacters> wordsWithCharacters = makeWordFromCharacters(characters, pageWidth, pageHeight);
+    QHash<const TinyTextEntity*, int> positions;
+    const QList<WordWithCharacters> wordsWithCharacters = makeWordFromCharacters(m_arena, characters, pageWidth, pageHeight, &positions);
 
     /**
      * Make a XY Cut tree for segmentation of the texts
      */
-    const RegionTextList tree = XYCutForBoundingBoxes(wordsWithCharacters, m_page->m_page->boundingBox(), pageWidth, pageHeight);
+    const RegionTextList tree = XYCutForBoundingBoxes(wordsWithCharacters, boundingBox, pageWidth, pageHeight);
 
     /**
      * Add spaces to the word
      */
-    const WordsWithCharacters listWithWordsAndSpaces = addNecessarySpace(tree, pageWidth, pageHeight);
+    const WordsWithCharacters listWithWordsAndSpaces = addNecessarySpace(m_arena, tree, pageWidth, pageHeight);
 
     /**
-     * Break the words into characters
+     * Break the words into characters, the words themselves go away with
+     * the arena
      */
     TextList listOfCharacters;
+    listOfCharacters.reserve(listWithWordsAndSpaces.count() + characters.count());
     foreach(const WordWithCharacters &word, listWithWordsAndSpaces)
     {
-        delete word.word;
         listOfCharacters.append(word.characters);
     }
+
+    /**
+     * Keep the order for the next time, the characters by their position
+     * and the spaces by their area
+     */
+    if (layouts)
+    {
+        QVector<int> order;
+        QVector<float> spaceAreas;
+        order.reserve(listOfCharacters.count());
+        foreach(TinyTextEntity *te, listOfCharacters)
+        {
+            const int position = positions.value(te, -1);
+            order.append(position);
+            if (position < 0)
+            {
+                const NormalizedRect area = te->area();
+                spaceAreas << area.left << area.top << area.right << area.bottom;
+            }
+        }
+        layouts->setLayout(m_page->m_number, key, order, spaceAreas);
+    }
+
     setWordList(listOfCharacters);
 }
 
@@ -1925,21 +2094,22 @@ TextEntity::List TextPage::words(const RegularAreaRect *area, TextAreaInclusionB
     TextEntity::List ret;
     if ( area )
     {
-        foreach (TinyTextEntity *te, d->m_words)
+        foreach ( int i, d->wordsNear( boundingRect( area ) ) )
         {
+            const TinyTextEntity *te = d->m_words.at( i );
             if (b == AnyPixelTextAreaInclusionBehaviour)
             {
-                if ( area->intersects( te->area ) )
+                if ( area->intersects( te->area() ) )
                 {
-                    ret.append( new TextEntity( te->text(), new Okular::NormalizedRect( te->area) ) );
+                    ret.append( new TextEntity( te->textCopy(), new Okular::NormalizedRect( te->area()) ) );
                 }
             }
             else
             {
-                const NormalizedPoint center = te->area.center();
+                const NormalizedPoint center = te->area().center();
                 if ( area->contains( center.x, center.y ) )
                 {
-                    ret.append( new TextEntity( te->text(), new Okular::NormalizedRect( te->area) ) );
+                    ret.append( new TextEntity( te->textCopy(), new Okular::NormalizedRect( te->area()) ) );
                 }
             }
         }
@@ -1948,7 +2118,7 @@ TextEntity::List TextPage::words(const RegularAreaRect *area, TextAreaInclusionB
     {
         foreach (TinyTextEntity *te, d->m_words)
         {
-            ret.append( new TextEntity( te->text(), new Okular::NormalizedRect( te->area) ) );
+            ret.append( new TextEntity( te->textCopy(), new Okular::NormalizedRect( te->area()) ) );
         }
     }
     return ret;
@@ -1957,13 +2127,12 @@ TextEntity::List TextPage::words(const RegularAreaRect *area, TextAreaInclusionB
 RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) const
 {
     TextList::ConstIterator itBegin = d->m_words.constBegin(), itEnd = d->m_words.constEnd();
-    TextList::ConstIterator it = itBegin;
     TextList::ConstIterator posIt = itEnd;
-    for ( ; it != itEnd; ++it )
+    foreach ( int i, d->wordsNear( NormalizedRect( p.x, p.y, p.x, p.y ) ) )
     {
-        if ( (*it)->area.contains( p.x, p.y ) )
+        if ( d->m_words.at( i )->area().contains( p.x, p.y ) )
         {
-            posIt = it;
+            posIt = itBegin + i;
             break;
         }
     }
@@ -2012,7 +2181,7 @@ RegularAreaRect * TextPage::wordAt( const NormalizedPoint &p, QString *word ) co
                 break;
             }
             
-            ret->appendShape( (*posIt)->area );
+            ret->appendShape( (*posIt)->area() );
             text += (*posIt)->text();
             if (itText.right(1).at(0).isSpace())
             {
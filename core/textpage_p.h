@@ -14,6 +14,8 @@
 #include <QtCore/QList>
 #include <QtCore/QMap>
 #include <QtCore/QPair>
+#include <QtCore/QString>
+#include <QtCore/QVector>
 #include <QtGui/QTransform>
 
 class SearchPoint;
@@ -23,14 +25,53 @@ class RegionText;
 namespace Okular
 {
 
+class NormalizedRect;
 class PagePrivate;
 typedef QList< TinyTextEntity* > TextList;
 
 /**
- * Returns whether the two strings match.
- * Satisfies the condition that if two strings match then their lengths are equal.
+ * The memory of the TinyTextEntity objects of a page and of their text.
+ *
+ * The entities are allocated one after the other in big blocks, and their
+ * UTF-16 text in other blocks, instead of each on its own on the heap. They
+ * are never freed one by one: the arena releases all of them at once.
  */
-typedef bool ( *TextComparisonFunction )( const QStringRef & from, const QStringRef & to );
+class TextArena
+{
+    public:
+        TextArena();
+        ~TextArena();
+
+        /**
+         * Makes room for @p entities entities with @p characters characters
+         * in total in a single block of each kind, so that they take no more
+         * memory than needed.
+         */
+        void reserve( int entities, int characters );
+
+        /**
+         * Creates an entity with a copy of @p text, that must not be empty.
+         */
+        TinyTextEntity *create( const QString &text, const NormalizedRect &rect );
+
+        /**
+         * Returns the memory used by the arena, in bytes.
+         */
+        qulonglong memoryUsage() const;
+
+    private:
+        Q_DISABLE_COPY( TextArena )
+
+        size_t nextBlockSize() const;
+        char *allocateBlock( size_t size );
+
+        QList< char * > m_blocks;
+        char *m_entities;
+        size_t m_entitiesLeft;
+        char *m_text;
+        size_t m_textLeft;
+        qulonglong m_memory;
+};
 
 /**
  * A list of RegionText. It keeps a bunch of TextList with their bounding rectangles
@@ -43,19 +84,54 @@ class TextPagePrivate
         TextPagePrivate();
         ~TextPagePrivate();
 
+        /**
+         * Finds @p query in the search text, the first match from @p start
+         * on or the last one ending before it.
+         */
         RegularAreaRect * findTextInternalForward( int searchID, const QString &query,
-                                                   TextComparisonFunction comparer,
-                                                   const TextList::ConstIterator &start,
-                                                   int start_offset,
-                                                   const TextList::ConstIterator &end);
+                                                   Qt::CaseSensitivity caseSensitivity,
+                                                   int start );
         RegularAreaRect * findTextInternalBackward( int searchID, const QString &query,
-                                                    TextComparisonFunction comparer,
-                                                    const TextList::ConstIterator &start,
-                                                    int start_offset,
-                                                    const TextList::ConstIterator &end );
+                                                    Qt::CaseSensitivity caseSensitivity,
+                                                    int start );
 
         /**
-         * Copy a TextList to m_words, the pointers of list are adopted
+         * Returns the text of the words one after the other, as the search
+         * sees it (the hyphens of the line breaks left out), case folded for
+         * @p caseSensitivity Qt::CaseInsensitive. It is built on first use.
+         */
+        const QString &searchText( Qt::CaseSensitivity caseSensitivity );
+
+        /**
+         * Returns the index of the word of the character at @p offset in the
+         * search text.
+         */
+        int wordAtSearchOffset( int offset ) const;
+
+        /**
+         * Forgets the search text and the search points, for the words changed.
+         */
+        void clearSearchText();
+
+        /**
+         * Returns the indexes in m_words, in increasing order, of the words
+         * whose area may intersect @p rect: a superset of them, found with a
+         * grid over the areas of the words that is built on first use.
+         */
+        QVector< int > wordsNear( const NormalizedRect &rect ) const;
+
+        /**
+         * Forgets the grid, for the words changed.
+         */
+        void clearGrid();
+
+        /**
+         * Returns the memory taken by the text page, in bytes.
+         */
+        qulonglong memoryUsage() const;
+
+        /**
+         * Copy a TextList to m_words, in an arena of its own
          */
         void setWordList(const TextList &list);
 
@@ -66,12 +142,29 @@ class TextPagePrivate
         void correctTextOrder();
 
         // variables those can be accessed directly from TextPage
+        TextArena *m_arena;
         TextList m_words;
         QMap< int, SearchPoint* > m_searchPoints;
         PagePrivate *m_page;
 
     private:
         RegularAreaRect * searchPointToArea(const SearchPoint* sp);
+        RegularAreaRect * searchResult( int searchID, int offset_begin, int offset_end );
+
+        void buildGrid() const;
+        int gridCell( double coordinate, double origin, double cellSize ) const;
+
+        QString m_searchText;
+        QString m_foldedSearchText;
+        // where the text of each word starts in m_searchText, and its end
+        QVector< int > m_searchTextOffsets;
+
+        // the words of each cell of the grid, one cell after the other, and
+        // where the words of each cell start in m_gridWords, and their end
+        mutable QVector< int > m_gridWords;
+        mutable QVector< int > m_gridCellStarts;
+        mutable int m_gridSize;
+        mutable double m_gridLeft, m_gridTop, m_gridCellWidth, m_gridCellHeight;
 };
 
 }
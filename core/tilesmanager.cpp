@@ -11,12 +11,16 @@
 #include <QPixmap>
 #include <QtCore/qmath.h>
 #include <QList>
+#include <QMap>
 #include <QPainter>
 
 #include "tile.h"
 
 #define TILES_MAXSIZE 2000000
 
+// Number of zoom levels kept besides the current one
+#define TILES_MAXLEVELS 3
+
 using namespace Okular;
 
 static bool rankedTilesLessThan( TileNode *t1, TileNode *t2 )
@@ -33,10 +37,67 @@ class TilesManager::Private
     public:
         Private();
 
+        /**
+         * The tiles of the page at a given size.
+         *
+         * Besides the level of the current size of the page, the levels of
+         * the previous zoom levels are kept: their tiles are shown scaled
+         * where the tiles of the current level are not ready yet, and they
+         * become current again when zooming back.
+         */
+        struct Level
+        {
+            Level( int width, int height );
+
+            int width;
+            int height;
+            // The page is split in a 4x4 grid of tiles
+            TileNode tiles[16];
+        };
+
         bool hasPixmap( const NormalizedRect &rect, const TileNode &tile ) const;
+
+        /**
+         * Whether the current level has valid pixmaps for all of @p rect
+         */
+        bool isCovered( const NormalizedRect &rect ) const;
+        bool isCovered( const NormalizedRect &rect, const TileNode &tile ) const;
         void tilesAt( const NormalizedRect &rect, TileNode &tile, QList<Tile> &result, TileLeaf tileLeaf );
         void setPixmap( const QPixmap *pixmap, const NormalizedRect &rect, TileNode &tile );
 
+        /**
+         * Appends to @p result the tiles of the other levels intersecting
+         * with @p rect that are not available in the current level yet, the
+         * tiles of the nearest levels last
+         */
+        void otherLevelsTilesAt( const NormalizedRect &rect, QList<Tile> &result );
+        void otherLevelTilesAt( const NormalizedRect &rect, TileNode &tile, QList<Tile> &result );
+
+        /**
+         * Rotates the pixmap of @p tile to the current rotation, if needed
+         */
+        void rotateTile( TileNode &tile );
+
+        /**
+         * Makes @p level the current one
+         */
+        void setLevel( Level *level );
+
+        /**
+         * Distance between @p level and the current level, in powers of two
+         */
+        double levelDistance( const Level *level ) const;
+
+        /**
+         * Deletes the other levels without pixmaps and the farthest ones
+         * from the current level, keeping TILES_MAXLEVELS at most
+         */
+        void trimLevels();
+
+        void deleteLevel( Level *level );
+        bool isCurrentLevel( const TileNode &tile ) const;
+        static bool hasPixmaps( const TileNode &tile );
+
         /**
          * Mark @p tile and all its children as dirty
          */
@@ -48,7 +109,12 @@ class TilesManager::Private
         void deleteTiles( const TileNode &tile );
 
         void markParentDirty( const TileNode &tile );
-        void rankTiles( TileNode &tile, QList<TileNode*> &rankedTiles, const NormalizedRect &visibleRect, int visiblePageNumber );
+        /**
+         * Appends the tiles with pixmap to @p rankedTiles, computing their
+         * distance from the viewport. @p levelPenalty is added to the
+         * distance of tiles of other levels.
+         */
+        void rankTiles( TileNode &tile, QList<TileNode*> &rankedTiles, const NormalizedRect &visibleRect, int visiblePageNumber, double levelPenalty );
         /**
          * Since the tile can be large enough to occupy a significant amount of
          * space, they may be split in more tiles. This operation is performed
@@ -65,28 +131,39 @@ class TilesManager::Private
          */
         bool splitBigTiles( TileNode &tile, const NormalizedRect &rect );
 
-        // The page is split in a 4x4 grid of tiles
-        TileNode tiles[16];
+        struct Request
+        {
+            NormalizedRect rect;
+            int width;
+            int height;
+            // its pixmap will not come, the region can be requested again
+            bool aborted;
+        };
+
+        Level *level;
+        // The tiles of the current level
+        TileNode *tiles;
+        // The levels of the other zoom levels, most recent first
+        QList<Level*> otherLevels;
         int width;
         int height;
         int pageNumber;
         qulonglong totalPixels;
         Rotation rotation;
         NormalizedRect visibleRect;
-        NormalizedRect requestRect;
-        int requestWidth;
-        int requestHeight;
+        // Regions being rendered, several of them when the tiles are
+        // rendered concurrently
+        QList<Request> requests;
 };
 
 TilesManager::Private::Private()
-    : width( 0 )
+    : level( 0 )
+    , tiles( 0 )
+    , width( 0 )
     , height( 0 )
     , pageNumber( 0 )
     , totalPixels( 0 )
     , rotation( Rotation0 )
-    , requestRect( NormalizedRect() )
-    , requestWidth( 0 )
-    , requestHeight( 0 )
 {
 }
 
@@ -94,26 +171,107 @@ TilesManager::TilesManager( int pageNumber, int width, int height, Rotation rota
     : d( new Private )
 {
     d->pageNumber = pageNumber;
-    d->width = width;
-    d->height = height;
     d->rotation = rotation;
+    d->setLevel( new Private::Level( width, height ) );
+}
+
+TilesManager::~TilesManager()
+{
+    d->deleteLevel( d->level );
+    foreach ( Private::Level *level, d->otherLevels )
+        d->deleteLevel( level );
+
+    delete d;
+}
 
+TilesManager::Private::Level::Level( int width, int height )
+    : width( width ), height( height )
+{
     // The page is split in a 4x4 grid of tiles
     const double dim = 0.25;
     for ( int i = 0; i < 16; ++i )
     {
         int x = i % 4;
         int y = i / 4;
-        d->tiles[ i ].rect = NormalizedRect( x*dim, y*dim, x*dim+dim, y*dim+dim );
+        tiles[ i ].rect = NormalizedRect( x*dim, y*dim, x*dim+dim, y*dim+dim );
     }
 }
 
-TilesManager::~TilesManager()
+void TilesManager::Private::setLevel( Level *newLevel )
+{
+    level = newLevel;
+    tiles = level->tiles;
+    width = level->width;
+    height = level->height;
+}
+
+double TilesManager::Private::levelDistance( const Level *other ) const
+{
+    return qAbs( qLn( (double)other->width / width ) ) / qLn( 2.0 );
+}
+
+void TilesManager::Private::deleteLevel( Level *other )
 {
     for ( int i = 0; i < 16; ++i )
-        d->deleteTiles( d->tiles[ i ] );
+        deleteTiles( other->tiles[ i ] );
 
-    delete d;
+    delete other;
+}
+
+bool TilesManager::Private::hasPixmaps( const TileNode &tile )
+{
+    if ( tile.pixmap )
+        return true;
+
+    for ( int i = 0; i < tile.nTiles; ++i )
+    {
+        if ( hasPixmaps( tile.tiles[ i ] ) )
+            return true;
+    }
+
+    return false;
+}
+
+void TilesManager::Private::trimLevels()
+{
+    QList<Level*>::iterator it = otherLevels.begin();
+    while ( it != otherLevels.end() )
+    {
+        bool empty = true;
+        for ( int i = 0; i < 16 && empty; ++i )
+            empty = !hasPixmaps( (*it)->tiles[ i ] );
+
+        if ( empty )
+        {
+            deleteLevel( *it );
+            it = otherLevels.erase( it );
+        }
+        else
+        {
+            ++it;
+        }
+    }
+
+    while ( otherLevels.count() > TILES_MAXLEVELS )
+    {
+        int farthest = 0;
+        for ( int i = 1; i < otherLevels.count(); ++i )
+        {
+            if ( levelDistance( otherLevels.at( i ) ) >= levelDistance( otherLevels.at( farthest ) ) )
+                farthest = i;
+        }
+
+        deleteLevel( otherLevels.takeAt( farthest ) );
+    }
+}
+
+bool TilesManager::Private::isCurrentLevel( const TileNode &tile ) const
+{
+    const TileNode *root = &tile;
+    while ( root->parent )
+        root = root->parent;
+
+    return root >= tiles && root < tiles + 16;
 }
 
 void TilesManager::Private::deleteTiles( const TileNode &tile )
@@ -138,10 +296,21 @@ void TilesManager::setSize( int width, int height )
     if ( width == d->width && height == d->height )
         return;
 
-    d->width = width;
-    d->height = height;
+    // The tiles of the current size are kept in their level, to be shown
+    // scaled until the tiles of the new size are ready
+    Private::Level *level = 0;
+    for ( int i = 0; i < d->otherLevels.count(); ++i )
+    {
+        if ( d->otherLevels.at( i )->width == width && d->otherLevels.at( i )->height == height )
+        {
+            level = d->otherLevels.takeAt( i );
+            break;
+        }
+    }
 
-    markDirty();
+    d->otherLevels.prepend( d->level );
+    d->setLevel( level ? level : new Private::Level( width, height ) );
+    d->trimLevels();
 }
 
 int TilesManager::width() const
@@ -173,6 +342,12 @@ void TilesManager::markDirty()
     {
         TilesManager::Private::markDirty( d->tiles[ i ] );
     }
+
+    foreach ( Private::Level *level, d->otherLevels )
+    {
+        for ( int i = 0; i < 16; ++i )
+            TilesManager::Private::markDirty( level->tiles[ i ] );
+    }
 }
 
 void TilesManager::Private::markDirty( TileNode &tile )
@@ -188,9 +363,12 @@ void TilesManager::Private::markDirty( TileNode &tile )
 void TilesManager::setPixmap( const QPixmap *pixmap, const NormalizedRect &rect )
 {
     NormalizedRect rotatedRect = TilesManager::fromRotatedRect( rect, d->rotation );
-    if ( !d->requestRect.isNull() )
+    if ( !d->requests.isEmpty() )
     {
-        if ( !(d->requestRect == rect) )
+        int request = 0;
+        while ( request < d->requests.count() && ( d->requests.at( request ).aborted || !(d->requests.at( request ).rect == rect) ) )
+            ++request;
+        if ( request == d->requests.count() )
             return;
 
         // Check whether the pixmap has the same absolute size of the expected
@@ -211,7 +389,7 @@ void TilesManager::setPixmap( const QPixmap *pixmap, const NormalizedRect &rect
         if ( rotatedRect.geometry( w, h ).size() != pixmapSize )
             return;
 
-        d->requestRect = NormalizedRect();
+        d->requests.removeAt( request );
     }
 
     for ( int i = 0; i < 16; ++i )
@@ -355,11 +533,49 @@ bool TilesManager::Private::hasPixmap( const NormalizedRect &rect, const TileNod
     return true;
 }
 
+bool TilesManager::Private::isCovered( const NormalizedRect &rect ) const
+{
+    for ( int i = 0; i < 16; ++i )
+    {
+        if ( !isCovered( rect, tiles[ i ] ) )
+            return false;
+    }
+
+    return true;
+}
+
+bool TilesManager::Private::isCovered( const NormalizedRect &rect, const TileNode &tile ) const
+{
+    // unlike hasPixmap(), tiles that only touch an edge of rect do not count
+    if ( tile.rect.left >= rect.right || tile.rect.right <= rect.left || tile.rect.top >= rect.bottom || tile.rect.bottom <= rect.top )
+        return true;
+
+    if ( tile.nTiles == 0 )
+        return tile.isValid();
+
+    if ( !tile.dirty )
+        return true;
+
+    for ( int i = 0; i < tile.nTiles; ++i )
+    {
+        if ( !isCovered( rect, tile.tiles[ i ] ) )
+            return false;
+    }
+
+    return true;
+}
+
 QList<Tile> TilesManager::tilesAt( const NormalizedRect &rect, TileLeaf tileLeaf )
 {
     QList<Tile> result;
 
     NormalizedRect rotatedRect = fromRotatedRect( rect, d->rotation );
+
+    // the tiles of other levels go first, so that the tiles of the current
+    // level are painted over them
+    if ( tileLeaf == PixmapTile )
+        d->otherLevelsTilesAt( rotatedRect, result );
+
     for ( int i = 0; i < 16; ++i )
     {
         d->tilesAt( rotatedRect, d->tiles[ i ], result, tileLeaf );
@@ -368,6 +584,42 @@ QList<Tile> TilesManager::tilesAt( const NormalizedRect &rect, TileLeaf tileLeaf
     return result;
 }
 
+void TilesManager::Private::otherLevelsTilesAt( const NormalizedRect &rect, QList<Tile> &result )
+{
+    if ( otherLevels.isEmpty() || isCovered( rect ) )
+        return;
+
+    // farthest levels first
+    QMap<double, Level*> levelsByDistance;
+    foreach ( Level *other, otherLevels )
+        levelsByDistance.insertMulti( -levelDistance( other ), other );
+
+    foreach ( Level *other, levelsByDistance )
+    {
+        for ( int i = 0; i < 16; ++i )
+            otherLevelTilesAt( rect, other->tiles[ i ], result );
+    }
+}
+
+void TilesManager::Private::otherLevelTilesAt( const NormalizedRect &rect, TileNode &tile, QList<Tile> &result )
+{
+    if ( !tile.rect.intersects( rect ) )
+        return;
+
+    if ( tile.pixmap )
+    {
+        if ( !isCovered( tile.rect ) )
+        {
+            rotateTile( tile );
+            result.append( Tile( TilesManager::toRotatedRect( tile.rect, rotation ), tile.pixmap, false ) );
+        }
+        return;
+    }
+
+    for ( int i = 0; i < tile.nTiles; ++i )
+        otherLevelTilesAt( rect, tile.tiles[ i ], result );
+}
+
 void TilesManager::Private::tilesAt( const NormalizedRect &rect, TileNode &tile, QList<Tile> &result, TileLeaf tileLeaf )
 {
     if ( !tile.rect.intersects( rect ) )
@@ -385,53 +637,8 @@ void TilesManager::Private::tilesAt( const NormalizedRect &rect, TileNode &tile,
         else
             rotatedRect = tile.rect;
 
-        if ( tile.pixmap && tileLeaf == PixmapTile && tile.rotation != rotation )
-        {
-            // Lazy tiles rotation
-            int angleToRotate = (rotation - tile.rotation)*90;
-            int xOffset = 0, yOffset = 0;
-            int w = 0, h = 0;
-            switch( angleToRotate )
-            {
-                case 0:
-                    xOffset = 0;
-                    yOffset = 0;
-                    w = tile.pixmap->width();
-                    h = tile.pixmap->height();
-                    break;
-                case 90:
-                case -270:
-                    xOffset = 0;
-                    yOffset = -tile.pixmap->height();
-                    w = tile.pixmap->height();
-                    h = tile.pixmap->width();
-                    break;
-                case 180:
-                case -180:
-                    xOffset = -tile.pixmap->width();
-                    yOffset = -tile.pixmap->height();
-                    w = tile.pixmap->width();
-                    h = tile.pixmap->height();
-                    break;
-                case 270:
-                case -90:
-                    xOffset = -tile.pixmap->width();
-                    yOffset = 0;
-                    w = tile.pixmap->height();
-                    h = tile.pixmap->width();
-                    break;
-            }
-            QPixmap *rotatedPixmap = new QPixmap( w, h );
-            QPainter p( rotatedPixmap );
-            p.rotate( angleToRotate );
-            p.translate( xOffset, yOffset );
-            p.drawPixmap( 0, 0, *tile.pixmap );
-            p.end();
-
-            delete tile.pixmap;
-            tile.pixmap = rotatedPixmap;
-            tile.rotation = rotation;
-        }
+        if ( tile.pixmap && tileLeaf == PixmapTile )
+            rotateTile( tile );
         result.append( Tile( rotatedRect, tile.pixmap, tile.isValid() ) );
     }
     else
@@ -441,6 +648,57 @@ void TilesManager::Private::tilesAt( const NormalizedRect &rect, TileNode &tile,
     }
 }
 
+void TilesManager::Private::rotateTile( TileNode &tile )
+{
+    if ( tile.rotation == rotation )
+        return;
+
+    // Lazy tiles rotation
+    int angleToRotate = (rotation - tile.rotation)*90;
+    int xOffset = 0, yOffset = 0;
+    int w = 0, h = 0;
+    switch( angleToRotate )
+    {
+        case 0:
+            xOffset = 0;
+            yOffset = 0;
+            w = tile.pixmap->width();
+            h = tile.pixmap->height();
+            break;
+        case 90:
+        case -270:
+            xOffset = 0;
+            yOffset = -tile.pixmap->height();
+            w = tile.pixmap->height();
+            h = tile.pixmap->width();
+            break;
+        case 180:
+        case -180:
+            xOffset = -tile.pixmap->width();
+            yOffset = -tile.pixmap->height();
+            w = tile.pixmap->width();
+            h = tile.pixmap->height();
+            break;
+        case 270:
+        case -90:
+            xOffset = -tile.pixmap->width();
+            yOffset = 0;
+            w = tile.pixmap->height();
+            h = tile.pixmap->width();
+            break;
+    }
+    QPixmap *rotatedPixmap = new QPixmap( w, h );
+    QPainter p( rotatedPixmap );
+    p.rotate( angleToRotate );
+    p.translate( xOffset, yOffset );
+    p.drawPixmap( 0, 0, *tile.pixmap );
+    p.end();
+
+    delete tile.pixmap;
+    tile.pixmap = rotatedPixmap;
+    tile.rotation = rotation;
+}
+
 qulonglong TilesManager::totalMemory() const
 {
     return 4*d->totalPixels;
@@ -451,7 +709,16 @@ void TilesManager::cleanupPixmapMemory( qulonglong numberOfBytes, const Normaliz
     QList<TileNode*> rankedTiles;
     for ( int i = 0; i < 16; ++i )
     {
-        d->rankTiles( d->tiles[ i ], rankedTiles, visibleRect, visiblePageNumber );
+        d->rankTiles( d->tiles[ i ], rankedTiles, visibleRect, visiblePageNumber, 0 );
+    }
+
+    // Tiles of other levels count as one page farther for each power of
+    // two between their size and the current one
+    foreach ( Private::Level *level, d->otherLevels )
+    {
+        const double levelPenalty = d->levelDistance( level );
+        for ( int i = 0; i < 16; ++i )
+            d->rankTiles( level->tiles[ i ], rankedTiles, visibleRect, visiblePageNumber, levelPenalty );
     }
     qSort( rankedTiles.begin(), rankedTiles.end(), rankedTilesLessThan );
 
@@ -461,8 +728,8 @@ void TilesManager::cleanupPixmapMemory( qulonglong numberOfBytes, const Normaliz
         if ( !tile->pixmap )
             continue;
 
-        // do not evict visible pixmaps
-        if ( tile->rect.intersects( visibleRect ) )
+        // do not evict visible pixmaps of the current level
+        if ( tile->rect.intersects( visibleRect ) && d->isCurrentLevel( *tile ) )
             continue;
 
         qulonglong pixels = tile->pixmap->width()*tile->pixmap->height();
@@ -477,6 +744,8 @@ void TilesManager::cleanupPixmapMemory( qulonglong numberOfBytes, const Normaliz
 
         d->markParentDirty( *tile );
     }
+
+    d->trimLevels();
 }
 
 void TilesManager::Private::markParentDirty( const TileNode &tile )
@@ -491,7 +760,7 @@ void TilesManager::Private::markParentDirty( const TileNode &tile )
     }
 }
 
-void TilesManager::Private::rankTiles( TileNode &tile, QList<TileNode*> &rankedTiles, const NormalizedRect &visibleRect, int visiblePageNumber )
+void TilesManager::Private::rankTiles( TileNode &tile, QList<TileNode*> &rankedTiles, const NormalizedRect &visibleRect, int visiblePageNumber, double levelPenalty )
 {
     // If the page is visible, visibleRect is not null.
     // Otherwise we use the number of one of the visible pages to calculate the
@@ -520,27 +789,84 @@ void TilesManager::Private::rankTiles( TileNode &tile, QList<TileNode*> &rankedT
             else
                 tile.distance = tile.rect.top;
         }
+        tile.distance += levelPenalty;
         rankedTiles.append( &tile );
     }
     else
     {
         for ( int i = 0; i < tile.nTiles; ++i )
         {
-            rankTiles( tile.tiles[ i ], rankedTiles, visibleRect, visiblePageNumber );
+            rankTiles( tile.tiles[ i ], rankedTiles, visibleRect, visiblePageNumber, levelPenalty );
         }
     }
 }
 
 bool TilesManager::isRequesting( const NormalizedRect &rect, int pageWidth, int pageHeight ) const
 {
-    return rect == d->requestRect && pageWidth == d->requestWidth && pageHeight == d->requestHeight;
+    foreach ( const Private::Request &request, d->requests )
+    {
+        if ( !request.aborted && rect == request.rect && pageWidth == request.width && pageHeight == request.height )
+            return true;
+    }
+
+    return false;
 }
 
 void TilesManager::setRequest( const NormalizedRect &rect, int pageWidth, int pageHeight )
 {
-    d->requestRect = rect;
-    d->requestWidth = pageWidth;
-    d->requestHeight = pageHeight;
+    if ( rect.isNull() )
+    {
+        d->requests.clear();
+        return;
+    }
+
+    // pixmaps of requests made at another zoom level are late: forget them
+    QList<Private::Request>::iterator it = d->requests.begin();
+    while ( it != d->requests.end() )
+    {
+        if ( (*it).width != pageWidth || (*it).height != pageHeight || ( (*it).rect == rect && !(*it).aborted ) )
+            it = d->requests.erase( it );
+        else
+            ++it;
+    }
+
+    const Private::Request request = { rect, pageWidth, pageHeight, false };
+    d->requests.append( request );
+}
+
+void TilesManager::abortRequest( const NormalizedRect &rect )
+{
+    for ( int i = 0; i < d->requests.count(); ++i )
+    {
+        if ( !d->requests.at( i ).aborted && d->requests.at( i ).rect == rect )
+        {
+            d->requests[ i ].aborted = true;
+            return;
+        }
+    }
+}
+
+void TilesManager::cancelRequest( const NormalizedRect &rect )
+{
+    // the aborted request of the region, if it was aborted: it may have
+    // been requested again meanwhile
+    int cancelled = -1;
+    for ( int i = 0; i < d->requests.count(); ++i )
+    {
+        if ( !(d->requests.at( i ).rect == rect) )
+            continue;
+
+        if ( d->requests.at( i ).aborted )
+        {
+            cancelled = i;
+            break;
+        }
+        if ( cancelled == -1 )
+            cancelled = i;
+    }
+
+    if ( cancelled != -1 )
+        d->requests.removeAt( cancelled );
 }
 
 bool TilesManager::Private::splitBigTiles( TileNode &tile, const NormalizedRect &rect )
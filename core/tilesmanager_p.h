@@ -94,6 +94,12 @@ class TileNode
  * The tiles manager is a tree of tiles. At first the page is divided in a 4x4
  * grid of 16 tiles. Then each of these tiles can be recursively split in 4
  * subtiles so that we keep the size of each pixmap inside a safe interval.
+ *
+ * There is a tree for each of the last page sizes (zoom levels): the tiles of
+ * the other levels are shown scaled where the tiles of the current level are
+ * not available yet, and zooming back to a previous size reuses its tiles.
+ * Tiles are evicted by their distance from the viewport and from the current
+ * level.
  */
 class TilesManager
 {
@@ -114,7 +120,7 @@ class TilesManager
          * tile we get a cropped part of the @p pixmap.
          *
          * Also it checks the dimensions of the given parameters against the
-         * current request as to avoid setting pixmaps of late requests.
+         * current requests as to avoid setting pixmaps of late requests.
          */
         void setPixmap( const QPixmap *pixmap, const NormalizedRect &rect );
 
@@ -131,6 +137,10 @@ class TilesManager
          * As to avoid requests of big areas, each traversed tile is checked
          * for its size and split if necessary.
          *
+         * PixmapTile also returns the tiles of other zoom levels covering
+         * what the current level lacks, first, so that they are painted
+         * below the tiles of the current level.
+         *
          * @param tileLeaf Indicate the type of tile to return
          */
         QList<Tile> tilesAt( const NormalizedRect &rect, TileLeaf tileLeaf );
@@ -155,13 +165,32 @@ class TilesManager
         bool isRequesting( const NormalizedRect &rect, int pageWidth, int pageHeight ) const;
 
         /**
-         * Sets a region to be requested so the tiles manager knows which
+         * Adds a region to be requested so the tiles manager knows which
          * pixmaps to expect and discard those not useful anymore (late pixmaps)
+         *
+         * Several regions of the same page size can be requested at the same
+         * time; requesting a region at another page size forgets the previous
+         * ones. A null @p rect forgets all the requested regions.
          */
         void setRequest( const NormalizedRect &rect, int pageWidth, int pageHeight );
 
         /**
-         * Inform the new size of the page and mark all tiles to repaint
+         * Marks the request of @p rect as aborted: it is still being
+         * rendered, but its pixmap will not come and the region can be
+         * requested again
+         */
+        void abortRequest( const NormalizedRect &rect );
+
+        /**
+         * Forgets the request of @p rect, whose pixmap will not come: the
+         * aborted one if it was aborted
+         */
+        void cancelRequest( const NormalizedRect &rect );
+
+        /**
+         * Inform the new size of the page. The tiles of the previous size are
+         * kept to be shown scaled, and the tiles of a size that was used
+         * recently become current again.
          */
         void setSize( int width, int height );
 
@@ -182,7 +211,7 @@ class TilesManager
         Rotation rotation() const;
 
         /**
-         * Mark all tiles as dirty
+         * Mark all tiles of all levels as dirty
          */
         void markDirty();
 
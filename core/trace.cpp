@@ -0,0 +1,154 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include "trace_p.h"
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QHash>
+#include <QtCore/QMutex>
+#include <QtCore/QMutexLocker>
+#include <QtCore/QTextStream>
+#include <QtCore/QThread>
+#include <QtCore/QVector>
+
+#include <kdebug.h>
+#include <kglobal.h>
+
+#include "debug_p.h"
+
+using namespace Okular;
+
+// do not let a forgotten trace eat all the memory
+static const int MaxEvents = 2000000;
+
+struct TraceEvent
+{
+    const char *name;
+    // 'X' complete, 'b'/'e' async begin/end
+    char phase;
+    int thread;
+    int page;
+    qint64 timestamp;
+    qint64 duration;
+    const void *id;
+};
+
+class TraceData
+{
+    public:
+        TraceData()
+            : fileName( QFile::decodeName( qgetenv( "OKULAR_TRACE" ) ) )
+        {
+            timer.start();
+        }
+
+        ~TraceData()
+        {
+            save();
+        }
+
+        void append( const TraceEvent &event );
+        void save();
+
+        const QString fileName;
+        QElapsedTimer timer;
+        QMutex mutex;
+        QVector< TraceEvent > events;
+        QHash< Qt::HANDLE, int > threads;
+};
+
+K_GLOBAL_STATIC( TraceData, s_trace )
+
+void TraceData::append( const TraceEvent &event )
+{
+    QMutexLocker locker( &mutex );
+    if ( events.count() >= MaxEvents )
+        return;
+
+    events.append( event );
+    // threads are numbered in the order they show up, the first is the GUI one
+    const Qt::HANDLE thread = QThread::currentThreadId();
+    QHash< Qt::HANDLE, int >::const_iterator it = threads.constFind( thread );
+    events.last().thread = it != threads.constEnd() ? it.value() : threads.insert( thread, threads.count() + 1 ).value();
+}
+
+void TraceData::save()
+{
+    QFile file( fileName );
+    if ( !file.open( QIODevice::WriteOnly | QIODevice::Truncate ) )
+    {
+        kWarning(OkularDebug) << "Could not write the trace file" << fileName;
+        return;
+    }
+
+    QMutexLocker locker( &mutex );
+    QTextStream out( &file );
+    out << "{\"displayTimeUnit\":\"ms\",\"traceEvents\":[\n";
+    out << "{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":1,\"tid\":1,\"args\":{\"name\":\"GUI\"}}";
+    foreach ( const TraceEvent &event, events )
+    {
+        out << ",\n{\"name\":\"" << event.name << "\",\"cat\":\"okular\",\"ph\":\"" << event.phase
+            << "\",\"pid\":1,\"tid\":" << event.thread << ",\"ts\":" << event.timestamp;
+        if ( event.phase == 'X' )
+            out << ",\"dur\":" << event.duration;
+        else
+            out << ",\"id\":\"0x" << QString::number( (quintptr)event.id, 16 ) << "\"";
+        if ( event.page >= 0 )
+            out << ",\"args\":{\"page\":" << event.page << "}";
+        out << "}";
+    }
+    out << "\n]}\n";
+
+    kDebug(OkularDebug) << "Wrote" << events.count() << "trace events to" << fileName;
+}
+
+bool Trace::isEnabled()
+{
+    static const bool enabled = !qgetenv( "OKULAR_TRACE" ).isEmpty();
+    return enabled;
+}
+
+qint64 Trace::now()
+{
+#if QT_VERSION >= 0x040800
+    return s_trace->timer.nsecsElapsed() / 1000;
+#else
+    return s_trace->timer.elapsed() * 1000;
+#endif
+}
+
+void Trace::begin( const char *name, const void *id, int page )
+{
+    if ( !isEnabled() )
+        return;
+
+    const TraceEvent event = { name, 'b', 0, page, now(), 0, id };
+    s_trace->append( event );
+}
+
+void Trace::end( const char *name, const void *id )
+{
+    if ( !isEnabled() )
+        return;
+
+    const TraceEvent event = { name, 'e', 0, -1, now(), 0, id };
+    s_trace->append( event );
+}
+
+void Trace::complete( const char *name, qint64 start, int page )
+{
+    if ( !isEnabled() )
+        return;
+
+    const TraceEvent event = { name, 'X', 0, page, start, now() - start, 0 };
+    s_trace->append( event );
+}
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,93 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#ifndef _OKULAR_TRACE_P_H_
+#define _OKULAR_TRACE_P_H_
+
+#include <QtCore/QtGlobal>
+
+#include "okular_export.h"
+
+namespace Okular {
+
+/**
+ * @short Timing of the rendering pipeline, for performance diagnosis
+ *
+ * Tracing is enabled by setting the OKULAR_TRACE environment variable to
+ * the name of a file; when the application quits the recorded events are
+ * written there in the Chrome trace event format, which can be loaded in
+ * chrome://tracing or Perfetto.
+ *
+ * Each pixmap request has a "Request" phase from its creation to its
+ * delivery to the observer, or until it is dropped, around its "Queued"
+ * and "Rendering" phases: the latency the user sees.
+ *
+ * When tracing is disabled all the methods return right away.
+ */
+class OKULAR_EXPORT Trace
+{
+    public:
+        /**
+         * Whether tracing is enabled.
+         */
+        static bool isEnabled();
+
+        /**
+         * The current time, in microseconds since the start of the trace.
+         */
+        static qint64 now();
+
+        /**
+         * Starts the @p name phase of the object @p id (e.g. a PixmapRequest),
+         * which can end in another thread.
+         */
+        static void begin( const char *name, const void *id, int page = -1 );
+
+        /**
+         * Ends the @p name phase of the object @p id.
+         */
+        static void end( const char *name, const void *id );
+
+        /**
+         * Records the @p name operation of the current thread, which started
+         * at @p start (see now()) and ends now.
+         */
+        static void complete( const char *name, qint64 start, int page = -1 );
+};
+
+/**
+ * Records the operation running in the current scope.
+ */
+class TraceScope
+{
+    public:
+        explicit TraceScope( const char *name, int page = -1 )
+            : m_name( name ), m_page( page ), m_start( Trace::isEnabled() ? Trace::now() : -1 )
+        {
+        }
+
+        ~TraceScope()
+        {
+            if ( m_start >= 0 )
+                Trace::complete( m_name, m_start, m_page );
+        }
+
+    private:
+        const char *m_name;
+        int m_page;
+        qint64 m_start;
+
+        Q_DISABLE_COPY( TraceScope )
+};
+
+}
+
+#endif
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -88,6 +88,8 @@ DjVuGenerator::DjVuGenerator( QObject *parent, const QVariantList &args )
 {
     setFeature( TextExtraction );
     setFeature( Threaded );
+    setFeature( TiledRendering );
+    setFeature( ReentrantTextExtraction );
     setFeature( PrintPostscript );
     if ( Okular::FilePrinter::ps2pdfAvailable() )
         setFeature( PrintToFile );
@@ -126,10 +128,24 @@ bool DjVuGenerator::doCloseDocument()
     return true;
 }
 
+static bool shouldAbortRender( void *request )
+{
+    return static_cast< Okular::PixmapRequest * >( request )->shouldAbortRender();
+}
+
 QImage DjVuGenerator::image( Okular::PixmapRequest *request )
 {
     userMutex()->lock();
-    QImage img = m_djvu->image( request->pageNumber(), request->width(), request->height(), request->page()->rotation() );
+    QImage img;
+    if ( request->isTile() )
+    {
+        const QRect rect = request->normalizedRect().geometry( request->width(), request->height() );
+        img = m_djvu->image( request->pageNumber(), request->width(), request->height(), rect, shouldAbortRender, request );
+    }
+    else
+    {
+        img = m_djvu->image( request->pageNumber(), request->width(), request->height(), request->page()->rotation(), shouldAbortRender, request );
+    }
     userMutex()->unlock();
     return img;
 }
@@ -25,6 +25,7 @@
 #include <libdjvu/miniexp.h>
 
 #include <stdio.h>
+#include <string.h>
 
 QDebug &operator<<( QDebug & s, const ddjvu_rect_t &r )
 {
@@ -429,13 +430,16 @@ class KDjVu::Private
 {
     public:
         Private()
-          : m_djvu_cxt( 0 ), m_djvu_document( 0 ), m_format( 0 ), m_docBookmarks( 0 ),
+          : m_djvu_cxt( 0 ), m_djvu_document( 0 ), m_format( 0 ), m_grayFormat( 0 ), m_docBookmarks( 0 ),
             m_cacheEnabled( true )
         {
         }
 
+        ddjvu_page_t *loadPage( int page );
         QImage generateImageTile( ddjvu_page_t *djvupage, int& res,
-            int width, int row, int xdelta, int height, int col, int ydelta );
+            int width, int height, const QRect &renderRect, bool gray );
+        QImage renderRegion( ddjvu_page_t *djvupage, int& res, int width, int height,
+            const QRect &region, KDjVu::AbortCheck abortCheck, void *abortData );
 
         void readBookmarks();
         void fillBookmarksRecurse( QDomDocument& maindoc, QDomNode& curnode,
@@ -448,6 +452,7 @@ class KDjVu::Private
         ddjvu_context_t *m_djvu_cxt;
         ddjvu_document_t *m_djvu_document;
         ddjvu_format_t *m_format;
+        ddjvu_format_t *m_grayFormat;
 
         QVector<KDjVu::Page*> m_pages;
         QVector<ddjvu_page_t *> m_pages_cache;
@@ -466,14 +471,42 @@ class KDjVu::Private
 
 unsigned int KDjVu::Private::s_formatmask[4] = { 0x00ff0000, 0x0000ff00, 0x000000ff, 0xff000000 };
 
+static QImage grayImage( int width, int height )
+{
+    static QVector<QRgb> colorTable;
+    if ( colorTable.isEmpty() )
+    {
+        colorTable.resize( 256 );
+        for ( int i = 0; i < 256; ++i )
+            colorTable[i] = qRgb( i, i, i );
+    }
+    QImage img( width, height, QImage::Format_Indexed8 );
+    img.setColorTable( colorTable );
+    return img;
+}
+
+ddjvu_page_t *KDjVu::Private::loadPage( int page )
+{
+    if ( !m_pages_cache.at( page ) )
+    {
+        ddjvu_page_t *newpage = ddjvu_page_create_by_pageno( m_djvu_document, page );
+        // wait for the new page to be loaded
+        ddjvu_status_t sts;
+        while ( ( sts = ddjvu_page_decoding_status( newpage ) ) < DDJVU_JOB_OK )
+            handle_ddjvu_messages( m_djvu_cxt, true );
+        m_pages_cache[page] = newpage;
+    }
+    return m_pages_cache[page];
+}
+
 QImage KDjVu::Private::generateImageTile( ddjvu_page_t *djvupage, int& res,
-    int width, int row, int xdelta, int height, int col, int ydelta )
+    int width, int height, const QRect &renderRect, bool gray )
 {
     ddjvu_rect_t renderrect;
-    renderrect.x = row * xdelta;
-    renderrect.y = col * ydelta;
-    int realwidth = qMin( width - renderrect.x, xdelta );
-    int realheight = qMin( height - renderrect.y, ydelta );
+    renderrect.x = renderRect.x();
+    renderrect.y = renderRect.y();
+    int realwidth = renderRect.width();
+    int realheight = renderRect.height();
     renderrect.w = realwidth;
     renderrect.h = realheight;
 #ifdef KDJVU_DEBUG
@@ -488,12 +521,12 @@ QImage KDjVu::Private::generateImageTile( ddjvu_page_t *djvupage, int& res,
     kDebug() << "pagerect:" << pagerect;
 #endif
     handle_ddjvu_messages( m_djvu_cxt, false );
-    QImage res_img( realwidth, realheight, QImage::Format_RGB32 );
+    QImage res_img = gray ? grayImage( realwidth, realheight ) : QImage( realwidth, realheight, QImage::Format_RGB32 );
     // the following line workarounds a rare crash in djvulibre;
     // it should be fixed with >= 3.5.21
     ddjvu_page_get_width( djvupage );
     res = ddjvu_page_render( djvupage, DDJVU_RENDER_COLOR,
-                  &pagerect, &renderrect, m_format, res_img.bytesPerLine(), (char *)res_img.bits() );
+                  &pagerect, &renderrect, gray ? m_grayFormat : m_format, res_img.bytesPerLine(), (char *)res_img.bits() );
 #ifdef KDJVU_DEBUG
     kDebug() << "rendering result:" << res;
 #endif
@@ -502,6 +535,77 @@ QImage KDjVu::Private::generateImageTile( ddjvu_page_t *djvupage, int& res,
     return res_img;
 }
 
+QImage KDjVu::Private::renderRegion( ddjvu_page_t *djvupage, int& res, int width, int height,
+    const QRect &region, KDjVu::AbortCheck abortCheck, void *abortData )
+{
+    static const int xdelta = 1500;
+    static const int ydelta = 1500;
+
+    int xparts = region.width() / xdelta + 1;
+    int yparts = region.height() / ydelta + 1;
+
+    // bitonal pages (scanned text, mostly) are rendered as 8 bit grayscale
+    // images, which take a quarter of the memory of color ones
+    const bool gray = ddjvu_page_get_type( djvupage ) == DDJVU_PAGETYPE_BITONAL;
+
+    QImage newimg;
+
+    res = 10000;
+    if ( ( xparts == 1 ) && ( yparts == 1 ) )
+    {
+         // only one part -- render at once with no need to auxiliary image
+         newimg = generateImageTile( djvupage, res, width, height, region, gray );
+    }
+    else
+    {
+        // more than one part -- need to render piece-by-piece and to compose
+        // the results; QPainter cannot paint on indexed images, so the rows
+        // of the grayscale parts are copied
+        newimg = gray ? grayImage( region.width(), region.height() ) : QImage( region.width(), region.height(), QImage::Format_RGB32 );
+        QPainter p;
+        if ( gray )
+            newimg.fill( 255 );
+        else
+            p.begin( &newimg );
+        int parts = xparts * yparts;
+        for ( int i = 0; i < parts; ++i )
+        {
+            if ( abortCheck && abortCheck( abortData ) )
+            {
+                if ( !gray )
+                    p.end();
+                res = 0;
+                return QImage();
+            }
+
+            int row = i % xparts;
+            int col = i / xparts;
+            const QRect part = QRect( region.x() + row * xdelta, region.y() + col * ydelta, xdelta, ydelta ) & region;
+            if ( part.isEmpty() )
+                continue;
+            int tmpres = 0;
+            QImage tempp = generateImageTile( djvupage, tmpres, width, height, part, gray );
+            if ( tmpres )
+            {
+                if ( gray )
+                {
+                    for ( int y = 0; y < tempp.height(); ++y )
+                        memcpy( newimg.scanLine( col * ydelta + y ) + row * xdelta, tempp.constScanLine( y ), tempp.width() );
+                }
+                else
+                {
+                    p.drawImage( row * xdelta, col * ydelta, tempp );
+                }
+            }
+            res = qMin( tmpres, res );
+        }
+        if ( !gray )
+            p.end();
+    }
+
+    return newimg;
+}
+
 void KDjVu::Private::readBookmarks()
 {
     if ( !m_djvu_document )
@@ -647,6 +751,9 @@ KDjVu::KDjVu() : d( new Private )
 #endif
     ddjvu_format_set_row_order( d->m_format, 1 );
     ddjvu_format_set_y_direction( d->m_format, 1 );
+    d->m_grayFormat = ddjvu_format_create( DDJVU_FORMAT_GREY8, 0, 0 );
+    ddjvu_format_set_row_order( d->m_grayFormat, 1 );
+    ddjvu_format_set_y_direction( d->m_grayFormat, 1 );
 }
 
 
@@ -655,6 +762,7 @@ KDjVu::~KDjVu()
     closeFile();
 
     ddjvu_format_release( d->m_format );
+    ddjvu_format_release( d->m_grayFormat );
     ddjvu_context_release( d->m_djvu_cxt );
 
     delete d;
@@ -905,7 +1013,7 @@ const QVector<KDjVu::Page*> &KDjVu::pages() const
     return d->m_pages;
 }
 
-QImage KDjVu::image( int page, int width, int height, int rotation )
+QImage KDjVu::image( int page, int width, int height, int rotation, AbortCheck abortCheck, void *abortData )
 {
     if ( d->m_cacheEnabled )
     {
@@ -932,16 +1040,7 @@ QImage KDjVu::image( int page, int width, int height, int rotation )
     }
     }
 
-    if ( !d->m_pages_cache.at( page ) )
-    {
-        ddjvu_page_t *newpage = ddjvu_page_create_by_pageno( d->m_djvu_document, page );
-        // wait for the new page to be loaded
-        ddjvu_status_t sts;
-        while ( ( sts = ddjvu_page_decoding_status( newpage ) ) < DDJVU_JOB_OK )
-            handle_ddjvu_messages( d->m_djvu_cxt, true );
-        d->m_pages_cache[page] = newpage;
-    }
-    ddjvu_page_t *djvupage = d->m_pages_cache[page];
+    ddjvu_page_t *djvupage = d->loadPage( page );
 
 /*
     if ( ddjvu_page_get_rotation( djvupage ) != flipRotation( rotation ) )
@@ -952,44 +1051,10 @@ QImage KDjVu::image( int page, int width, int height, int rotation )
     }
 */
 
-    static const int xdelta = 1500;
-    static const int ydelta = 1500;
-
-    int xparts = width / xdelta + 1;
-    int yparts = height / ydelta + 1;
-
-    QImage newimg;
-
-    int res = 10000;
-    if ( ( xparts == 1 ) && ( yparts == 1 ) )
-    {
-         // only one part -- render at once with no need to auxiliary image
-         newimg = d->generateImageTile( djvupage, res,
-                 width, 0, xdelta, height, 0, ydelta );
-    }
-    else
-    {
-        // more than one part -- need to render piece-by-piece and to compose
-        // the results
-        newimg = QImage( width, height, QImage::Format_RGB32 );
-        QPainter p;
-        p.begin( &newimg );
-        int parts = xparts * yparts;
-        for ( int i = 0; i < parts; ++i )
-        {
-            int row = i % xparts;
-            int col = i / xparts;
-            int tmpres = 0;
-            QImage tempp = d->generateImageTile( djvupage, tmpres,
-                    width, row, xdelta, height, col, ydelta );
-            if ( tmpres )
-            {
-                p.drawImage( row * xdelta, col * ydelta, tempp );
-            }
-            res = qMin( tmpres, res );
-        }
-        p.end();
-    }
+    int res = 0;
+    QImage newimg = d->renderRegion( djvupage, res, width, height, QRect( 0, 0, width, height ), abortCheck, abortData );
+    if ( newimg.isNull() )
+        return newimg;
 
     if ( res && d->m_cacheEnabled )
     {
@@ -1025,6 +1090,17 @@ QImage KDjVu::image( int page, int width, int height, int rotation )
     return newimg;
 }
 
+QImage KDjVu::image( int page, int width, int height, const QRect &rect, AbortCheck abortCheck, void *abortData )
+{
+    const QRect region = rect & QRect( 0, 0, width, height );
+    if ( region.isEmpty() )
+        return QImage();
+
+    ddjvu_page_t *djvupage = d->loadPage( page );
+    int res = 0;
+    return d->renderRegion( djvupage, res, width, height, region, abortCheck, abortData );
+}
+
 bool KDjVu::exportAsPostScript( const QString & fileName, const QList<int>& pageList ) const
 {
     if ( !d->m_djvu_document || fileName.trimmed().isEmpty() || pageList.isEmpty() )
@@ -250,12 +250,30 @@ class KDjVu
          */
         void linksAndAnnotationsForPage( int pageNum, QList<KDjVu::Link*> *links, QList<KDjVu::Annotation*> *annotations ) const;
 
+        /**
+         * Function called with the \p data passed to image() to know whether
+         * the rendering should be stopped.
+         */
+        typedef bool (*AbortCheck)( void *data );
+
         /**
          * Check if the image for the specified \p page with the specified
          * \p width, \p height and \p rotation is already in cache, and returns
          * it. If not, a null image is returned.
+         *
+         * Big images are rendered in parts; if \p abortCheck is set, it is
+         * called before each part, and a null image is returned if it says
+         * so.
+         */
+        QImage image( int page, int width, int height, int rotation, AbortCheck abortCheck = 0, void *abortData = 0 );
+
+        /**
+         * Renders the part \p rect of the specified \p page scaled to
+         * \p width and \p height. The image is not cached.
+         *
+         * \p abortCheck and \p abortData work as in image() above.
          */
-        QImage image( int page, int width, int height, int rotation );
+        QImage image( int page, int width, int height, const QRect &rect, AbortCheck abortCheck = 0, void *abortData = 0 );
 
         /**
          * Export the currently open document as PostScript file \p fileName.
@@ -53,6 +53,7 @@ KIMGIOGenerator::KIMGIOGenerator( QObject *parent, const QVariantList &args )
 {
     setFeature( ReadRawData );
     setFeature( Threaded );
+    setFeature( ReentrantRendering );
     setFeature( TiledRendering );
     setFeature( PrintNative );
     setFeature( PrintToFile );
@@ -436,6 +436,8 @@ PDFGenerator::PDFGenerator( QObject *parent, const QVariantList &args )
         setFeature( PrintToFile );
     setFeature( ReadRawData );
     setFeature( TiledRendering );
+    // only the text list comes from poppler under the lock
+    setFeature( ReentrantTextExtraction );
 
 #ifdef HAVE_POPPLER_0_16
     // You only need to do it once not for each of the documents but it is cheap enough
@@ -824,6 +826,14 @@ QImage PDFGenerator::image( Okular::PixmapRequest * request )
     // 0. LOCK [waits for the thread end]
     userMutex()->lock();
 
+    // poppler-qt4 cannot stop a rendering once started, but the request
+    // may have been aborted while waiting for the lock
+    if ( request->shouldAbortRender() )
+    {
+        userMutex()->unlock();
+        return QImage();
+    }
+
     // 1. Set OutputDev parameters and Generate contents
     // note: thread safety is set on 'false' for the GUI (this) thread
     Poppler::Page *p = pdfdoc->page(page->number());
@@ -1157,6 +1167,15 @@ QVariant PDFGenerator::metaData( const QString & key, const QVariant & option )
         QMutexLocker ml(userMutex());
         return pdfdoc->scripts();
     }
+    else if ( key == "RenderSettings" )
+    {
+        // the settings of the backend that change the rendered pages
+#ifdef HAVE_POPPLER_0_24
+        return QString( "thinlines=%1" ).arg( PDFSettings::enhanceThinLines() );
+#else
+        return QString();
+#endif
+    }
     else if ( key == "HasUnsupportedXfaForm" )
     {
 #ifdef HAVE_POPPLER_0_22
@@ -15,7 +15,9 @@
 #include <qfileinfo.h>
 #include <qimage.h>
 #include <qlist.h>
+#include <qmutex.h>
 #include <qpainter.h>
+#include <qvector.h>
 #include <QtGui/QPrinter>
 
 #include <kaboutdata.h>
@@ -86,17 +88,99 @@ void okular_tiffUnmapProc( thandle_t, tdata_t, toff_t )
 }
 
 
+// do not decode more than this number of pixels at once
+static const int MaxBandPixels = 4 * 1024 * 1024;
+// but rather decode a bigger band than decode a strip more than once
+static const int MaxStripPixels = 32 * 1024 * 1024;
+
+// a resolution of a page: the page itself, or a reduced resolution version
+// of it stored in a SubIFD or in the directory following the page
+struct TiffLevel
+{
+    toff_t offset;
+    uint32 width;
+    uint32 height;
+};
+
 class TIFFGenerator::Private
 {
     public:
         Private()
           : tiff( 0 ), dev( 0 ) {}
 
+        TIFF* openHandle();
+        TIFF* acquireHandle();
+        void releaseHandle( TIFF *handle );
+        void closeHandles();
+
         TIFF* tiff;
         QByteArray data;
         QIODevice* dev;
+        QString fileName;
+        // the resolutions of each page, the largest first
+        QVector< QList< TiffLevel > > levels;
+
+        // handles for the rendering threads, each with its own device and
+        // current directory, so that pages can be decoded concurrently
+        QMutex handlesMutex;
+        QList< TIFF* > freeHandles;
 };
 
+TIFF* TIFFGenerator::Private::openHandle()
+{
+    QIODevice *device = 0;
+    if ( !fileName.isEmpty() )
+    {
+        device = new QFile( fileName );
+    }
+    else
+    {
+        QBuffer *buffer = new QBuffer();
+        buffer->setData( data );
+        device = buffer;
+    }
+
+    TIFF *handle = 0;
+    if ( device->open( QIODevice::ReadOnly ) )
+    {
+        handle = TIFFClientOpen( fileName.isEmpty() ? "<stdin>" : data.constData(), "r", device,
+                     okular_tiffReadProc, okular_tiffWriteProc, okular_tiffSeekProc,
+                     okular_tiffCloseProc, okular_tiffSizeProc,
+                     okular_tiffMapProc, okular_tiffUnmapProc );
+    }
+    if ( !handle )
+        delete device;
+    return handle;
+}
+
+TIFF* TIFFGenerator::Private::acquireHandle()
+{
+    {
+        QMutexLocker locker( &handlesMutex );
+        if ( !freeHandles.isEmpty() )
+            return freeHandles.takeLast();
+    }
+    return openHandle();
+}
+
+void TIFFGenerator::Private::releaseHandle( TIFF *handle )
+{
+    QMutexLocker locker( &handlesMutex );
+    freeHandles.append( handle );
+}
+
+void TIFFGenerator::Private::closeHandles()
+{
+    QMutexLocker locker( &handlesMutex );
+    foreach ( TIFF *handle, freeHandles )
+    {
+        QIODevice *device = static_cast< QIODevice * >( TIFFClientdata( handle ) );
+        TIFFClose( handle );
+        delete device;
+    }
+    freeHandles.clear();
+}
+
 static QDateTime convertTIFFDateTime( const char* tiffdate )
 {
     if ( !tiffdate )
@@ -181,6 +265,8 @@ TIFFGenerator::TIFFGenerator( QObject *parent, const QVariantList &args )
       d( new Private )
 {
     setFeature( Threaded );
+    setFeature( TiledRendering );
+    setFeature( ReentrantRendering );
     setFeature( PrintNative );
     setFeature( PrintToFile );
     setFeature( ReadRawData );
@@ -188,6 +274,7 @@ TIFFGenerator::TIFFGenerator( QObject *parent, const QVariantList &args )
 
 TIFFGenerator::~TIFFGenerator()
 {
+    d->closeHandles();
     if ( d->tiff )
     {
         TIFFClose( d->tiff );
@@ -202,6 +289,7 @@ bool TIFFGenerator::loadDocument( const QString & fileName, QVector<Okular::Page
     QFile* qfile = new QFile( fileName );
     qfile->open( QIODevice::ReadOnly );
     d->dev = qfile;
+    d->fileName = fileName;
     d->data = QFile::encodeName( QFileInfo( *qfile ).fileName() );
     return loadTiff( pagesVector, d->data.constData() );
 }
@@ -226,6 +314,7 @@ bool TIFFGenerator::loadTiff( QVector< Okular::Page * > & pagesVector, const cha
         delete d->dev;
         d->dev = 0;
         d->data.clear();
+        d->fileName.clear();
         return false;
     }
 
@@ -237,6 +326,7 @@ bool TIFFGenerator::loadTiff( QVector< Okular::Page * > & pagesVector, const cha
 bool TIFFGenerator::doCloseDocument()
 {
     // closing the old document
+    d->closeHandles();
     if ( d->tiff )
     {
         TIFFClose( d->tiff );
@@ -244,54 +334,279 @@ bool TIFFGenerator::doCloseDocument()
         delete d->dev;
         d->dev = 0;
         d->data.clear();
-        m_pageMapping.clear();
+        d->fileName.clear();
+        d->levels.clear();
     }
 
     return true;
 }
 
+/**
+ * Converts @p image to an 8 bit grayscale image, which takes a quarter of
+ * the memory of a 32 bit one in the page cache.
+ */
+static QImage grayscaleImage( const QImage &image )
+{
+    QVector< QRgb > colorTable( 256 );
+    for ( int i = 0; i < 256; ++i )
+        colorTable[i] = qRgb( i, i, i );
+
+    QImage gray( image.width(), image.height(), QImage::Format_Indexed8 );
+    gray.setColorTable( colorTable );
+    for ( int y = 0; y < image.height(); ++y )
+    {
+        const QRgb *src = reinterpret_cast< const QRgb * >( image.scanLine( y ) );
+        uchar *dest = gray.scanLine( y );
+        for ( int x = 0; x < image.width(); ++x )
+            dest[x] = qGray( src[x] );
+    }
+    return gray;
+}
+
+// writes the averages accumulated in @p sums and @p counts to @p row of @p image
+static void flushRow( QImage *image, int row, QVector< quint64 > &sums, QVector< int > &counts )
+{
+    if ( row < 0 )
+        return;
+
+    QRgb *dest = reinterpret_cast< QRgb * >( image->scanLine( row ) );
+    for ( int x = 0; x < image->width(); ++x )
+    {
+        const int count = counts[ x ];
+        if ( count > 0 )
+            dest[ x ] = qRgb( sums[ 3 * x ] / count, sums[ 3 * x + 1 ] / count, sums[ 3 * x + 2 ] / count );
+        sums[ 3 * x ] = sums[ 3 * x + 1 ] = sums[ 3 * x + 2 ] = 0;
+        counts[ x ] = 0;
+    }
+}
+
+/**
+ * Decodes the part @p region of the current directory of @p tiff, an image
+ * of @p width x @p height pixels, scaled to @p scaledWidth x @p scaledHeight.
+ *
+ * Only the strips or tiles that intersect @p region are read, a band of rows
+ * at a time. When scaling down, each band is averaged into the rows of the
+ * result as soon as it is decoded. A band holds MaxBandPixels pixels, or a
+ * whole strip when a strip is taller than that but has at most MaxStripPixels
+ * pixels, so that no strip is decoded more than once: an image stored as a
+ * single strip of up to MaxStripPixels pixels (128 MB decoded) is thus read
+ * at once. Bigger strips are read in bands of MaxBandPixels pixels, decoding
+ * the strip again for each of them. When scaling up, the source pixels are
+ * fewer than the result ones and are decoded at once, then scaled with
+ * @p nearest or smooth sampling.
+ *
+ * Returns a null image on failure or when @p request is aborted.
+ */
+static QImage decodeRegion( TIFF *tiff, uint32 orientation, uint32 width, uint32 height,
+                            int scaledWidth, int scaledHeight, const QRect &region, bool nearest,
+                            Okular::PixmapRequest *request )
+{
+    char emsg[1024];
+    TIFFRGBAImage rgba;
+    if ( !TIFFRGBAImageOK( tiff, emsg ) || !TIFFRGBAImageBegin( &rgba, tiff, 0, emsg ) )
+    {
+        kWarning(TiffDebug) << "Cannot decode the image:" << emsg;
+        return QImage();
+    }
+    // the pixels as laid out in the file, the page is rotated by the core
+    rgba.req_orientation = orientation;
+
+    const bool downscale = (int)width >= scaledWidth && (int)height >= scaledHeight;
+
+    // the source pixels covering the region, plus one pixel around them for
+    // the interpolation when scaling up, so that tiles join seamlessly
+    const int margin = downscale ? 0 : 1;
+    const int sx0 = qMax( 0, (int)( (qint64)region.x() * width / scaledWidth ) - margin );
+    const int sy0 = qMax( 0, (int)( (qint64)region.y() * height / scaledHeight ) - margin );
+    const int sx1 = qMin( (int)width, (int)( ( (qint64)( region.x() + region.width() ) * width + scaledWidth - 1 ) / scaledWidth ) + margin );
+    const int sy1 = qMin( (int)height, (int)( ( (qint64)( region.y() + region.height() ) * height + scaledHeight - 1 ) / scaledHeight ) + margin );
+    const int sw = sx1 - sx0;
+    const int sh = sy1 - sy0;
+
+    QImage result( region.size(), QImage::Format_RGB32 );
+    result.fill( qRgb( 255, 255, 255 ) );
+    if ( sw <= 0 || sh <= 0 )
+    {
+        TIFFRGBAImageEnd( &rgba );
+        return result;
+    }
+
+    if ( !downscale )
+    {
+        QImage source( sw, sh, QImage::Format_RGB32 );
+        rgba.row_offset = sy0;
+        rgba.col_offset = sx0;
+        const bool ok = TIFFRGBAImageGet( &rgba, (uint32 *)source.bits(), sw, sh ) != 0;
+        TIFFRGBAImageEnd( &rgba );
+        if ( !ok )
+            return QImage();
+
+        // an image read by TIFFRGBAImageGet is ABGR, we need ARGB
+        source = source.rgbSwapped();
+
+        if ( nearest )
+        {
+            QVector< int > columns( region.width() );
+            for ( int x = 0; x < region.width(); ++x )
+                columns[ x ] = qBound( 0, (int)( (qint64)( region.x() + x ) * width / scaledWidth ) - sx0, sw - 1 );
+            for ( int y = 0; y < region.height(); ++y )
+            {
+                const int sy = qBound( 0, (int)( (qint64)( region.y() + y ) * height / scaledHeight ) - sy0, sh - 1 );
+                const QRgb *src = reinterpret_cast< const QRgb * >( source.constScanLine( sy ) );
+                QRgb *dest = reinterpret_cast< QRgb * >( result.scanLine( y ) );
+                for ( int x = 0; x < region.width(); ++x )
+                    dest[ x ] = src[ columns[ x ] ];
+            }
+        }
+        else
+        {
+            QPainter p( &result );
+            p.setRenderHint( QPainter::SmoothPixmapTransform );
+            p.translate( -region.x(), -region.y() );
+            p.scale( (qreal)scaledWidth / width, (qreal)scaledHeight / height );
+            p.drawImage( sx0, sy0, source );
+        }
+        return result;
+    }
+
+    // the column of the result each source column goes to, -1 if none
+    QVector< int > columns( sw );
+    for ( int i = 0; i < sw; ++i )
+    {
+        const int x = (int)( (qint64)( sx0 + i ) * scaledWidth / width ) - region.x();
+        columns[ i ] = x < region.width() ? x : -1;
+    }
+
+    // bands of whole strips or tiles, so that each is decoded only once
+    uint32 unit = 0;
+    if ( TIFFIsTiled( tiff ) )
+        TIFFGetField( tiff, TIFFTAG_TILELENGTH, &unit );
+    else
+        TIFFGetFieldDefaulted( tiff, TIFFTAG_ROWSPERSTRIP, &unit );
+    unit = qBound( (uint32)1, unit, height );
+    int bandRows = qMax( 1, MaxBandPixels / sw );
+    if ( bandRows >= (int)unit )
+        bandRows -= bandRows % unit;
+    else if ( (qint64)unit * sw <= MaxStripPixels )
+        // up to the whole image when it is a single strip
+        bandRows = unit;
+
+    QVector< uint32 > band( bandRows * sw );
+    QVector< quint64 > sums( 3 * region.width(), 0 );
+    QVector< int > counts( region.width(), 0 );
+    int currentRow = -1;
+    // start at a band boundary, for the same reason
+    for ( int bandY = sy0 - sy0 % bandRows; bandY < sy1; bandY += bandRows )
+    {
+        if ( request && request->shouldAbortRender() )
+        {
+            TIFFRGBAImageEnd( &rgba );
+            return QImage();
+        }
+
+        const int firstRow = qMax( bandY, sy0 );
+        const int rows = qMin( bandY + bandRows, sy1 ) - firstRow;
+        rgba.row_offset = firstRow;
+        rgba.col_offset = sx0;
+        if ( !TIFFRGBAImageGet( &rgba, band.data(), sw, rows ) )
+        {
+            TIFFRGBAImageEnd( &rgba );
+            return QImage();
+        }
+
+        for ( int r = 0; r < rows; ++r )
+        {
+            const int y = (int)( (qint64)( firstRow + r ) * scaledHeight / height ) - region.y();
+            if ( y < 0 || y >= region.height() )
+                continue;
+            if ( y != currentRow )
+            {
+                flushRow( &result, currentRow, sums, counts );
+                currentRow = y;
+            }
+
+            const uint32 *src = band.constData() + r * sw;
+            for ( int i = 0; i < sw; ++i )
+            {
+                const int x = columns[ i ];
+                if ( x < 0 )
+                    continue;
+                sums[ 3 * x ] += TIFFGetR( src[ i ] );
+                sums[ 3 * x + 1 ] += TIFFGetG( src[ i ] );
+                sums[ 3 * x + 2 ] += TIFFGetB( src[ i ] );
+                ++counts[ x ];
+            }
+        }
+    }
+    flushRow( &result, currentRow, sums, counts );
+    TIFFRGBAImageEnd( &rgba );
+
+    return result;
+}
+
 QImage TIFFGenerator::image( Okular::PixmapRequest * request )
 {
     bool generated = false;
     QImage img;
 
-    if ( TIFFSetDirectory( d->tiff, mapPage( request->page()->number() ) ) )
+    // the directories are reached through their offsets, without walking
+    // the chain of directories of the file
+    const QList< TiffLevel > levels = d->levels.value( request->pageNumber() );
+    TIFF *tiff = levels.isEmpty() ? 0 : d->acquireHandle();
+    if ( tiff && TIFFSetSubDirectory( tiff, levels.first().offset ) )
     {
-        int rotation = request->page()->rotation();
-        uint32 width = 1;
-        uint32 height = 1;
         uint32 orientation = 0;
-        TIFFGetField( d->tiff, TIFFTAG_IMAGEWIDTH, &width );
-        TIFFGetField( d->tiff, TIFFTAG_IMAGELENGTH, &height );
-
-        if ( !TIFFGetField( d->tiff, TIFFTAG_ORIENTATION, &orientation ) )
+        if ( !TIFFGetField( tiff, TIFFTAG_ORIENTATION, &orientation ) )
             orientation = ORIENTATION_TOPLEFT;
 
-        QImage image( width, height, QImage::Format_RGB32 );
-        uint32 * data = (uint32 *)image.bits();
+        // fax and scanned pages are often bilevel or grayscale
+        uint16 samplesPerPixel = 1;
+        uint16 bitsPerSample = 1;
+        uint16 photometric = PHOTOMETRIC_RGB;
+        TIFFGetFieldDefaulted( tiff, TIFFTAG_SAMPLESPERPIXEL, &samplesPerPixel );
+        TIFFGetFieldDefaulted( tiff, TIFFTAG_BITSPERSAMPLE, &bitsPerSample );
+        TIFFGetField( tiff, TIFFTAG_PHOTOMETRIC, &photometric );
+        const bool grayscale = samplesPerPixel == 1 && bitsPerSample <= 8 &&
+            ( photometric == PHOTOMETRIC_MINISWHITE || photometric == PHOTOMETRIC_MINISBLACK );
+
+        // the request is for the unrotated page, the core rotates the image
+        const int reqwidth = request->width();
+        const int reqheight = request->height();
+        const Okular::NormalizedRect rect = request->isTile() ? request->normalizedRect() : Okular::NormalizedRect( 0, 0, 1, 1 );
+        const QRect region = rect.geometry( reqwidth, reqheight ) & QRect( 0, 0, reqwidth, reqheight );
+
+        // the smallest resolution that is not smaller than the request
+        TiffLevel level = levels.first();
+        foreach ( const TiffLevel &l, levels )
+        {
+            if ( (int)l.width >= reqwidth && (int)l.height >= reqheight )
+                level = l;
+        }
 
-        // read data
-        if ( TIFFReadRGBAImageOriented( d->tiff, width, height, data, orientation ) != 0 )
+        // a bilevel page zoomed in stays bilevel: 1 bit per pixel
+        const bool bilevel = grayscale && bitsPerSample == 1 && reqwidth >= (int)level.width && reqheight >= (int)level.height;
+
+        if ( !region.isEmpty() && ( level.offset == levels.first().offset || TIFFSetSubDirectory( tiff, level.offset ) ) )
         {
-            // an image read by ReadRGBAImage is ABGR, we need ARGB, so swap red and blue
-            uint32 size = width * height;
-            for ( uint32 i = 0; i < size; ++i )
+            const QImage image = decodeRegion( tiff, orientation, level.width, level.height,
+                                               reqwidth, reqheight, region, bilevel, request );
+            if ( !image.isNull() )
             {
-                uint32 red = ( data[i] & 0x00FF0000 ) >> 16;
-                uint32 blue = ( data[i] & 0x000000FF ) << 16;
-                data[i] = ( data[i] & 0xFF00FF00 ) + red + blue;
+                if ( bilevel )
+                    img = image.convertToFormat( QImage::Format_Mono, Qt::ThresholdDither );
+                else if ( grayscale )
+                    img = grayscaleImage( image );
+                else
+                    img = image;
+
+                generated = true;
             }
-
-            int reqwidth = request->width();
-            int reqheight = request->height();
-            if ( rotation % 2 == 1 )
-                qSwap( reqwidth, reqheight );
-            img = image.scaled( reqwidth, reqheight, Qt::IgnoreAspectRatio, Qt::SmoothTransformation );
-
-            generated = true;
         }
     }
 
+    if ( tiff )
+        d->releaseHandle( tiff );
+
     if ( !generated )
     {
         img = QImage( request->width(), request->height(), QImage::Format_RGB32 );
@@ -349,6 +664,28 @@ Okular::DocumentInfo TIFFGenerator::generateDocumentInfo( const QSet<Okular::Doc
     return docInfo;
 }
 
+static bool largerLevel( const TiffLevel &l1, const TiffLevel &l2 )
+{
+    return l1.width > l2.width;
+}
+
+// whether the current directory is a reduced resolution version of a page
+static bool isReducedImage( TIFF *tiff )
+{
+    uint32 subfileType = 0;
+    return TIFFGetField( tiff, TIFFTAG_SUBFILETYPE, &subfileType ) && ( subfileType & FILETYPE_REDUCEDIMAGE );
+}
+
+// appends the size of the current directory, at @p offset, to @p levels
+static void appendLevel( TIFF *tiff, toff_t offset, QList< TiffLevel > *levels )
+{
+    TiffLevel level;
+    level.offset = offset;
+    if ( TIFFGetField( tiff, TIFFTAG_IMAGEWIDTH, &level.width ) == 1 &&
+         TIFFGetField( tiff, TIFFTAG_IMAGELENGTH, &level.height ) == 1 )
+        levels->append( level );
+}
+
 void TIFFGenerator::loadPages( QVector<Okular::Page*> & pagesVector )
 {
     if ( !d->tiff )
@@ -356,7 +693,9 @@ void TIFFGenerator::loadPages( QVector<Okular::Page*> & pagesVector )
 
     tdir_t dirs = TIFFNumberOfDirectories( d->tiff );
     pagesVector.resize( dirs );
+    d->levels.resize( dirs );
     tdir_t realdirs = 0;
+    toff_t pageOffset = 0;
 
     uint32 width = 0;
     uint32 height = 0;
@@ -364,27 +703,56 @@ void TIFFGenerator::loadPages( QVector<Okular::Page*> & pagesVector )
     const double dpiX = Okular::Utils::dpiX();
     const double dpiY = Okular::Utils::dpiY();
 
-    for ( tdir_t i = 0; i < dirs; ++i )
+    // one pass over the chain of directories
+    bool more = TIFFSetDirectory( d->tiff, 0 );
+    for ( ; more && realdirs < dirs; more = TIFFReadDirectory( d->tiff ) )
     {
-        if ( !TIFFSetDirectory( d->tiff, i ) )
+        // the reduced resolution images of pyramidal files are not pages
+        if ( realdirs > 0 && isReducedImage( d->tiff ) )
+        {
+            appendLevel( d->tiff, TIFFCurrentDirOffset( d->tiff ), &d->levels[ realdirs - 1 ] );
             continue;
+        }
 
         if ( TIFFGetField( d->tiff, TIFFTAG_IMAGEWIDTH, &width ) != 1 ||
              TIFFGetField( d->tiff, TIFFTAG_IMAGELENGTH, &height ) != 1 )
             continue;
 
+        pageOffset = TIFFCurrentDirOffset( d->tiff );
+        QList< TiffLevel > &levels = d->levels[ realdirs ];
+        levels.clear();
+        appendLevel( d->tiff, pageOffset, &levels );
+
         adaptSizeToResolution( d->tiff, TIFFTAG_XRESOLUTION, dpiX, &width );
         adaptSizeToResolution( d->tiff, TIFFTAG_YRESOLUTION, dpiY, &height );
 
         Okular::Page * page = new Okular::Page( realdirs, width, height, readTiffRotation( d->tiff ) );
         pagesVector[ realdirs ] = page;
-
-        m_pageMapping[ realdirs ] = i;
-
         ++realdirs;
+
+        // reduced resolution images in SubIFDs; the array belongs to the
+        // directory, which is left while reading them
+        uint16 subIfdCount = 0;
+        toff_t *subIfds = 0;
+        if ( TIFFGetField( d->tiff, TIFFTAG_SUBIFD, &subIfdCount, &subIfds ) && subIfdCount > 0 )
+        {
+            QVector< toff_t > offsets( subIfdCount );
+            qCopy( subIfds, subIfds + subIfdCount, offsets.begin() );
+            foreach ( toff_t offset, offsets )
+            {
+                if ( TIFFSetSubDirectory( d->tiff, offset ) && isReducedImage( d->tiff ) )
+                    appendLevel( d->tiff, offset, &levels );
+            }
+            // back to the page, to go on with the directory after it
+            if ( !TIFFSetSubDirectory( d->tiff, pageOffset ) )
+                break;
+        }
     }
 
     pagesVector.resize( realdirs );
+    d->levels.resize( realdirs );
+    for ( int i = 0; i < d->levels.count(); ++i )
+        qStableSort( d->levels[ i ].begin(), d->levels[ i ].end(), largerLevel );
 }
 
 bool TIFFGenerator::print( QPrinter& printer )
@@ -400,7 +768,8 @@ bool TIFFGenerator::print( QPrinter& printer )
 
     for ( tdir_t i = 0; i < pageList.count(); ++i )
     {
-        if ( !TIFFSetDirectory( d->tiff, mapPage( pageList[i] - 1 ) ) )
+        const QList< TiffLevel > levels = d->levels.value( pageList[i] - 1 );
+        if ( levels.isEmpty() || !TIFFSetSubDirectory( d->tiff, levels.first().offset ) )
             continue;
 
         if ( TIFFGetField( d->tiff, TIFFTAG_IMAGEWIDTH, &width ) != 1 ||
@@ -441,16 +810,5 @@ bool TIFFGenerator::print( QPrinter& printer )
     return true;
 }
 
-int TIFFGenerator::mapPage( int page ) const
-{
-    QHash< int, int >::const_iterator it = m_pageMapping.find( page );
-    if ( it == m_pageMapping.end() )
-    {
-        kWarning(TiffDebug) << "Requesting unmapped page" << page << ":" << m_pageMapping;
-        return -1;
-    }
-    return it.value();
-}
-
 #include "generator_tiff.moc"
 
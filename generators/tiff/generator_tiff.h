@@ -12,8 +12,6 @@
 
 #include <core/generator.h>
 
-#include <qhash.h>
-
 class TIFFGenerator : public Okular::Generator
 {
     Q_OBJECT
@@ -38,9 +36,6 @@ class TIFFGenerator : public Okular::Generator
 
         bool loadTiff( QVector< Okular::Page * > & pagesVector, const char *name );
         void loadPages( QVector<Okular::Page*> & pagesVector );
-        int mapPage( int page ) const;
-
-        QHash< int, int > m_pageMapping;
 };
 
 #endif
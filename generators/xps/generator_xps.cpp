@@ -747,6 +747,7 @@ static QString unicodeString( const QString &raw )
 XpsHandler::XpsHandler(XpsPage *page): m_page(page)
 {
     m_painter = NULL;
+    m_request = NULL;
 }
 
 XpsHandler::~XpsHandler()
@@ -772,6 +773,10 @@ bool XpsHandler::startElement( const QString &nameSpace,
     Q_UNUSED( nameSpace )
     Q_UNUSED( qname )
 
+    // stops the parsing
+    if ( m_request && m_request->shouldAbortRender() )
+        return false;
+
     XpsRenderNode node;
     node.name = localName;
     node.attributes = atts;
@@ -1433,7 +1438,7 @@ XpsPage::~XpsPage()
     delete m_pageImage;
 }
 
-bool XpsPage::renderToImage( QImage *p )
+bool XpsPage::renderToImage( QImage *p, const Okular::PixmapRequest *request )
 {
 
     if ((m_pageImage == NULL) || (m_pageImage->size() != p->size())) {
@@ -1448,19 +1453,20 @@ bool XpsPage::renderToImage( QImage *p )
     if (! m_pageIsRendered) {
         m_pageImage->fill( qRgba( 255, 255, 255, 255 ) );
         QPainter painter( m_pageImage );
-        renderToPainter( &painter );
-        m_pageIsRendered = true;
+        // an aborted rendering must not be reused
+        m_pageIsRendered = renderToPainter( &painter, request );
     }
 
     *p = *m_pageImage;
 
-    return true;
+    return m_pageIsRendered;
 }
 
-bool XpsPage::renderToPainter( QPainter *painter )
+bool XpsPage::renderToPainter( QPainter *painter, const Okular::PixmapRequest *request )
 {
     XpsHandler handler( this );
     handler.m_painter = painter;
+    handler.m_request = request;
     handler.m_painter->setWorldTransform(QTransform().scale((qreal)painter->device()->width() / size().width(), (qreal)painter->device()->height() / size().height()));
     QXmlSimpleReader parser;
     parser.setContentHandler( &handler );
@@ -1472,7 +1478,7 @@ bool XpsPage::renderToPainter( QPainter *painter )
     bool ok = parser.parse( source );
     kDebug(XpsDebug) << "Parse result: " << ok;
 
-    return true;
+    return !request || !request->shouldAbortRender();
 }
 
 QSizeF XpsPage::size() const
@@ -2139,7 +2145,7 @@ QImage XpsGenerator::image( Okular::PixmapRequest * request )
     QSize size( (int)request->width(), (int)request->height() );
     QImage image( size, QImage::Format_RGB32 );
     XpsPage *pageToRender = m_xpsFile->page( request->page()->number() );
-    pageToRender->renderToImage( &image );
+    pageToRender->renderToImage( &image, request );
     return image;
 }
 
@@ -139,6 +139,9 @@ protected:
 
     QPainter *m_painter;
 
+    // the request being rendered, polled for cancellation between nodes
+    const Okular::PixmapRequest *m_request;
+
     QImage m_image;
 
     QStack<XpsRenderNode> m_nodes;
@@ -153,8 +156,8 @@ public:
     ~XpsPage();
 
     QSizeF size() const;
-    bool renderToImage( QImage *p );
-    bool renderToPainter( QPainter *painter );
+    bool renderToImage( QImage *p, const Okular::PixmapRequest *request = 0 );
+    bool renderToPainter( QPainter *painter, const Okular::PixmapRequest *request = 0 );
     Okular::TextPage* textPage();
 
     QImage loadImageFromFile( const QString &filename );
@@ -0,0 +1,125 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <qtest_kde.h>
+
+#include "../core/observer.h"
+#include "../core/allocatedpixmaps_p.h"
+
+class VisiblePagesObserver : public Okular::DocumentObserver
+{
+    public:
+        VisiblePagesObserver( int first, int last ) : m_first( first ), m_last( last ) {}
+
+        bool canUnloadPixmap( int page ) const
+        {
+            return page < m_first || page > m_last;
+        }
+
+    private:
+        int m_first;
+        int m_last;
+};
+
+class AllocatedPixmapsTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void testFarthest();
+        void testTake();
+        void benchmarkEviction();
+};
+
+void AllocatedPixmapsTest::testFarthest()
+{
+    VisiblePagesObserver observer1( 8, 12 );
+    Okular::DocumentObserver observer2;
+    Okular::AllocatedPixmaps pixmaps;
+    QVERIFY( !pixmaps.farthest( 10, false ) );
+
+    for ( int page = 8; page <= 12; ++page )
+        pixmaps.append( new AllocatedPixmap( &observer1, page, 100 ) );
+    pixmaps.append( new AllocatedPixmap( &observer2, 13, 100 ) );
+    QCOMPARE( pixmaps.count(), 6 );
+
+    // pixmaps of visible pages are only candidates if unloadableOnly is false
+    QCOMPARE( pixmaps.farthest( 10, false )->page, 13 );
+    QCOMPARE( pixmaps.farthest( 10, false, &observer1 )->page, 8 );
+    QVERIFY( !pixmaps.farthest( 10, true, &observer1 ) );
+    QCOMPARE( pixmaps.farthest( 10, true )->observer, &observer2 );
+
+    // moving the viewport changes the farthest page without touching the index
+    QCOMPARE( pixmaps.farthest( 13, false )->page, 8 );
+    QCOMPARE( pixmaps.farthest( 7, false )->page, 13 );
+
+    pixmaps.append( new AllocatedPixmap( &observer1, 0, 100 ) );
+    QCOMPARE( pixmaps.farthest( 10, true )->page, 0 );
+
+    qDeleteAll( pixmaps.takeAll() );
+    QVERIFY( pixmaps.isEmpty() );
+}
+
+void AllocatedPixmapsTest::testTake()
+{
+    Okular::DocumentObserver observer1, observer2;
+    Okular::AllocatedPixmaps pixmaps;
+
+    for ( int page = 0; page < 10; ++page )
+    {
+        pixmaps.append( new AllocatedPixmap( &observer1, page, 100 ) );
+        pixmaps.append( new AllocatedPixmap( &observer2, page, 10 ) );
+    }
+
+    AllocatedPixmap *p = pixmaps.take( &observer2, 9 );
+    QVERIFY( p );
+    QCOMPARE( p->observer, &observer2 );
+    QCOMPARE( p->page, 9 );
+    delete p;
+    QVERIFY( !pixmaps.take( &observer2, 9 ) );
+    QCOMPARE( pixmaps.count(), 19 );
+
+    QCOMPARE( pixmaps.farthest( 0, false, &observer2 )->page, 8 );
+
+    QList< AllocatedPixmap * > taken = pixmaps.takeAll( &observer1 );
+    QCOMPARE( taken.count(), 10 );
+    qDeleteAll( taken );
+    QVERIFY( !pixmaps.farthest( 0, false, &observer1 ) );
+    QCOMPARE( pixmaps.farthest( 0, false )->observer, &observer2 );
+
+    taken = pixmaps.takeAll();
+    QCOMPARE( taken.count(), 9 );
+    qDeleteAll( taken );
+    QVERIFY( pixmaps.isEmpty() );
+}
+
+// Evict and reallocate pixmaps while scrolling through a big document with
+// thousands of cached pixmaps; the cost must not depend on the cache size
+void AllocatedPixmapsTest::benchmarkEviction()
+{
+    const int pages = 5000;
+    Okular::DocumentObserver observer;
+    Okular::AllocatedPixmaps pixmaps;
+    for ( int page = 0; page < pages; ++page )
+        pixmaps.append( new AllocatedPixmap( &observer, page, 100 ) );
+
+    int current = 0;
+    QBENCHMARK
+    {
+        AllocatedPixmap *p = pixmaps.farthest( current, true );
+        pixmaps.remove( p );
+        pixmaps.append( p );
+        current = ( current + 1 ) % pages;
+    }
+
+    qDeleteAll( pixmaps.takeAll() );
+}
+
+QTEST_KDEMAIN( AllocatedPixmapsTest, NoGUI )
+#include "allocatedpixmapstest.moc"
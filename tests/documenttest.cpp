@@ -9,11 +9,14 @@
 
 #include <qtest_kde.h>
 
+#include <QtCore/QElapsedTimer>
+
 #include <threadweaver/ThreadWeaver.h>
 
 #include "../core/document.h"
 #include "../core/generator.h"
 #include "../core/observer.h"
+#include "../core/page.h"
 #include "../core/rotationjob_p.h"
 #include "../settings_core.h"
 
@@ -24,6 +27,7 @@ class DocumentTest
 
     private slots:
         void testCloseDuringRotationJob();
+        void testRequestAfterAbort();
 };
 
 // Test that we don't crash if the document is closed while a RotationJob
@@ -58,5 +62,41 @@ void DocumentTest::testCloseDuringRotationJob()
     qApp->processEvents();
 }
 
+// Test that a page is rendered when it is requested again at the size of a
+// request that was aborted while it was being rendered
+void DocumentTest::testRequestAfterAbort()
+{
+    Okular::SettingsCore::instance( "documenttest" );
+    Okular::Document *document = new Okular::Document( 0 );
+    const QString testFile = KDESRCDIR "data/file1.pdf";
+    const KMimeType::Ptr mime = KMimeType::findByPath( testFile );
+
+    Okular::DocumentObserver *observer = new Okular::DocumentObserver();
+    document->addObserver( observer );
+    QCOMPARE( document->openDocument( testFile, KUrl(), mime ), Okular::Document::OpenSuccess );
+
+    // render the first page, then abort it requesting only the second one
+    document->requestPixmaps( QLinkedList<Okular::PixmapRequest*>()
+        << new Okular::PixmapRequest( observer, 0, 300, 300, 1, Okular::PixmapRequest::Asynchronous ) );
+    document->requestPixmaps( QLinkedList<Okular::PixmapRequest*>()
+        << new Okular::PixmapRequest( observer, 1, 300, 300, 1, Okular::PixmapRequest::Asynchronous ) );
+
+    // and request it again at the same size
+    document->requestPixmaps( QLinkedList<Okular::PixmapRequest*>()
+        << new Okular::PixmapRequest( observer, 0, 300, 300, 1, Okular::PixmapRequest::Asynchronous )
+        << new Okular::PixmapRequest( observer, 1, 300, 300, 1, Okular::PixmapRequest::Asynchronous ) );
+
+    QElapsedTimer timer;
+    timer.start();
+    while ( !document->page( 0 )->hasPixmap( observer, 300, 300 ) && timer.elapsed() < 10000 )
+        QTest::qWait( 50 );
+    QVERIFY( document->page( 0 )->hasPixmap( observer, 300, 300 ) );
+
+    document->closeDocument();
+    document->removeObserver( observer );
+    delete document;
+    delete observer;
+}
+
 QTEST_KDEMAIN( DocumentTest, GUI )
 #include "documenttest.moc"
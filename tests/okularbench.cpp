@@ -0,0 +1,332 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+/*
+ * Headless benchmark of okularcore: opens each document given on the
+ * command line with the generator installed for its type, and measures
+ * the open time, the time to the first pixmap, the render throughput, the
+ * text extraction time, the search latency and the peak memory.
+ *
+ * The results are written to stdout as JSON (default) or CSV, one record
+ * per document, so that they can be compared across releases.
+ */
+
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QEventLoop>
+#include <QtCore/QFile>
+#include <QtCore/QLinkedList>
+#include <QtCore/QSet>
+#include <QtCore/QTextStream>
+#include <QtCore/QTimer>
+#include <QtGui/QColor>
+
+#include <kaboutdata.h>
+#include <kapplication.h>
+#include <kcmdlineargs.h>
+#include <kmimetype.h>
+#include <kurl.h>
+
+#include "../core/document.h"
+#include "../core/generator.h"
+#include "../core/observer.h"
+#include "../core/page.h"
+#include "../settings_core.h"
+
+Q_DECLARE_METATYPE(Okular::Document::SearchStatus)
+
+// give up on a page or a search after this time
+static const int Timeout = 60000;
+
+class BenchObserver : public QObject, public Okular::DocumentObserver
+{
+    Q_OBJECT
+
+    public:
+        BenchObserver( Okular::Document *document )
+            : m_document( document ), m_peakPixmapBytes( 0 )
+        {
+        }
+
+        void notifyPageChanged( int page, int flags )
+        {
+            if ( !( flags & Pixmap ) )
+                return;
+
+            m_renderedPages.insert( page );
+
+            // as the document accounts it, with the pixmaps of other pages
+            // evicted meanwhile and the compact pages at their real size
+            m_peakPixmapBytes = qMax( m_peakPixmapBytes, m_document->pixmapsMemory() );
+
+            emit pixmapRendered();
+        }
+
+        // renders @p page at @p width pixels, returns false on timeout
+        bool renderPage( int page, int width )
+        {
+            const Okular::Page *p = m_document->page( page );
+            const int height = qRound( width * p->ratio() );
+            m_renderedPages.remove( page );
+
+            Okular::PixmapRequest *request = new Okular::PixmapRequest( this, page, width, height, 1, Okular::PixmapRequest::Asynchronous );
+            m_document->requestPixmaps( QLinkedList< Okular::PixmapRequest * >() << request, Okular::Document::NoOption );
+
+            // synchronous generators are done already
+            QEventLoop loop;
+            QTimer timer;
+            timer.setSingleShot( true );
+            connect( this, SIGNAL(pixmapRendered()), &loop, SLOT(quit()) );
+            connect( &timer, SIGNAL(timeout()), &loop, SLOT(quit()) );
+            timer.start( Timeout );
+            while ( !m_renderedPages.contains( page ) && timer.isActive() )
+                loop.exec();
+            return m_renderedPages.contains( page );
+        }
+
+        qulonglong peakPixmapBytes() const
+        {
+            return m_peakPixmapBytes;
+        }
+
+    signals:
+        void pixmapRendered();
+
+    private:
+        Okular::Document *m_document;
+        QSet< int > m_renderedPages;
+        qulonglong m_peakPixmapBytes;
+};
+
+class SearchWaiter : public QObject
+{
+    Q_OBJECT
+
+    public:
+        SearchWaiter() : m_finished( false ), m_status( Okular::Document::NoMatchFound ) {}
+
+        bool m_finished;
+        Okular::Document::SearchStatus m_status;
+
+    public slots:
+        void searchFinished( int, Okular::Document::SearchStatus status )
+        {
+            m_finished = true;
+            m_status = status;
+            emit finished();
+        }
+
+    signals:
+        void finished();
+};
+
+struct BenchResult
+{
+    QString file;
+    QString mimeType;
+    int pages;
+    qint64 openMs;
+    qint64 firstPixmapMs;
+    double pagesPerSecond;
+    qint64 textExtractionMs;
+    qint64 searchMs;
+    bool searchMatched;
+    qulonglong peakPixmapBytes;
+    qulonglong peakRssBytes;
+};
+
+// peak resident memory of the process, or 0 where it is unknown
+static qulonglong peakRss()
+{
+#if defined(Q_OS_LINUX)
+    QFile statusFile( "/proc/self/status" );
+    if ( !statusFile.open( QIODevice::ReadOnly ) )
+        return 0;
+
+    QTextStream readStream( &statusFile );
+    while ( true )
+    {
+        const QString entry = readStream.readLine();
+        if ( entry.isNull() ) break;
+        if ( entry.startsWith( "VmHWM:" ) )
+            return Q_UINT64_C(1024) * entry.section( ' ', -2, -2 ).toULongLong();
+    }
+#endif
+    return 0;
+}
+
+static bool runBenchmark( const QString &fileName, int width, int maxPages, const QString &searchText, BenchResult *result )
+{
+    const KMimeType::Ptr mime = KMimeType::findByPath( fileName );
+    result->file = fileName;
+    result->mimeType = mime->name();
+
+    Okular::Document document( 0 );
+    BenchObserver observer( &document );
+    document.addObserver( &observer );
+
+    QElapsedTimer timer;
+    timer.start();
+    if ( document.openDocument( fileName, KUrl( fileName ), mime ) != Okular::Document::OpenSuccess )
+    {
+        document.removeObserver( &observer );
+        return false;
+    }
+    result->openMs = timer.elapsed();
+    result->pages = document.pages();
+
+    const int pages = maxPages > 0 ? qMin( (int)document.pages(), maxPages ) : document.pages();
+
+    // the text of the rendered pages is not extracted along with them, so
+    // that the render phase does not include text extraction and the text
+    // phase finds no text pages already extracted
+    document.setExtractTextOfRenderedPages( false );
+
+    // time to first pixmap
+    timer.restart();
+    observer.renderPage( 0, width );
+    result->firstPixmapMs = timer.elapsed();
+
+    // sustained throughput, page after page
+    int renderedPages = 0;
+    timer.restart();
+    for ( int i = 1; i < pages; ++i )
+    {
+        if ( observer.renderPage( i, width ) )
+            ++renderedPages;
+    }
+    const qint64 renderMs = timer.elapsed();
+    result->pagesPerSecond = renderMs > 0 ? renderedPages * 1000.0 / renderMs : 0;
+    document.setExtractTextOfRenderedPages( true );
+
+    // full document text extraction, several pages at the same time if
+    // the generator allows it, ahead of the page being used
+    timer.restart();
+    QList< int > textPages;
+    for ( int i = 0; i < pages; ++i )
+        textPages.append( i );
+    for ( int i = 0; i < pages; ++i )
+    {
+        document.requestTextPages( textPages.mid( i ) );
+        if ( !document.page( i )->hasTextPage() )
+            document.requestTextPage( i );
+    }
+    document.requestTextPages( QList< int >() );
+    result->textExtractionMs = timer.elapsed();
+
+    // search latency, with the text pages in place
+    SearchWaiter waiter;
+    QObject::connect( &document, SIGNAL(searchFinished(int,Okular::Document::SearchStatus)),
+                      &waiter, SLOT(searchFinished(int,Okular::Document::SearchStatus)) );
+    QEventLoop loop;
+    QObject::connect( &waiter, SIGNAL(finished()), &loop, SLOT(quit()) );
+    QTimer::singleShot( Timeout, &loop, SLOT(quit()) );
+    timer.restart();
+    document.searchText( 1, searchText, true, Qt::CaseInsensitive, Okular::Document::AllDocument, false, Qt::yellow );
+    if ( !waiter.m_finished )
+        loop.exec();
+    result->searchMs = timer.elapsed();
+    result->searchMatched = waiter.m_status == Okular::Document::MatchFound;
+
+    result->peakPixmapBytes = observer.peakPixmapBytes();
+    result->peakRssBytes = peakRss();
+
+    document.closeDocument();
+    document.removeObserver( &observer );
+    return true;
+}
+
+static QString jsonString( const QString &s )
+{
+    QString escaped = s;
+    escaped.replace( '\\', "\\\\" ).replace( '"', "\\\"" );
+    return '"' + escaped + '"';
+}
+
+static QString csvString( const QString &s )
+{
+    QString escaped = s;
+    escaped.replace( '"', "\"\"" );
+    return '"' + escaped + '"';
+}
+
+int main( int argc, char **argv )
+{
+    KAboutData about( "okularbench", 0, ki18n( "Okular Benchmark" ), "0.1",
+                      ki18n( "Measures the performance of the Okular document core" ),
+                      KAboutData::License_GPL );
+    KCmdLineArgs::init( argc, argv, &about );
+
+    KCmdLineOptions options;
+    options.add( "width <pixels>", ki18n( "Width of the rendered pages" ), "1000" );
+    options.add( "pages <number>", ki18n( "Render at most this number of pages of each document, 0 for all" ), "0" );
+    options.add( "search <text>", ki18n( "Text to search for" ), "the" );
+    options.add( "format <format>", ki18n( "Output format: json or csv" ), "json" );
+    options.add( "+files", ki18n( "Documents to benchmark" ) );
+    KCmdLineArgs::addCmdLineOptions( options );
+    KApplication app;
+
+    qRegisterMetaType<Okular::Document::SearchStatus>();
+    Okular::SettingsCore::instance( "okularbench" );
+
+    KCmdLineArgs *args = KCmdLineArgs::parsedArgs();
+    const int width = qMax( 1, args->getOption( "width" ).toInt() );
+    const int maxPages = args->getOption( "pages" ).toInt();
+    const QString searchText = args->getOption( "search" );
+    const bool csv = args->getOption( "format" ) == "csv";
+
+    QTextStream out( stdout );
+    QTextStream err( stderr );
+    if ( csv )
+        out << "file,mimetype,pages,open_ms,first_pixmap_ms,pages_per_second,text_extraction_ms,search_ms,search_matched,peak_pixmap_bytes,peak_rss_bytes\n";
+    else
+        out << "[\n";
+
+    int failures = 0;
+    bool first = true;
+    for ( int i = 0; i < args->count(); ++i )
+    {
+        BenchResult r;
+        if ( !runBenchmark( args->url( i ).toLocalFile(), width, maxPages, searchText, &r ) )
+        {
+            err << "Could not open " << args->arg( i ) << "\n";
+            ++failures;
+            continue;
+        }
+
+        if ( csv )
+        {
+            out << csvString( r.file ) << ',' << r.mimeType << ',' << r.pages << ',' << r.openMs << ','
+                << r.firstPixmapMs << ',' << r.pagesPerSecond << ',' << r.textExtractionMs << ','
+                << r.searchMs << ',' << ( r.searchMatched ? 1 : 0 ) << ',' << r.peakPixmapBytes << ','
+                << r.peakRssBytes << '\n';
+        }
+        else
+        {
+            if ( !first )
+                out << ",\n";
+            out << "  {\"file\": " << jsonString( r.file ) << ", \"mimetype\": " << jsonString( r.mimeType )
+                << ", \"pages\": " << r.pages << ", \"open_ms\": " << r.openMs
+                << ", \"first_pixmap_ms\": " << r.firstPixmapMs << ", \"pages_per_second\": " << r.pagesPerSecond
+                << ", \"text_extraction_ms\": " << r.textExtractionMs << ", \"search_ms\": " << r.searchMs
+                << ", \"search_matched\": " << ( r.searchMatched ? "true" : "false" )
+                << ", \"peak_pixmap_bytes\": " << r.peakPixmapBytes << ", \"peak_rss_bytes\": " << r.peakRssBytes << "}";
+        }
+        out.flush();
+        first = false;
+    }
+    if ( !csv )
+        out << "\n]\n";
+
+    args->clear();
+    return failures ? 1 : 0;
+}
+
+#include "okularbench.moc"
+
+/* kate: replace-tabs on; indent-width 4; */
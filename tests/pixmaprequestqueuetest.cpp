@@ -0,0 +1,132 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <qtest_kde.h>
+
+#include "../core/generator.h"
+#include "../core/observer.h"
+#include "../core/pixmaprequestqueue_p.h"
+
+class PixmapRequestQueueTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void testOrdering();
+        void testTakeRequests();
+        void benchmarkContinuousScrolling();
+};
+
+static Okular::PixmapRequest *preloadRequest( Okular::DocumentObserver *observer, int page, int priority )
+{
+    Okular::PixmapRequest::PixmapRequestFeatures requestFeatures = Okular::PixmapRequest::Preload;
+    requestFeatures |= Okular::PixmapRequest::Asynchronous;
+    return new Okular::PixmapRequest( observer, page, 100, 100, priority, requestFeatures );
+}
+
+void PixmapRequestQueueTest::testOrdering()
+{
+    Okular::DocumentObserver observer;
+    Okular::PixmapRequestQueue queue;
+
+    Okular::PixmapRequest *far = preloadRequest( &observer, 10, 4 );
+    Okular::PixmapRequest *near = preloadRequest( &observer, 6, 4 );
+    Okular::PixmapRequest *visible = preloadRequest( &observer, 5, 1 );
+    Okular::PixmapRequest *nearToo = preloadRequest( &observer, 4, 4 );
+    Okular::PixmapRequest *sync1 = preloadRequest( &observer, 20, 0 );
+    Okular::PixmapRequest *sync2 = preloadRequest( &observer, 20, 0 );
+
+    queue.enqueue( far, 10 - 5 );
+    queue.enqueue( near, 6 - 5 );
+    queue.enqueue( visible, 5 - 5 );
+    queue.enqueue( nearToo, 4 - 5 );
+    queue.enqueue( sync1, 20 - 5 );
+    queue.enqueue( sync2, 20 - 5 );
+    QCOMPARE( queue.count(), 6 );
+
+    // priority zero requests first, the most recent one on top; then by
+    // priority; then by distance, and in order of arrival
+    QList< Okular::PixmapRequest * > expected;
+    expected << sync2 << sync1 << visible << near << nearToo << far;
+    QCOMPARE( queue.requests(), expected );
+
+    foreach ( Okular::PixmapRequest *request, expected )
+    {
+        QCOMPARE( queue.top(), request );
+        QCOMPARE( queue.takeTop(), request );
+        delete request;
+    }
+    QVERIFY( queue.isEmpty() );
+    QVERIFY( !queue.takeTop() );
+}
+
+void PixmapRequestQueueTest::testTakeRequests()
+{
+    Okular::DocumentObserver observer1, observer2;
+    Okular::PixmapRequestQueue queue;
+
+    for ( int i = 0; i < 10; ++i )
+    {
+        queue.enqueue( preloadRequest( &observer1, i, 4 ), i );
+        queue.enqueue( preloadRequest( &observer2, i, 5 ), i );
+    }
+
+    QList< Okular::PixmapRequest * > taken = queue.takeRequests( &observer1, 3 );
+    QCOMPARE( taken.count(), 1 );
+    QCOMPARE( taken.first()->pageNumber(), 3 );
+    QCOMPARE( taken.first()->observer(), &observer1 );
+    qDeleteAll( taken );
+    QCOMPARE( queue.count(), 19 );
+    QVERIFY( queue.takeRequests( &observer1, 3 ).isEmpty() );
+
+    Okular::PixmapRequest *top = queue.top();
+    QVERIFY( queue.remove( top ) );
+    QVERIFY( !queue.remove( top ) );
+    delete top;
+
+    taken = queue.takeRequests( &observer1 );
+    QCOMPARE( taken.count(), 8 );
+    qDeleteAll( taken );
+    foreach ( Okular::PixmapRequest *request, queue.requests() )
+        QCOMPARE( request->observer(), &observer2 );
+
+    taken = queue.takeAll();
+    QCOMPARE( taken.count(), 10 );
+    qDeleteAll( taken );
+    QVERIFY( queue.isEmpty() );
+}
+
+// Simulate continuous scrolling in a big document with the Greedy memory
+// profile: on every scroll step the observer drops its previous requests
+// and preloads every page again, then a couple of requests are dispatched
+void PixmapRequestQueueTest::benchmarkContinuousScrolling()
+{
+    const int pages = 5000;
+    const int scrollSteps = 50;
+    Okular::DocumentObserver observer;
+    Okular::PixmapRequestQueue queue;
+
+    QBENCHMARK
+    {
+        for ( int step = 0; step < scrollSteps; ++step )
+        {
+            const int current = step * 10;
+            qDeleteAll( queue.takeRequests( &observer ) );
+            for ( int page = 0; page < pages; ++page )
+                queue.enqueue( preloadRequest( &observer, page, page == current ? 1 : 4 ), page - current );
+
+            for ( int i = 0; i < 2; ++i )
+                delete queue.takeTop();
+        }
+        qDeleteAll( queue.takeAll() );
+    }
+}
+
+QTEST_KDEMAIN( PixmapRequestQueueTest, NoGUI )
+#include "pixmaprequestqueuetest.moc"
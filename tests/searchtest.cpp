@@ -9,7 +9,11 @@
 
 #include <qtest_kde.h>
 
+#include <QtCore/QDir>
+
 #include "../core/document.h"
+#include "../core/document_p.h"
+#include "../core/misc.h"
 #include "../core/page.h"
 #include "../core/textpage.h"
 #include "../settings_core.h"
@@ -46,8 +50,12 @@ class SearchTest : public QObject
         void testHyphenAtEndOfLineWithoutYOverlap();
         void testHyphenWithYOverlap();
         void testHyphenAtEndOfPage();
+        void testCaseInsensitiveAcrossWords();
         void testOneColumn();
         void testTwoColumns();
+        void testTextInArea();
+        void testTextAreaOfSelection();
+        void testLayoutCacheColumns();
 };
 
 void SearchTest::initTestCase()
@@ -370,6 +378,47 @@ void SearchTest::testHyphenAtEndOfPage()
     delete page;
 }
 
+void SearchTest::testCaseInsensitiveAcrossWords()
+{
+    QVector<QString> text;
+    text << "Foo" << "BAR-"
+         << "baz" << " " << "fooBar";
+
+    QVector<Okular::NormalizedRect> rect;
+    rect << Okular::NormalizedRect(0.0, 0.0, 0.3, 0.1) << Okular::NormalizedRect(0.3, 0.0, 0.6, 0.1)
+         << Okular::NormalizedRect(0.0, 0.2, 0.3, 0.3) << Okular::NormalizedRect(0.3, 0.2, 0.4, 0.3)
+         << Okular::NormalizedRect(0.4, 0.2, 0.9, 0.3);
+
+    CREATE_PAGE;
+
+    // the match spans the words and the hyphen of the line break
+    Okular::RegularAreaRect* result = tp->findText(0, "FOOBARBAZ", Okular::FromTop, Qt::CaseInsensitive, NULL);
+    QVERIFY(result);
+    Okular::RegularAreaRect expected;
+    expected.append(rect[0]);
+    expected.append(rect[1]);
+    expected.append(rect[2]);
+    expected.simplify();
+    QCOMPARE(*result, expected);
+    delete result;
+
+    // the next matches go on from the end of the previous one
+    result = tp->findText(0, "foobar", Okular::NextResult, Qt::CaseInsensitive, NULL);
+    QVERIFY(result);
+    QVERIFY(!result->isEmpty());
+    QVERIFY(rect[4].intersects(result->first()));
+    QVERIFY(!rect[0].intersects(result->first()));
+    delete result;
+
+    result = tp->findText(0, "foobar", Okular::NextResult, Qt::CaseInsensitive, NULL);
+    QVERIFY(!result);
+
+    result = tp->findText(0, "foobar", Okular::FromTop, Qt::CaseSensitive, NULL);
+    QVERIFY(!result);
+
+    delete page;
+}
+
 void SearchTest::testOneColumn()
 {
   //Tests that the layout analysis algorithm does not create too many columns.
@@ -429,6 +478,334 @@ void SearchTest::testTwoColumns()
   delete page;
 }
 
+void SearchTest::testTextInArea()
+{
+  //Tests that the grid used to find the words in an area finds the same
+  //words as going through all of them.
+
+  QVector<QString> text;
+  QVector<Okular::NormalizedRect> rect;
+  for (int y = 0; y < 30; y++) {
+    for (int x = 0; x < 30; x++) {
+      text << QString(QChar('a' + (x + y) % 26));
+      rect << Okular::NormalizedRect(x / 30.0, y / 30.0, (x + 0.8) / 30.0, (y + 0.8) / 30.0);
+    }
+  }
+
+  CREATE_PAGE;
+
+  Okular::RegularAreaRect area;
+  area.appendShape(Okular::NormalizedRect(0.3, 0.4, 0.45, 0.5));
+
+  QString expected;
+  const Okular::TextEntity::List words = tp->words(NULL, Okular::TextPage::AnyPixelTextAreaInclusionBehaviour);
+  foreach (Okular::TextEntity *word, words) {
+    if (area.intersects(*word->area()))
+      expected += word->text();
+  }
+  qDeleteAll(words);
+
+  QVERIFY(!expected.isEmpty());
+  QCOMPARE(tp->text(&area, Okular::TextPage::AnyPixelTextAreaInclusionBehaviour), expected);
+
+  const Okular::TextEntity::List inArea = tp->words(&area, Okular::TextPage::AnyPixelTextAreaInclusionBehaviour);
+  QString found;
+  foreach (Okular::TextEntity *word, inArea)
+    found += word->text();
+  qDeleteAll(inArea);
+  QCOMPARE(found, expected);
+
+  Okular::RegularAreaRect* result = tp->wordAt(Okular::NormalizedPoint(10.5 / 30, 12.5 / 30));
+  QVERIFY(result);
+  QVERIFY(result->contains(10.5 / 30, 12.5 / 30));
+  delete result;
+
+  delete page;
+}
+
+static QStringList areaRects(const Okular::RegularAreaRect &area)
+{
+  QStringList result;
+  foreach (const Okular::NormalizedRect &r, area)
+    result << QString("%1 %2 %3 %4").arg(r.left, 0, 'f', 4).arg(r.top, 0, 'f', 4).arg(r.right, 0, 'f', 4).arg(r.bottom, 0, 'f', 4);
+  return result;
+}
+
+//The area TextPage::textArea gives for a selection from startC to endC, found
+//as it was before the grid: going through all the entities for each cursor.
+static Okular::RegularAreaRect scanTextArea(const Okular::TextEntity::List &words, const Okular::Page *page,
+                                            Okular::NormalizedPoint startC, Okular::NormalizedPoint endC)
+{
+  Okular::RegularAreaRect ret;
+  const double scaleX = page->width();
+  const double scaleY = page->height();
+
+  if (startC.x > endC.x)
+    qSwap(startC, endC);
+
+  const Okular::NormalizedRect boundingRect = page->boundingBox();
+  const QRect content = boundingRect.geometry(scaleX, scaleY);
+  const double minX = content.left(), maxX = content.right();
+  const double minY = content.top(), maxY = content.bottom();
+
+  const Okular::NormalizedRect start_end = (startC.y < endC.y) ? Okular::NormalizedRect(startC.x, startC.y, endC.x, endC.y)
+                                                               : Okular::NormalizedRect(startC.x, endC.y, endC.x, startC.y);
+  if (!boundingRect.intersects(start_end))
+    return ret;
+
+  if (startC.x * scaleX < minX) startC.x = minX / scaleX;
+  if (endC.x * scaleX > maxX) endC.x = maxX / scaleX;
+  if (startC.y * scaleY < minY) startC.y = minY / scaleY;
+  if (endC.y * scaleY > maxY) endC.y = maxY / scaleY;
+  if (startC.y * scaleY > maxY) startC.y = maxY / scaleY;
+  if (endC.y * scaleY < minY) endC.y = minY / scaleY;
+
+  //0 and count stand for "not found", as the iterators did
+  const int count = words.count();
+  int start = 0, end = count;
+  for (int i = 0; i < count; i++) {
+    if (words[i]->area()->contains(startC.x, startC.y))
+      start = i;
+    if (words[i]->area()->contains(endC.x, endC.y))
+      end = i;
+  }
+
+  if (start == 0 && end == count) {
+    bool found = false;
+    for (int i = 0; i < count && !found; i++)
+      found = start_end.intersects(*words[i]->area());
+    if (!found)
+      return ret;
+  }
+
+  bool selection_two_start = false;
+  if (start == 0) {
+    if (startC.y <= endC.y) {
+      for (int i = 0; i < count; i++) {
+        const Okular::NormalizedRect &rect = *words[i]->area();
+        if (!rect.isBottom(startC) && rect.isRight(startC)) {
+          start = i;
+          break;
+        }
+      }
+    } else {
+      selection_two_start = true;
+      int distance = scaleX + scaleY + 100;
+      for (int i = 0; i < count; i++) {
+        const Okular::NormalizedRect &rect = *words[i]->area();
+        if (rect.isBottomOrLevel(startC) && rect.isRight(startC)) {
+          const QRect entRect = rect.geometry(scaleX, scaleY);
+          const int xdist = qAbs(int(entRect.center().x() - startC.x * scaleX));
+          const int ydist = qAbs(int(entRect.center().y() - startC.y * scaleY));
+          if (xdist + ydist < distance) {
+            distance = xdist + ydist;
+            start = i;
+          }
+        }
+      }
+    }
+  }
+
+  if (end == count) {
+    if (startC.y <= endC.y) {
+      for (int i = count - 1; i >= 0; i--) {
+        const Okular::NormalizedRect &rect = *words[i]->area();
+        if (!rect.isTop(endC) && rect.isLeft(endC)) {
+          end = i;
+          break;
+        }
+      }
+    } else {
+      int distance = scaleX + scaleY + 100;
+      for (int i = count - 1; i >= 0; i--) {
+        const Okular::NormalizedRect &rect = *words[i]->area();
+        if (rect.isTopOrLevel(endC) && rect.isLeft(endC)) {
+          const QRect entRect = rect.geometry(scaleX, scaleY);
+          const int xdist = qAbs(int(entRect.center().x() - endC.x * scaleX));
+          const int ydist = qAbs(int(entRect.center().y() - endC.y * scaleY));
+          if (xdist + ydist < distance) {
+            distance = xdist + ydist;
+            end = i;
+          }
+        }
+      }
+    }
+  }
+
+  if (selection_two_start && start > end)
+    start = start - 1;
+  if (start > end)
+    qSwap(start, end);
+  if (end == count)
+    end--;
+
+  const Okular::MergeSide side = (Okular::MergeSide)page->totalOrientation();
+  for (; start <= end; start++)
+    ret.appendShape(*words[start]->area(), side);
+  return ret;
+}
+
+void SearchTest::testTextAreaOfSelection()
+{
+  //Tests that the grid used to find the ends of a selection gives the same
+  //area as going through all the entities, for selections that start and
+  //end between words and between lines, where the nearest entity is searched.
+
+  QVector<QString> text;
+  QVector<Okular::NormalizedRect> rect;
+  const double charWidth = 0.025, wordGap = 0.04, lineHeight = 0.03, lineGap = 0.02;
+  for (int line = 0; line < 16; line++) {
+    const double top = 0.05 + line * (lineHeight + lineGap);
+    double left = 0.05;
+    for (int word = 0; word < 6; word++) {
+      //words of 2 to 5 characters
+      const int length = 2 + (word + line) % 4;
+      for (int c = 0; c < length; c++) {
+        text << QString(QChar('a' + (c + word + line) % 26));
+        rect << Okular::NormalizedRect(left, top, left + charWidth * 0.9, top + lineHeight);
+        left += charWidth;
+      }
+      left += wordGap;
+    }
+  }
+
+  CREATE_PAGE;
+
+  //the points in the gaps between the words of a line, and between the lines
+  QList<Okular::NormalizedPoint> gaps;
+  for (int line = 0; line < 16; line += 3) {
+    const double top = 0.05 + line * (lineHeight + lineGap);
+    gaps << Okular::NormalizedPoint(0.02, top + lineHeight / 2);
+    const int firstWordLength = 2 + line % 4;
+    gaps << Okular::NormalizedPoint(0.05 + firstWordLength * charWidth + wordGap / 2, top + lineHeight / 2);
+    gaps << Okular::NormalizedPoint(0.3, top + lineHeight + lineGap / 2);
+    gaps << Okular::NormalizedPoint(0.6, top - lineGap / 2);
+    gaps << Okular::NormalizedPoint(0.97, top + lineHeight / 2);
+  }
+
+  const Okular::TextEntity::List words = tp->words(NULL, Okular::TextPage::AnyPixelTextAreaInclusionBehaviour);
+  int typeOne = 0, typeTwo = 0;
+  foreach (const Okular::NormalizedPoint &a, gaps) {
+    foreach (const Okular::NormalizedPoint &b, gaps) {
+      if (a.x == b.x || a.y == b.y)
+        continue;
+
+      //type 01 when the left point is above the right one, type 02 otherwise
+      const Okular::NormalizedPoint &left = a.x < b.x ? a : b;
+      const Okular::NormalizedPoint &right = a.x < b.x ? b : a;
+      if (left.y < right.y)
+        typeOne++;
+      else
+        typeTwo++;
+
+      Okular::TextSelection selection(a, b);
+      Okular::RegularAreaRect *area = tp->textArea(&selection);
+      QCOMPARE(areaRects(*area), areaRects(scanTextArea(words, page, selection.start(), selection.end())));
+      delete area;
+    }
+  }
+  qDeleteAll(words);
+
+  QVERIFY(typeOne > 0);
+  QVERIFY(typeTwo > 0);
+
+  delete page;
+}
+
+static QStringList textEntities(const Okular::TextPage *tp)
+{
+  QStringList result;
+  const Okular::TextEntity::List words = tp->words(NULL, Okular::TextPage::AnyPixelTextAreaInclusionBehaviour);
+  foreach (Okular::TextEntity *word, words) {
+    const Okular::NormalizedRect *area = word->area();
+    result << QString("%1 %2 %3 %4 %5").arg(word->text()).arg(area->left, 0, 'f', 4).arg(area->top, 0, 'f', 4)
+                                       .arg(area->right, 0, 'f', 4).arg(area->bottom, 0, 'f', 4);
+  }
+  qDeleteAll(words);
+  return result;
+}
+
+void SearchTest::testLayoutCacheColumns()
+{
+  //Tests that a page put in order from the text layout cache of its document
+  //is the same as when its layout is analyzed, on a page with three columns
+  //whose words the generator gives line by line across the columns.
+
+  QVector<QString> text;
+  QVector<Okular::NormalizedRect> rect;
+  for (int line = 0; line < 4; line++) {
+    for (int column = 0; column < 3; column++) {
+      for (int word = 0; word < 2; word++) {
+        text << QString("c%1l%2w%3").arg(column).arg(line).arg(word);
+        const double left = column * 0.35 + word * 0.15;
+        rect << Okular::NormalizedRect(left, line * 0.15, left + 0.12, line * 0.15 + 0.1);
+      }
+    }
+  }
+
+  //the columns are read one after the other, as the layout analysis always did
+  QStringList expected;
+  for (int column = 0; column < 3; column++)
+    for (int line = 0; line < 4; line++)
+      for (int word = 0; word < 2; word++)
+        expected << QString("c%1l%2w%3").arg(column).arg(line).arg(word);
+
+  Okular::Document document(0);
+  const QString testFile = KDESRCDIR "data/file1.pdf";
+  const KMimeType::Ptr mime = KMimeType::findByPath(testFile);
+  QCOMPARE(document.openDocument(testFile, KUrl(), mime), Okular::Document::OpenSuccess);
+  Okular::Page *documentPage = const_cast<Okular::Page *>(document.page(0));
+
+  //a page out of any document is always analyzed
+  Okular::Page *page = new Okular::Page(0, documentPage->width(), documentPage->height(), Okular::Rotation0);
+  Okular::TextPage *tp = new Okular::TextPage();
+  for (int i = 0; i < text.size(); i++)
+    tp->append(text[i], new Okular::NormalizedRect(rect[i]));
+  page->setTextPage(tp);
+  const QStringList analyzed = textEntities(tp);
+
+  QStringList words;
+  const Okular::TextEntity::List entities = tp->words(NULL, Okular::TextPage::AnyPixelTextAreaInclusionBehaviour);
+  foreach (Okular::TextEntity *entity, entities) {
+    if (!entity->text().trimmed().isEmpty())
+      words << entity->text();
+  }
+  qDeleteAll(entities);
+  QCOMPARE(words, expected);
+  delete page;
+
+  //opened without an url, the document has no document info file, so its
+  //text layouts are not saved in the docdata directory
+  Okular::DocumentPrivate *documentPrivate = Okular::DocumentPrivate::get(&document);
+  QVERIFY(documentPrivate->m_xmlFileName.isEmpty());
+  Okular::TextLayoutCache &layouts = documentPrivate->m_textLayouts;
+  const QString layoutsFileName = QDir::tempPath() + "/searchtest.textlayout";
+
+  //the first time the layout of the page of the document is analyzed and
+  //kept, the second time it is taken from the cache
+  for (int pass = 0; pass < 2; pass++) {
+    tp = new Okular::TextPage();
+    for (int i = 0; i < text.size(); i++)
+      tp->append(text[i], new Okular::NormalizedRect(rect[i]));
+    documentPage->setTextPage(tp);
+    QCOMPARE(textEntities(tp), analyzed);
+
+    if (pass == 0) {
+      //saving resets the modified flag, that storing a layout sets
+      QVERIFY(layouts.isModified());
+      QVERIFY(layouts.memory() > 0);
+      QVERIFY(layouts.save(layoutsFileName, "searchtest"));
+      QFile::remove(layoutsFileName);
+      QVERIFY(!layouts.isModified());
+    } else {
+      //the layout was not analyzed and stored again
+      QVERIFY(!layouts.isModified());
+    }
+  }
+
+  document.closeDocument();
+}
+
 QTEST_KDEMAIN( SearchTest, GUI )
 
 #include "searchtest.moc"
@@ -0,0 +1,122 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <qtest_kde.h>
+
+#include <QtCore/QDir>
+
+#include "../core/textindex_p.h"
+
+class TextIndexTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void testCandidates();
+        void testHyphenation();
+        void testUnindexedPages();
+        void testSaveLoad();
+};
+
+void TextIndexTest::testCandidates()
+{
+    Okular::TextIndex index;
+    index.clear( 3 );
+    index.addPage( 0, "The quick brown fox" );
+    index.addPage( 1, "jumps over\nthe lazy dog" );
+    index.addPage( 2, "Foxtrot" );
+    QVERIFY( index.isComplete() );
+
+    // a single word matches anywhere in the words
+    QCOMPARE( index.candidatePages( "fox" ).count( true ), 2 );
+    QVERIFY( index.candidatePages( "OX" ).testBit( 0 ) );
+    QVERIFY( index.candidatePages( "azy" ).testBit( 1 ) );
+    QCOMPARE( index.candidatePages( "cat" ).count( true ), 0 );
+
+    // the words inside a phrase are whole words
+    QCOMPARE( index.candidatePages( "ick brown fo" ).count( true ), 1 );
+    QCOMPARE( index.candidatePages( "ick row fo" ).count( true ), 0 );
+    QVERIFY( index.candidatePages( "over the" ).testBit( 1 ) );
+    QCOMPARE( index.candidatePages( "brown dog" ).count( true ), 0 );
+}
+
+void TextIndexTest::testHyphenation()
+{
+    Okular::TextIndex index;
+    index.clear( 1 );
+    index.addPage( 0, "an extra-\nordinary long hy-\nphen-\nated word" );
+
+    QCOMPARE( index.candidatePages( "extraordinary" ).count( true ), 1 );
+    QCOMPARE( index.candidatePages( "hyphenated word" ).count( true ), 1 );
+    QCOMPARE( index.candidatePages( "an extraordinary long" ).count( true ), 1 );
+}
+
+void TextIndexTest::testUnindexedPages()
+{
+    Okular::TextIndex index;
+    index.clear( 4 );
+    index.addPage( 1, "alpha" );
+    QVERIFY( !index.isComplete() );
+    QVERIFY( index.isIndexed( 1 ) );
+    QVERIFY( !index.isIndexed( 2 ) );
+    QCOMPARE( index.nextUnindexedPage( 1 ), 2 );
+    QCOMPARE( index.nextUnindexedPage( 3 ), 3 );
+
+    // the pages not indexed yet may contain anything
+    const QBitArray candidates = index.candidatePages( "beta" );
+    QVERIFY( candidates.testBit( 0 ) );
+    QVERIFY( !candidates.testBit( 1 ) );
+    QVERIFY( candidates.testBit( 2 ) );
+    QVERIFY( candidates.testBit( 3 ) );
+
+    index.addPage( 0, QString() );
+    index.addPage( 2, QString() );
+    index.addPage( 3, QString() );
+    QVERIFY( index.isComplete() );
+    QCOMPARE( index.nextUnindexedPage( 0 ), -1 );
+}
+
+void TextIndexTest::testSaveLoad()
+{
+    const QString fileName = QDir::tempPath() + "/textindextest.textindex";
+
+    Okular::TextIndex index;
+    index.clear( 2 );
+    index.addPage( 1, "persistent words" );
+    QVERIFY( index.isModified() );
+    QVERIFY( index.save( fileName, "document" ) );
+    QVERIFY( !index.isModified() );
+
+    Okular::TextIndex loaded;
+    QVERIFY( loaded.load( fileName, 2, "document" ) );
+    QVERIFY( !loaded.isModified() );
+    QVERIFY( loaded.isIndexed( 1 ) );
+    QVERIFY( !loaded.isIndexed( 0 ) );
+    QVERIFY( loaded.candidatePages( "words" ).testBit( 1 ) );
+    QVERIFY( !loaded.candidatePages( "other" ).testBit( 1 ) );
+
+    // the index of another document is not used
+    QVERIFY( !loaded.load( fileName, 3, "document" ) );
+    QCOMPARE( loaded.pageCount(), 3 );
+    QVERIFY( !loaded.isIndexed( 1 ) );
+
+    // nor is the one of a document with as many pages, e.g. a document
+    // replaced by another one of the same name and size
+    QVERIFY( !loaded.load( fileName, 2, "modified document" ) );
+    QCOMPARE( loaded.pageCount(), 2 );
+    QVERIFY( !loaded.isIndexed( 1 ) );
+
+    QFile::remove( fileName );
+}
+
+QTEST_KDEMAIN( TextIndexTest, NoGUI )
+
+#include "textindextest.moc"
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,121 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <qtest_kde.h>
+
+#include <QtCore/QDir>
+
+#include "../core/textlayoutcache_p.h"
+
+class TextLayoutCacheTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void testLayout();
+        void testMaxMemory();
+        void testSaveLoad();
+};
+
+void TextLayoutCacheTest::testLayout()
+{
+    Okular::TextLayoutCache cache;
+    cache.clear( 2 );
+
+    QVector< int > order;
+    order << 3 << 4 << 5 << -1 << 0 << 1 << 2 << -1 << 7;
+    QVector< float > spaceAreas;
+    spaceAreas << 0.1f << 0.2f << 0.3f << 0.4f << 0.5f << 0.6f << 0.7f << 0.8f;
+    cache.setLayout( 1, "key", order, spaceAreas );
+    QVERIFY( cache.isModified() );
+
+    QVector< int > cachedOrder;
+    QVector< float > cachedSpaceAreas;
+    QVERIFY( cache.layout( 1, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QCOMPARE( cachedOrder, order );
+    QCOMPARE( cachedSpaceAreas, spaceAreas );
+
+    // the layout of another text, or of another page, is not used
+    QVERIFY( !cache.layout( 1, "other key", &cachedOrder, &cachedSpaceAreas ) );
+    QVERIFY( !cache.layout( 0, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QVERIFY( !cache.layout( 2, "key", &cachedOrder, &cachedSpaceAreas ) );
+}
+
+void TextLayoutCacheTest::testMaxMemory()
+{
+    Okular::TextLayoutCache cache;
+    cache.clear( 10 );
+
+    QVector< int > order;
+    for ( int i = 0; i < 100; ++i )
+        order << i;
+    for ( int page = 0; page < 10; ++page )
+        cache.setLayout( page, "key", order, QVector< float >() );
+    const qulonglong pageMemory = cache.memory() / 10;
+    QVERIFY( pageMemory > 0 );
+
+    // the layouts farthest from the last one stored are dropped
+    cache.clear( 10 );
+    cache.setMaxMemory( 4 * pageMemory );
+    for ( int page = 0; page < 10; ++page )
+        cache.setLayout( page, "key", order, QVector< float >() );
+    QCOMPARE( cache.memory(), 4 * pageMemory );
+    cache.setLayout( 5, "key", order, QVector< float >() );
+    QCOMPARE( cache.memory(), 4 * pageMemory );
+    QVector< int > cachedOrder;
+    QVector< float > cachedSpaceAreas;
+    QVERIFY( cache.layout( 5, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QVERIFY( cache.layout( 8, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QVERIFY( !cache.layout( 9, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QVERIFY( !cache.layout( 0, "key", &cachedOrder, &cachedSpaceAreas ) );
+
+    cache.clear( 10 );
+    QCOMPARE( cache.memory(), Q_UINT64_C(0) );
+}
+
+void TextLayoutCacheTest::testSaveLoad()
+{
+    const QString fileName = QDir::tempPath() + "/textlayoutcachetest.textlayout";
+
+    QVector< int > order;
+    for ( int i = 0; i < 1000; ++i )
+        order << ( i % 10 == 9 ? -1 : i );
+    const QVector< float > spaceAreas( 4 * 100, 0.25f );
+
+    Okular::TextLayoutCache cache;
+    cache.clear( 3 );
+    cache.setLayout( 2, "key", order, spaceAreas );
+    QVERIFY( cache.save( fileName, "document" ) );
+    QVERIFY( !cache.isModified() );
+
+    Okular::TextLayoutCache loaded;
+    QVERIFY( loaded.load( fileName, 3, "document" ) );
+    QVERIFY( !loaded.isModified() );
+    QVector< int > cachedOrder;
+    QVector< float > cachedSpaceAreas;
+    QVERIFY( loaded.layout( 2, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QCOMPARE( cachedOrder, order );
+    QCOMPARE( cachedSpaceAreas, spaceAreas );
+    QVERIFY( !loaded.layout( 1, "key", &cachedOrder, &cachedSpaceAreas ) );
+
+    // the cache of another document is not used
+    QVERIFY( !loaded.load( fileName, 4, "document" ) );
+    QCOMPARE( loaded.pageCount(), 4 );
+    QVERIFY( !loaded.layout( 2, "key", &cachedOrder, &cachedSpaceAreas ) );
+    QVERIFY( !loaded.load( fileName, 3, "modified document" ) );
+    QVERIFY( !loaded.layout( 2, "key", &cachedOrder, &cachedSpaceAreas ) );
+
+    QFile::remove( fileName );
+}
+
+QTEST_KDEMAIN( TextLayoutCacheTest, NoGUI )
+
+#include "textlayoutcachetest.moc"
+
+/* kate: replace-tabs on; indent-width 4; */
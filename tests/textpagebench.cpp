@@ -0,0 +1,203 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+/*
+ * Benchmark of the text storage of okularcore: builds the text pages of a
+ * synthetic dense document, one entity per character as the PDF generator
+ * does, and measures the build time and the resident memory they take.
+ * For comparison, it measures the same for the storage the text pages had
+ * before their arena: one heap TinyTextEntity per character, with a
+ * NormalizedRect of doubles.
+ *
+ * Each storage is measured in a process of its own, so that the memory
+ * freed by the first one does not hide the growth of the second one.
+ *
+ * Usage: textpagebench [pages [characters per page]]
+ */
+
+#include <QtCore/QCoreApplication>
+#include <QtCore/QElapsedTimer>
+#include <QtCore/QFile>
+#include <QtCore/QProcess>
+#include <QtCore/QStringList>
+#include <QtCore/QTextStream>
+
+#include <cstring>
+
+#include "../core/area.h"
+#include "../core/page.h"
+#include "../core/textpage.h"
+
+// the lines of a page and their characters
+static const int Columns = 80;
+
+// resident memory of the process, or 0 where it is unknown
+static qint64 rss()
+{
+#if defined(Q_OS_LINUX)
+    QFile statusFile( "/proc/self/status" );
+    if ( !statusFile.open( QIODevice::ReadOnly ) )
+        return 0;
+
+    QTextStream readStream( &statusFile );
+    while ( true )
+    {
+        const QString entry = readStream.readLine();
+        if ( entry.isNull() ) break;
+        if ( entry.startsWith( "VmRSS:" ) )
+            return Q_INT64_C(1024) * entry.section( ' ', -2, -2 ).toLongLong();
+    }
+#endif
+    return 0;
+}
+
+static QString character( int page, int i )
+{
+    // words of 1 to 8 letters
+    if ( ( i + page ) % 9 == 8 || i % Columns == Columns - 1 )
+        return QString( ' ' );
+    return QString( QChar( 'a' + ( i * 7 + page ) % 26 ) );
+}
+
+static Okular::NormalizedRect characterRect( int i, int characters )
+{
+    const int lines = ( characters + Columns - 1 ) / Columns;
+    const double width = 1.0 / Columns, height = 1.0 / lines;
+    const int x = i % Columns, y = i / Columns;
+    return Okular::NormalizedRect( x * width, y * height, ( x + 1 ) * width, ( y + 0.8 ) * height );
+}
+
+/*
+ * The entity of a character as the text pages kept it before their arena.
+ */
+class TinyTextEntity
+{
+    static const int MaxStaticChars = sizeof( QChar * ) / sizeof( QChar );
+
+    public:
+        TinyTextEntity( const QString &text, const Okular::NormalizedRect &rect )
+            : area( rect )
+        {
+            length = text.length();
+            if ( length <= MaxStaticChars )
+                std::memcpy( d.qc, text.constData(), length * sizeof( QChar ) );
+            else
+            {
+                d.data = new QChar[ length ];
+                std::memcpy( d.data, text.constData(), length * sizeof( QChar ) );
+            }
+        }
+
+        ~TinyTextEntity()
+        {
+            if ( length > MaxStaticChars )
+                delete [] d.data;
+        }
+
+        Okular::NormalizedRect area;
+
+    private:
+        Q_DISABLE_COPY( TinyTextEntity )
+
+        union
+        {
+            QChar *data;
+            ushort qc[MaxStaticChars];
+        } d;
+        int length;
+};
+
+// builds the text pages, laid out by the pages as when they are extracted
+static void buildTextPages( int pageCount, int characters )
+{
+    QList< Okular::Page * > pages;
+    for ( int p = 0; p < pageCount; ++p )
+    {
+        Okular::TextPage *textPage = new Okular::TextPage();
+        for ( int i = 0; i < characters; ++i )
+            textPage->append( character( p, i ), new Okular::NormalizedRect( characterRect( i, characters ) ) );
+
+        Okular::Page *page = new Okular::Page( p, 600, 800, Okular::Rotation0 );
+        page->setTextPage( textPage );
+        pages.append( page );
+    }
+}
+
+// builds the same characters as the text pages did before their arena
+static void buildTinyTextEntities( int pageCount, int characters )
+{
+    QList< QList< TinyTextEntity * > > lists;
+    for ( int p = 0; p < pageCount; ++p )
+    {
+        QList< TinyTextEntity * > list;
+        for ( int i = 0; i < characters; ++i )
+        {
+            // the extracted area was copied into the entity, then deleted
+            Okular::NormalizedRect *area = new Okular::NormalizedRect( characterRect( i, characters ) );
+            list.append( new TinyTextEntity( character( p, i ), *area ) );
+            delete area;
+        }
+        lists.append( list );
+    }
+}
+
+int main( int argc, char **argv )
+{
+    QCoreApplication app( argc, argv );
+    QStringList args = app.arguments();
+    QTextStream out( stdout );
+
+    // the child processes measure one storage each, and do not free it:
+    // the process exit does
+    if ( args.count() > 1 && args.at( 1 ).startsWith( "--" ) )
+    {
+        const QString mode = args.takeAt( 1 );
+        const int pageCount = args.count() > 1 ? qMax( 1, args.at( 1 ).toInt() ) : 200;
+        const int characters = args.count() > 2 ? qMax( 1, args.at( 2 ).toInt() ) : 4000;
+
+        const qint64 before = rss();
+        QElapsedTimer timer;
+        timer.start();
+        if ( mode == "--textpages" )
+            buildTextPages( pageCount, characters );
+        else if ( mode == "--tinytextentities" )
+            buildTinyTextEntities( pageCount, characters );
+        else
+            return 1;
+        out << timer.elapsed() << " " << rss() - before << "\n";
+        return 0;
+    }
+
+    const int pageCount = args.count() > 1 ? qMax( 1, args.at( 1 ).toInt() ) : 200;
+    const int characters = args.count() > 2 ? qMax( 1, args.at( 2 ).toInt() ) : 4000;
+    const double totalCharacters = (double)pageCount * characters;
+    out << "pages: " << pageCount << ", characters per page: " << characters << "\n";
+
+    const QStringList modes = QStringList() << "--textpages" << "--tinytextentities";
+    const QStringList names = QStringList() << "text pages (including the layout analysis)" << "heap TinyTextEntity";
+    for ( int m = 0; m < modes.count(); ++m )
+    {
+        QProcess child;
+        child.start( app.applicationFilePath(), QStringList() << modes.at( m ) << QString::number( pageCount ) << QString::number( characters ) );
+        if ( !child.waitForFinished( -1 ) || child.exitStatus() != QProcess::NormalExit || child.exitCode() != 0 )
+        {
+            out << names.at( m ) << ": failed\n";
+            continue;
+        }
+
+        const QStringList result = QString::fromLatin1( child.readAllStandardOutput() ).split( ' ' );
+        const qint64 ms = result.value( 0 ).toLongLong();
+        const qint64 bytes = result.value( 1 ).trimmed().toLongLong();
+        out << names.at( m ) << ": " << ms << " ms, " << bytes << " bytes, "
+            << bytes / totalCharacters << " bytes per character\n";
+    }
+    return 0;
+}
+
+/* kate: replace-tabs on; indent-width 4; */
@@ -0,0 +1,174 @@
+/***************************************************************************
+ *   Copyright (C) 2015 by agent <agent@local>                             *
+ *                                                                         *
+ *   This program is free software; you can redistribute it and/or modify  *
+ *   it under the terms of the GNU General Public License as published by  *
+ *   the Free Software Foundation; either version 2 of the License, or     *
+ *   (at your option) any later version.                                   *
+ ***************************************************************************/
+
+#include <qtest_kde.h>
+
+#include <QtGui/QPixmap>
+
+#include "../core/tile.h"
+#include "../core/tilesmanager_p.h"
+
+static const Okular::NormalizedRect wholePage( 0, 0, 1, 1 );
+static const Okular::NormalizedRect firstTile( 0, 0, 0.25, 0.25 );
+
+// whether the tile at @p rect is up to date (hasPixmap() also checks the
+// tiles that touch the edges of the rect)
+static bool hasValidTile( Okular::TilesManager &tm, const Okular::NormalizedRect &rect )
+{
+    foreach ( const Okular::Tile &tile, tm.tilesAt( rect, Okular::TilesManager::PixmapTile ) )
+    {
+        if ( tile.rect() == rect && tile.isValid() )
+            return true;
+    }
+    return false;
+}
+
+class TilesManagerTest : public QObject
+{
+    Q_OBJECT
+
+    private slots:
+        void testZoomBack();
+        void testOtherLevelsBelowCurrent();
+        void testEviction();
+        void testConcurrentRequests();
+        void testAbortedRequest();
+};
+
+void TilesManagerTest::testZoomBack()
+{
+    Okular::TilesManager tm( 0, 1000, 1000 );
+    QPixmap pixmap( 1000, 1000 );
+    tm.setPixmap( &pixmap, wholePage );
+    QVERIFY( tm.hasPixmap( wholePage ) );
+    const qulonglong memory = tm.totalMemory();
+
+    // the tiles of the previous size are shown scaled meanwhile
+    tm.setSize( 2000, 2000 );
+    QVERIFY( !tm.hasPixmap( wholePage ) );
+    const QList<Okular::Tile> tiles = tm.tilesAt( wholePage, Okular::TilesManager::PixmapTile );
+    QCOMPARE( tiles.count(), 16 );
+    foreach ( const Okular::Tile &tile, tiles )
+    {
+        QVERIFY( !tile.isValid() );
+        QCOMPARE( tile.pixmap()->size(), QSize( 250, 250 ) );
+    }
+
+    // and they are used again when zooming back
+    tm.setSize( 1000, 1000 );
+    QVERIFY( tm.hasPixmap( wholePage ) );
+    QCOMPARE( tm.totalMemory(), memory );
+
+    // unless their contents changed
+    tm.setSize( 2000, 2000 );
+    tm.markDirty();
+    tm.setSize( 1000, 1000 );
+    QVERIFY( !tm.hasPixmap( wholePage ) );
+}
+
+void TilesManagerTest::testOtherLevelsBelowCurrent()
+{
+    Okular::TilesManager tm( 0, 1000, 1000 );
+    QPixmap pixmap( 1000, 1000 );
+    tm.setPixmap( &pixmap, wholePage );
+    tm.setSize( 2000, 2000 );
+
+    QPixmap tilePixmap( 500, 500 );
+    tm.setPixmap( &tilePixmap, firstTile );
+    QVERIFY( hasValidTile( tm, firstTile ) );
+
+    // the tile of the current level is the last one, over the others,
+    // which do not include the one it replaces
+    const QList<Okular::Tile> tiles = tm.tilesAt( wholePage, Okular::TilesManager::PixmapTile );
+    QCOMPARE( tiles.count(), 16 );
+    QVERIFY( tiles.last().isValid() );
+    QCOMPARE( tiles.last().pixmap()->size(), QSize( 500, 500 ) );
+    for ( int i = 0; i < 15; ++i )
+        QVERIFY( !( tiles.at( i ).rect() == firstTile ) );
+
+    // where the current level is complete, the other levels are not needed
+    const Okular::NormalizedRect insideFirstTile( 0.1, 0.1, 0.2, 0.2 );
+    QCOMPARE( tm.tilesAt( insideFirstTile, Okular::TilesManager::PixmapTile ).count(), 1 );
+}
+
+void TilesManagerTest::testEviction()
+{
+    Okular::TilesManager tm( 0, 1000, 1000 );
+    QPixmap pixmap( 1000, 1000 );
+    tm.setPixmap( &pixmap, wholePage );
+    tm.setSize( 2000, 2000 );
+    QPixmap tilePixmap( 500, 500 );
+    tm.setPixmap( &tilePixmap, firstTile );
+    QCOMPARE( tm.totalMemory(), Q_UINT64_C(4) * ( 1000 * 1000 + 500 * 500 ) );
+
+    // the tiles of the other level go first, even the visible ones, while
+    // the visible tiles of the current level are kept
+    tm.cleanupPixmapMemory( Q_UINT64_C(4) * 250 * 250, firstTile, 0 );
+    QCOMPARE( tm.totalMemory(), Q_UINT64_C(4) * ( 1000 * 1000 - 250 * 250 + 500 * 500 ) );
+    QVERIFY( hasValidTile( tm, firstTile ) );
+
+    tm.cleanupPixmapMemory( Q_UINT64_C(4) * 1000 * 1000 * 10, firstTile, 0 );
+    QCOMPARE( tm.totalMemory(), Q_UINT64_C(4) * 500 * 500 );
+    QVERIFY( hasValidTile( tm, firstTile ) );
+    QCOMPARE( tm.tilesAt( wholePage, Okular::TilesManager::PixmapTile ).count(), 1 );
+}
+
+void TilesManagerTest::testConcurrentRequests()
+{
+    const Okular::NormalizedRect secondTile( 0.25, 0, 0.5, 0.25 );
+    Okular::TilesManager tm( 0, 2000, 2000 );
+    tm.setRequest( firstTile, 2000, 2000 );
+    tm.setRequest( secondTile, 2000, 2000 );
+    QVERIFY( tm.isRequesting( firstTile, 2000, 2000 ) );
+    QVERIFY( tm.isRequesting( secondTile, 2000, 2000 ) );
+
+    // tiles arrive in any order
+    QPixmap tilePixmap( 500, 500 );
+    tm.setPixmap( &tilePixmap, secondTile );
+    QVERIFY( hasValidTile( tm, secondTile ) );
+    QVERIFY( !tm.isRequesting( secondTile, 2000, 2000 ) );
+    QVERIFY( tm.isRequesting( firstTile, 2000, 2000 ) );
+
+    // an aborted request does not block the next one
+    tm.cancelRequest( firstTile );
+    QVERIFY( !tm.isRequesting( firstTile, 2000, 2000 ) );
+
+    // requests at another zoom level make the pending ones late
+    tm.setRequest( firstTile, 2000, 2000 );
+    tm.setRequest( secondTile, 1000, 1000 );
+    QVERIFY( !tm.isRequesting( firstTile, 2000, 2000 ) );
+    tm.setPixmap( &tilePixmap, firstTile );
+    QVERIFY( !hasValidTile( tm, firstTile ) );
+}
+
+void TilesManagerTest::testAbortedRequest()
+{
+    Okular::TilesManager tm( 0, 2000, 2000 );
+    tm.setRequest( firstTile, 2000, 2000 );
+
+    // an aborted request still being rendered does not block the next one
+    tm.abortRequest( firstTile );
+    QVERIFY( !tm.isRequesting( firstTile, 2000, 2000 ) );
+    tm.setRequest( firstTile, 2000, 2000 );
+    QVERIFY( tm.isRequesting( firstTile, 2000, 2000 ) );
+
+    // which is still expected when the aborted one ends
+    tm.cancelRequest( firstTile );
+    QVERIFY( tm.isRequesting( firstTile, 2000, 2000 ) );
+    QPixmap tilePixmap( 500, 500 );
+    tm.setPixmap( &tilePixmap, firstTile );
+    QVERIFY( hasValidTile( tm, firstTile ) );
+    QVERIFY( !tm.isRequesting( firstTile, 2000, 2000 ) );
+}
+
+QTEST_KDEMAIN( TilesManagerTest, GUI )
+
+#include "tilesmanagertest.moc"
+
+/* kate: replace-tabs on; indent-width 4; */
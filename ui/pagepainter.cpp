@@ -35,6 +35,7 @@
 #include "core/tile.h"
 #include "settings_core.h"
 #include "core/document_p.h"
+#include "core/trace_p.h"
 
 K_GLOBAL_STATIC_WITH_ARGS( QPixmap, busyPixmap, ( KIconLoader::global()->loadIcon("okular", KIconLoader::NoGroup, 32, KIconLoader::DefaultState, QStringList(), 0, true) ) )
 
@@ -63,6 +64,8 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
     Okular::DocumentObserver *observer, int flags, int scaledWidth, int scaledHeight, const QRect &limits,
     const Okular::NormalizedRect &crop, Okular::NormalizedPoint *viewPortPoint )
 {
+    Okular::TraceScope traceScope( "PagePainter", page->number() );
+
 	/* Calculate the cropped geometry of the page */
 	QRect scaledCrop = crop.geometry( scaledWidth, scaledHeight );
 	int croppedWidth = scaledCrop.width();
@@ -91,17 +94,25 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
 
     const bool hasTilesManager = page->hasTilesManager( observer );
     const QPixmap *pixmap = 0;
+    // bilevel and grayscale pages are kept as compact images, and only the
+    // painted part of them is converted
+    const QImage *compactImage = 0;
+    QSize pixmapSize;
 
     if ( !hasTilesManager )
     {
         /** 1 - RETRIEVE THE 'PAGE+ID' PIXMAP OR A SIMILAR 'PAGE' ONE **/
         pixmap = page->_o_nearestPixmap( observer, scaledWidth, scaledHeight );
+        if ( pixmap )
+            pixmapSize = pixmap->size();
+        else if ( ( compactImage = page->_o_nearestImage( observer, scaledWidth, scaledHeight ) ) )
+            pixmapSize = compactImage->size();
 
         /** 1B - IF NO PIXMAP, DRAW EMPTY PAGE **/
-        double pixmapRescaleRatio = pixmap ? scaledWidth / (double)pixmap->width() : -1;
-        long pixmapPixels = pixmap ? (long)pixmap->width() * (long)pixmap->height() : 0;
-        if ( !pixmap || pixmapRescaleRatio > 20.0 || pixmapRescaleRatio < 0.25 ||
-             (scaledWidth != pixmap->width() && pixmapPixels > 6000000L) )
+        double pixmapRescaleRatio = pixmapSize.isValid() ? scaledWidth / (double)pixmapSize.width() : -1;
+        long pixmapPixels = (long)pixmapSize.width() * (long)pixmapSize.height();
+        if ( !pixmapSize.isValid() || pixmapRescaleRatio > 20.0 || pixmapRescaleRatio < 0.25 ||
+             (scaledWidth != pixmapSize.width() && pixmapPixels > 6000000L) )
         {
             // draw something on the blank page: the okular icon or a cross (as a fallback)
             if ( !busyPixmap->isNull() )
@@ -264,6 +275,16 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
                 tIt++;
             }
         }
+        else if ( compactImage )
+        {
+            QImage destImage;
+            if ( pixmapSize == QSize( scaledWidth, scaledHeight ) )
+                destImage = compactImage->copy( limitsInPixmap ).convertToFormat( QImage::Format_RGB32 );
+            else
+                scaleImageOnImage( destImage, *compactImage, scaledWidth, scaledHeight, limitsInPixmap, QImage::Format_RGB32 );
+            destPainter->drawImage( limits.left(), limits.top(), destImage, 0, 0,
+                                     limits.width(),limits.height() );
+        }
         else
         {
             // 4A.1. if size is ok, draw the page pixmap using painter
@@ -292,6 +313,8 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
         bool has_alpha;
         if ( pixmap )
             has_alpha = pixmap->hasAlpha();
+        else if ( compactImage )
+            has_alpha = compactImage->hasAlphaChannel();
         else
             has_alpha = true;
 
@@ -331,6 +354,14 @@ void PagePainter::paintCroppedPageOnPainter( QPainter * destPainter, const Okula
             }
             p.end();
         }
+        else if ( compactImage )
+        {
+            // 4B.1. convert the needed part of the compact image: normal or scaled
+            if ( pixmapSize == QSize( scaledWidth, scaledHeight ) )
+                backImage = compactImage->copy( limitsInPixmap ).convertToFormat( QImage::Format_ARGB32_Premultiplied );
+            else
+                scaleImageOnImage( backImage, *compactImage, scaledWidth, scaledHeight, limitsInPixmap );
+        }
         else
         {
             // 4B.1. draw the page pixmap: normal or scaled
@@ -876,10 +907,16 @@ void PagePainter::cropPixmapOnImage( QImage & dest, const QPixmap * src, const Q
 
 void PagePainter::scalePixmapOnImage ( QImage & dest, const QPixmap * src,
     int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format )
+{
+    scaleImageOnImage( dest, src->toImage(), scaledWidth, scaledHeight, cropRect, format );
+}
+
+void PagePainter::scaleImageOnImage ( QImage & dest, const QImage & src,
+    int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format )
 {
     // {source, destination, scaling} params
-    int srcWidth = src->width(),
-        srcHeight = src->height(),
+    int srcWidth = src.width(),
+        srcHeight = src.height(),
         destLeft = cropRect.left(),
         destTop = cropRect.top(),
         destWidth = cropRect.width(),
@@ -889,20 +926,25 @@ void PagePainter::scalePixmapOnImage ( QImage & dest, const QPixmap * src,
     dest = QImage( destWidth, destHeight, format );
     unsigned int * destData = (unsigned int *)dest.bits();
 
-    // source image (1:1 conversion from pixmap)
-    QImage srcImage = src->toImage().convertToFormat(format);
+    // source image: convert only the part that ends up in the destination
+    const int srcLeft = (destLeft * srcWidth) / scaledWidth,
+              srcTop = (destTop * srcHeight) / scaledHeight,
+              srcRight = ((destLeft + destWidth - 1) * srcWidth) / scaledWidth,
+              srcBottom = ((destTop + destHeight - 1) * srcHeight) / scaledHeight;
+    QImage srcImage = src.copy( srcLeft, srcTop, srcRight - srcLeft + 1, srcBottom - srcTop + 1 ).convertToFormat(format);
     unsigned int * srcData = (unsigned int *)srcImage.bits();
+    const int srcStride = srcImage.width();
 
     // precalc the x correspondancy conversion in a lookup table
     QVarLengthArray<unsigned int> xOffset( destWidth );
     for ( int x = 0; x < destWidth; x++ )
-        xOffset[ x ] = ((x + destLeft) * srcWidth) / scaledWidth;
+        xOffset[ x ] = ((x + destLeft) * srcWidth) / scaledWidth - srcLeft;
 
     // for each pixel of the destination image apply the color of the
     // corresponsing pixel on the source image (note: keep parenthesis)
     for ( int y = 0; y < destHeight; y++ )
     {
-        unsigned int srcOffset = srcWidth * (((destTop + y) * srcHeight) / scaledHeight);
+        unsigned int srcOffset = srcStride * ((((destTop + y) * srcHeight) / scaledHeight) - srcTop);
         for ( int x = 0; x < destWidth; x++ )
             (*destData++) = srcData[ srcOffset + xOffset[x] ];
     }
@@ -60,6 +60,8 @@ class PagePainter
         // the QRect(0,0, scaledWidth,scaledHeight)
         static void scalePixmapOnImage( QImage & dest, const QPixmap *src,
             int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format = QImage::Format_ARGB32_Premultiplied );
+        static void scaleImageOnImage( QImage & dest, const QImage & src,
+            int scaledWidth, int scaledHeight, const QRect & cropRect, QImage::Format format = QImage::Format_ARGB32_Premultiplied );
 
         // set the alpha component of the image to a given value
         static void changeImageAlpha( QImage & image, unsigned int alpha );
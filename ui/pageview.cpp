@@ -110,6 +110,15 @@ TableSelectionPart::TableSelectionPart(  PageViewItem * item_p, const Okular::No
 }
 
 // structure used internally by PageView for data storage
+// the scroll velocity is forgotten after this time without moves (ms)
+static const int ScrollVelocityTimeout = 300;
+// below this velocity (px/ms) the view is considered still
+static const double MinimumScrollVelocity = 0.05;
+// beyond this velocity (px/ms) the pages left behind are not preloaded
+static const double FastScrollVelocity = 3.0;
+// preload what will be scrolled into view within this time (ms)
+static const int PreloadLookahead = 1000;
+
 class PageViewPrivate
 {
 public:
@@ -118,6 +127,8 @@ public:
     FormWidgetsController* formWidgetsController();
     OkularTTS* tts();
     QString selectedText() const;
+    void updateScrollVelocity( int y );
+    double scrollVelocity() const;
 
     // the document, pageviewItems and the 'visible cache'
     PageView *q;
@@ -161,6 +172,11 @@ public:
     // auto scroll
     int scrollIncrement;
     QTimer * autoScrollTimer;
+    // vertical scroll velocity in pixels per millisecond (positive when
+    // scrolling down), used to preload the pages the user is heading to
+    QTime scrollSampleTime;
+    int scrollSampleY;
+    double scrollSampleVelocity;
     // annotations
     PageViewAnnotator * annotator;
     //text annotation dialogs list
@@ -228,6 +244,41 @@ PageViewPrivate::PageViewPrivate( PageView *qq )
 {
 }
 
+void PageViewPrivate::updateScrollVelocity( int y )
+{
+    if ( !scrollSampleTime.isValid() )
+    {
+        scrollSampleTime.start();
+        scrollSampleY = y;
+        return;
+    }
+
+    const int elapsed = scrollSampleTime.elapsed();
+    // wait for a later sample, as wheel steps and autoscroll ticks can
+    // come in bursts
+    if ( elapsed < 10 )
+        return;
+
+    const double velocity = ( y - scrollSampleY ) / (double)elapsed;
+    // the first movement after a pause starts from still
+    if ( elapsed > ScrollVelocityTimeout )
+        scrollSampleVelocity = velocity / 2;
+    else
+        scrollSampleVelocity = 0.6 * velocity + 0.4 * scrollSampleVelocity;
+
+    scrollSampleTime.start();
+    scrollSampleY = y;
+}
+
+double PageViewPrivate::scrollVelocity() const
+{
+    if ( !scrollSampleTime.isValid() || scrollSampleTime.elapsed() > ScrollVelocityTimeout
+         || qAbs( scrollSampleVelocity ) < MinimumScrollVelocity )
+        return 0.0;
+
+    return scrollSampleVelocity;
+}
+
 FormWidgetsController* PageViewPrivate::formWidgetsController()
 {
     if ( !formsWidgetController )
@@ -296,6 +347,8 @@ PageView::PageView( QWidget *parent, Okular::Document *document )
     d->viewportMoveTimer = 0;
     d->scrollIncrement = 0;
     d->autoScrollTimer = 0;
+    d->scrollSampleY = 0;
+    d->scrollSampleVelocity = 0.0;
     d->annotator = 0;
     d->dirtyLayout = false;
     d->blockViewport = false;
@@ -2908,7 +2961,9 @@ void PageView::guessTableDividers()
         rowSelectionTicks.append( qMakePair( tsp.rectInSelection.top,    +1 ) );
         rowSelectionTicks.append( qMakePair( tsp.rectInSelection.bottom, -1 ) );
 
-        // get the words in this part
+        // get the words in this part, the text page may have been unloaded
+        if ( !tsp.item->page()->hasTextPage() )
+            d->document->requestTextPage( tsp.item->pageNumber() );
         Okular::RegularAreaRect rects;
         rects.append( tsp.rectInItem );
         const Okular::TextEntity::List words = tsp.item->page()->words( &rects, Okular::TextPage::CentralPixelTextAreaInclusionBehaviour );
@@ -3019,6 +3074,8 @@ void PageView::mouseDoubleClickEvent( QMouseEvent * e )
             if ( d->mouseMode == Okular::Settings::EnumMouseMode::TextSelect ) {
                 textSelectionClear();
 
+                if ( !pageItem->page()->hasTextPage() )
+                    d->document->requestTextPage( pageItem->pageNumber() );
                 Okular::RegularAreaRect *wordRect = pageItem->page()->wordAt( Okular::NormalizedPoint( nX, nY ) );
                 if ( wordRect )
                 {
@@ -4308,7 +4365,7 @@ void PageView::delayedResizeEvent()
     slotRequestVisiblePixmaps();
 }
 
-static void slotRequestPreloadPixmap( Okular::DocumentObserver * observer, const PageViewItem * i, const QRect &expandedViewportRect, QLinkedList< Okular::PixmapRequest * > *requestedPixmaps )
+static void slotRequestPreloadPixmap( Okular::DocumentObserver * observer, const PageViewItem * i, const QRect &expandedViewportRect, int priority, QLinkedList< Okular::PixmapRequest * > *requestedPixmaps )
 {
     Okular::NormalizedRect preRenderRegion;
     const QRect intersectionRect = expandedViewportRect.intersect( i->croppedGeometry() );
@@ -4323,7 +4380,7 @@ static void slotRequestPreloadPixmap( Okular::DocumentObserver * observer, const
         const bool pageHasTilesManager = i->page()->hasTilesManager( observer );
         if ( pageHasTilesManager && !preRenderRegion.isNull() )
         {
-            Okular::PixmapRequest * p = new Okular::PixmapRequest( observer, i->pageNumber(), i->uncroppedWidth(), i->uncroppedHeight(), PAGEVIEW_PRELOAD_PRIO, requestFeatures );
+            Okular::PixmapRequest * p = new Okular::PixmapRequest( observer, i->pageNumber(), i->uncroppedWidth(), i->uncroppedHeight(), priority, requestFeatures );
             requestedPixmaps->push_back( p );
 
             p->setNormalizedRect( preRenderRegion );
@@ -4331,7 +4388,7 @@ static void slotRequestPreloadPixmap( Okular::DocumentObserver * observer, const
         }
         else if ( !pageHasTilesManager )
         {
-            Okular::PixmapRequest * p = new Okular::PixmapRequest( observer, i->pageNumber(), i->uncroppedWidth(), i->uncroppedHeight(), PAGEVIEW_PRELOAD_PRIO, requestFeatures );
+            Okular::PixmapRequest * p = new Okular::PixmapRequest( observer, i->pageNumber(), i->uncroppedWidth(), i->uncroppedHeight(), priority, requestFeatures );
             requestedPixmaps->push_back( p );
             p->setNormalizedRect( preRenderRegion );
         }
@@ -4340,6 +4397,11 @@ static void slotRequestPreloadPixmap( Okular::DocumentObserver * observer, const
 
 void PageView::slotRequestVisiblePixmaps( int newValue )
 {
+    // track how the view moves, whatever moves it (wheel, scrollbar, autoscroll
+    // or smooth viewport moves)
+    if ( newValue != -1 )
+        d->updateScrollVelocity( verticalScrollBar()->value() );
+
     // if requests are blocked (because raised by an unwanted event), exit
     if ( d->blockPixmapsRequest || d->viewportMoveActive )
         return;
@@ -4427,7 +4489,9 @@ void PageView::slotRequestVisiblePixmaps( int newValue )
 #ifdef PAGEVIEW_DEBUG
             kWarning() << "rerequesting visible pixmaps for page" << i->pageNumber() << "!";
 #endif
-            Okular::PixmapRequest * p = new Okular::PixmapRequest( this, i->pageNumber(), i->uncroppedWidth(), i->uncroppedHeight(), PAGEVIEW_PRIO, Okular::PixmapRequest::Asynchronous );
+            Okular::PixmapRequest::PixmapRequestFeatures requestFeatures = Okular::PixmapRequest::Asynchronous;
+            requestFeatures |= Okular::PixmapRequest::Progressive;
+            Okular::PixmapRequest * p = new Okular::PixmapRequest( this, i->pageNumber(), i->uncroppedWidth(), i->uncroppedHeight(), PAGEVIEW_PRIO, requestFeatures );
             requestedPixmaps.push_back( p );
 
             if ( i->page()->hasTilesManager( this ) )
@@ -4464,30 +4528,114 @@ void PageView::slotRequestVisiblePixmaps( int newValue )
          Okular::SettingsCore::memoryLevel() != Okular::SettingsCore::EnumMemoryLevel::Low )
     {
         // as the requests are done in the order as they appear in the list,
-        // request first the next page and then the previous
-
-        int pagesToPreload = viewColumns();
+        // request first the pages the view is moving to and then the others
+
+        const int columns = viewColumns();
+        int pagesAfter = columns;
+        int pagesBefore = columns;
+        int pixelsAfter = pixelsToExpand;
+        int pixelsBefore = pixelsToExpand;
+        int priorityAfter = PAGEVIEW_PRELOAD_PRIO;
+        int priorityBefore = PAGEVIEW_PRELOAD_PRIO;
+
+        // when scrolling, look ahead as far as the view will go while the
+        // pages render; after a fast fling the pages behind are not needed
+        const double velocity = d->scrollVelocity();
+        if ( velocity != 0.0 )
+        {
+            const int pixelsAhead = qRound( qAbs( velocity ) * PreloadLookahead );
+            const int pageHeight = qMax( 1, d->visibleItems.first()->croppedHeight() );
+            const int pagesAhead = columns * ( 1 + (int)ceil( (double)pixelsAhead / pageHeight ) );
+            const bool fast = qAbs( velocity ) > FastScrollVelocity;
+            if ( velocity > 0 )
+            {
+                pagesAfter = pagesAhead;
+                pixelsAfter += pixelsAhead;
+                pagesBefore = fast ? 0 : columns;
+                pixelsBefore = fast ? 0 : pixelsToExpand;
+                priorityBefore = PAGEVIEW_PRELOAD_BEHIND_PRIO;
+            }
+            else
+            {
+                pagesBefore = pagesAhead;
+                pixelsBefore += pixelsAhead;
+                pagesAfter = fast ? 0 : columns;
+                pixelsAfter = fast ? 0 : pixelsToExpand;
+                priorityAfter = PAGEVIEW_PRELOAD_BEHIND_PRIO;
+            }
+        }
 
-        // if the greedy option is set, preload all pages
-        if (Okular::SettingsCore::memoryLevel() == Okular::SettingsCore::EnumMemoryLevel::Greedy)
-            pagesToPreload = d->items.count();
+        // do not preload more than the memory can keep along with the
+        // visible pages, or the preloaded pages would evict each other
+        int maxPreload;
+        switch ( Okular::SettingsCore::memoryLevel() )
+        {
+            case Okular::SettingsCore::EnumMemoryLevel::Greedy:
+                // preload all pages
+                maxPreload = d->items.count();
+                pagesAfter = pagesBefore = d->items.count();
+                break;
+            case Okular::SettingsCore::EnumMemoryLevel::Aggressive:
+                maxPreload = 12 * columns;
+                break;
+            default:
+                maxPreload = 4 * columns;
+                break;
+        }
+        const PageViewItem *firstVisible = d->visibleItems.first();
+        const qulonglong pageBytes = 4 * (qulonglong)firstVisible->uncroppedWidth() * firstVisible->uncroppedHeight();
+        const qulonglong memoryBudget = Q_UINT64_C(1048576) * Okular::SettingsCore::pixmapMemoryBudget();
+        if ( memoryBudget > 0 && pageBytes > 0 )
+        {
+            const qulonglong pagesInBudget = memoryBudget / pageBytes;
+            if ( pagesInBudget < (qulonglong)( maxPreload + d->visibleItems.count() ) )
+                maxPreload = qMax( 0, (int)pagesInBudget - d->visibleItems.count() );
+        }
+        // there is nothing to preload past the ends of the document
+        pagesAfter = qMin( pagesAfter, (int)d->items.count() - 1 - d->visibleItems.last()->pageNumber() );
+        pagesBefore = qMin( pagesBefore, d->visibleItems.first()->pageNumber() );
+        if ( velocity > 0 )
+        {
+            pagesAfter = qMin( pagesAfter, maxPreload );
+            pagesBefore = qMin( pagesBefore, maxPreload - pagesAfter );
+        }
+        else if ( velocity < 0 )
+        {
+            pagesBefore = qMin( pagesBefore, maxPreload );
+            pagesAfter = qMin( pagesAfter, maxPreload - pagesBefore );
+        }
+        else
+        {
+            // standing still: each direction gets half of the pages, and
+            // what the other one leaves
+            pagesAfter = qMin( pagesAfter, maxPreload - qMin( pagesBefore, maxPreload / 2 ) );
+            pagesBefore = qMin( pagesBefore, maxPreload - pagesAfter );
+        }
 
-        const QRect expandedViewportRect = viewportRect.adjusted( 0, -pixelsToExpand, 0, pixelsToExpand );
+        const QRect expandedViewportRect = viewportRect.adjusted( 0, -pixelsBefore, 0, pixelsAfter );
+        const int pagesToPreload = qMax( pagesAfter, pagesBefore );
+        const bool headFirst = velocity < 0;
 
         for( int j = 1; j <= pagesToPreload; j++ )
         {
             // add the page after the 'visible series' in preload
             const int tailRequest = d->visibleItems.last()->pageNumber() + j;
-            if ( tailRequest < (int)d->items.count() )
+            // add the page before the 'visible series' in preload
+            const int headRequest = d->visibleItems.first()->pageNumber() - j;
+
+            if ( headFirst && j <= pagesBefore && headRequest >= 0 )
             {
-                slotRequestPreloadPixmap( this, d->items[ tailRequest ], expandedViewportRect, &requestedPixmaps );
+                slotRequestPreloadPixmap( this, d->items[ headRequest ], expandedViewportRect, priorityBefore, &requestedPixmaps );
             }
 
-            // add the page before the 'visible series' in preload
-            const int headRequest = d->visibleItems.first()->pageNumber() - j;
-            if ( headRequest >= 0 )
+            if ( j <= pagesAfter && tailRequest < (int)d->items.count() )
             {
-                slotRequestPreloadPixmap( this, d->items[ headRequest ], expandedViewportRect, &requestedPixmaps );
+                slotRequestPreloadPixmap( this, d->items[ tailRequest ], expandedViewportRect, priorityAfter, &requestedPixmaps );
+            }
+
+            if ( !headFirst && j <= pagesBefore && headRequest >= 0 )
+            {
+                slotRequestPreloadPixmap( this, d->items[ headRequest ], expandedViewportRect, priorityBefore, &requestedPixmaps );
             }
 
             // stop if we've already reached both ends of the document
@@ -4953,15 +5101,24 @@ void PageView::slotRefreshPage()
 
 void PageView::slotSpeakDocument()
 {
+    // extract the text pages ahead of the one being read, several at the
+    // same time if possible, then textSelectionForItem() takes them in turn
+    QList< int > textPages;
+    foreach ( const PageViewItem *item, d->items )
+        textPages.append( item->pageNumber() );
+
     QString text;
-    QVector< PageViewItem * >::const_iterator it = d->items.constBegin(), itEnd = d->items.constEnd();
-    for ( ; it < itEnd; ++it )
+    for ( int i = 0; i < d->items.count(); ++i )
     {
-        Okular::RegularAreaRect * area = textSelectionForItem( *it );
-        text.append( (*it)->page()->text( area ) );
+        d->document->requestTextPages( textPages.mid( i ) );
+
+        PageViewItem *item = d->items.at( i );
+        Okular::RegularAreaRect * area = textSelectionForItem( item );
+        text.append( item->page()->text( area ) );
         text.append( '\n' );
         delete area;
     }
+    d->document->requestTextPages( QList< int >() );
 
     d->tts()->say( text );
 }